@@ -0,0 +1,131 @@
+//
+// Created by 最上川 on 2022/8/12/012.
+//
+// CPU only microbenchmark for JobSystem::parallel_for, compares every splitter with a serial loop.
+
+#include <jobSystem.h>
+#include <splitter.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+struct Transform
+{
+    float matrix[16];
+    float position[4];
+    float result[4];
+};
+
+static void transformObjects(Transform* objects, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        Transform& t = objects[i];
+        for (int row = 0; row < 4; row++)
+        {
+            float sum = 0.0f;
+            for (int col = 0; col < 4; col++)
+            {
+                sum += t.matrix[row * 4 + col] * t.position[col];
+            }
+            t.result[row] = sum;
+        }
+    }
+}
+
+// the cost grows along the range, which is what static splitting handles badly
+static void unbalancedWork(float* values, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        float v = values[i];
+        const int iterations = 1 + static_cast<int>(v);
+        for (int k = 0; k < iterations; k++)
+        {
+            v = std::sqrt(v * v + 1.0f);
+        }
+        values[i] = v;
+    }
+}
+
+template<typename F>
+static double measure(int repeat, F&& f)
+{
+    double best = 1e30;
+    for (int i = 0; i < repeat; i++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        f();
+        auto end = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+template<typename T, typename S>
+static double measureParallel(Base::JobSystem& jobSystem, int repeat, T* data, unsigned int count, void(*f)(T*, unsigned int), const S& splitter)
+{
+    return measure(repeat, [&]() {
+        jobSystem.wait(jobSystem.run(jobSystem.parallel_for(data, count, f, splitter)));
+    });
+}
+
+static void report(const char* name, unsigned int count, double ms, double serialMs)
+{
+    printf("%-24s %10.3f ms %10.2f Melem/s %8.2fx\n", name, ms, count / ms / 1000.0, serialMs / ms);
+}
+
+int main()
+{
+    Base::JobSystem jobSystem;
+    const int repeat = 10;
+    printf("workers: %u\n", jobSystem.getWorkerCount());
+
+    {
+        const unsigned int count = 1u << 20;
+        std::vector<Transform> objects(count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            for (int k = 0; k < 16; k++)
+            {
+                objects[i].matrix[k] = static_cast<float>((i + k) % 7);
+            }
+            for (int k = 0; k < 4; k++)
+            {
+                objects[i].position[k] = static_cast<float>(k);
+            }
+        }
+
+        printf("\nper-object transforms, %u objects\n", count);
+        const double serial = measure(repeat, [&]() { transformObjects(objects.data(), count); });
+        report("serial", count, serial, serial);
+        report("CountSplitter(1024)", count, measureParallel(jobSystem, repeat, objects.data(), count, transformObjects, Base::CountSplitter(1024)), serial);
+        report("DataSizeSplitter(16KB)", count, measureParallel(jobSystem, repeat, objects.data(), count, transformObjects, Base::DataSizeSplitter(16 * 1024)), serial);
+        report("AutoSplitter", count, measureParallel(jobSystem, repeat, objects.data(), count, transformObjects, Base::AutoSplitter(64)), serial);
+    }
+
+    {
+        const unsigned int count = 1u << 16;
+        std::vector<float> values(count);
+        auto reset = [&]() {
+            for (unsigned int i = 0; i < count; i++)
+            {
+                values[i] = static_cast<float>(i % 256);
+            }
+        };
+
+        printf("\nunbalanced loop, %u elements\n", count);
+        reset();
+        const double serial = measure(repeat, [&]() { unbalancedWork(values.data(), count); });
+        report("serial", count, serial, serial);
+        reset();
+        report("CountSplitter(1024)", count, measureParallel(jobSystem, repeat, values.data(), count, unbalancedWork, Base::CountSplitter(1024)), serial);
+        reset();
+        report("DataSizeSplitter(16KB)", count, measureParallel(jobSystem, repeat, values.data(), count, unbalancedWork, Base::DataSizeSplitter(16 * 1024)), serial);
+        reset();
+        report("AutoSplitter", count, measureParallel(jobSystem, repeat, values.data(), count, unbalancedWork, Base::AutoSplitter(16)), serial);
+    }
+    return 0;
+}
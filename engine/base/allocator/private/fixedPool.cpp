@@ -0,0 +1,91 @@
+//
+// Created by 最上川 on 2022/8/16/016.
+//
+
+#include <fixedPool.h>
+#include <algorithm>
+
+namespace Base
+{
+    FixedPool::FixedPool(size_t elementSize, size_t align, size_t elementsPerBlock, MemoryTag tag)
+        : mTag{tag}
+        , mAlign{std::max(align, alignof(FreeNode))}
+        , mElementsPerBlock{elementsPerBlock > 0 ? elementsPerBlock : 1}
+        , mLiveCount{0}
+        , mFreeList{nullptr}
+    {
+        // every element has to hold a free list link and keep the next one aligned
+        const size_t size = std::max(elementSize, sizeof(FreeNode));
+        mElementSize = (size + mAlign - 1) & ~(mAlign - 1);
+    }
+
+    FixedPool::~FixedPool()
+    {
+        assert(mLiveCount == 0 && "pool destroyed with live elements");
+        for (auto& block : mBlocks)
+        {
+            aligned_free(block);
+        }
+        mBlocks.clear();
+    }
+
+    void FixedPool::addBlock()
+    {
+        char* block = static_cast<char*>(aligned_alloc(mElementSize * mElementsPerBlock, mAlign, mTag));
+        assert(block);
+        mBlocks.push_back(block);
+        for (size_t i = mElementsPerBlock; i-- > 0;)
+        {
+            FreeNode* node = reinterpret_cast<FreeNode*>(block + i * mElementSize);
+            node->mNext = mFreeList;
+            mFreeList = node;
+        }
+    }
+
+    void* FixedPool::allocate()
+    {
+        if (!mFreeList)
+        {
+            addBlock();
+        }
+        FreeNode* node = mFreeList;
+        mFreeList = node->mNext;
+        mLiveCount++;
+        return node;
+    }
+
+    void FixedPool::deallocate(void* p)
+    {
+        if (!p)
+        {
+            return;
+        }
+        FreeNode* node = static_cast<FreeNode*>(p);
+        node->mNext = mFreeList;
+        mFreeList = node;
+        mLiveCount--;
+    }
+
+    FixedPoolSet::FixedPoolSet(size_t elementsPerBlock, MemoryTag tag)
+        : mElementsPerBlock{elementsPerBlock}
+        , mTag{tag}
+    {
+
+    }
+
+    FixedPool* FixedPoolSet::getPool(size_t elementSize, size_t align)
+    {
+        // same rounding as FixedPool, types that end up with the same layout share a pool
+        const size_t alignment = std::max(align, sizeof(void*));
+        const size_t size = (std::max(elementSize, sizeof(void*)) + alignment - 1) & ~(alignment - 1);
+        for (auto& pool : mPools)
+        {
+            if (pool->getElementSize() == size && pool->getAlign() == alignment)
+            {
+                return pool.get();
+            }
+        }
+        mPools.push_back(std::make_unique<FixedPool>(elementSize, align, mElementsPerBlock, mTag));
+        return mPools.back().get();
+    }
+}
@@ -0,0 +1,109 @@
+//
+// Created by 最上川 on 2022/8/16/016.
+//
+
+#include <linearArena.h>
+#include <algorithm>
+#include <cstdint>
+
+namespace Base
+{
+    static constexpr size_t ARENA_BLOCK_ALIGN = 64;
+
+    LinearArena::LinearArena(size_t blockSize, MemoryTag tag)
+        : mTag{tag}
+        , mBlockSize{blockSize}
+        , mBlockIndex{0}
+        , mOffset{0}
+        , mUsedBefore{0}
+    {
+        addBlock(mBlockSize);
+    }
+
+    LinearArena::~LinearArena()
+    {
+        for (auto& block : mBlocks)
+        {
+            aligned_free(block.mData);
+        }
+        mBlocks.clear();
+    }
+
+    void LinearArena::addBlock(size_t size)
+    {
+        Block block{};
+        block.mSize = std::max(size, mBlockSize);
+        block.mData = static_cast<char*>(aligned_alloc(block.mSize, ARENA_BLOCK_ALIGN, mTag));
+        assert(block.mData);
+        mBlocks.push_back(block);
+    }
+
+    void* LinearArena::allocate(size_t size, size_t align)
+    {
+        assert(align && !(align & (align - 1)));
+        while (true)
+        {
+            Block& block = mBlocks[mBlockIndex];
+            const uintptr_t base = reinterpret_cast<uintptr_t>(block.mData);
+            const uintptr_t aligned = (base + mOffset + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+            const size_t offset = aligned - base;
+            if (offset + size <= block.mSize)
+            {
+                mOffset = offset + size;
+                return block.mData + offset;
+            }
+
+            // move on to the next block, adding one that is large enough if needed
+            mUsedBefore += mOffset;
+            mBlockIndex++;
+            mOffset = 0;
+            if (mBlockIndex == mBlocks.size())
+            {
+                addBlock(size + align);
+            }
+        }
+    }
+
+    void LinearArena::deallocate(void* p, size_t size)
+    {
+        char* data = static_cast<char*>(p);
+        Block& block = mBlocks[mBlockIndex];
+        if (data >= block.mData && data + size == block.mData + mOffset)
+        {
+            mOffset -= size;
+        }
+    }
+
+    void LinearArena::reset()
+    {
+        if (mBlockIndex > 0)
+        {
+            size_t total = 0;
+            for (auto& block : mBlocks)
+            {
+                total += block.mSize;
+                aligned_free(block.mData);
+            }
+            mBlocks.clear();
+            addBlock(total);
+        }
+        mBlockIndex = 0;
+        mOffset = 0;
+        mUsedBefore = 0;
+    }
+
+    size_t LinearArena::getUsedSize() const
+    {
+        return mUsedBefore + mOffset;
+    }
+
+    size_t LinearArena::getCapacity() const
+    {
+        size_t total = 0;
+        for (auto& block : mBlocks)
+        {
+            total += block.mSize;
+        }
+        return total;
+    }
+}
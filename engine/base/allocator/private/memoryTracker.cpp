@@ -0,0 +1,207 @@
+//
+// Created by 最上川 on 2022/8/18/018.
+//
+
+#include <memoryTracker.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <execinfo.h>
+#endif
+
+namespace Base
+{
+    static constexpr size_t TAG_COUNT = static_cast<size_t>(MemoryTag::Count);
+
+    const char* getMemoryTagName(MemoryTag tag)
+    {
+        switch (tag)
+        {
+            case MemoryTag::General:    return "General";
+            case MemoryTag::JobSystem:  return "JobSystem";
+            case MemoryTag::Frame:      return "Frame";
+            case MemoryTag::RHI:        return "RHI";
+            case MemoryTag::Asset:      return "Asset";
+            default:                    return "Unknown";
+        }
+    }
+
+    static uint32_t captureCallstack(void** frames, uint32_t count)
+    {
+#if defined(WIN32)
+        return static_cast<uint32_t>(::CaptureStackBackTrace(2, count, frames, nullptr));
+#else
+        // skip this function and onAllocate
+        void* all[MemorySample::MAX_FRAMES + 2];
+        const int captured = ::backtrace(all, static_cast<int>(count + 2));
+        const uint32_t kept = captured > 2 ? static_cast<uint32_t>(captured - 2) : 0u;
+        for (uint32_t i = 0; i < kept; i++)
+        {
+            frames[i] = all[i + 2];
+        }
+        return kept;
+#endif
+    }
+
+    MemoryTracker::MemoryTracker()
+        : mSampleRate{0}
+        , mSampleCounter{0}
+    {
+
+    }
+
+    MemoryTracker& MemoryTracker::get()
+    {
+        // never destroyed, blocks may still be freed during static destruction
+        static MemoryTracker* tracker = new MemoryTracker();
+        return *tracker;
+    }
+
+    void MemoryTracker::onAllocate(void* p, size_t size, MemoryTag tag)
+    {
+        TagCounters& counters = mCounters[static_cast<size_t>(tag)];
+        const uint64_t bytes = counters.mBytes.fetch_add(size, std::memory_order_relaxed) + size;
+        counters.mLiveCount.fetch_add(1, std::memory_order_relaxed);
+        counters.mTotalCount.fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t peak = counters.mPeakBytes.load(std::memory_order_relaxed);
+        while (bytes > peak && !counters.mPeakBytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed))
+        {
+        }
+
+        const uint32_t rate = mSampleRate.load(std::memory_order_relaxed);
+        if (rate > 0 && mSampleCounter.fetch_add(1, std::memory_order_relaxed) % rate == 0)
+        {
+            MemorySample sample{};
+            sample.mTag = tag;
+            sample.mSize = size;
+            sample.mFrameCount = captureCallstack(sample.mFrames, MemorySample::MAX_FRAMES);
+            std::lock_guard<std::mutex> lock(mSampleMutex);
+            mSamples[p] = sample;
+        }
+    }
+
+    void MemoryTracker::onFree(void* p, size_t size, MemoryTag tag)
+    {
+        TagCounters& counters = mCounters[static_cast<size_t>(tag)];
+        counters.mBytes.fetch_sub(size, std::memory_order_relaxed);
+        counters.mLiveCount.fetch_sub(1, std::memory_order_relaxed);
+
+        if (mSampleRate.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(mSampleMutex);
+            mSamples.erase(p);
+        }
+    }
+
+    MemoryTagStats MemoryTracker::getStats(MemoryTag tag) const
+    {
+        const TagCounters& counters = mCounters[static_cast<size_t>(tag)];
+        MemoryTagStats stats;
+        stats.mBytes = counters.mBytes.load(std::memory_order_relaxed);
+        stats.mPeakBytes = counters.mPeakBytes.load(std::memory_order_relaxed);
+        stats.mLiveCount = counters.mLiveCount.load(std::memory_order_relaxed);
+        stats.mTotalCount = counters.mTotalCount.load(std::memory_order_relaxed);
+        stats.mBudget = counters.mBudget.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void MemoryTracker::resetPeaks()
+    {
+        for (auto& counters : mCounters)
+        {
+            counters.mPeakBytes.store(counters.mBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+
+    void MemoryTracker::setBudget(MemoryTag tag, uint64_t bytes)
+    {
+        mCounters[static_cast<size_t>(tag)].mBudget.store(bytes, std::memory_order_relaxed);
+    }
+
+    std::vector<MemoryTag> MemoryTracker::getOverBudgetTags() const
+    {
+        std::vector<MemoryTag> tags;
+        for (size_t i = 0; i < TAG_COUNT; i++)
+        {
+            const uint64_t budget = mCounters[i].mBudget.load(std::memory_order_relaxed);
+            if (budget > 0 && mCounters[i].mBytes.load(std::memory_order_relaxed) > budget)
+            {
+                tags.push_back(static_cast<MemoryTag>(i));
+            }
+        }
+        return tags;
+    }
+
+    void MemoryTracker::setSampleRate(uint32_t rate)
+    {
+        mSampleRate.store(rate, std::memory_order_relaxed);
+        if (rate == 0)
+        {
+            std::lock_guard<std::mutex> lock(mSampleMutex);
+            mSamples.clear();
+        }
+    }
+
+    std::vector<MemorySample> MemoryTracker::getLiveSamples() const
+    {
+        std::lock_guard<std::mutex> lock(mSampleMutex);
+        std::vector<MemorySample> samples;
+        samples.reserve(mSamples.size());
+        for (auto& sample : mSamples)
+        {
+            samples.push_back(sample.second);
+        }
+        return samples;
+    }
+
+    std::string MemoryTracker::toJson() const
+    {
+        std::ostringstream json;
+        json << "{\n  \"tracking\": " << (HOMURA_MEMORY_TRACKING ? "true" : "false") << ",\n  \"tags\": [\n";
+        for (size_t i = 0; i < TAG_COUNT; i++)
+        {
+            const MemoryTagStats stats = getStats(static_cast<MemoryTag>(i));
+            json << "    {\"name\": \"" << getMemoryTagName(static_cast<MemoryTag>(i)) << "\""
+                 << ", \"bytes\": " << stats.mBytes
+                 << ", \"peakBytes\": " << stats.mPeakBytes
+                 << ", \"liveCount\": " << stats.mLiveCount
+                 << ", \"totalCount\": " << stats.mTotalCount
+                 << ", \"budget\": " << stats.mBudget << "}"
+                 << (i + 1 < TAG_COUNT ? ",\n" : "\n");
+        }
+        json << "  ],\n  \"samples\": [\n";
+
+        // addresses only, symbolize offline against the binary
+        const std::vector<MemorySample> samples = getLiveSamples();
+        for (size_t i = 0; i < samples.size(); i++)
+        {
+            const MemorySample& sample = samples[i];
+            json << "    {\"tag\": \"" << getMemoryTagName(sample.mTag) << "\", \"size\": " << sample.mSize << ", \"callstack\": [";
+            for (uint32_t frame = 0; frame < sample.mFrameCount; frame++)
+            {
+                char address[32];
+                std::snprintf(address, sizeof(address), "\"%p\"", sample.mFrames[frame]);
+                json << (frame > 0 ? ", " : "") << address;
+            }
+            json << "]}" << (i + 1 < samples.size() ? ",\n" : "\n");
+        }
+        json << "  ]\n}\n";
+        return json.str();
+    }
+
+    bool MemoryTracker::dumpJson(const std::string& filename) const
+    {
+        std::ofstream file(filename, std::ios::out | std::ios::trunc);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        file << toJson();
+        return file.good();
+    }
+}
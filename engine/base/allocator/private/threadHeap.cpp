@@ -0,0 +1,196 @@
+//
+// Created by 最上川 on 2022/8/16/016.
+//
+
+#include <threadHeap.h>
+#include <algorithm>
+#include <mutex>
+
+namespace Base
+{
+    static constexpr uint32_t LARGE_CLASS = UINT32_MAX;
+
+    // heaps whose thread exited with live allocations, both trivially destructible so threads
+    // that exit late during shutdown can still use them
+    static std::mutex orphanMutex;
+    static ThreadHeap* orphanHeaps = nullptr;
+
+    // destroys the heap when its thread exits, unless something allocated from it is still alive
+    struct ThreadHeap::Holder
+    {
+        ThreadHeap* mHeap = nullptr;
+
+        ~Holder()
+        {
+            if (mHeap)
+            {
+                mHeap->collectRemote();
+                if (mHeap->mLiveCount == 0)
+                {
+                    delete mHeap;
+                }
+                else
+                {
+                    mHeap->orphan();
+                }
+                mHeap = nullptr;
+            }
+        }
+    };
+
+    static uint32_t getSizeClass(size_t size)
+    {
+        uint32_t sizeClass = 0;
+        size_t classSize = 16;
+        while (classSize < size)
+        {
+            classSize <<= 1;
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+
+    ThreadHeap::ThreadHeap()
+        : mRemoteFreeList{nullptr}
+        , mLiveCount{0}
+        , mNextOrphan{nullptr}
+    {
+        for (uint32_t i = 0; i < CLASS_COUNT; i++)
+        {
+            const size_t classSize = 16u << i;
+            // about 16KB per block whatever the class
+            mPools[i] = std::make_unique<FixedPool>(classSize, MAX_ALIGN, std::max<size_t>(16 * 1024 / classSize, 4));
+        }
+    }
+
+    ThreadHeap::~ThreadHeap()
+    {
+
+    }
+
+    ThreadHeap& ThreadHeap::local()
+    {
+        static thread_local Holder holder;
+        if (!holder.mHeap)
+        {
+            holder.mHeap = adoptOrphan();
+        }
+        if (!holder.mHeap)
+        {
+            holder.mHeap = new ThreadHeap();
+        }
+        return *holder.mHeap;
+    }
+
+    void ThreadHeap::orphan()
+    {
+        // frees from other threads keep going to the remote list until a thread adopts the heap
+        std::lock_guard<std::mutex> lock(orphanMutex);
+        mNextOrphan = orphanHeaps;
+        orphanHeaps = this;
+    }
+
+    ThreadHeap* ThreadHeap::adoptOrphan()
+    {
+        ThreadHeap* heap = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(orphanMutex);
+            heap = orphanHeaps;
+            if (heap)
+            {
+                orphanHeaps = heap->mNextOrphan;
+                heap->mNextOrphan = nullptr;
+            }
+        }
+        if (heap)
+        {
+            // the pools belong to this thread now, what was freed since the old one exited goes back
+            heap->collectRemote();
+        }
+        return heap;
+    }
+
+    void* ThreadHeap::allocate(size_t size, size_t align)
+    {
+        assert(align <= MAX_ALIGN && "over aligned allocation");
+        return local().allocateLocal(size);
+    }
+
+    void ThreadHeap::deallocate(void* p)
+    {
+        if (!p)
+        {
+            return;
+        }
+
+        Header* header = static_cast<Header*>(p) - 1;
+        if (header->mClass == LARGE_CLASS)
+        {
+            aligned_free(header);
+            return;
+        }
+
+        ThreadHeap* owner = header->mOwner;
+        if (owner == &local())
+        {
+            owner->deallocateLocal(header);
+        }
+        else
+        {
+            owner->deallocateRemote(header);
+        }
+    }
+
+    void* ThreadHeap::allocateLocal(size_t size)
+    {
+        const size_t total = size + sizeof(Header);
+        Header* header = nullptr;
+        if (total > MAX_CLASS_SIZE)
+        {
+            header = static_cast<Header*>(aligned_alloc(total, MAX_ALIGN));
+            header->mOwner = nullptr;
+            header->mClass = LARGE_CLASS;
+            return header + 1;
+        }
+
+        if (mRemoteFreeList.load(std::memory_order_relaxed))
+        {
+            collectRemote();
+        }
+
+        const uint32_t sizeClass = getSizeClass(std::max(total, sizeof(RemoteNode)));
+        header = static_cast<Header*>(mPools[sizeClass]->allocate());
+        header->mOwner = this;
+        header->mClass = sizeClass;
+        mLiveCount++;
+        return header + 1;
+    }
+
+    void ThreadHeap::deallocateLocal(Header* header)
+    {
+        mPools[header->mClass]->deallocate(header);
+        mLiveCount--;
+    }
+
+    void ThreadHeap::deallocateRemote(Header* header)
+    {
+        // every block is at least a RemoteNode, see allocateLocal()
+        RemoteNode* node = reinterpret_cast<RemoteNode*>(header);
+        RemoteNode* head = mRemoteFreeList.load(std::memory_order_relaxed);
+        do
+        {
+            node->mNext = head;
+        } while (!mRemoteFreeList.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    void ThreadHeap::collectRemote()
+    {
+        RemoteNode* node = mRemoteFreeList.exchange(nullptr, std::memory_order_acquire);
+        while (node)
+        {
+            RemoteNode* next = node->mNext;
+            deallocateLocal(&node->mHeader);
+            node = next;
+        }
+    }
+}
@@ -0,0 +1,298 @@
+//
+// Created by 最上川 on 2022/8/20/020.
+//
+
+#include <tlsfAllocator.h>
+#include <cassert>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Base
+{
+    static inline uint32_t findLastSet(uint64_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return 63u - static_cast<uint32_t>(__builtin_clzll(value));
+#endif
+    }
+
+    static inline uint32_t findFirstSet(uint64_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+    }
+
+    TlsfAllocator::TlsfAllocator(uint64_t size)
+        : mSize{size}
+        , mUsedSize{0}
+        , mAllocationCount{0}
+        , mFirstLevelBitmap{0}
+        , mFirstBlock{nullptr}
+        , mBlockPool{sizeof(Block), alignof(Block), 128}
+    {
+        assert(size > 0);
+        std::memset(mSecondLevelBitmap, 0, sizeof(mSecondLevelBitmap));
+        std::memset(mFreeLists, 0, sizeof(mFreeLists));
+
+        mFirstBlock = createBlock(0, size);
+        insertFree(mFirstBlock);
+    }
+
+    TlsfAllocator::~TlsfAllocator()
+    {
+        // live allocations are dropped together with the range
+        Block* block = mFirstBlock;
+        while (block)
+        {
+            Block* next = block->mNextPhysical;
+            destroyBlock(block);
+            block = next;
+        }
+    }
+
+    TlsfAllocator::Block* TlsfAllocator::createBlock(uint64_t offset, uint64_t size)
+    {
+        Block* block = static_cast<Block*>(mBlockPool.allocate());
+        block->mOffset = offset;
+        block->mSize = size;
+        block->mPrevPhysical = nullptr;
+        block->mNextPhysical = nullptr;
+        block->mPrevFree = nullptr;
+        block->mNextFree = nullptr;
+        block->mFree = false;
+        return block;
+    }
+
+    void TlsfAllocator::destroyBlock(Block* block)
+    {
+        mBlockPool.deallocate(block);
+    }
+
+    void TlsfAllocator::mapping(uint64_t size, uint32_t& fl, uint32_t& sl)
+    {
+        if (size < SMALL_SIZE)
+        {
+            fl = 0;
+            sl = static_cast<uint32_t>(size);
+            return;
+        }
+        const uint32_t log2 = findLastSet(size);
+        fl = log2 - SL_LOG2 + 1;
+        sl = static_cast<uint32_t>(size >> (log2 - SL_LOG2)) ^ SL_COUNT;
+    }
+
+    void TlsfAllocator::insertFree(Block* block)
+    {
+        uint32_t fl, sl;
+        mapping(block->mSize, fl, sl);
+        Block* head = mFreeLists[fl][sl];
+        block->mFree = true;
+        block->mPrevFree = nullptr;
+        block->mNextFree = head;
+        if (head)
+        {
+            head->mPrevFree = block;
+        }
+        mFreeLists[fl][sl] = block;
+        mFirstLevelBitmap |= 1ull << fl;
+        mSecondLevelBitmap[fl] |= 1u << sl;
+    }
+
+    void TlsfAllocator::removeFree(Block* block)
+    {
+        uint32_t fl, sl;
+        mapping(block->mSize, fl, sl);
+        if (block->mPrevFree)
+        {
+            block->mPrevFree->mNextFree = block->mNextFree;
+        }
+        else
+        {
+            mFreeLists[fl][sl] = block->mNextFree;
+        }
+        if (block->mNextFree)
+        {
+            block->mNextFree->mPrevFree = block->mPrevFree;
+        }
+
+        if (!mFreeLists[fl][sl])
+        {
+            mSecondLevelBitmap[fl] &= ~(1u << sl);
+            if (!mSecondLevelBitmap[fl])
+            {
+                mFirstLevelBitmap &= ~(1ull << fl);
+            }
+        }
+        block->mFree = false;
+        block->mPrevFree = nullptr;
+        block->mNextFree = nullptr;
+    }
+
+    TlsfAllocator::Block* TlsfAllocator::findFreeBlock(uint64_t size)
+    {
+        // round up to the next list, every block in it is large enough
+        if (size >= SMALL_SIZE)
+        {
+            const uint64_t round = (1ull << (findLastSet(size) - SL_LOG2)) - 1;
+            if (size > UINT64_MAX - round)
+            {
+                return nullptr;
+            }
+            size += round;
+        }
+
+        uint32_t fl, sl;
+        mapping(size, fl, sl);
+        uint32_t secondLevel = mSecondLevelBitmap[fl] & (~0u << sl);
+        if (!secondLevel)
+        {
+            const uint64_t firstLevel = fl + 1 < 64 ? mFirstLevelBitmap & (~0ull << (fl + 1)) : 0;
+            if (!firstLevel)
+            {
+                return nullptr;
+            }
+            fl = findFirstSet(firstLevel);
+            secondLevel = mSecondLevelBitmap[fl];
+        }
+        sl = findFirstSet(secondLevel);
+        return mFreeLists[fl][sl];
+    }
+
+    TlsfAllocator::Block* TlsfAllocator::split(Block* block, uint64_t size)
+    {
+        // block keeps the first size bytes, the returned rest is not in any free list yet
+        Block* rest = createBlock(block->mOffset + size, block->mSize - size);
+        rest->mPrevPhysical = block;
+        rest->mNextPhysical = block->mNextPhysical;
+        if (block->mNextPhysical)
+        {
+            block->mNextPhysical->mPrevPhysical = rest;
+        }
+        block->mNextPhysical = rest;
+        block->mSize = size;
+        return rest;
+    }
+
+    TlsfAllocator::Block* TlsfAllocator::merge(Block* block)
+    {
+        Block* prev = block->mPrevPhysical;
+        if (prev && prev->mFree)
+        {
+            removeFree(prev);
+            prev->mSize += block->mSize;
+            prev->mNextPhysical = block->mNextPhysical;
+            if (block->mNextPhysical)
+            {
+                block->mNextPhysical->mPrevPhysical = prev;
+            }
+            destroyBlock(block);
+            block = prev;
+        }
+
+        Block* next = block->mNextPhysical;
+        if (next && next->mFree)
+        {
+            removeFree(next);
+            block->mSize += next->mSize;
+            block->mNextPhysical = next->mNextPhysical;
+            if (next->mNextPhysical)
+            {
+                next->mNextPhysical->mPrevPhysical = block;
+            }
+            destroyBlock(next);
+        }
+        return block;
+    }
+
+    TlsfAllocator::Allocation TlsfAllocator::allocate(uint64_t size, uint64_t align)
+    {
+        assert(align && !(align & (align - 1)));
+        Allocation allocation;
+        if (size == 0 || size > mSize)
+        {
+            return allocation;
+        }
+
+        // worst case padding, a block this large always fits once aligned
+        Block* block = findFreeBlock(size + align - 1);
+        if (!block)
+        {
+            return allocation;
+        }
+        removeFree(block);
+
+        const uint64_t alignedOffset = (block->mOffset + align - 1) & ~(align - 1);
+        const uint64_t padding = alignedOffset - block->mOffset;
+        if (padding > 0)
+        {
+            // the padding in front stays free, its physical predecessor is in use
+            Block* aligned = split(block, padding);
+            insertFree(block);
+            block = aligned;
+        }
+
+        if (block->mSize > size)
+        {
+            insertFree(split(block, size));
+        }
+
+        mUsedSize += block->mSize;
+        mAllocationCount++;
+        allocation.mOffset = block->mOffset;
+        allocation.mSize = block->mSize;
+        allocation.mHandle = block;
+        return allocation;
+    }
+
+    void TlsfAllocator::free(const Allocation& allocation)
+    {
+        if (!allocation.isValid())
+        {
+            return;
+        }
+        Block* block = static_cast<Block*>(allocation.mHandle);
+        assert(!block->mFree && block->mOffset == allocation.mOffset && "double free or foreign allocation");
+        mUsedSize -= block->mSize;
+        mAllocationCount--;
+        insertFree(merge(block));
+    }
+
+    uint64_t TlsfAllocator::getLargestFreeSize() const
+    {
+        if (!mFirstLevelBitmap)
+        {
+            return 0;
+        }
+        // the highest list is only a size class, walk it for the exact value
+        const uint32_t fl = findLastSet(mFirstLevelBitmap);
+        const uint32_t sl = findLastSet(mSecondLevelBitmap[fl]);
+        uint64_t largest = 0;
+        for (Block* block = mFreeLists[fl][sl]; block; block = block->mNextFree)
+        {
+            largest = block->mSize > largest ? block->mSize : largest;
+        }
+        return largest;
+    }
+
+    float TlsfAllocator::getFragmentation() const
+    {
+        const uint64_t freeSize = mSize - mUsedSize;
+        if (freeSize == 0)
+        {
+            return 0.0f;
+        }
+        return 1.0f - static_cast<float>(getLargestFreeSize()) / static_cast<float>(freeSize);
+    }
+}
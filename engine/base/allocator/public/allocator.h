@@ -5,13 +5,16 @@
 #ifndef HOMURA_ALLOCATOR_H
 #define HOMURA_ALLOCATOR_H
 #include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <memoryTracker.h>
 
 #if defined(WIN32)
 #include <malloc.h>
 #endif
 namespace Base
 {
-    inline void* aligned_alloc(size_t size, size_t align) noexcept
+    inline void* aligned_alloc_untracked(size_t size, size_t align) noexcept
     {
         // 'align' must be a power of two and a multiple of sizeof(void*)
         align = (align < sizeof(void*)) ? sizeof(void*) : align;
@@ -27,7 +30,7 @@ namespace Base
         return p;
     }
 
-    inline void aligned_free(void* p)
+    inline void aligned_free_untracked(void* p)
     {
 #if defined(WIN32)
         ::_aligned_free(p);
@@ -36,13 +39,110 @@ namespace Base
 #endif
     }
 
+#if HOMURA_MEMORY_TRACKING
+    // sits right in front of the returned pointer
+    struct AllocationHeader
+    {
+        uint64_t    mSize;
+        MemoryTag   mTag;
+        // distance from the start of the real block
+        uint32_t    mOffset;
+    };
+#endif
+
+    inline void* aligned_alloc(size_t size, size_t align, MemoryTag tag = MemoryTag::General) noexcept
+    {
+#if HOMURA_MEMORY_TRACKING
+        align = (align < sizeof(void*)) ? sizeof(void*) : align;
+        const size_t offset = (sizeof(AllocationHeader) + align - 1) & ~(align - 1);
+        char* block = static_cast<char*>(aligned_alloc_untracked(size + offset, align));
+        if (!block)
+        {
+            return nullptr;
+        }
+        char* p = block + offset;
+        AllocationHeader* header = reinterpret_cast<AllocationHeader*>(p) - 1;
+        header->mSize = size;
+        header->mTag = tag;
+        header->mOffset = static_cast<uint32_t>(offset);
+        MemoryTracker::get().onAllocate(p, size, tag);
+        return p;
+#else
+        (void)tag;
+        return aligned_alloc_untracked(size, align);
+#endif
+    }
+
+    inline void aligned_free(void* p)
+    {
+#if HOMURA_MEMORY_TRACKING
+        if (!p)
+        {
+            return;
+        }
+        AllocationHeader* header = static_cast<AllocationHeader*>(p) - 1;
+        MemoryTracker::get().onFree(p, header->mSize, header->mTag);
+        aligned_free_untracked(static_cast<char*>(p) - header->mOffset);
+#else
+        aligned_free_untracked(p);
+#endif
+    }
+
+    // Aligned heap allocator, usable as the allocator of STL containers
     template<typename TYPE>
     class allocator
     {
     public:
+        using value_type = TYPE;
+
+        allocator(MemoryTag tag = MemoryTag::General) noexcept
+            : mTag{tag}
+        {
+
+        }
+
+        template<typename U>
+        allocator(const allocator<U>& other) noexcept
+            : mTag{other.getTag()}
+        {
+
+        }
+
         TYPE* allocate(size_t n);
-        void deallocate(TYPE* p);
+        void deallocate(TYPE* p, size_t n = 0);
+
+        MemoryTag getTag() const
+        {
+            return mTag;
+        }
+    private:
+        MemoryTag mTag;
     };
+
+    template<typename TYPE>
+    TYPE* allocator<TYPE>::allocate(size_t n)
+    {
+        return static_cast<TYPE*>(aligned_alloc(n * sizeof(TYPE), alignof(TYPE), mTag));
+    }
+
+    template<typename TYPE>
+    void allocator<TYPE>::deallocate(TYPE* p, size_t)
+    {
+        aligned_free(p);
+    }
+
+    // the tag only decides where an allocation is counted, any instance can free any block
+    template<typename T, typename U>
+    bool operator==(const allocator<T>&, const allocator<U>&) noexcept
+    {
+        return true;
+    }
+
+    template<typename T, typename U>
+    bool operator!=(const allocator<T>&, const allocator<U>&) noexcept
+    {
+        return false;
+    }
 }
 
 #endif //HOMURA_ALLOCATOR_H
@@ -0,0 +1,145 @@
+//
+// Created by 最上川 on 2022/8/16/016.
+//
+
+#ifndef HOMURA_FIXEDPOOL_H
+#define HOMURA_FIXEDPOOL_H
+#include <allocator.h>
+#include <memory>
+#include <vector>
+
+namespace Base
+{
+    // Hands out elements of one size from blocks of elementsPerBlock, freed elements go
+    // to a free list and are reused first. Memory is only returned when the pool dies.
+    // Not thread safe.
+    class FixedPool
+    {
+    public:
+        FixedPool(size_t elementSize, size_t align, size_t elementsPerBlock = 256, MemoryTag tag = MemoryTag::General);
+        ~FixedPool();
+        FixedPool(const FixedPool&) = delete;
+        FixedPool& operator=(const FixedPool&) = delete;
+
+        void* allocate();
+        void deallocate(void* p);
+
+        size_t getElementSize() const
+        {
+            return mElementSize;
+        }
+
+        size_t getAlign() const
+        {
+            return mAlign;
+        }
+
+        size_t getLiveCount() const
+        {
+            return mLiveCount;
+        }
+    private:
+        struct FreeNode
+        {
+            FreeNode* mNext;
+        };
+        void addBlock();
+    private:
+        MemoryTag           mTag;
+        size_t              mElementSize;
+        size_t              mAlign;
+        size_t              mElementsPerBlock;
+        size_t              mLiveCount;
+        FreeNode*           mFreeList;
+        std::vector<void*>  mBlocks;
+    };
+
+    // Pools of different element sizes sharing one lifetime, so allocators rebound
+    // to other types still compare equal and free into the right pool
+    class FixedPoolSet
+    {
+    public:
+        explicit FixedPoolSet(size_t elementsPerBlock = 256, MemoryTag tag = MemoryTag::General);
+
+        FixedPool* getPool(size_t elementSize, size_t align);
+
+        MemoryTag getTag() const
+        {
+            return mTag;
+        }
+    private:
+        size_t                                  mElementsPerBlock;
+        MemoryTag                               mTag;
+        std::vector<std::unique_ptr<FixedPool>> mPools;
+    };
+
+    // Single element allocations, which is what node based containers make, come from a
+    // FixedPool. Array allocations fall through to the aligned heap.
+    template<typename TYPE>
+    class PoolAllocator
+    {
+    public:
+        using value_type = TYPE;
+
+        explicit PoolAllocator(size_t elementsPerBlock = 256, MemoryTag tag = MemoryTag::General)
+            : PoolAllocator(std::make_shared<FixedPoolSet>(elementsPerBlock, tag))
+        {
+
+        }
+
+        explicit PoolAllocator(const std::shared_ptr<FixedPoolSet>& pools)
+            : mPools{pools}
+            , mPool{pools->getPool(sizeof(TYPE), alignof(TYPE))}
+        {
+
+        }
+
+        template<typename U>
+        PoolAllocator(const PoolAllocator<U>& other)
+            : PoolAllocator(other.getPools())
+        {
+
+        }
+
+        TYPE* allocate(size_t n)
+        {
+            if (n == 1)
+            {
+                return static_cast<TYPE*>(mPool->allocate());
+            }
+            return static_cast<TYPE*>(aligned_alloc(n * sizeof(TYPE), alignof(TYPE), mPools->getTag()));
+        }
+
+        void deallocate(TYPE* p, size_t n)
+        {
+            if (n == 1)
+            {
+                mPool->deallocate(p);
+                return;
+            }
+            aligned_free(p);
+        }
+
+        const std::shared_ptr<FixedPoolSet>& getPools() const
+        {
+            return mPools;
+        }
+    private:
+        std::shared_ptr<FixedPoolSet>   mPools;
+        FixedPool*                      mPool;
+    };
+
+    template<typename T, typename U>
+    bool operator==(const PoolAllocator<T>& a, const PoolAllocator<U>& b) noexcept
+    {
+        return a.getPools() == b.getPools();
+    }
+
+    template<typename T, typename U>
+    bool operator!=(const PoolAllocator<T>& a, const PoolAllocator<U>& b) noexcept
+    {
+        return a.getPools() != b.getPools();
+    }
+}
+
+#endif //HOMURA_FIXEDPOOL_H
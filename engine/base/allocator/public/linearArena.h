@@ -0,0 +1,102 @@
+//
+// Created by 最上川 on 2022/8/16/016.
+//
+
+#ifndef HOMURA_LINEARARENA_H
+#define HOMURA_LINEARARENA_H
+#include <allocator.h>
+#include <vector>
+
+namespace Base
+{
+    // Bump allocator for short lived data. Nothing is freed individually, reset() releases
+    // everything at once, typically at the start of a frame. Not thread safe.
+    class LinearArena
+    {
+    public:
+        explicit LinearArena(size_t blockSize = 64 * 1024, MemoryTag tag = MemoryTag::Frame);
+        ~LinearArena();
+        LinearArena(const LinearArena&) = delete;
+        LinearArena& operator=(const LinearArena&) = delete;
+
+        void* allocate(size_t size, size_t align);
+        // hands back p if it is the latest allocation, so a growing vector reuses its space
+        void deallocate(void* p, size_t size);
+        // if the last frame needed more than one block they are merged,
+        // so a steady workload ends up without any heap allocation
+        void reset();
+
+        size_t getUsedSize() const;
+        size_t getCapacity() const;
+    private:
+        struct Block
+        {
+            char*   mData;
+            size_t  mSize;
+        };
+
+        void addBlock(size_t size);
+    private:
+        std::vector<Block>  mBlocks;
+        MemoryTag           mTag;
+        size_t              mBlockSize;
+        size_t              mBlockIndex;
+        size_t              mOffset;
+        // bytes used in the blocks before mBlockIndex
+        size_t              mUsedBefore;
+    };
+
+    template<typename TYPE>
+    class ArenaAllocator
+    {
+    public:
+        using value_type = TYPE;
+
+        explicit ArenaAllocator(LinearArena* arena) noexcept
+            : mArena{arena}
+        {
+
+        }
+
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+            : mArena{other.getArena()}
+        {
+
+        }
+
+        TYPE* allocate(size_t n)
+        {
+            return static_cast<TYPE*>(mArena->allocate(n * sizeof(TYPE), alignof(TYPE)));
+        }
+
+        void deallocate(TYPE* p, size_t n)
+        {
+            mArena->deallocate(p, n * sizeof(TYPE));
+        }
+
+        LinearArena* getArena() const
+        {
+            return mArena;
+        }
+    private:
+        LinearArena* mArena;
+    };
+
+    template<typename T, typename U>
+    bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) noexcept
+    {
+        return a.getArena() == b.getArena();
+    }
+
+    template<typename T, typename U>
+    bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) noexcept
+    {
+        return a.getArena() != b.getArena();
+    }
+
+    template<typename TYPE>
+    using ArenaVector = std::vector<TYPE, ArenaAllocator<TYPE>>;
+}
+
+#endif //HOMURA_LINEARARENA_H
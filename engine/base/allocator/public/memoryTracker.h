@@ -0,0 +1,95 @@
+//
+// Created by 最上川 on 2022/8/18/018.
+//
+
+#ifndef HOMURA_MEMORYTRACKER_H
+#define HOMURA_MEMORYTRACKER_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Tracking puts a small header in front of every Base::aligned_alloc block,
+// it is switched with the HOMURA_MEMORY_TRACKING cmake option
+#ifndef HOMURA_MEMORY_TRACKING
+#define HOMURA_MEMORY_TRACKING 0
+#endif
+
+namespace Base
+{
+    enum class MemoryTag : uint32_t
+    {
+        General = 0,
+        JobSystem,
+        Frame,
+        RHI,
+        Asset,
+        Count
+    };
+
+    const char* getMemoryTagName(MemoryTag tag);
+
+    struct MemoryTagStats
+    {
+        uint64_t mBytes = 0;
+        uint64_t mPeakBytes = 0;
+        uint64_t mLiveCount = 0;
+        uint64_t mTotalCount = 0;
+        // 0 means no budget
+        uint64_t mBudget = 0;
+    };
+
+    struct MemorySample
+    {
+        static constexpr uint32_t MAX_FRAMES = 16;
+        MemoryTag   mTag;
+        size_t      mSize;
+        uint32_t    mFrameCount;
+        void*       mFrames[MAX_FRAMES];
+    };
+
+    class MemoryTracker
+    {
+    public:
+        static MemoryTracker& get();
+
+        void onAllocate(void* p, size_t size, MemoryTag tag);
+        void onFree(void* p, size_t size, MemoryTag tag);
+
+        MemoryTagStats getStats(MemoryTag tag) const;
+        void resetPeaks();
+
+        void setBudget(MemoryTag tag, uint64_t bytes);
+        // tags whose current bytes exceed their budget
+        std::vector<MemoryTag> getOverBudgetTags() const;
+
+        // records the callstack of every n-th allocation that is still alive, 0 turns it off
+        void setSampleRate(uint32_t rate);
+        std::vector<MemorySample> getLiveSamples() const;
+
+        std::string toJson() const;
+        bool dumpJson(const std::string& filename) const;
+    private:
+        MemoryTracker();
+
+        struct alignas(64) TagCounters
+        {
+            std::atomic<uint64_t> mBytes{0};
+            std::atomic<uint64_t> mPeakBytes{0};
+            std::atomic<uint64_t> mLiveCount{0};
+            std::atomic<uint64_t> mTotalCount{0};
+            std::atomic<uint64_t> mBudget{0};
+        };
+    private:
+        TagCounters                                 mCounters[static_cast<size_t>(MemoryTag::Count)];
+        std::atomic<uint32_t>                       mSampleRate;
+        std::atomic<uint64_t>                       mSampleCounter;
+        mutable std::mutex                          mSampleMutex;
+        std::unordered_map<void*, MemorySample>     mSamples;
+    };
+}
+
+#endif //HOMURA_MEMORYTRACKER_H
@@ -0,0 +1,104 @@
+//
+// Created by 最上川 on 2022/8/16/016.
+//
+
+#ifndef HOMURA_THREADHEAP_H
+#define HOMURA_THREADHEAP_H
+#include <allocator.h>
+#include <fixedPool.h>
+#include <atomic>
+#include <cstdint>
+
+namespace Base
+{
+    // Size class heap owned by a single thread, allocation never takes a lock.
+    // Memory may be freed from any thread, a foreign free is handed back to the owner
+    // through a lock-free list and recycled on its next allocation.
+    // A heap whose thread exits with live allocations is orphaned, not torn down. The next thread
+    // that needs a heap adopts it together with the frees that reached it in between.
+    class ThreadHeap
+    {
+    public:
+        static constexpr size_t MAX_ALIGN = 16;
+        static constexpr uint32_t CLASS_COUNT = 8;
+        // allocations above this go straight to the aligned heap
+        static constexpr size_t MAX_CLASS_SIZE = 16u << (CLASS_COUNT - 1);
+
+        // heap of the calling thread, created on first use
+        static ThreadHeap& local();
+
+        static void* allocate(size_t size, size_t align = MAX_ALIGN);
+        static void deallocate(void* p);
+
+        size_t getLiveCount() const
+        {
+            return mLiveCount;
+        }
+
+        ThreadHeap(const ThreadHeap&) = delete;
+        ThreadHeap& operator=(const ThreadHeap&) = delete;
+    private:
+        struct alignas(MAX_ALIGN) Header
+        {
+            ThreadHeap* mOwner;
+            uint32_t    mClass;
+        };
+        struct RemoteNode
+        {
+            Header      mHeader;
+            RemoteNode* mNext;
+        };
+        struct Holder;
+
+        ThreadHeap();
+        ~ThreadHeap();
+        static ThreadHeap* adoptOrphan();
+        void orphan();
+        void* allocateLocal(size_t size);
+        void deallocateLocal(Header* header);
+        void deallocateRemote(Header* header);
+        void collectRemote();
+    private:
+        std::unique_ptr<FixedPool>  mPools[CLASS_COUNT];
+        std::atomic<RemoteNode*>    mRemoteFreeList;
+        size_t                      mLiveCount;
+        // next heap of the orphan list
+        ThreadHeap*                 mNextOrphan;
+    };
+
+    template<typename TYPE>
+    class ThreadHeapAllocator
+    {
+        static_assert(alignof(TYPE) <= ThreadHeap::MAX_ALIGN, "type is over aligned for the thread heap");
+    public:
+        using value_type = TYPE;
+
+        ThreadHeapAllocator() noexcept = default;
+        template<typename U>
+        ThreadHeapAllocator(const ThreadHeapAllocator<U>&) noexcept {}
+
+        TYPE* allocate(size_t n)
+        {
+            return static_cast<TYPE*>(ThreadHeap::allocate(n * sizeof(TYPE), alignof(TYPE)));
+        }
+
+        void deallocate(TYPE* p, size_t n)
+        {
+            ThreadHeap::deallocate(p);
+        }
+    };
+
+    template<typename T, typename U>
+    bool operator==(const ThreadHeapAllocator<T>&, const ThreadHeapAllocator<U>&) noexcept
+    {
+        return true;
+    }
+
+    template<typename T, typename U>
+    bool operator!=(const ThreadHeapAllocator<T>&, const ThreadHeapAllocator<U>&) noexcept
+    {
+        return false;
+    }
+}
+
+#endif //HOMURA_THREADHEAP_H
@@ -0,0 +1,119 @@
+//
+// Created by 最上川 on 2022/8/20/020.
+//
+
+#ifndef HOMURA_TLSFALLOCATOR_H
+#define HOMURA_TLSFALLOCATOR_H
+#include <fixedPool.h>
+#include <cstdint>
+
+namespace Base
+{
+    // Two level segregated fit allocator over an abstract range [0, size). It never touches the
+    // memory it manages, so it can sub allocate GPU heaps and runs the same on the CPU.
+    // Allocation and free are O(1), free neighbours are merged right away. Not thread safe.
+    class TlsfAllocator
+    {
+    public:
+        struct Allocation
+        {
+            uint64_t    mOffset = 0;
+            uint64_t    mSize = 0;
+            void*       mHandle = nullptr;
+
+            bool isValid() const
+            {
+                return mHandle != nullptr;
+            }
+        };
+
+        explicit TlsfAllocator(uint64_t size);
+        ~TlsfAllocator();
+        TlsfAllocator(const TlsfAllocator&) = delete;
+        TlsfAllocator& operator=(const TlsfAllocator&) = delete;
+
+        // align must be a power of two, returns an invalid allocation when nothing fits
+        Allocation allocate(uint64_t size, uint64_t align = 1);
+        void free(const Allocation& allocation);
+
+        uint64_t getSize() const
+        {
+            return mSize;
+        }
+
+        uint64_t getUsedSize() const
+        {
+            return mUsedSize;
+        }
+
+        uint32_t getAllocationCount() const
+        {
+            return mAllocationCount;
+        }
+
+        bool isEmpty() const
+        {
+            return mAllocationCount == 0;
+        }
+
+        uint64_t getLargestFreeSize() const;
+        // 0 when all free space is one range, towards 1 the more it is split up
+        float getFragmentation() const;
+
+        // visits live allocations in address order, used by defragmentation
+        template<typename F>
+        void forEachAllocation(F&& f) const;
+    private:
+        static constexpr uint32_t SL_LOG2 = 4;
+        static constexpr uint32_t SL_COUNT = 1u << SL_LOG2;
+        static constexpr uint32_t FL_COUNT = 64 - SL_LOG2 + 1;
+        static constexpr uint64_t SMALL_SIZE = SL_COUNT;
+
+        struct Block
+        {
+            uint64_t    mOffset;
+            uint64_t    mSize;
+            Block*      mPrevPhysical;
+            Block*      mNextPhysical;
+            Block*      mPrevFree;
+            Block*      mNextFree;
+            bool        mFree;
+        };
+
+        static void mapping(uint64_t size, uint32_t& fl, uint32_t& sl);
+        Block* findFreeBlock(uint64_t size);
+        void insertFree(Block* block);
+        void removeFree(Block* block);
+        Block* split(Block* block, uint64_t size);
+        Block* merge(Block* block);
+        Block* createBlock(uint64_t offset, uint64_t size);
+        void destroyBlock(Block* block);
+    private:
+        uint64_t    mSize;
+        uint64_t    mUsedSize;
+        uint32_t    mAllocationCount;
+        uint64_t    mFirstLevelBitmap;
+        uint32_t    mSecondLevelBitmap[FL_COUNT];
+        Block*      mFreeLists[FL_COUNT][SL_COUNT];
+        Block*      mFirstBlock;
+        FixedPool   mBlockPool;
+    };
+
+    template<typename F>
+    void TlsfAllocator::forEachAllocation(F&& f) const
+    {
+        for (Block* block = mFirstBlock; block; block = block->mNextPhysical)
+        {
+            if (!block->mFree)
+            {
+                Allocation allocation;
+                allocation.mOffset = block->mOffset;
+                allocation.mSize = block->mSize;
+                allocation.mHandle = block;
+                f(allocation);
+            }
+        }
+    }
+}
+
+#endif //HOMURA_TLSFALLOCATOR_H
@@ -0,0 +1,725 @@
+//
+// Created by 最上川 on 2022/8/31/031.
+//
+
+#include <blockCompressor.h>
+#include <jobSystem.h>
+#include <splitter.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HOMURA_BC_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HOMURA_BC_NEON 1
+#endif
+
+namespace Base
+{
+    // one block channel by channel, so four texels fill a vector
+    struct BlockTexels
+    {
+        alignas(16) float mChannel[4][16];
+    };
+
+    // a use mask that takes every texel of the block
+    static constexpr bool ALL_TEXELS[16] = {true, true, true, true, true, true, true, true, true, true, true, true, true, true, true, true};
+
+    static void loadTexels(const uint8_t* texels, BlockTexels& block)
+    {
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                block.mChannel[c][i] = texels[i * 4 + c];
+            }
+        }
+    }
+
+    // Nearest of count palette entries for every texel, over channels [first, first + channelCount).
+    // Returns the summed squared error of the texels in use, the others get no index
+    static float selectIndices(const BlockTexels& texels, uint32_t first, uint32_t channelCount, const float (*palette)[4], uint32_t count,
+                               const bool* use, uint8_t* indices)
+    {
+        alignas(16) float errors[16];
+#if defined(HOMURA_BC_SSE2)
+        for (uint32_t group = 0; group < 16; group += 4)
+        {
+            __m128 values[4];
+            for (uint32_t c = 0; c < channelCount; c++)
+            {
+                values[c] = _mm_load_ps(&texels.mChannel[first + c][group]);
+            }
+            __m128 best = _mm_set1_ps(FLT_MAX);
+            __m128i bestIndex = _mm_setzero_si128();
+            for (uint32_t p = 0; p < count; p++)
+            {
+                __m128 distance = _mm_setzero_ps();
+                for (uint32_t c = 0; c < channelCount; c++)
+                {
+                    const __m128 delta = _mm_sub_ps(values[c], _mm_set1_ps(palette[p][first + c]));
+                    distance = _mm_add_ps(distance, _mm_mul_ps(delta, delta));
+                }
+                const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+                best = _mm_min_ps(distance, best);
+                bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(static_cast<int>(p))), _mm_andnot_si128(closer, bestIndex));
+            }
+            alignas(16) int32_t groupIndices[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(groupIndices), bestIndex);
+            _mm_store_ps(errors + group, best);
+            for (uint32_t k = 0; k < 4; k++)
+            {
+                indices[group + k] = static_cast<uint8_t>(groupIndices[k]);
+            }
+        }
+#elif defined(HOMURA_BC_NEON)
+        for (uint32_t group = 0; group < 16; group += 4)
+        {
+            float32x4_t values[4];
+            for (uint32_t c = 0; c < channelCount; c++)
+            {
+                values[c] = vld1q_f32(&texels.mChannel[first + c][group]);
+            }
+            float32x4_t best = vdupq_n_f32(FLT_MAX);
+            uint32x4_t bestIndex = vdupq_n_u32(0);
+            for (uint32_t p = 0; p < count; p++)
+            {
+                float32x4_t distance = vdupq_n_f32(0.0f);
+                for (uint32_t c = 0; c < channelCount; c++)
+                {
+                    const float32x4_t delta = vsubq_f32(values[c], vdupq_n_f32(palette[p][first + c]));
+                    distance = vmlaq_f32(distance, delta, delta);
+                }
+                const uint32x4_t closer = vcltq_f32(distance, best);
+                best = vminq_f32(distance, best);
+                bestIndex = vbslq_u32(closer, vdupq_n_u32(p), bestIndex);
+            }
+            uint32_t groupIndices[4];
+            vst1q_u32(groupIndices, bestIndex);
+            vst1q_f32(errors + group, best);
+            for (uint32_t k = 0; k < 4; k++)
+            {
+                indices[group + k] = static_cast<uint8_t>(groupIndices[k]);
+            }
+        }
+#else
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            errors[i] = FLT_MAX;
+            for (uint32_t p = 0; p < count; p++)
+            {
+                float distance = 0.0f;
+                for (uint32_t c = 0; c < channelCount; c++)
+                {
+                    const float delta = texels.mChannel[first + c][i] - palette[p][first + c];
+                    distance += delta * delta;
+                }
+                if (distance < errors[i])
+                {
+                    errors[i] = distance;
+                    indices[i] = static_cast<uint8_t>(p);
+                }
+            }
+        }
+#endif
+        float total = 0.0f;
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            total += use[i] ? errors[i] : 0.0f;
+        }
+        return total;
+    }
+
+    // Endpoints along the principal axis of the texels in use, through their extremes.
+    // False if no texel is in use
+    static bool fitPrincipalAxis(const BlockTexels& texels, uint32_t channelCount, const bool* use, float* e0, float* e1)
+    {
+        float mean[4] = {};
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            if (use[i])
+            {
+                for (uint32_t c = 0; c < channelCount; c++)
+                {
+                    mean[c] += texels.mChannel[c][i];
+                }
+                count++;
+            }
+        }
+        if (count == 0)
+        {
+            return false;
+        }
+        for (uint32_t c = 0; c < channelCount; c++)
+        {
+            mean[c] /= count;
+        }
+
+        float covariance[4][4] = {};
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            if (!use[i])
+            {
+                continue;
+            }
+            for (uint32_t a = 0; a < channelCount; a++)
+            {
+                for (uint32_t b = a; b < channelCount; b++)
+                {
+                    covariance[a][b] += (texels.mChannel[a][i] - mean[a]) * (texels.mChannel[b][i] - mean[b]);
+                }
+            }
+        }
+
+        // power iteration from the channel that varies most
+        float axis[4] = {};
+        uint32_t widest = 0;
+        for (uint32_t c = 0; c < channelCount; c++)
+        {
+            for (uint32_t b = 0; b < c; b++)
+            {
+                covariance[c][b] = covariance[b][c];
+            }
+            widest = covariance[c][c] > covariance[widest][widest] ? c : widest;
+        }
+        axis[widest] = 1.0f;
+        for (uint32_t iteration = 0; iteration < 8; iteration++)
+        {
+            float next[4] = {};
+            float length = 0.0f;
+            for (uint32_t a = 0; a < channelCount; a++)
+            {
+                for (uint32_t b = 0; b < channelCount; b++)
+                {
+                    next[a] += covariance[a][b] * axis[b];
+                }
+                length += next[a] * next[a];
+            }
+            if (length < 1e-12f)
+            {
+                break;
+            }
+            length = 1.0f / std::sqrt(length);
+            for (uint32_t c = 0; c < channelCount; c++)
+            {
+                axis[c] = next[c] * length;
+            }
+        }
+
+        float low = FLT_MAX;
+        float high = -FLT_MAX;
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            if (!use[i])
+            {
+                continue;
+            }
+            float projection = 0.0f;
+            for (uint32_t c = 0; c < channelCount; c++)
+            {
+                projection += (texels.mChannel[c][i] - mean[c]) * axis[c];
+            }
+            low = std::min(low, projection);
+            high = std::max(high, projection);
+        }
+        for (uint32_t c = 0; c < channelCount; c++)
+        {
+            e0[c] = std::min(std::max(mean[c] + axis[c] * low, 0.0f), 255.0f);
+            e1[c] = std::min(std::max(mean[c] + axis[c] * high, 0.0f), 255.0f);
+        }
+        return true;
+    }
+
+    // Least squares endpoints for fixed indices, weights[index] is how far towards e1 the index sits.
+    // False if the indices do not pin both endpoints down
+    static bool fitLeastSquares(const BlockTexels& texels, uint32_t channelCount, const bool* use, const uint8_t* indices, const float* weights, float* e0, float* e1)
+    {
+        float aa = 0.0f;
+        float ab = 0.0f;
+        float bb = 0.0f;
+        float ax[4] = {};
+        float bx[4] = {};
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            if (!use[i])
+            {
+                continue;
+            }
+            const float b = weights[indices[i]];
+            const float a = 1.0f - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (uint32_t c = 0; c < channelCount; c++)
+            {
+                ax[c] += a * texels.mChannel[c][i];
+                bx[c] += b * texels.mChannel[c][i];
+            }
+        }
+        const float determinant = aa * bb - ab * ab;
+        if (std::abs(determinant) < 1e-6f)
+        {
+            return false;
+        }
+        for (uint32_t c = 0; c < channelCount; c++)
+        {
+            e0[c] = std::min(std::max((bb * ax[c] - ab * bx[c]) / determinant, 0.0f), 255.0f);
+            e1[c] = std::min(std::max((aa * bx[c] - ab * ax[c]) / determinant, 0.0f), 255.0f);
+        }
+        return true;
+    }
+
+    static void writeLittleEndian(uint8_t* dst, uint64_t value, uint32_t bytes)
+    {
+        for (uint32_t i = 0; i < bytes; i++)
+        {
+            dst[i] = static_cast<uint8_t>(value >> (i * 8));
+        }
+    }
+
+    static uint16_t packRgb565(const float* color)
+    {
+        const uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+        const uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+        const uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    static void unpackRgb565(uint16_t value, float* color)
+    {
+        const uint32_t r = (value >> 11) & 31;
+        const uint32_t g = (value >> 5) & 63;
+        const uint32_t b = value & 31;
+        color[0] = static_cast<float>((r << 3) | (r >> 2));
+        color[1] = static_cast<float>((g << 2) | (g >> 4));
+        color[2] = static_cast<float>((b << 3) | (b >> 2));
+    }
+
+    struct ColorBlock
+    {
+        uint16_t    mColor0;
+        uint16_t    mColor1;
+        uint8_t     mIndices[16];
+        float       mError;
+    };
+
+    static ColorBlock quantizeColorBlock(const BlockTexels& texels, const bool* use, bool threeColor, const float* e0, const float* e1)
+    {
+        ColorBlock block;
+        block.mColor0 = packRgb565(e0);
+        block.mColor1 = packRgb565(e1);
+
+        float palette[4][4] = {};
+        unpackRgb565(block.mColor0, palette[0]);
+        unpackRgb565(block.mColor1, palette[1]);
+        for (uint32_t c = 0; c < 3; c++)
+        {
+            if (threeColor)
+            {
+                palette[2][c] = (palette[0][c] + palette[1][c]) * 0.5f;
+            }
+            else
+            {
+                palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+                palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+            }
+        }
+        block.mError = selectIndices(texels, 0, 3, palette, threeColor ? 3 : 4, use, block.mIndices);
+        return block;
+    }
+
+    // BC1 color part, also the color half of BC3 which never uses the 3 color mode
+    static void encodeColorBlock(const BlockTexels& texels, bool allowTransparent, uint8_t* dst)
+    {
+        bool use[16];
+        bool threeColor = false;
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            use[i] = !allowTransparent || texels.mChannel[3][i] >= 128.0f;
+            threeColor |= !use[i];
+        }
+
+        ColorBlock block{0, 0, {}, 0.0f};
+        float e0[4];
+        float e1[4];
+        if (fitPrincipalAxis(texels, 3, use, e0, e1))
+        {
+            block = quantizeColorBlock(texels, use, threeColor, e0, e1);
+
+            // palette position of every index towards color 1
+            static const float FOUR_COLOR_WEIGHTS[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+            static const float THREE_COLOR_WEIGHTS[4] = {0.0f, 1.0f, 0.5f, 0.0f};
+            if (fitLeastSquares(texels, 3, use, block.mIndices, threeColor ? THREE_COLOR_WEIGHTS : FOUR_COLOR_WEIGHTS, e0, e1))
+            {
+                const ColorBlock refined = quantizeColorBlock(texels, use, threeColor, e0, e1);
+                block = refined.mError < block.mError ? refined : block;
+            }
+        }
+
+        // the mode is told by the order of the colors, swapping them swaps the ends of the palette
+        bool swap = false;
+        if (threeColor)
+        {
+            swap = block.mColor0 > block.mColor1;
+        }
+        else if (block.mColor0 == block.mColor1)
+        {
+            std::fill(block.mIndices, block.mIndices + 16, 0);
+        }
+        else
+        {
+            swap = block.mColor0 < block.mColor1;
+        }
+        if (swap)
+        {
+            static const uint8_t FOUR_COLOR_SWAP[4] = {1, 0, 3, 2};
+            static const uint8_t THREE_COLOR_SWAP[4] = {1, 0, 2, 3};
+            std::swap(block.mColor0, block.mColor1);
+            for (uint32_t i = 0; i < 16; i++)
+            {
+                block.mIndices[i] = threeColor ? THREE_COLOR_SWAP[block.mIndices[i]] : FOUR_COLOR_SWAP[block.mIndices[i]];
+            }
+        }
+
+        uint32_t indices = 0;
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            // index 3 of the 3 color mode is transparent black
+            indices |= static_cast<uint32_t>(use[i] ? block.mIndices[i] : 3) << (i * 2);
+        }
+        writeLittleEndian(dst, block.mColor0, 2);
+        writeLittleEndian(dst + 2, block.mColor1, 2);
+        writeLittleEndian(dst + 4, indices, 4);
+    }
+
+    static float quantizeSingleChannel(const BlockTexels& texels, uint32_t channel, uint32_t e0, uint32_t e1, uint8_t* indices)
+    {
+        float palette[8][4] = {};
+        palette[0][channel] = static_cast<float>(e0);
+        palette[1][channel] = static_cast<float>(e1);
+        if (e0 > e1)
+        {
+            for (uint32_t i = 2; i < 8; i++)
+            {
+                palette[i][channel] = ((8 - i) * e0 + (i - 1) * e1) / 7.0f;
+            }
+        }
+        else
+        {
+            for (uint32_t i = 2; i < 6; i++)
+            {
+                palette[i][channel] = ((6 - i) * e0 + (i - 1) * e1) / 5.0f;
+            }
+            palette[6][channel] = 0.0f;
+            palette[7][channel] = 255.0f;
+        }
+        return selectIndices(texels, channel, 1, palette, 8, ALL_TEXELS, indices);
+    }
+
+    // BC4 block of one channel, also the alpha half of BC3
+    static void encodeSingleChannel(const BlockTexels& texels, uint32_t channel, uint8_t* dst)
+    {
+        uint32_t low = 255;
+        uint32_t high = 0;
+        // extremes of the texels that are neither 0 nor 255, which the 6 value mode has for free
+        uint32_t innerLow = 255;
+        uint32_t innerHigh = 0;
+        bool hasExtremes = false;
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            const uint32_t value = static_cast<uint32_t>(texels.mChannel[channel][i]);
+            low = std::min(low, value);
+            high = std::max(high, value);
+            if (value == 0 || value == 255)
+            {
+                hasExtremes = true;
+            }
+            else
+            {
+                innerLow = std::min(innerLow, value);
+                innerHigh = std::max(innerHigh, value);
+            }
+        }
+
+        uint32_t e0 = high;
+        uint32_t e1 = low;
+        uint8_t indices[16] = {};
+        if (high > low)
+        {
+            // 8 interpolated values
+            float error = quantizeSingleChannel(texels, channel, e0, e1, indices);
+            if (hasExtremes && innerLow <= innerHigh)
+            {
+                uint8_t sixIndices[16];
+                const float sixError = quantizeSingleChannel(texels, channel, innerLow, innerHigh, sixIndices);
+                if (sixError < error)
+                {
+                    e0 = innerLow;
+                    e1 = innerHigh;
+                    std::memcpy(indices, sixIndices, sizeof(indices));
+                }
+            }
+        }
+
+        uint64_t bits = 0;
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            bits |= static_cast<uint64_t>(indices[i]) << (i * 3);
+        }
+        dst[0] = static_cast<uint8_t>(e0);
+        dst[1] = static_cast<uint8_t>(e1);
+        writeLittleEndian(dst + 2, bits, 6);
+    }
+
+    // BC7 mode 6, 7 bit RGBA endpoints with a shared low bit each and 16 interpolated colors
+    static const uint32_t BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    struct Bc7Block
+    {
+        uint8_t     mEndpoint[2][4];
+        uint8_t     mPBit[2];
+        uint8_t     mIndices[16];
+        float       mError;
+    };
+
+    static void quantizeBc7Endpoint(const float* endpoint, uint8_t* quantized, uint8_t& pBit)
+    {
+        float bestError = FLT_MAX;
+        for (uint32_t p = 0; p < 2; p++)
+        {
+            uint8_t candidate[4];
+            float error = 0.0f;
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                const int32_t q = std::min(std::max(static_cast<int32_t>(std::lround((endpoint[c] - p) * 0.5f)), 0), 127);
+                candidate[c] = static_cast<uint8_t>(q);
+                const float delta = static_cast<float>((q << 1) | p) - endpoint[c];
+                error += delta * delta;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                std::memcpy(quantized, candidate, sizeof(candidate));
+                pBit = static_cast<uint8_t>(p);
+            }
+        }
+    }
+
+    static Bc7Block quantizeBc7Block(const BlockTexels& texels, const float* e0, const float* e1)
+    {
+        Bc7Block block;
+        quantizeBc7Endpoint(e0, block.mEndpoint[0], block.mPBit[0]);
+        quantizeBc7Endpoint(e1, block.mEndpoint[1], block.mPBit[1]);
+
+        float palette[16][4];
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            const uint32_t a = (block.mEndpoint[0][c] << 1) | block.mPBit[0];
+            const uint32_t b = (block.mEndpoint[1][c] << 1) | block.mPBit[1];
+            for (uint32_t i = 0; i < 16; i++)
+            {
+                palette[i][c] = static_cast<float>(((64 - BC7_WEIGHTS[i]) * a + BC7_WEIGHTS[i] * b + 32) >> 6);
+            }
+        }
+        block.mError = selectIndices(texels, 0, 4, palette, 16, ALL_TEXELS, block.mIndices);
+        return block;
+    }
+
+    void encodeBC1(const uint8_t* texels, uint8_t* block)
+    {
+        BlockTexels values;
+        loadTexels(texels, values);
+        encodeColorBlock(values, true, block);
+    }
+
+    void encodeBC3(const uint8_t* texels, uint8_t* block)
+    {
+        BlockTexels values;
+        loadTexels(texels, values);
+        encodeSingleChannel(values, 3, block);
+        encodeColorBlock(values, false, block + 8);
+    }
+
+    void encodeBC4(const uint8_t* texels, uint8_t* block)
+    {
+        BlockTexels values;
+        loadTexels(texels, values);
+        encodeSingleChannel(values, 0, block);
+    }
+
+    void encodeBC5(const uint8_t* texels, uint8_t* block)
+    {
+        BlockTexels values;
+        loadTexels(texels, values);
+        encodeSingleChannel(values, 0, block);
+        encodeSingleChannel(values, 1, block + 8);
+    }
+
+    void encodeBC7(const uint8_t* texels, uint8_t* block)
+    {
+        BlockTexels values;
+        loadTexels(texels, values);
+
+        float e0[4];
+        float e1[4];
+        fitPrincipalAxis(values, 4, ALL_TEXELS, e0, e1);
+        Bc7Block best = quantizeBc7Block(values, e0, e1);
+
+        float weights[16];
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            weights[i] = BC7_WEIGHTS[i] / 64.0f;
+        }
+        if (fitLeastSquares(values, 4, ALL_TEXELS, best.mIndices, weights, e0, e1))
+        {
+            const Bc7Block refined = quantizeBc7Block(values, e0, e1);
+            best = refined.mError < best.mError ? refined : best;
+        }
+
+        // the high bit of the first index is implied 0, swapping the endpoints mirrors the indices
+        if (best.mIndices[0] & 8)
+        {
+            std::swap(best.mEndpoint[0], best.mEndpoint[1]);
+            std::swap(best.mPBit[0], best.mPBit[1]);
+            for (uint32_t i = 0; i < 16; i++)
+            {
+                best.mIndices[i] = static_cast<uint8_t>(15 - best.mIndices[i]);
+            }
+        }
+
+        uint64_t bits[2] = {};
+        uint32_t position = 0;
+        auto write = [&bits, &position](uint32_t value, uint32_t count) -> void {
+            for (uint32_t i = 0; i < count; i++, position++)
+            {
+                bits[position / 64] |= static_cast<uint64_t>((value >> i) & 1) << (position % 64);
+            }
+        };
+        write(1 << 6, 7);
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            write(best.mEndpoint[0][c], 7);
+            write(best.mEndpoint[1][c], 7);
+        }
+        write(best.mPBit[0], 1);
+        write(best.mPBit[1], 1);
+        write(best.mIndices[0], 3);
+        for (uint32_t i = 1; i < 16; i++)
+        {
+            write(best.mIndices[i], 4);
+        }
+        writeLittleEndian(block, bits[0], 8);
+        writeLittleEndian(block + 8, bits[1], 8);
+    }
+
+    using BlockEncoder = void(*)(const uint8_t*, uint8_t*);
+
+    struct CompressPass
+    {
+        const Image*    mSource;
+        Image*          mResult;
+        BlockEncoder    mEncoder;
+        uint32_t        mBlockSize;
+    };
+
+    struct BlockRow
+    {
+        const CompressPass* mPass;
+        uint32_t            mLevel;
+        uint32_t            mRow;
+    };
+
+    static void compressRows(BlockRow* rows, unsigned int count)
+    {
+        uint8_t texels[64];
+        for (unsigned int i = 0; i < count; i++)
+        {
+            const CompressPass& pass = *rows[i].mPass;
+            const ImageLevel& level = pass.mSource->getLevel(rows[i].mLevel);
+            const uint8_t* src = pass.mSource->getData(rows[i].mLevel);
+            const uint32_t blocksX = (level.mWidth + 3) / 4;
+            uint8_t* dst = pass.mResult->getData(rows[i].mLevel) + static_cast<size_t>(rows[i].mRow) * blocksX * pass.mBlockSize;
+
+            for (uint32_t bx = 0; bx < blocksX; bx++)
+            {
+                // partial blocks repeat the last row and column
+                for (uint32_t y = 0; y < 4; y++)
+                {
+                    const uint32_t sy = std::min(rows[i].mRow * 4 + y, level.mHeight - 1);
+                    for (uint32_t x = 0; x < 4; x++)
+                    {
+                        const uint32_t sx = std::min(bx * 4 + x, level.mWidth - 1);
+                        std::memcpy(texels + (y * 4 + x) * 4, src + (static_cast<size_t>(sy) * level.mWidth + sx) * 4, 4);
+                    }
+                }
+                pass.mEncoder(texels, dst + bx * pass.mBlockSize);
+            }
+        }
+    }
+
+    Image compressImage(const Image& source, ImageFormat format, JobSystem* jobSystem, uint32_t blockRowsPerJob)
+    {
+        if (source.isCompressed() || !Image::isCompressed(format))
+        {
+            return source;
+        }
+        if (source.isSrgb())
+        {
+            format = format == ImageFormat::BC1_UNORM ? ImageFormat::BC1_SRGB : format == ImageFormat::BC3_UNORM ? ImageFormat::BC3_SRGB :
+                     format == ImageFormat::BC7_UNORM ? ImageFormat::BC7_SRGB : format;
+        }
+
+        Image result(source.getWidth(), source.getHeight(), format, source.getLevelCount());
+        CompressPass pass{};
+        pass.mSource    = &source;
+        pass.mResult    = &result;
+        pass.mBlockSize = Image::getBlockSize(format);
+        switch (format)
+        {
+            case ImageFormat::BC1_UNORM:
+            case ImageFormat::BC1_SRGB:
+                pass.mEncoder = &encodeBC1;
+                break;
+            case ImageFormat::BC3_UNORM:
+            case ImageFormat::BC3_SRGB:
+                pass.mEncoder = &encodeBC3;
+                break;
+            case ImageFormat::BC4_UNORM:
+                pass.mEncoder = &encodeBC4;
+                break;
+            case ImageFormat::BC5_UNORM:
+                pass.mEncoder = &encodeBC5;
+                break;
+            default:
+                pass.mEncoder = &encodeBC7;
+                break;
+        }
+
+        // block rows of every level in one range, small levels do not wait for each other
+        std::vector<BlockRow> rows;
+        for (uint32_t level = 0; level < source.getLevelCount(); level++)
+        {
+            const uint32_t blocksY = (source.getLevel(level).mHeight + 3) / 4;
+            for (uint32_t row = 0; row < blocksY; row++)
+            {
+                rows.push_back({&pass, level, row});
+            }
+        }
+
+        const uint32_t rowCount = static_cast<uint32_t>(rows.size());
+        if (!jobSystem || rowCount <= blockRowsPerJob)
+        {
+            compressRows(rows.data(), rowCount);
+            return result;
+        }
+        Job* root = jobSystem->parallel_for(rows.data(), rowCount, &compressRows, CountSplitter(std::max(blockRowsPerJob, 1u)));
+        jobSystem->wait(jobSystem->run(root));
+        return result;
+    }
+}
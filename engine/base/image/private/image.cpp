@@ -0,0 +1,76 @@
+//
+// Created by 最上川 on 2022/8/30/030.
+//
+
+#include <image.h>
+#include <algorithm>
+
+namespace Base
+{
+    uint32_t Image::getMipCount(uint32_t width, uint32_t height)
+    {
+        uint32_t count = 1;
+        uint32_t size = std::max(width, height);
+        while (size > 1)
+        {
+            size >>= 1;
+            count++;
+        }
+        return count;
+    }
+
+    uint32_t Image::getBlockDimension(ImageFormat format)
+    {
+        return format == ImageFormat::RGBA8_UNORM || format == ImageFormat::RGBA8_SRGB ? 1 : 4;
+    }
+
+    uint32_t Image::getBlockSize(ImageFormat format)
+    {
+        switch (format)
+        {
+            case ImageFormat::RGBA8_UNORM:
+            case ImageFormat::RGBA8_SRGB:
+                return 4;
+            case ImageFormat::BC1_UNORM:
+            case ImageFormat::BC1_SRGB:
+            case ImageFormat::BC4_UNORM:
+                return 8;
+            case ImageFormat::BC3_UNORM:
+            case ImageFormat::BC3_SRGB:
+            case ImageFormat::BC5_UNORM:
+            case ImageFormat::BC7_UNORM:
+            case ImageFormat::BC7_SRGB:
+                return 16;
+            default:
+                return 0;
+        }
+    }
+
+    bool Image::isSrgb(ImageFormat format)
+    {
+        return format == ImageFormat::RGBA8_SRGB || format == ImageFormat::BC1_SRGB || format == ImageFormat::BC3_SRGB || format == ImageFormat::BC7_SRGB;
+    }
+
+    void Image::resize(uint32_t width, uint32_t height, ImageFormat format, uint32_t levelCount)
+    {
+        const uint32_t maxLevels = getMipCount(width, height);
+        levelCount = levelCount == 0 ? maxLevels : std::min(levelCount, maxLevels);
+
+        mFormat = format;
+        mLevels.resize(levelCount);
+        const uint32_t blockDimension = getBlockDimension(format);
+        size_t offset = 0;
+        for (uint32_t i = 0; i < levelCount; i++)
+        {
+            ImageLevel& level = mLevels[i];
+            level.mWidth    = std::max(width >> i, 1u);
+            level.mHeight   = std::max(height >> i, 1u);
+            level.mOffset   = offset;
+            // partial blocks at the right and bottom edge are stored whole
+            level.mSize     = static_cast<size_t>((level.mWidth + blockDimension - 1) / blockDimension) * ((level.mHeight + blockDimension - 1) / blockDimension) *
+                              getBlockSize(format);
+            offset += level.mSize;
+        }
+        mData.resize(offset);
+    }
+}
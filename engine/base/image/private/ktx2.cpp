@@ -0,0 +1,356 @@
+//
+// Created by 最上川 on 2022/8/30/030.
+//
+
+#include <ktx2.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace Base
+{
+    static const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+    // VkFormat values, base does not include vulkan
+    static constexpr uint32_t VK_FORMAT_UNDEFINED_VALUE = 0;
+    static constexpr uint32_t VK_FORMAT_R8G8B8A8_UNORM_VALUE = 37;
+    static constexpr uint32_t VK_FORMAT_R8G8B8A8_SRGB_VALUE = 43;
+    static constexpr uint32_t VK_FORMAT_BC1_RGBA_UNORM_BLOCK_VALUE = 133;
+    static constexpr uint32_t VK_FORMAT_BC1_RGBA_SRGB_BLOCK_VALUE = 134;
+    static constexpr uint32_t VK_FORMAT_BC3_UNORM_BLOCK_VALUE = 137;
+    static constexpr uint32_t VK_FORMAT_BC3_SRGB_BLOCK_VALUE = 138;
+    static constexpr uint32_t VK_FORMAT_BC4_UNORM_BLOCK_VALUE = 139;
+    static constexpr uint32_t VK_FORMAT_BC5_UNORM_BLOCK_VALUE = 141;
+    static constexpr uint32_t VK_FORMAT_BC7_UNORM_BLOCK_VALUE = 145;
+    static constexpr uint32_t VK_FORMAT_BC7_SRGB_BLOCK_VALUE = 146;
+
+    // data format descriptor values, see the Khronos Data Format specification
+    static constexpr uint32_t KHR_DF_MODEL_RGBSDA = 1;
+    static constexpr uint32_t KHR_DF_MODEL_BC1A = 128;
+    static constexpr uint32_t KHR_DF_MODEL_BC3 = 130;
+    static constexpr uint32_t KHR_DF_MODEL_BC4 = 131;
+    static constexpr uint32_t KHR_DF_MODEL_BC5 = 132;
+    static constexpr uint32_t KHR_DF_MODEL_BC7 = 134;
+    static constexpr uint32_t KHR_DF_PRIMARIES_BT709 = 1;
+    static constexpr uint32_t KHR_DF_TRANSFER_LINEAR = 1;
+    static constexpr uint32_t KHR_DF_TRANSFER_SRGB = 2;
+    // channel ids are per color model
+    static constexpr uint32_t KHR_DF_CHANNEL_RGBSDA_RED = 0;
+    static constexpr uint32_t KHR_DF_CHANNEL_RGBSDA_GREEN = 1;
+    static constexpr uint32_t KHR_DF_CHANNEL_RGBSDA_BLUE = 2;
+    static constexpr uint32_t KHR_DF_CHANNEL_RGBSDA_ALPHA = 15;
+    static constexpr uint32_t KHR_DF_CHANNEL_BC1A_COLOR = 0;
+    static constexpr uint32_t KHR_DF_CHANNEL_BC1A_ALPHA = 1;
+    static constexpr uint32_t KHR_DF_CHANNEL_BC3_COLOR = 0;
+    static constexpr uint32_t KHR_DF_CHANNEL_BC3_ALPHA = 15;
+    static constexpr uint32_t KHR_DF_CHANNEL_BC4_DATA = 0;
+    static constexpr uint32_t KHR_DF_CHANNEL_BC5_RED = 0;
+    static constexpr uint32_t KHR_DF_CHANNEL_BC5_GREEN = 1;
+    static constexpr uint32_t KHR_DF_CHANNEL_BC7_COLOR = 0;
+    static constexpr uint32_t KHR_DF_SAMPLE_LINEAR = 0x80;
+
+    struct Ktx2Header
+    {
+        uint8_t     mIdentifier[12];
+        uint32_t    mVkFormat;
+        uint32_t    mTypeSize;
+        uint32_t    mPixelWidth;
+        uint32_t    mPixelHeight;
+        uint32_t    mPixelDepth;
+        uint32_t    mLayerCount;
+        uint32_t    mFaceCount;
+        uint32_t    mLevelCount;
+        uint32_t    mSupercompressionScheme;
+        uint32_t    mDfdByteOffset;
+        uint32_t    mDfdByteLength;
+        uint32_t    mKvdByteOffset;
+        uint32_t    mKvdByteLength;
+        uint64_t    mSgdByteOffset;
+        uint64_t    mSgdByteLength;
+    };
+    static_assert(sizeof(Ktx2Header) == 80, "ktx2 header is 80 bytes");
+
+    struct Ktx2Level
+    {
+        uint64_t    mByteOffset;
+        uint64_t    mByteLength;
+        uint64_t    mUncompressedByteLength;
+    };
+
+    uint32_t getKtx2VkFormat(ImageFormat format)
+    {
+        switch (format)
+        {
+            case ImageFormat::RGBA8_UNORM:
+                return VK_FORMAT_R8G8B8A8_UNORM_VALUE;
+            case ImageFormat::RGBA8_SRGB:
+                return VK_FORMAT_R8G8B8A8_SRGB_VALUE;
+            case ImageFormat::BC1_UNORM:
+                return VK_FORMAT_BC1_RGBA_UNORM_BLOCK_VALUE;
+            case ImageFormat::BC1_SRGB:
+                return VK_FORMAT_BC1_RGBA_SRGB_BLOCK_VALUE;
+            case ImageFormat::BC3_UNORM:
+                return VK_FORMAT_BC3_UNORM_BLOCK_VALUE;
+            case ImageFormat::BC3_SRGB:
+                return VK_FORMAT_BC3_SRGB_BLOCK_VALUE;
+            case ImageFormat::BC4_UNORM:
+                return VK_FORMAT_BC4_UNORM_BLOCK_VALUE;
+            case ImageFormat::BC5_UNORM:
+                return VK_FORMAT_BC5_UNORM_BLOCK_VALUE;
+            case ImageFormat::BC7_UNORM:
+                return VK_FORMAT_BC7_UNORM_BLOCK_VALUE;
+            case ImageFormat::BC7_SRGB:
+                return VK_FORMAT_BC7_SRGB_BLOCK_VALUE;
+            default:
+                return VK_FORMAT_UNDEFINED_VALUE;
+        }
+    }
+
+    static bool getImageFormat(uint32_t vkFormat, ImageFormat& format)
+    {
+        for (uint32_t i = 0; i < static_cast<uint32_t>(ImageFormat::FORMAT_SIZE); i++)
+        {
+            if (getKtx2VkFormat(static_cast<ImageFormat>(i)) == vkFormat)
+            {
+                format = static_cast<ImageFormat>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void appendWord(std::vector<uint8_t>& data, uint32_t word)
+    {
+        const size_t offset = data.size();
+        data.resize(offset + sizeof(word));
+        std::memcpy(data.data() + offset, &word, sizeof(word));
+    }
+
+    struct DfdSample
+    {
+        uint32_t    mChannel;
+        uint32_t    mBitOffset;
+        uint32_t    mBitLength;
+        // alpha, stored linear even in sRGB images
+        bool        mAlpha;
+    };
+
+    struct DfdLayout
+    {
+        uint32_t    mColorModel;
+        uint32_t    mSampleCount;
+        DfdSample   mSamples[4];
+    };
+
+    // samples of one texel block, a byte per channel for RGBA8 and whole blocks for BC
+    static DfdLayout getDfdLayout(ImageFormat format)
+    {
+        switch (format)
+        {
+            case ImageFormat::BC1_UNORM:
+            case ImageFormat::BC1_SRGB:
+                return {KHR_DF_MODEL_BC1A, 2, {{KHR_DF_CHANNEL_BC1A_COLOR, 0, 64, false}, {KHR_DF_CHANNEL_BC1A_ALPHA, 0, 64, true}}};
+            case ImageFormat::BC3_UNORM:
+            case ImageFormat::BC3_SRGB:
+                return {KHR_DF_MODEL_BC3, 2, {{KHR_DF_CHANNEL_BC3_ALPHA, 0, 64, true}, {KHR_DF_CHANNEL_BC3_COLOR, 64, 64, false}}};
+            case ImageFormat::BC4_UNORM:
+                return {KHR_DF_MODEL_BC4, 1, {{KHR_DF_CHANNEL_BC4_DATA, 0, 64, false}}};
+            case ImageFormat::BC5_UNORM:
+                return {KHR_DF_MODEL_BC5, 2, {{KHR_DF_CHANNEL_BC5_RED, 0, 64, false}, {KHR_DF_CHANNEL_BC5_GREEN, 64, 64, false}}};
+            case ImageFormat::BC7_UNORM:
+            case ImageFormat::BC7_SRGB:
+                return {KHR_DF_MODEL_BC7, 1, {{KHR_DF_CHANNEL_BC7_COLOR, 0, 128, false}}};
+            default:
+                return {KHR_DF_MODEL_RGBSDA, 4, {{KHR_DF_CHANNEL_RGBSDA_RED, 0, 8, false}, {KHR_DF_CHANNEL_RGBSDA_GREEN, 8, 8, false},
+                                                 {KHR_DF_CHANNEL_RGBSDA_BLUE, 16, 8, false}, {KHR_DF_CHANNEL_RGBSDA_ALPHA, 24, 8, true}}};
+        }
+    }
+
+    // a basic descriptor block
+    static std::vector<uint8_t> buildDataFormatDescriptor(ImageFormat format)
+    {
+        const bool srgb = Image::isSrgb(format);
+        const bool compressed = Image::isCompressed(format);
+        const DfdLayout layout = getDfdLayout(format);
+        const uint32_t blockSize = 24 + 16 * layout.mSampleCount;
+
+        std::vector<uint8_t> dfd;
+        appendWord(dfd, 4 + blockSize);
+        // vendor khronos, descriptor type basic
+        appendWord(dfd, 0);
+        // version 1.3, block size
+        appendWord(dfd, 2 | (blockSize << 16));
+        appendWord(dfd, layout.mColorModel | (KHR_DF_PRIMARIES_BT709 << 8) | ((srgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR) << 16));
+        // texel block dimensions minus one, bytes of a block in plane 0
+        const uint32_t blockDimension = Image::getBlockDimension(format) - 1;
+        appendWord(dfd, blockDimension | (blockDimension << 8));
+        appendWord(dfd, Image::getBlockSize(format));
+        appendWord(dfd, 0);
+        for (uint32_t i = 0; i < layout.mSampleCount; i++)
+        {
+            const DfdSample& sample = layout.mSamples[i];
+            const uint32_t channel = sample.mChannel | (srgb && sample.mAlpha ? KHR_DF_SAMPLE_LINEAR : 0);
+            appendWord(dfd, sample.mBitOffset | ((sample.mBitLength - 1) << 16) | (channel << 24));
+            appendWord(dfd, 0);
+            appendWord(dfd, 0);
+            appendWord(dfd, compressed ? 0xFFFFFFFF : 255);
+        }
+        return dfd;
+    }
+
+    static size_t alignUp(size_t value, size_t align)
+    {
+        return (value + align - 1) / align * align;
+    }
+
+    bool writeKtx2(const std::string& filename, const Image& image)
+    {
+        const uint32_t vkFormat = getKtx2VkFormat(image.getFormat());
+        if (image.empty() || vkFormat == VK_FORMAT_UNDEFINED_VALUE)
+        {
+            return false;
+        }
+
+        const std::vector<uint8_t> dfd = buildDataFormatDescriptor(image.getFormat());
+        std::vector<uint8_t> kvd;
+        const char writer[] = "KTXwriter\0Homura";
+        appendWord(kvd, sizeof(writer));
+        kvd.insert(kvd.end(), writer, writer + sizeof(writer));
+        kvd.resize(alignUp(kvd.size(), 4), 0);
+
+        const uint32_t levelCount = image.getLevelCount();
+        Ktx2Header header{};
+        std::memcpy(header.mIdentifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+        header.mVkFormat                = vkFormat;
+        header.mTypeSize                = 1;
+        header.mPixelWidth              = image.getWidth();
+        header.mPixelHeight             = image.getHeight();
+        header.mFaceCount               = 1;
+        header.mLevelCount              = levelCount;
+        header.mDfdByteOffset           = static_cast<uint32_t>(sizeof(Ktx2Header) + sizeof(Ktx2Level) * levelCount);
+        header.mDfdByteLength           = static_cast<uint32_t>(dfd.size());
+        header.mKvdByteOffset           = header.mDfdByteOffset + header.mDfdByteLength;
+        header.mKvdByteLength           = static_cast<uint32_t>(kvd.size());
+
+        // mip data goes smallest level first, every level aligned to the texel block size and to 4
+        const size_t blockBytes = Image::getBlockSize(image.getFormat());
+        const size_t levelAlign = blockBytes % 4 == 0 ? blockBytes : blockBytes * 4;
+        std::vector<Ktx2Level> levels(levelCount);
+        size_t offset = header.mKvdByteOffset + header.mKvdByteLength;
+        for (uint32_t i = levelCount; i-- > 0;)
+        {
+            offset = alignUp(offset, levelAlign);
+            levels[i].mByteOffset               = offset;
+            levels[i].mByteLength               = image.getLevel(i).mSize;
+            levels[i].mUncompressedByteLength   = image.getLevel(i).mSize;
+            offset += image.getLevel(i).mSize;
+        }
+
+        std::vector<uint8_t> file(offset, 0);
+        std::memcpy(file.data(), &header, sizeof(header));
+        std::memcpy(file.data() + sizeof(header), levels.data(), sizeof(Ktx2Level) * levelCount);
+        std::memcpy(file.data() + header.mDfdByteOffset, dfd.data(), dfd.size());
+        std::memcpy(file.data() + header.mKvdByteOffset, kvd.data(), kvd.size());
+        for (uint32_t i = 0; i < levelCount; i++)
+        {
+            std::memcpy(file.data() + levels[i].mByteOffset, image.getData(i), image.getLevel(i).mSize);
+        }
+
+        std::ofstream stream(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!stream.is_open())
+        {
+            return false;
+        }
+        stream.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+        return stream.good();
+    }
+
+    // header and level index, checked against what an Image can hold
+    static bool readKtx2Header(std::ifstream& stream, Ktx2Info& info, std::vector<Ktx2Level>& levels)
+    {
+        stream.seekg(0, std::ios::end);
+        const uint64_t fileSize = static_cast<uint64_t>(stream.tellg());
+        stream.seekg(0, std::ios::beg);
+        if (fileSize < sizeof(Ktx2Header))
+        {
+            return false;
+        }
+
+        Ktx2Header header;
+        stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!stream.good() || std::memcmp(header.mIdentifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0 || !getImageFormat(header.mVkFormat, info.mFormat) ||
+            header.mPixelWidth == 0 || header.mPixelHeight == 0 || header.mPixelDepth > 1 || header.mLayerCount > 1 || header.mFaceCount != 1 ||
+            header.mSupercompressionScheme != 0)
+        {
+            return false;
+        }
+
+        // a level count of 0 asks the loader to generate the mips, mip 0 is all there is
+        info.mWidth         = header.mPixelWidth;
+        info.mHeight        = header.mPixelHeight;
+        info.mLevelCount    = std::max(header.mLevelCount, 1u);
+        if (info.mLevelCount > Image::getMipCount(info.mWidth, info.mHeight) || sizeof(Ktx2Header) + sizeof(Ktx2Level) * info.mLevelCount > fileSize)
+        {
+            return false;
+        }
+        levels.resize(info.mLevelCount);
+        stream.read(reinterpret_cast<char*>(levels.data()), static_cast<std::streamsize>(sizeof(Ktx2Level) * info.mLevelCount));
+        if (!stream.good())
+        {
+            return false;
+        }
+
+        // level sizes are what the layout of an Image says, so reads never go past the file
+        const Image layout(info.mWidth, info.mHeight, info.mFormat, info.mLevelCount);
+        for (uint32_t i = 0; i < info.mLevelCount; i++)
+        {
+            const size_t size = layout.getLevel(i).mSize;
+            if (levels[i].mByteLength != size || levels[i].mByteOffset > fileSize || fileSize - levels[i].mByteOffset < size)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool readKtx2Info(const std::string& filename, Ktx2Info& info)
+    {
+        std::ifstream stream(filename, std::ios::in | std::ios::binary);
+        std::vector<Ktx2Level> levels;
+        return stream.is_open() && readKtx2Header(stream, info, levels);
+    }
+
+    bool readKtx2(const std::string& filename, Image& image)
+    {
+        return readKtx2(filename, image, 0);
+    }
+
+    bool readKtx2(const std::string& filename, Image& image, uint32_t firstLevel)
+    {
+        std::ifstream stream(filename, std::ios::in | std::ios::binary);
+        Ktx2Info info;
+        std::vector<Ktx2Level> levels;
+        if (!stream.is_open() || !readKtx2Header(stream, info, levels) || firstLevel >= info.mLevelCount)
+        {
+            return false;
+        }
+
+        const uint32_t levelCount = info.mLevelCount - firstLevel;
+        image.resize(std::max(info.mWidth >> firstLevel, 1u), std::max(info.mHeight >> firstLevel, 1u), info.mFormat, levelCount);
+        if (image.getLevelCount() != levelCount)
+        {
+            return false;
+        }
+        for (uint32_t i = 0; i < levelCount; i++)
+        {
+            const Ktx2Level& level = levels[firstLevel + i];
+            stream.seekg(static_cast<std::streamoff>(level.mByteOffset), std::ios::beg);
+            stream.read(reinterpret_cast<char*>(image.getData(i)), static_cast<std::streamsize>(image.getLevel(i).mSize));
+            if (!stream.good())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,355 @@
+//
+// Created by 最上川 on 2022/8/30/030.
+//
+
+#include <mipGenerator.h>
+#include <jobSystem.h>
+#include <splitter.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HOMURA_MIP_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HOMURA_MIP_NEON 1
+#endif
+
+namespace Base
+{
+    // one RGBA texel of linear floats
+#if defined(HOMURA_MIP_SSE2)
+    using Texel = __m128;
+
+    static inline Texel zeroTexel()                             { return _mm_setzero_ps(); }
+    static inline Texel loadTexel(const float* p)               { return _mm_loadu_ps(p); }
+    static inline void storeTexel(float* p, Texel v)            { _mm_storeu_ps(p, v); }
+    static inline Texel madTexel(Texel acc, Texel v, float w)   { return _mm_add_ps(acc, _mm_mul_ps(v, _mm_set1_ps(w))); }
+#elif defined(HOMURA_MIP_NEON)
+    using Texel = float32x4_t;
+
+    static inline Texel zeroTexel()                             { return vdupq_n_f32(0.0f); }
+    static inline Texel loadTexel(const float* p)               { return vld1q_f32(p); }
+    static inline void storeTexel(float* p, Texel v)            { vst1q_f32(p, v); }
+    static inline Texel madTexel(Texel acc, Texel v, float w)   { return vmlaq_n_f32(acc, v, w); }
+#else
+    struct Texel
+    {
+        float mValue[4];
+    };
+
+    static inline Texel zeroTexel()                             { return {{0.0f, 0.0f, 0.0f, 0.0f}}; }
+    static inline Texel loadTexel(const float* p)               { return {{p[0], p[1], p[2], p[3]}}; }
+    static inline void storeTexel(float* p, Texel v)            { std::memcpy(p, v.mValue, sizeof(v.mValue)); }
+    static inline Texel madTexel(Texel acc, Texel v, float w)
+    {
+        return {{acc.mValue[0] + v.mValue[0] * w, acc.mValue[1] + v.mValue[1] * w, acc.mValue[2] + v.mValue[2] * w, acc.mValue[3] + v.mValue[3] * w}};
+    }
+#endif
+
+    static constexpr uint32_t SRGB_ENCODE_SIZE = 1 << 14;
+    static constexpr double PI = 3.14159265358979323846;
+
+    struct ColorTables
+    {
+        float   mDecode[256];
+        // linear value scaled by SRGB_ENCODE_SIZE - 1 to the sRGB byte
+        uint8_t mEncode[SRGB_ENCODE_SIZE];
+
+        ColorTables()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                const float c = i / 255.0f;
+                mDecode[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            for (uint32_t i = 0; i < SRGB_ENCODE_SIZE; i++)
+            {
+                const float l = static_cast<float>(i) / (SRGB_ENCODE_SIZE - 1);
+                const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                mEncode[i] = static_cast<uint8_t>(std::min(255.0f, c * 255.0f + 0.5f));
+            }
+        }
+    };
+
+    static const ColorTables& getColorTables()
+    {
+        static const ColorTables tables;
+        return tables;
+    }
+
+    // source taps of every destination texel along one axis, weights sum up to 1
+    struct FilterAxis
+    {
+        struct Tap
+        {
+            uint32_t mFirst;
+            uint32_t mCount;
+            uint32_t mWeightOffset;
+        };
+
+        std::vector<Tap>    mTaps;
+        std::vector<float>  mWeights;
+    };
+
+    static double besselI0(double x)
+    {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 32; k++)
+        {
+            const double t = x / (2.0 * k);
+            term *= t * t;
+            sum += term;
+            if (term < sum * 1e-12)
+            {
+                break;
+            }
+        }
+        return sum;
+    }
+
+    static void buildAxis(FilterAxis& axis, uint32_t srcSize, uint32_t dstSize, const MipGeneratorConfig& config)
+    {
+        axis.mTaps.resize(dstSize);
+        axis.mWeights.clear();
+
+        const double scale = static_cast<double>(srcSize) / dstSize;
+        const double radius = config.mFilter == MipFilter::Box ? scale * 0.5 : config.mKaiserRadius * scale * 0.5;
+        const double windowNorm = besselI0(config.mKaiserAlpha);
+        std::vector<double> weights;
+
+        for (uint32_t d = 0; d < dstSize; d++)
+        {
+            const double center = (d + 0.5) * scale;
+            const int32_t first = static_cast<int32_t>(std::floor(center - radius));
+            const int32_t last = static_cast<int32_t>(std::ceil(center + radius)) - 1;
+
+            weights.assign(static_cast<size_t>(last - first + 1), 0.0);
+            double sum = 0.0;
+            for (int32_t s = first; s <= last; s++)
+            {
+                double w = 0.0;
+                if (config.mFilter == MipFilter::Box || scale <= 1.0)
+                {
+                    // coverage of the texel by the destination footprint
+                    w = std::max(0.0, std::min(s + 1.0, center + radius) - std::max(static_cast<double>(s), center - radius));
+                }
+                else
+                {
+                    const double t = s + 0.5 - center;
+                    if (std::abs(t) >= radius)
+                    {
+                        continue;
+                    }
+                    const double x = t / scale;
+                    const double sinc = x == 0.0 ? 1.0 : std::sin(PI * x) / (PI * x);
+                    const double r = t / radius;
+                    w = sinc * besselI0(config.mKaiserAlpha * std::sqrt(1.0 - r * r)) / windowNorm;
+                }
+                weights[s - first] = w;
+                sum += w;
+            }
+
+            // texels past the edge are clamped, their weight goes to the edge texel
+            const int32_t clampedFirst = std::max(first, 0);
+            const int32_t clampedLast = std::min(last, static_cast<int32_t>(srcSize) - 1);
+            FilterAxis::Tap& tap = axis.mTaps[d];
+            tap.mFirst          = static_cast<uint32_t>(clampedFirst);
+            tap.mCount          = static_cast<uint32_t>(clampedLast - clampedFirst + 1);
+            tap.mWeightOffset   = static_cast<uint32_t>(axis.mWeights.size());
+            axis.mWeights.resize(axis.mWeights.size() + tap.mCount, 0.0f);
+            float* tapWeights = axis.mWeights.data() + tap.mWeightOffset;
+            for (int32_t s = first; s <= last; s++)
+            {
+                const int32_t index = std::min(std::max(s, clampedFirst), clampedLast) - clampedFirst;
+                tapWeights[index] += static_cast<float>(weights[s - first] / sum);
+            }
+        }
+    }
+
+    // one level step, rows are split between jobs
+    struct MipPass
+    {
+        const uint8_t*      mSrcBytes;
+        const float*        mSrc;
+        uint32_t            mSrcWidth;
+        // srcHeight rows of dstWidth texels, filtered horizontally
+        float*              mTemp;
+        float*              mDst;
+        uint8_t*            mDstBytes;
+        uint32_t            mDstWidth;
+        const FilterAxis*   mHorizontal;
+        const FilterAxis*   mVertical;
+        bool                mSrgb;
+    };
+
+    struct MipRow
+    {
+        MipPass*    mPass;
+        uint32_t    mRow;
+    };
+
+    static void decodeRows(MipRow* rows, unsigned int count)
+    {
+        const ColorTables& tables = getColorTables();
+        for (unsigned int i = 0; i < count; i++)
+        {
+            const MipPass& pass = *rows[i].mPass;
+            const size_t offset = static_cast<size_t>(rows[i].mRow) * pass.mSrcWidth * 4;
+            const uint8_t* src = pass.mSrcBytes + offset;
+            float* dst = pass.mDst + offset;
+            for (uint32_t x = 0; x < pass.mSrcWidth * 4; x += 4)
+            {
+                dst[x + 0] = pass.mSrgb ? tables.mDecode[src[x + 0]] : src[x + 0] / 255.0f;
+                dst[x + 1] = pass.mSrgb ? tables.mDecode[src[x + 1]] : src[x + 1] / 255.0f;
+                dst[x + 2] = pass.mSrgb ? tables.mDecode[src[x + 2]] : src[x + 2] / 255.0f;
+                dst[x + 3] = src[x + 3] / 255.0f;
+            }
+        }
+    }
+
+    static void filterRowsHorizontal(MipRow* rows, unsigned int count)
+    {
+        for (unsigned int i = 0; i < count; i++)
+        {
+            const MipPass& pass = *rows[i].mPass;
+            const float* src = pass.mSrc + static_cast<size_t>(rows[i].mRow) * pass.mSrcWidth * 4;
+            float* dst = pass.mTemp + static_cast<size_t>(rows[i].mRow) * pass.mDstWidth * 4;
+            for (uint32_t x = 0; x < pass.mDstWidth; x++)
+            {
+                const FilterAxis::Tap& tap = pass.mHorizontal->mTaps[x];
+                const float* weights = pass.mHorizontal->mWeights.data() + tap.mWeightOffset;
+                const float* texel = src + tap.mFirst * 4;
+                Texel sum = zeroTexel();
+                for (uint32_t k = 0; k < tap.mCount; k++)
+                {
+                    sum = madTexel(sum, loadTexel(texel + k * 4), weights[k]);
+                }
+                storeTexel(dst + x * 4, sum);
+            }
+        }
+    }
+
+    static inline uint8_t encodeUnorm(float value)
+    {
+        return static_cast<uint8_t>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+
+    static void filterRowsVertical(MipRow* rows, unsigned int count)
+    {
+        const ColorTables& tables = getColorTables();
+        for (unsigned int i = 0; i < count; i++)
+        {
+            const MipPass& pass = *rows[i].mPass;
+            const uint32_t y = rows[i].mRow;
+            const FilterAxis::Tap& tap = pass.mVertical->mTaps[y];
+            const float* weights = pass.mVertical->mWeights.data() + tap.mWeightOffset;
+            const size_t rowSize = static_cast<size_t>(pass.mDstWidth) * 4;
+            float* dst = pass.mDst + y * rowSize;
+
+            // whole rows at a time, every tap streams through one row of the temp buffer
+            const float* first = pass.mTemp + tap.mFirst * rowSize;
+            for (uint32_t x = 0; x < rowSize; x += 4)
+            {
+                storeTexel(dst + x, madTexel(zeroTexel(), loadTexel(first + x), weights[0]));
+            }
+            for (uint32_t k = 1; k < tap.mCount; k++)
+            {
+                const float* src = pass.mTemp + (tap.mFirst + k) * rowSize;
+                const float w = weights[k];
+                for (uint32_t x = 0; x < rowSize; x += 4)
+                {
+                    storeTexel(dst + x, madTexel(loadTexel(dst + x), loadTexel(src + x), w));
+                }
+            }
+
+            uint8_t* bytes = pass.mDstBytes + y * rowSize;
+            for (uint32_t x = 0; x < rowSize; x += 4)
+            {
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                    const float value = std::min(std::max(dst[x + c], 0.0f), 1.0f);
+                    bytes[x + c] = pass.mSrgb ? tables.mEncode[static_cast<uint32_t>(value * (SRGB_ENCODE_SIZE - 1) + 0.5f)] : encodeUnorm(value);
+                }
+                bytes[x + 3] = encodeUnorm(dst[x + 3]);
+            }
+        }
+    }
+
+    static void runRows(JobSystem* jobSystem, MipRow* rows, uint32_t count, void(*function)(MipRow*, unsigned int), uint32_t rowsPerJob)
+    {
+        if (!jobSystem || count <= rowsPerJob)
+        {
+            function(rows, count);
+            return;
+        }
+        Job* root = jobSystem->parallel_for(rows, count, function, CountSplitter(rowsPerJob));
+        jobSystem->wait(jobSystem->run(root));
+    }
+
+    Image generateMips(const Image& source, const MipGeneratorConfig& config, JobSystem* jobSystem)
+    {
+        // blocks cannot be filtered, compressed images are baked with their mips already
+        if (source.isCompressed())
+        {
+            return source;
+        }
+        const uint32_t width = source.getWidth();
+        const uint32_t height = source.getHeight();
+        Image result(width, height, source.getFormat(), 0);
+        if (source.empty())
+        {
+            return result;
+        }
+        std::memcpy(result.getData(0), source.getData(0), source.getLevel(0).mSize);
+        getColorTables();
+
+        const size_t texelCount = static_cast<size_t>(width) * height;
+        // linear copies of the level being read and the one being written
+        const allocator<float> alloc(MemoryTag::Asset);
+        std::vector<float, allocator<float>> src(texelCount * 4, alloc);
+        std::vector<float, allocator<float>> dst(static_cast<size_t>(std::max(width / 2, 1u)) * std::max(height / 2, 1u) * 4, alloc);
+        std::vector<float, allocator<float>> temp(static_cast<size_t>(height) * std::max(width / 2, 1u) * 4, alloc);
+        std::vector<MipRow> rows(height);
+        FilterAxis horizontal;
+        FilterAxis vertical;
+        const uint32_t rowsPerJob = std::max(config.mRowsPerJob, 1u);
+
+        MipPass pass{};
+        pass.mSrgb      = source.isSrgb();
+        pass.mSrcBytes  = source.getData(0);
+        pass.mDst       = src.data();
+        pass.mSrcWidth  = width;
+        for (uint32_t y = 0; y < height; y++)
+        {
+            rows[y] = {&pass, y};
+        }
+        runRows(jobSystem, rows.data(), height, &decodeRows, rowsPerJob);
+
+        for (uint32_t level = 1; level < result.getLevelCount(); level++)
+        {
+            const ImageLevel& srcLevel = result.getLevel(level - 1);
+            const ImageLevel& dstLevel = result.getLevel(level);
+            buildAxis(horizontal, srcLevel.mWidth, dstLevel.mWidth, config);
+            buildAxis(vertical, srcLevel.mHeight, dstLevel.mHeight, config);
+
+            pass.mSrc           = src.data();
+            pass.mSrcWidth      = srcLevel.mWidth;
+            pass.mTemp          = temp.data();
+            pass.mDst           = dst.data();
+            pass.mDstBytes      = result.getData(level);
+            pass.mDstWidth      = dstLevel.mWidth;
+            pass.mHorizontal    = &horizontal;
+            pass.mVertical      = &vertical;
+
+            // every row of the temp buffer has to be there before the vertical pass reads it
+            runRows(jobSystem, rows.data(), srcLevel.mHeight, &filterRowsHorizontal, rowsPerJob);
+            runRows(jobSystem, rows.data(), dstLevel.mHeight, &filterRowsVertical, rowsPerJob);
+            std::swap(src, dst);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,30 @@
+//
+// Created by 最上川 on 2022/8/31/031.
+//
+
+#ifndef HOMURA_BLOCKCOMPRESSOR_H
+#define HOMURA_BLOCKCOMPRESSOR_H
+#include <image.h>
+
+namespace Base
+{
+    class JobSystem;
+
+    // Encoders of one 4x4 block, texels are RGBA8 row major. Endpoints follow the principal axis of the
+    // block and are refined once by least squares, indices are picked four texels at a time with SIMD.
+    // BC1 uses its 3 color mode with transparent texels when any alpha is below 128. BC7 only
+    // writes mode 6, one RGBA subset with 4 bit indices
+    void encodeBC1(const uint8_t* texels, uint8_t* block);
+    void encodeBC3(const uint8_t* texels, uint8_t* block);
+    // red
+    void encodeBC4(const uint8_t* texels, uint8_t* block);
+    // red and green
+    void encodeBC5(const uint8_t* texels, uint8_t* block);
+    void encodeBC7(const uint8_t* texels, uint8_t* block);
+
+    // Compresses every level of an RGBA8 image to format, an sRGB image to its sRGB variant where the
+    // format has one. With a job system block rows of all levels are encoded in parallel, it must be
+    // called from the thread that owns the job system
+    Image compressImage(const Image& source, ImageFormat format, JobSystem* jobSystem = nullptr, uint32_t blockRowsPerJob = 4);
+}
+#endif //HOMURA_BLOCKCOMPRESSOR_H
@@ -0,0 +1,127 @@
+//
+// Created by 最上川 on 2022/8/30/030.
+//
+
+#ifndef HOMURA_IMAGE_H
+#define HOMURA_IMAGE_H
+#include <allocator.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Base
+{
+    enum class ImageFormat : uint32_t
+    {
+        RGBA8_UNORM = 0,
+        // color channels are sRGB encoded, alpha is linear
+        RGBA8_SRGB,
+        // 4x4 blocks. BC1 is RGB with 1 bit alpha, BC3 adds smooth alpha, BC4 is red only, BC5 red and green,
+        // BC7 is RGBA at the size of BC3 and its quality
+        BC1_UNORM,
+        BC1_SRGB,
+        BC3_UNORM,
+        BC3_SRGB,
+        BC4_UNORM,
+        BC5_UNORM,
+        BC7_UNORM,
+        BC7_SRGB,
+        FORMAT_SIZE
+    };
+
+    struct ImageLevel
+    {
+        uint32_t    mWidth = 0;
+        uint32_t    mHeight = 0;
+        // into the data of the image
+        size_t      mOffset = 0;
+        size_t      mSize = 0;
+    };
+
+    // A 2D image with its mip chain, levels are tightly packed one after another starting at mip 0.
+    // Levels of block compressed formats are whole blocks, rows of blocks top to bottom
+    class Image
+    {
+    public:
+        Image() = default;
+        Image(uint32_t width, uint32_t height, ImageFormat format, uint32_t levelCount = 1)
+        {
+            resize(width, height, format, levelCount);
+        }
+
+        // lays out levelCount levels, 0 means the full chain down to 1x1. Contents are undefined
+        void resize(uint32_t width, uint32_t height, ImageFormat format, uint32_t levelCount = 1);
+
+        // full chain length of a width x height image
+        static uint32_t getMipCount(uint32_t width, uint32_t height);
+        // texels along either side of a block, 1 for uncompressed formats, and the bytes of one block
+        static uint32_t getBlockDimension(ImageFormat format);
+        static uint32_t getBlockSize(ImageFormat format);
+        static bool isCompressed(ImageFormat format)
+        {
+            return getBlockDimension(format) > 1;
+        }
+        static bool isSrgb(ImageFormat format);
+
+        uint8_t* getData(uint32_t level = 0)
+        {
+            return mData.data() + mLevels[level].mOffset;
+        }
+
+        const uint8_t* getData(uint32_t level = 0) const
+        {
+            return mData.data() + mLevels[level].mOffset;
+        }
+
+        const ImageLevel& getLevel(uint32_t level) const
+        {
+            return mLevels[level];
+        }
+
+        uint32_t getLevelCount() const
+        {
+            return static_cast<uint32_t>(mLevels.size());
+        }
+
+        uint32_t getWidth() const
+        {
+            return mLevels.empty() ? 0 : mLevels[0].mWidth;
+        }
+
+        uint32_t getHeight() const
+        {
+            return mLevels.empty() ? 0 : mLevels[0].mHeight;
+        }
+
+        ImageFormat getFormat() const
+        {
+            return mFormat;
+        }
+
+        bool isSrgb() const
+        {
+            return isSrgb(mFormat);
+        }
+
+        bool isCompressed() const
+        {
+            return isCompressed(mFormat);
+        }
+
+        size_t getSize() const
+        {
+            return mData.size();
+        }
+
+        bool empty() const
+        {
+            return mLevels.empty();
+        }
+    private:
+        ImageFormat                 mFormat = ImageFormat::RGBA8_UNORM;
+        std::vector<ImageLevel>     mLevels;
+        // counted as asset memory, with every level the readers, mip generator and compressor fill
+        std::vector<uint8_t, allocator<uint8_t>> mData{allocator<uint8_t>(MemoryTag::Asset)};
+    };
+}
+#endif //HOMURA_IMAGE_H
@@ -0,0 +1,36 @@
+//
+// Created by 最上川 on 2022/8/30/030.
+//
+
+#ifndef HOMURA_KTX2_H
+#define HOMURA_KTX2_H
+#include <image.h>
+#include <string>
+
+namespace Base
+{
+    // KTX 2.0 files of one 2D image and its mips, without supercompression. The vkFormat of the file
+    // is the Vulkan format of the image, so levels go to the GPU as they are
+    bool writeKtx2(const std::string& filename, const Image& image);
+    // false if the file is not KTX 2.0 or uses a format, array layers, cube faces, depth or
+    // supercompression an Image cannot hold
+    bool readKtx2(const std::string& filename, Image& image);
+    // Only levels firstLevel and up, level 0 of image is level firstLevel of the file. The data of
+    // the other levels is never read, streaming loads the small end of a chain first this way
+    bool readKtx2(const std::string& filename, Image& image, uint32_t firstLevel);
+
+    struct Ktx2Info
+    {
+        uint32_t    mWidth = 0;
+        uint32_t    mHeight = 0;
+        uint32_t    mLevelCount = 0;
+        ImageFormat mFormat = ImageFormat::RGBA8_UNORM;
+    };
+
+    // the header of a file that readKtx2() accepts, without reading any level
+    bool readKtx2Info(const std::string& filename, Ktx2Info& info);
+
+    // the VkFormat value a file of this format is tagged with
+    uint32_t getKtx2VkFormat(ImageFormat format);
+}
+#endif //HOMURA_KTX2_H
@@ -0,0 +1,38 @@
+//
+// Created by 最上川 on 2022/8/30/030.
+//
+
+#ifndef HOMURA_MIPGENERATOR_H
+#define HOMURA_MIPGENERATOR_H
+#include <image.h>
+
+namespace Base
+{
+    class JobSystem;
+
+    enum class MipFilter : uint32_t
+    {
+        // area average, exact for odd sizes as well
+        Box = 0,
+        // Kaiser windowed sinc, keeps detail the box blurs away at the cost of slight ringing
+        Kaiser
+    };
+
+    struct MipGeneratorConfig
+    {
+        MipFilter   mFilter = MipFilter::Kaiser;
+        // half width of the Kaiser window in source texels of a 2:1 step, and its shape. A larger alpha
+        // rings less and blurs more
+        float       mKaiserRadius = 3.0f;
+        float       mKaiserAlpha = 4.0f;
+        // rows filtered by one job
+        uint32_t    mRowsPerJob = 16;
+    };
+
+    // Returns source with its full mip chain, every level filtered from the one above it. Filtering
+    // runs on linear values: sRGB color is decoded first and encoded again per level, alpha is linear.
+    // With a job system the rows of a level are filtered in parallel, it must be called from the thread
+    // that owns the job system. Only mip 0 of source is read, block compressed sources come back as they are
+    Image generateMips(const Image& source, const MipGeneratorConfig& config = MipGeneratorConfig{}, JobSystem* jobSystem = nullptr);
+}
+#endif //HOMURA_MIPGENERATOR_H
@@ -0,0 +1,130 @@
+//
+// Created by 最上川 on 2022/8/14/014.
+//
+
+#include <jobGraph.h>
+#include <cassert>
+
+namespace Base
+{
+    JobGraph::JobGraph(JobSystem* system)
+        : mSystem{system}
+    {
+
+    }
+
+    JobGraph::Node JobGraph::addNode(JobFunction function)
+    {
+        GraphNode node{};
+        node.mFunction = function;
+        mNodes.push_back(node);
+        return static_cast<Node>(mNodes.size() - 1);
+    }
+
+    void JobGraph::addDependency(Node before, Node after)
+    {
+        assert(before < mNodes.size() && after < mNodes.size() && before != after);
+        mEdges.emplace_back(before, after);
+    }
+
+    JobHandle JobGraph::submit()
+    {
+        assert(isAcyclic() && "job graph has a cycle");
+
+        // every node is a child of the root, so waiting on the root waits for the whole graph
+        Job* root = mSystem->createJob(nullptr, &JobGraph::emptyJob);
+        mJobs.resize(mNodes.size());
+        for (size_t i = 0; i < mNodes.size(); i++)
+        {
+            Job* job = mSystem->createJob(root, mNodes[i].mFunction);
+            std::memcpy(job->mData, mNodes[i].mData, JOB_DATA_SIZE);
+            mJobs[i] = job;
+        }
+
+        // wire all edges before anything runs, an ancestor must not finish while it is being extended
+        std::vector<bool> dependent(mNodes.size(), false);
+        std::vector<std::vector<Node>> successors(mNodes.size());
+        for (auto& edge : mEdges)
+        {
+            successors[edge.first].push_back(edge.second);
+            dependent[edge.second] = true;
+        }
+        for (size_t i = 0; i < mNodes.size(); i++)
+        {
+            // a job holds MAX_CONTINUATION_COUNT continuations, wider fan-outs hand the rest to empty relay jobs
+            Job* ancestor = mJobs[i];
+            size_t next = 0;
+            while (successors[i].size() - next > MAX_CONTINUATION_COUNT)
+            {
+                for (size_t k = 0; k + 1 < MAX_CONTINUATION_COUNT; k++)
+                {
+                    mSystem->addContinuation(ancestor, mJobs[successors[i][next++]]);
+                }
+                Job* relay = mSystem->createJob(root, &JobGraph::emptyJob);
+                mSystem->addContinuation(ancestor, relay);
+                ancestor = relay;
+            }
+            for (; next < successors[i].size(); next++)
+            {
+                mSystem->addContinuation(ancestor, mJobs[successors[i][next]]);
+            }
+        }
+
+        // the dependency counters can not be read here, sources already running may be decrementing them
+        for (size_t i = 0; i < mJobs.size(); i++)
+        {
+            if (!dependent[i])
+            {
+                mSystem->run(mJobs[i]);
+            }
+        }
+        return mSystem->run(root);
+    }
+
+    void JobGraph::clear()
+    {
+        mNodes.clear();
+        mEdges.clear();
+        mJobs.clear();
+    }
+
+    bool JobGraph::isAcyclic() const
+    {
+        // Kahn's algorithm, every node is visited exactly when the graph has no cycle
+        std::vector<uint32_t> inDegree(mNodes.size(), 0);
+        for (auto& edge : mEdges)
+        {
+            inDegree[edge.second]++;
+        }
+
+        std::vector<Node> ready;
+        for (Node i = 0; i < mNodes.size(); i++)
+        {
+            if (inDegree[i] == 0)
+            {
+                ready.push_back(i);
+            }
+        }
+
+        size_t visited = 0;
+        while (!ready.empty())
+        {
+            const Node node = ready.back();
+            ready.pop_back();
+            visited++;
+            for (auto& edge : mEdges)
+            {
+                if (edge.first == node && --inDegree[edge.second] == 0)
+                {
+                    ready.push_back(edge.second);
+                }
+            }
+        }
+        return visited == mNodes.size();
+    }
+
+    void JobGraph::emptyJob(Job*, const void*)
+    {
+
+    }
+}
@@ -0,0 +1,37 @@
+//
+// Created by 最上川 on 2022/8/15/015.
+//
+
+#include <jobSemaphore.h>
+
+namespace Base
+{
+    JobSemaphore::JobSemaphore(int count)
+        : mCount{count}
+    {
+
+    }
+
+    void JobSemaphore::signal(int count)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mCount += count;
+        }
+
+        // one notify per permit, notify_all would wake sleepers that find nothing to take
+        for (int i = 0; i < count; i++)
+        {
+            mCv.notify_one();
+        }
+    }
+
+    void JobSemaphore::wait()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCv.wait(lock, [this] {
+            return mCount > 0;
+        });
+        mCount--;
+    }
+}
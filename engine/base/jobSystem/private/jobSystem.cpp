@@ -5,23 +5,75 @@
 #include <jobSystem.h>
 #include <allocator.h>
 #include <workStealQueue.h>
+#include <profiler.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
 
 namespace Base
 {
+    // worker owned by the calling thread, only that thread may push to or pop from its queue
+    static thread_local JobWorker* sCurrentWorker = nullptr;
+
+    static inline void cpuRelax()
+    {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
     template<typename TYPE, size_t COUNT>
-    Worker<TYPE, COUNT>::Worker()
+    Worker<TYPE, COUNT>::Worker(JobSystem* system, uint32_t id)
+        : mSystem{system}
+        , mPool{nullptr}
+        , mFreeList{nullptr}
+        , mRemoteFreeList{nullptr}
+        , mId{id}
+        , mRandom{0x9E3779B9u * (id + 1)}
+        , mSpinCount{0}
+        , mYieldCount{0}
+        , mParkCount{0}
+        , mStealCount{0}
     {
         mQueue = std::make_shared<WorkQueue>();
-        mAllocator = std::make_shared<allocator<TYPE>>();
+        mAllocator = std::make_shared<allocator<TYPE>>(MemoryTag::JobSystem);
         mPool = mAllocator->allocate(COUNT);
-        mThread = std::thread(&Worker::execute, this);
-        mIndex = -1;
+        for (size_t i = COUNT; i-- > 0;)
+        {
+            TYPE* job = new (&mPool[i]) TYPE();
+            job->mGeneration.store(0, std::memory_order_relaxed);
+            job->mOwner = id;
+            job->mNext = mFreeList;
+            mFreeList = job;
+        }
     }
 
     template<typename TYPE, size_t COUNT>
     Worker<TYPE, COUNT>::~Worker()
     {
+        join();
+        for (size_t i = 0; i < COUNT; i++)
+        {
+            mPool[i].~TYPE();
+        }
         mAllocator->deallocate(mPool);
+    }
+
+    template<typename TYPE, size_t COUNT>
+    void Worker<TYPE, COUNT>::start()
+    {
+        mThread = std::thread(&Worker::execute, this);
+    }
+
+    template<typename TYPE, size_t COUNT>
+    void Worker<TYPE, COUNT>::join()
+    {
         if (mThread.joinable())
         {
             mThread.join();
@@ -31,18 +83,66 @@ namespace Base
     template<typename TYPE, size_t COUNT>
     TYPE* Worker<TYPE, COUNT>::createJob()
     {
-        mIndex++;
-        return &mPool[mIndex & (COUNT - 1u)];
+        if (!mFreeList)
+        {
+            mFreeList = mRemoteFreeList.exchange(nullptr, std::memory_order_acquire);
+        }
+
+        TYPE* job = mFreeList;
+        if (job)
+        {
+            mFreeList = job->mNext;
+        }
+        return job;
     }
 
     template<typename TYPE, size_t COUNT>
-    void Worker<TYPE,COUNT>::run(Job* job)
+    void Worker<TYPE, COUNT>::release(TYPE* job)
+    {
+        job->mGeneration.fetch_add(1, std::memory_order_release);
+        if (job->mOwner == mId)
+        {
+            job->mNext = mFreeList;
+            mFreeList = job;
+        }
+        else if (job->mOwner == OVERFLOW_JOB_OWNER)
+        {
+            mSystem->releaseOverflowJob(job);
+        }
+        else
+        {
+            // only the owner ever pops and it always takes the whole list, so there is no ABA here
+            std::atomic<TYPE*>& list = mSystem->mWorker[job->mOwner]->mRemoteFreeList;
+            TYPE* head = list.load(std::memory_order_relaxed);
+            do
+            {
+                job->mNext = head;
+            } while (!list.compare_exchange_weak(head, job, std::memory_order_release, std::memory_order_relaxed));
+        }
+    }
+
+    template<typename TYPE, size_t COUNT>
+    void Worker<TYPE,COUNT>::run(TYPE* job)
     {
         assert(job);
-        size_t index = job - mPool;
-        assert(index >= 0 && index < MAX_JOB_COUNT);
-        mQueue->push(index);
-        mCv.notify_one();
+        if (getLoad() >= COUNT)
+        {
+            // the deque is full, running inline is better than overwriting a queued job
+            {
+                PROFILE_ZONE("job");
+                (job->mFunction)(job, job->mData);
+            }
+            finish(job);
+            return;
+        }
+        mQueue->push(job);
+        // seq_cst pairs with idle(), either the sleeper sees the job or we see the sleeper
+        mSystem->mPendingJobs.fetch_add(1, std::memory_order_seq_cst);
+        mSystem->wake(1);
+        if (mSystem->mWaiting.load(std::memory_order_seq_cst) > 0)
+        {
+            mSystem->notifyWaiters();
+        }
     }
 
     template<typename TYPE, size_t COUNT>
@@ -52,17 +152,51 @@ namespace Base
     }
 
     template<typename TYPE, size_t COUNT>
-    bool Worker<TYPE, COUNT>::loop()
+    uint32_t Worker<TYPE, COUNT>::random()
+    {
+        // xorshift32
+        uint32_t x = mRandom;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        mRandom = x;
+        return x;
+    }
+
+    template<typename TYPE, size_t COUNT>
+    TYPE* Worker<TYPE, COUNT>::getJob()
     {
         TYPE* job = mQueue->pop();
         if (!job)
         {
-            job = mQueue->steal();
+            JobWorker* victim = mSystem->selectVictim(this);
+            if (victim)
+            {
+                job = victim->mQueue->steal();
+                if (job)
+                {
+                    mStealCount.store(mStealCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                }
+            }
         }
 
         if (job)
         {
-            (job->mFunction)(job, job->mData);
+            mSystem->mPendingJobs.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    template<typename TYPE, size_t COUNT>
+    bool Worker<TYPE, COUNT>::loop()
+    {
+        TYPE* job = getJob();
+        if (job)
+        {
+            {
+                PROFILE_ZONE("job");
+                (job->mFunction)(job, job->mData);
+            }
             finish(job);
         }
         return job != nullptr;
@@ -71,97 +205,378 @@ namespace Base
     template<typename TYPE, size_t COUNT>
     void Worker<TYPE, COUNT>::finish(TYPE* job)
     {
-        int unfinished = job->mUnfinishedJobs.fetch_sub(1, std::memory_order_acquire);
+        const int unfinished = job->mUnfinishedJobs.fetch_sub(1, std::memory_order_acq_rel) - 1;
         if (unfinished == 0)
         {
-            if (job->mParent)
+            const int count = job->mContinuationCount.load(std::memory_order_acquire);
+            for (int i = 0; i < count; i++)
+            {
+                TYPE* continuation = job->mContinuations[i];
+                if (continuation->mDependencyCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    run(continuation);
+                }
+            }
+
+            const bool root = job->mParent == nullptr;
+            if (!root)
             {
                 finish(job->mParent);
             }
+            release(job);
+
+            // only root jobs are waited on. The read modify write sees the latest count, so either
+            // the waiter sees this job finished or we see the waiter
+            if (root && mSystem->mWaiting.fetch_add(0, std::memory_order_acq_rel) > 0)
+            {
+                mSystem->notifyWaiters();
+            }
         }
-        // delete job
     }
 
     template<typename TYPE, size_t COUNT>
     void Worker<TYPE, COUNT>::execute()
     {
-        while(!mExit.load())
+        sCurrentWorker = this;
+        PROFILE_THREAD("job worker " + std::to_string(mId));
+        while (!mSystem->mExit.load(std::memory_order_acquire))
         {
             if (!loop())
             {
-                // wait
-                std::unique_lock<std::mutex> lock(mMutex);
-                mCv.wait(lock);
+                mSystem->idle(this);
             }
         }
+        sCurrentWorker = nullptr;
     }
 
-    JobSystem::JobSystem()
+    JobSystem::JobSystem(uint32_t threadCount, const JobIdleConfig& idleConfig)
+        : mIdleConfig{idleConfig}
+        , mSleeping{0}
+        , mPendingJobs{0}
+        , mExit{false}
+        , mWakeCount{0}
+        , mWakeBatchCount{0}
+        , mWaiting{0}
+        , mOverflowFreeList{nullptr}
     {
-        int threadCounts = std::thread::hardware_concurrency() - 1;
-        for (int i = 0; i < threadCounts; i++)
+        if (threadCount == 0)
+        {
+            threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+        }
+
+        // worker 0 belongs to the calling thread
+        for (uint32_t i = 0; i <= threadCount; i++)
+        {
+            mWorker.push_back(new JobWorker(this, i));
+        }
+        sCurrentWorker = mWorker[0];
+
+        // every queue has to exist before anyone starts stealing
+        for (uint32_t i = 1; i <= threadCount; i++)
+        {
+            mWorker[i]->start();
+        }
+    }
+
+    JobSystem::~JobSystem()
+    {
+        mExit.store(true, std::memory_order_seq_cst);
+        wake(static_cast<int>(mWorker.size()));
+
+        for (auto& worker : mWorker)
+        {
+            worker->join();
+        }
+
+        if (sCurrentWorker && sCurrentWorker->mSystem == this)
+        {
+            sCurrentWorker = nullptr;
+        }
+
+        for (auto& worker : mWorker)
         {
-            JobWorker* worker{};
-            mWorker.push_back(worker);
+            delete worker;
         }
+        mWorker.clear();
+
+        allocator<Job> alloc(MemoryTag::JobSystem);
+        for (auto& block : mOverflowBlocks)
+        {
+            for (size_t i = 0; i < OVERFLOW_JOB_COUNT; i++)
+            {
+                block[i].~Job();
+            }
+            alloc.deallocate(block);
+        }
+        mOverflowBlocks.clear();
+    }
+
+    Job* JobSystem::createJob(JobFunction function)
+    {
+        return createJob(nullptr, function);
     }
 
     Job* JobSystem::createJob(Base::Job* parent, Base::JobFunction function)
     {
-        // 选择负载最小的worker, 在其上面创建任务
-        JobWorker* worker = selectMinLoadWorker();
+        JobWorker* worker = getCurrentWorker();
         Job* job = worker->createJob();
+        if (job == nullptr)
+        {
+            job = createOverflowJob();
+        }
+        job->mGeneration.fetch_add(1, std::memory_order_relaxed);
         if (parent != nullptr)
         {
             parent->mUnfinishedJobs.fetch_add(1, std::memory_order_relaxed);
-            job->mParent = parent;
         }
         job->mFunction = function;
-        job->mUnfinishedJobs = 1;
-        worker->run(job);
+        job->mParent = parent;
+        job->mUnfinishedJobs.store(1, std::memory_order_relaxed);
+        job->mContinuationCount.store(0, std::memory_order_relaxed);
+        job->mDependencyCount.store(0, std::memory_order_relaxed);
         return job;
     }
 
-    JobWorker* JobSystem::selectMinLoadWorker()
+    void JobSystem::addContinuation(Job* ancestor, Job* continuation)
+    {
+        assert(ancestor && continuation && ancestor != continuation);
+        assert((ancestor->mGeneration.load(std::memory_order_relaxed) & 1u) && "ancestor has already been released");
+        assert(ancestor->mUnfinishedJobs.load(std::memory_order_relaxed) > 0 && "ancestor has already finished");
+        const int index = ancestor->mContinuationCount.fetch_add(1, std::memory_order_relaxed);
+        if (index >= static_cast<int>(MAX_CONTINUATION_COUNT))
+        {
+            // past mContinuations lies the rest of the job, fail in release builds too
+            std::cerr << "a job has more than " << MAX_CONTINUATION_COUNT << " continuations" << std::endl;
+            std::abort();
+        }
+        continuation->mDependencyCount.fetch_add(1, std::memory_order_relaxed);
+        ancestor->mContinuations[index] = continuation;
+    }
+
+    JobWorker* JobSystem::getCurrentWorker()
     {
-        JobWorker* worker = mWorker[0];
-        for (int i = 1; i < mWorker.size(); i++)
+        assert(sCurrentWorker && sCurrentWorker->mSystem == this && "jobs can only be created and run from a worker thread");
+        return sCurrentWorker;
+    }
+
+    JobWorker* JobSystem::selectVictim(JobWorker* thief)
+    {
+        const uint32_t count = static_cast<uint32_t>(mWorker.size());
+        if (count < 2)
         {
-            if (mWorker[i]->getLoad() < worker->getLoad())
+            return nullptr;
+        }
+
+        // pick uniformly among the other workers
+        uint32_t index = thief->random() % (count - 1);
+        if (index >= thief->mId)
+        {
+            index++;
+        }
+        return mWorker[index];
+    }
+
+    Job* JobSystem::createOverflowJob()
+    {
+        std::lock_guard<std::mutex> lock(mOverflowMutex);
+        if (!mOverflowFreeList)
+        {
+            allocator<Job> alloc(MemoryTag::JobSystem);
+            Job* block = alloc.allocate(OVERFLOW_JOB_COUNT);
+            for (size_t i = OVERFLOW_JOB_COUNT; i-- > 0;)
             {
-                worker = mWorker[i];
-                break;
+                Job* job = new (&block[i]) Job();
+                job->mGeneration.store(0, std::memory_order_relaxed);
+                job->mOwner = OVERFLOW_JOB_OWNER;
+                job->mNext = mOverflowFreeList;
+                mOverflowFreeList = job;
             }
+            mOverflowBlocks.push_back(block);
         }
-        return worker;
+
+        Job* job = mOverflowFreeList;
+        mOverflowFreeList = job->mNext;
+        return job;
     }
 
-    Job *JobSystem::getJob()
+    void JobSystem::releaseOverflowJob(Job* job)
     {
-        return nullptr;
+        std::lock_guard<std::mutex> lock(mOverflowMutex);
+        job->mNext = mOverflowFreeList;
+        mOverflowFreeList = job;
     }
 
-    bool JobSystem::hasCompleted(Job *job)
+    void JobSystem::wake(int count)
     {
-        return job->mUnfinishedJobs.load(std::memory_order_acquire) <= 0;
+        // claim sleepers before signalling, so one parked worker never gets two permits
+        int sleeping = mSleeping.load(std::memory_order_seq_cst);
+        while (sleeping > 0 && count > 0)
+        {
+            const int batch = std::min(sleeping, count);
+            if (mSleeping.compare_exchange_weak(sleeping, sleeping - batch, std::memory_order_seq_cst))
+            {
+                mSemaphore.signal(batch);
+                mWakeCount.fetch_add(batch, std::memory_order_relaxed);
+                mWakeBatchCount.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
     }
 
-    void JobSystem::run(Job *job)
+    void JobSystem::idle(JobWorker* worker)
     {
+        auto hasWork = [this] {
+            return mPendingJobs.load(std::memory_order_seq_cst) > 0 || mExit.load(std::memory_order_seq_cst);
+        };
+        auto count = [](std::atomic<uint64_t>& counter) {
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        };
+
+        for (uint32_t i = 0; i < mIdleConfig.mSpinCount; i++)
+        {
+            if (hasWork())
+            {
+                count(worker->mSpinCount);
+                return;
+            }
+            cpuRelax();
+        }
+
+        for (uint32_t i = 0; i < mIdleConfig.mYieldCount; i++)
+        {
+            if (hasWork())
+            {
+                count(worker->mYieldCount);
+                return;
+            }
+            std::this_thread::yield();
+        }
 
+        mSleeping.fetch_add(1, std::memory_order_seq_cst);
+        if (hasWork())
+        {
+            // take ourselves back unless a waker has already claimed us, then its permit is ours
+            int sleeping = mSleeping.load(std::memory_order_seq_cst);
+            while (sleeping > 0 && !mSleeping.compare_exchange_weak(sleeping, sleeping - 1, std::memory_order_seq_cst))
+            {
+            }
+            if (sleeping > 0)
+            {
+                count(worker->mSpinCount);
+                return;
+            }
+        }
+
+        count(worker->mParkCount);
+        mSemaphore.wait();
+
+        // a single push wakes a single worker, pull in helpers for whatever piled up meanwhile
+        const int pending = mPendingJobs.load(std::memory_order_relaxed);
+        if (pending > 1)
+        {
+            wake(pending - 1);
+        }
     }
 
-    void JobSystem::wait(Job *job)
+    void JobSystem::notifyWaiters()
     {
-        while (!hasCompleted(job))
         {
+            std::lock_guard<std::mutex> lock(mWaitMutex);
+        }
+        mWaitCv.notify_all();
+    }
+
+    JobSystemStats JobSystem::getStats() const
+    {
+        JobSystemStats stats;
+        for (auto& worker : mWorker)
+        {
+            stats.mSpinCount += worker->mSpinCount.load(std::memory_order_relaxed);
+            stats.mYieldCount += worker->mYieldCount.load(std::memory_order_relaxed);
+            stats.mParkCount += worker->mParkCount.load(std::memory_order_relaxed);
+            stats.mStealCount += worker->mStealCount.load(std::memory_order_relaxed);
+        }
+        stats.mWakeCount = mWakeCount.load(std::memory_order_relaxed);
+        stats.mWakeBatchCount = mWakeBatchCount.load(std::memory_order_relaxed);
+        return stats;
+    }
 
+    void JobSystem::resetStats()
+    {
+        for (auto& worker : mWorker)
+        {
+            worker->mSpinCount.store(0, std::memory_order_relaxed);
+            worker->mYieldCount.store(0, std::memory_order_relaxed);
+            worker->mParkCount.store(0, std::memory_order_relaxed);
+            worker->mStealCount.store(0, std::memory_order_relaxed);
         }
+        mWakeCount.store(0, std::memory_order_relaxed);
+        mWakeBatchCount.store(0, std::memory_order_relaxed);
+    }
+
+    uint32_t JobSystem::getCurrentWorkerIndex()
+    {
+        return getCurrentWorker()->mId;
+    }
+
+    Job *JobSystem::getJob()
+    {
+        return getCurrentWorker()->getJob();
+    }
+
+    bool JobSystem::hasCompleted(const JobHandle& handle)
+    {
+        // a new generation means the job finished and its slot has been reused since
+        Job* job = handle.mJob;
+        return job->mGeneration.load(std::memory_order_acquire) != handle.mGeneration ||
+               job->mUnfinishedJobs.load(std::memory_order_acquire) <= 0;
+    }
+
+    JobHandle JobSystem::run(Job *job)
+    {
+        assert(job->mDependencyCount.load(std::memory_order_relaxed) == 0 && "continuations are scheduled by their ancestors");
+        // the generation has to be read before the job can finish
+        const uint32_t generation = job->mGeneration.load(std::memory_order_relaxed);
+        assert((generation & 1u) && "stale job, it has already been released");
+        getCurrentWorker()->run(job);
+        return JobHandle{job, generation};
     }
 
-    template<typename T, typename S>
-    Job *JobSystem::parallel_for(T *data, unsigned int count, void (*f)(T *, unsigned int), const S &splitter)
+    void JobSystem::wait(const JobHandle& handle)
     {
-        return nullptr;
+        // help out instead of spinning, the job we wait on may sit in our own queue.
+        // Without work the same spin, yield, park backoff as idle() applies
+        JobWorker* worker = getCurrentWorker();
+        uint32_t idleRound = 0;
+        while (!hasCompleted(handle))
+        {
+            if (worker->loop())
+            {
+                idleRound = 0;
+            }
+            else if (idleRound < mIdleConfig.mSpinCount)
+            {
+                idleRound++;
+                cpuRelax();
+            }
+            else if (idleRound < mIdleConfig.mSpinCount + mIdleConfig.mYieldCount)
+            {
+                idleRound++;
+                std::this_thread::yield();
+            }
+            else
+            {
+                worker->mParkCount.store(worker->mParkCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                mWaiting.fetch_add(1, std::memory_order_acq_rel);
+                {
+                    std::unique_lock<std::mutex> lock(mWaitMutex);
+                    mWaitCv.wait(lock, [this, &handle] {
+                        return hasCompleted(handle) || mPendingJobs.load(std::memory_order_seq_cst) > 0;
+                    });
+                }
+                mWaiting.fetch_sub(1, std::memory_order_relaxed);
+                idleRound = 0;
+            }
+        }
     }
-}
\ No newline at end of file
+}
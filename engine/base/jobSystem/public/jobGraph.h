@@ -0,0 +1,64 @@
+//
+// Created by 最上川 on 2022/8/14/014.
+//
+
+#ifndef HOMURA_JOBGRAPH_H
+#define HOMURA_JOBGRAPH_H
+#include <jobSystem.h>
+#include <utility>
+
+namespace Base
+{
+    // Describes a set of jobs and the order between them, then hands it to the job system as
+    // continuations. A node runs as soon as all nodes it depends on have finished, nothing polls.
+    // The graph can be submitted again every frame.
+    class JobGraph
+    {
+    public:
+        using Node = uint32_t;
+
+        explicit JobGraph(JobSystem* system);
+
+        Node addNode(JobFunction function);
+        template<typename T>
+        Node addNode(JobFunction function, const T& data);
+        // after runs once before and all its children have finished
+        void addDependency(Node before, Node after);
+
+        // Creates the jobs of all nodes and runs those without dependencies.
+        // The returned job completes when every node has finished, wait() on it.
+        JobHandle submit();
+        void clear();
+        size_t getNodeCount() const
+        {
+            return mNodes.size();
+        }
+    private:
+        struct GraphNode
+        {
+            JobFunction mFunction;
+            char        mData[JOB_DATA_SIZE];
+        };
+
+        bool isAcyclic() const;
+        // the root and the relays of wide fan-outs
+        static void emptyJob(Job* job, const void* jobData);
+    private:
+        JobSystem*                          mSystem;
+        std::vector<GraphNode>              mNodes;
+        std::vector<std::pair<Node, Node>>  mEdges;
+        std::vector<Job*>                   mJobs;
+    };
+
+    template<typename T>
+    JobGraph::Node JobGraph::addNode(JobFunction function, const T& data)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "job data must be trivially copyable");
+        static_assert(sizeof(T) <= JOB_DATA_SIZE, "job data exceeds the job payload");
+        const Node node = addNode(function);
+        std::memcpy(mNodes[node].mData, &data, sizeof(T));
+        return node;
+    }
+}
+
+#endif //HOMURA_JOBGRAPH_H
@@ -0,0 +1,30 @@
+//
+// Created by 最上川 on 2022/8/15/015.
+//
+
+#ifndef HOMURA_JOBSEMAPHORE_H
+#define HOMURA_JOBSEMAPHORE_H
+#include <mutex>
+#include <condition_variable>
+
+namespace Base
+{
+    // Counting semaphore, permits are kept until someone takes them so a signal is never lost
+    class JobSemaphore
+    {
+    public:
+        explicit JobSemaphore(int count = 0);
+        JobSemaphore(const JobSemaphore&) = delete;
+        JobSemaphore& operator=(const JobSemaphore&) = delete;
+
+        // releases count permits with a single lock
+        void signal(int count = 1);
+        void wait();
+    private:
+        std::mutex              mMutex;
+        std::condition_variable mCv;
+        int                     mCount;
+    };
+}
+
+#endif //HOMURA_JOBSEMAPHORE_H
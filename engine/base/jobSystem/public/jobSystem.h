@@ -5,17 +5,26 @@
 #ifndef HOMURA_JOBSYSTEM_H
 #define HOMURA_JOBSYSTEM_H
 #include <atomic>
+#include <cstdint>
 #include <thread>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <cstring>
+#include <type_traits>
 #include <condition_variable>
+#include <jobSemaphore.h>
 
 namespace Base
 {
     static constexpr size_t CACHE_LINE_SIZE = 64;
     static constexpr size_t MAX_JOB_COUNT = 4096;
+    static constexpr size_t OVERFLOW_JOB_COUNT = 1024;
+    static constexpr size_t MAX_CONTINUATION_COUNT = 14;
+    static constexpr uint32_t OVERFLOW_JOB_OWNER = UINT32_MAX;
 
     struct Job;
+    class JobSystem;
     template<typename TYPE, size_t COUNT> class WorkStealQueue;
     template<typename TYPE, size_t COUNT> struct Worker;
     template<typename TYPE> class allocator;
@@ -23,59 +32,221 @@ namespace Base
     using JobFunction = void(*)(Job*, const void*);
     using JobWorker = Worker<Job, MAX_JOB_COUNT>;
 
+    // the payload fills the rest of the job, so a job is exactly three cache lines.
+    // the owner is padded up to pointer alignment
+    static constexpr size_t JOB_DATA_SIZE = 3 * CACHE_LINE_SIZE - sizeof(JobFunction) - sizeof(Job*) * (MAX_CONTINUATION_COUNT + 1) - sizeof(std::atomic<int>) * 4 - sizeof(uint32_t) * 2;
+
     struct alignas(CACHE_LINE_SIZE) Job
     {
         Job() {}
         Job(const Job&) = delete;
         Job(Job&&) = delete;
         JobFunction mFunction;
-        Job* mParent;
+        union
+        {
+            Job* mParent;
+            // link in a free list while the job is not in use
+            Job* mNext;
+        };
         // If the counter is greater than 0, either the job itself or any of its child jobs hasn’t finished
         std::atomic<int> mUnfinishedJobs;
         std::atomic<int> mContinuationCount;
-        Job* mContinuations[15];
-        char mData[];
+        // number of unfinished jobs this one is a continuation of, it is scheduled when this drops to 0
+        std::atomic<int> mDependencyCount;
+        // odd while the job is in use, bumped on every allocation and release
+        std::atomic<uint32_t> mGeneration;
+        // worker whose pool the job came from, or OVERFLOW_JOB_OWNER
+        uint32_t mOwner;
+        Job* mContinuations[MAX_CONTINUATION_COUNT];
+        char mData[JOB_DATA_SIZE];
+    };
+    static_assert(sizeof(Job) == 3 * CACHE_LINE_SIZE, "job must fill whole cache lines");
+
+    // A job is recycled as soon as it has finished, so a Job* must not be kept past run().
+    // The handle remembers the generation instead and stays safe to query afterwards.
+    struct JobHandle
+    {
+        Job* mJob = nullptr;
+        uint32_t mGeneration = 0;
+    };
+
+    // An idle worker spins, then yields, then parks on the job system semaphore
+    struct JobIdleConfig
+    {
+        uint32_t mSpinCount = 64;
+        uint32_t mYieldCount = 16;
+    };
+
+    // How often each idle path ended the wait, summed over all workers
+    struct JobSystemStats
+    {
+        uint64_t mSpinCount = 0;
+        uint64_t mYieldCount = 0;
+        uint64_t mParkCount = 0;
+        // workers released from the semaphore and the number of signal() batches it took
+        uint64_t mWakeCount = 0;
+        uint64_t mWakeBatchCount = 0;
+        uint64_t mStealCount = 0;
     };
 
     template<typename TYPE, size_t COUNT>
     struct Worker {
-        using WorkQueue = WorkStealQueue<size_t, COUNT>;
+        using WorkQueue = WorkStealQueue<TYPE*, COUNT>;
         using alloc = allocator<TYPE>;
-        Worker();
+        Worker(JobSystem* system, uint32_t id);
         ~Worker();
+        void start();
+        void join();
         TYPE* createJob();
-        void run(Job* job);
+        void release(TYPE* job);
+        void run(TYPE* job);
         size_t getLoad();
+        TYPE* getJob();
         bool loop();
         void execute();
         void finish(TYPE* job);
+        uint32_t random();
+        JobSystem* mSystem;
         TYPE* mPool;
-        int mIndex;
+        // only touched by the owning thread
+        TYPE* mFreeList;
+        // jobs of this pool released by other workers, the owner takes the whole list at once
+        std::atomic<TYPE*> mRemoteFreeList;
+        uint32_t mId;
+        uint32_t mRandom;
+        // written by the owner only, relaxed
+        std::atomic<uint64_t> mSpinCount;
+        std::atomic<uint64_t> mYieldCount;
+        std::atomic<uint64_t> mParkCount;
+        std::atomic<uint64_t> mStealCount;
         std::thread mThread;
-        std::condition_variable mCv;
-        std::mutex mMutex;
         std::shared_ptr<WorkQueue> mQueue;
         std::shared_ptr<alloc> mAllocator;
-        std::atomic<bool> mExit;
     };
 
     class JobSystem
     {
+        template<typename TYPE, size_t COUNT> friend struct Worker;
     public:
-        JobSystem();
+        // threadCount is the number of background workers, 0 means one per remaining hardware thread.
+        // The constructing thread becomes worker 0 and only executes jobs inside wait().
+        explicit JobSystem(uint32_t threadCount = 0, const JobIdleConfig& idleConfig = JobIdleConfig{});
+        ~JobSystem();
+        JobSystem(const JobSystem&) = delete;
+        JobSystem& operator=(const JobSystem&) = delete;
+
+        Job* createJob(JobFunction function);
         Job* createJob(Job* parent, JobFunction function);
-        void run(Job* job);
-        void wait(Job* job);
+        template<typename T>
+        Job* createJob(Job* parent, JobFunction function, const T& data);
+        JobHandle run(Job* job);
+        void wait(const JobHandle& handle);
+        // continuation is run automatically once ancestor and all its children have finished.
+        // Must be called before ancestor is run, a continuation itself is never passed to run().
+        // A job takes MAX_CONTINUATION_COUNT continuations, more abort
+        void addContinuation(Job* ancestor, Job* continuation);
         Job* getJob();
-        bool hasCompleted(Job* job);
+        bool hasCompleted(const JobHandle& handle);
+        uint32_t getCurrentWorkerIndex();
+        uint32_t getWorkerCount() const
+        {
+            return static_cast<uint32_t>(mWorker.size());
+        }
+        JobSystemStats getStats() const;
+        void resetStats();
 
+        // Returns the root job of the loop, run() it and wait() on the handle like any other job.
+        // f is called with consecutive sub ranges of data, S is one of the policies in splitter.h
         template<typename T, typename S>
         Job* parallel_for(T* data, unsigned int count, void(*f)(T*, unsigned int), const S& splitter);
     private:
-        JobWorker* selectMinLoadWorker();
+        template<typename T, typename S>
+        struct ParallelForJobData
+        {
+            JobSystem*      mSystem;
+            T*              mData;
+            void            (*mFunction)(T*, unsigned int);
+            unsigned int    mCount;
+            uint32_t        mOwner;
+            S               mSplitter;
+        };
+
+        template<typename T, typename S>
+        static void parallelForJob(Job* job, const void* jobData);
+
+        JobWorker* getCurrentWorker();
+        JobWorker* selectVictim(JobWorker* thief);
+        Job* createOverflowJob();
+        void releaseOverflowJob(Job* job);
+        // releases up to count parked workers in one batch
+        void wake(int count);
+        void idle(JobWorker* worker);
+        void notifyWaiters();
     private:
         std::vector<JobWorker*> mWorker;
+        JobIdleConfig           mIdleConfig;
+        JobSemaphore            mSemaphore;
+        // parked workers that nobody has claimed a permit for yet
+        std::atomic<int>        mSleeping;
+        std::atomic<int>        mPendingJobs;
+        std::atomic<bool>       mExit;
+        std::atomic<uint64_t>   mWakeCount;
+        std::atomic<uint64_t>   mWakeBatchCount;
+        // threads parked in wait(), they wake on new jobs or finished root jobs
+        std::mutex              mWaitMutex;
+        std::condition_variable mWaitCv;
+        std::atomic<int>        mWaiting;
+        // used once a worker pool runs dry, grows by OVERFLOW_JOB_COUNT and is never shrunk
+        std::mutex              mOverflowMutex;
+        std::vector<Job*>       mOverflowBlocks;
+        Job*                    mOverflowFreeList;
     };
+
+    template<typename T>
+    Job* JobSystem::createJob(Job* parent, JobFunction function, const T& data)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "job data must be trivially copyable");
+        static_assert(sizeof(T) <= JOB_DATA_SIZE, "job data exceeds the job payload");
+        Job* job = createJob(parent, function);
+        std::memcpy(job->mData, &data, sizeof(T));
+        return job;
+    }
+
+    template<typename T, typename S>
+    void JobSystem::parallelForJob(Job* job, const void* jobData)
+    {
+        ParallelForJobData<T, S> data = *static_cast<const ParallelForJobData<T, S>*>(jobData);
+        JobSystem* system = data.mSystem;
+        const uint32_t worker = system->getCurrentWorkerIndex();
+        data.mSplitter.onExecute(worker != data.mOwner, system->getWorkerCount());
+
+        if (data.mSplitter.template split<T>(data.mCount))
+        {
+            const unsigned int leftCount = data.mSplitter.template splitPoint<T>(data.mCount);
+            data.mSplitter.onSplit();
+            data.mOwner = worker;
+
+            ParallelForJobData<T, S> left = data;
+            left.mCount = leftCount;
+            ParallelForJobData<T, S> right = data;
+            right.mData = data.mData + leftCount;
+            right.mCount = data.mCount - leftCount;
+
+            system->run(system->createJob(job, &JobSystem::parallelForJob<T, S>, left));
+            system->run(system->createJob(job, &JobSystem::parallelForJob<T, S>, right));
+        }
+        else
+        {
+            (data.mFunction)(data.mData, data.mCount);
+        }
+    }
+
+    template<typename T, typename S>
+    Job* JobSystem::parallel_for(T* data, unsigned int count, void(*f)(T*, unsigned int), const S& splitter)
+    {
+        ParallelForJobData<T, S> jobData{this, data, f, count, getCurrentWorkerIndex(), splitter};
+        return createJob(nullptr, &JobSystem::parallelForJob<T, S>, jobData);
+    }
 }
 
 #endif //HOMURA_JOBSYSTEM_H
@@ -0,0 +1,129 @@
+//
+// Created by 最上川 on 2022/8/12/012.
+//
+
+#ifndef HOMURA_SPLITTER_H
+#define HOMURA_SPLITTER_H
+#include <jobSystem.h>
+
+namespace Base
+{
+    // Splitting policies for JobSystem::parallel_for.
+    // split() decides whether a range is divided further, splitPoint() where it is cut,
+    // onExecute() is told whether the range has been stolen by another worker.
+
+    class CountSplitter
+    {
+    public:
+        explicit CountSplitter(unsigned int count)
+            : mCount{count > 0 ? count : 1}
+        {
+
+        }
+
+        template<typename T>
+        bool split(unsigned int count) const
+        {
+            return count > mCount;
+        }
+
+        template<typename T>
+        unsigned int splitPoint(unsigned int count) const
+        {
+            return count / 2;
+        }
+
+        void onExecute(bool, uint32_t) {}
+        void onSplit() {}
+    private:
+        unsigned int mCount;
+    };
+
+    class DataSizeSplitter
+    {
+    public:
+        // size is rounded up to whole cache lines
+        explicit DataSizeSplitter(unsigned int size = 256 * CACHE_LINE_SIZE)
+            : mSize{static_cast<unsigned int>((size + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1))}
+        {
+
+        }
+
+        template<typename T>
+        bool split(unsigned int count) const
+        {
+            return static_cast<size_t>(count) * sizeof(T) > mSize;
+        }
+
+        // cut on a cache line boundary so neighbouring ranges of line aligned data never share a line
+        template<typename T>
+        unsigned int splitPoint(unsigned int count) const
+        {
+            const size_t lineElements = sizeof(T) < CACHE_LINE_SIZE ? CACHE_LINE_SIZE / sizeof(T) : 1;
+            const size_t half = count / 2;
+            const size_t aligned = half - half % lineElements;
+            return static_cast<unsigned int>(aligned > 0 ? aligned : half);
+        }
+
+        void onExecute(bool, uint32_t) {}
+        void onSplit() {}
+    private:
+        unsigned int mSize;
+    };
+
+    // Starts with a few ranges per worker and only splits deeper where ranges get stolen,
+    // so balanced loops stay coarse and unbalanced ones spread out on demand.
+    class AutoSplitter
+    {
+    public:
+        explicit AutoSplitter(unsigned int minCount = 1)
+            : mMinCount{minCount > 0 ? minCount : 1}
+            , mDepth{-1}
+        {
+
+        }
+
+        template<typename T>
+        bool split(unsigned int count) const
+        {
+            return count > mMinCount && mDepth > 0;
+        }
+
+        template<typename T>
+        unsigned int splitPoint(unsigned int count) const
+        {
+            return count / 2;
+        }
+
+        void onExecute(bool stolen, uint32_t workerCount)
+        {
+            if (mDepth < 0)
+            {
+                // four ranges per worker to begin with
+                int depth = 2;
+                for (uint32_t n = 1; n < workerCount; n <<= 1)
+                {
+                    depth++;
+                }
+                mDepth = depth;
+            }
+            else if (stolen && mDepth < DEMAND_DEPTH)
+            {
+                mDepth += DEMAND_DEPTH_ADD;
+            }
+        }
+
+        void onSplit()
+        {
+            mDepth--;
+        }
+    private:
+        static constexpr int DEMAND_DEPTH = 8;
+        static constexpr int DEMAND_DEPTH_ADD = 2;
+
+        unsigned int mMinCount;
+        int mDepth;
+    };
+}
+
+#endif //HOMURA_SPLITTER_H
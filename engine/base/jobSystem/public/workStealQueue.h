@@ -6,6 +6,7 @@
 #ifndef HOMURA_WORKSTEALQUEUE_H
 #define HOMURA_WORKSTEALQUEUE_H
 #include <atomic>
+#include <cstddef>
 
 namespace Base
 {
@@ -14,12 +15,14 @@ namespace Base
     {
         static_assert(!(COUNT & (COUNT - 1)), "count must be a power of two");
         static constexpr size_t MASK = COUNT - 1u;
-        // steal at pop
-        std::atomic<int> mTop;
-        // posh, pop at bottom
-        std::atomic<int> mBottom;
-        TYPE mQueue[COUNT];
+        // steal at top
+        alignas(64) std::atomic<int> mTop;
+        // push, pop at bottom
+        alignas(64) std::atomic<int> mBottom;
+        // a thief may read a slot the owner is overwriting, its CAS on top fails in that case
+        std::atomic<TYPE> mQueue[COUNT];
     public:
+        WorkStealQueue() : mTop{0}, mBottom{0} {}
         void push(TYPE item);
         TYPE pop();
         TYPE steal();
@@ -30,7 +33,7 @@ namespace Base
     void WorkStealQueue<TYPE, COUNT>::push(TYPE item)
     {
         int bottom = mBottom.load(std::memory_order_relaxed);
-        mQueue[bottom & MASK] = item;
+        mQueue[bottom & MASK].store(item, std::memory_order_relaxed);
         mBottom.store(bottom + 1, std::memory_order_release);
     }
 
@@ -39,10 +42,10 @@ namespace Base
     {
         int bottom = mBottom.fetch_sub(1, std::memory_order_seq_cst) - 1;
         int top = mTop.load(std::memory_order_seq_cst);
-        TYPE item;
+        TYPE item = nullptr;
         if (top <= bottom)
         {
-            item = mQueue[bottom & MASK];
+            item = mQueue[bottom & MASK].load(std::memory_order_relaxed);
             if (top != bottom)
             {
                 return item;
@@ -70,7 +73,7 @@ namespace Base
             int bottom = mBottom.load(std::memory_order_seq_cst);
             if (top < bottom)
             {
-                TYPE item = mQueue[top & MASK];
+                TYPE item = mQueue[top & MASK].load(std::memory_order_relaxed);
                 if (mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
                 {
                     return item;
@@ -85,7 +88,7 @@ namespace Base
     {
         int top = mTop.load(std::memory_order_seq_cst);
         int bottom = mBottom.load(std::memory_order_seq_cst);
-        return bottom - top;
+        return bottom > top ? static_cast<size_t>(bottom - top) : 0u;
     }
 }
 #endif //HOMURA_WORKSTEALQUEUE_H
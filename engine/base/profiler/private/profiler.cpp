@@ -0,0 +1,208 @@
+//
+// Created by 最上川 on 2022/8/26/026.
+//
+
+#include <profiler.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace Base
+{
+    static constexpr uint32_t DEFAULT_BUFFER_CAPACITY = 64 * 1024;
+
+    std::atomic<bool> Profiler::sCapturing{false};
+    const std::chrono::steady_clock::time_point Profiler::sEpoch = std::chrono::steady_clock::now();
+
+    // buffer of the calling thread, owned by the profiler so it outlives the thread for the export
+    static thread_local ProfileThreadBuffer* sThreadBuffer = nullptr;
+
+    static void writeString(std::ostringstream& json, const std::string& value)
+    {
+        json << '"';
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\')
+            {
+                json << '\\';
+            }
+            json << c;
+        }
+        json << '"';
+    }
+
+    // chrome traces count in microseconds
+    static void writeTime(std::ostringstream& json, uint64_t nanoseconds)
+    {
+        char time[32];
+        std::snprintf(time, sizeof(time), "%llu.%03llu", static_cast<unsigned long long>(nanoseconds / 1000), static_cast<unsigned long long>(nanoseconds % 1000));
+        json << time;
+    }
+
+    Profiler::Profiler()
+        : mGeneration{0}
+        , mCapacity{DEFAULT_BUFFER_CAPACITY}
+    {
+
+    }
+
+    Profiler& Profiler::get()
+    {
+        // never destroyed, worker threads may still end zones during static destruction
+        static Profiler* profiler = new Profiler();
+        return *profiler;
+    }
+
+    void Profiler::setBufferCapacity(uint32_t events)
+    {
+        mCapacity.store(events, std::memory_order_relaxed);
+    }
+
+    void Profiler::beginCapture()
+    {
+        // every thread resets its own buffer on its next event
+        mGeneration.fetch_add(1, std::memory_order_acq_rel);
+        sCapturing.store(true, std::memory_order_release);
+    }
+
+    void Profiler::endCapture()
+    {
+        sCapturing.store(false, std::memory_order_release);
+    }
+
+    ProfileThreadBuffer* Profiler::getThreadBuffer()
+    {
+        if (!sThreadBuffer)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mBuffers.push_back(std::make_unique<ProfileThreadBuffer>());
+            sThreadBuffer = mBuffers.back().get();
+            sThreadBuffer->mThreadId = static_cast<uint32_t>(mBuffers.size());
+            sThreadBuffer->mThreadName = "thread " + std::to_string(mBuffers.size());
+            // never matches, so the first event sizes the buffer
+            sThreadBuffer->mGeneration.store(UINT32_MAX, std::memory_order_relaxed);
+        }
+        return sThreadBuffer;
+    }
+
+    void Profiler::record(const ProfileEvent& event)
+    {
+        if (!isCapturing())
+        {
+            return;
+        }
+
+        ProfileThreadBuffer* buffer = getThreadBuffer();
+        const uint32_t generation = mGeneration.load(std::memory_order_acquire);
+        if (buffer->mGeneration.load(std::memory_order_relaxed) != generation)
+        {
+            // exports skip the buffer until the release below, nobody reads what is reset here
+            buffer->mCount.store(0, std::memory_order_relaxed);
+            buffer->mDropped.store(0, std::memory_order_relaxed);
+            const uint32_t capacity = mCapacity.load(std::memory_order_relaxed);
+            if (buffer->mEvents.size() != capacity)
+            {
+                buffer->mEvents.resize(capacity);
+            }
+            buffer->mGeneration.store(generation, std::memory_order_release);
+        }
+
+        const uint32_t count = buffer->mCount.load(std::memory_order_relaxed);
+        if (count >= buffer->mEvents.size())
+        {
+            buffer->mDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buffer->mEvents[count] = event;
+        buffer->mCount.store(count + 1, std::memory_order_release);
+    }
+
+    void Profiler::recordZone(const char* name, uint64_t start, uint64_t end)
+    {
+        record(ProfileEvent{name, start, end, 0, ProfileEventType::Zone});
+    }
+
+    void Profiler::recordCounter(const char* name, int64_t value)
+    {
+        const uint64_t time = now();
+        record(ProfileEvent{name, time, time, value, ProfileEventType::Counter});
+    }
+
+    void Profiler::setThreadName(const std::string& name)
+    {
+        ProfileThreadBuffer* buffer = getThreadBuffer();
+        std::lock_guard<std::mutex> lock(mMutex);
+        buffer->mThreadName = name;
+    }
+
+    uint64_t Profiler::getDroppedCount() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const uint32_t generation = mGeneration.load(std::memory_order_acquire);
+        uint64_t dropped = 0;
+        for (const auto& buffer : mBuffers)
+        {
+            if (buffer->mGeneration.load(std::memory_order_acquire) == generation)
+            {
+                dropped += buffer->mDropped.load(std::memory_order_relaxed);
+            }
+        }
+        return dropped;
+    }
+
+    std::string Profiler::toChromeTrace() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const uint32_t generation = mGeneration.load(std::memory_order_acquire);
+
+        std::ostringstream json;
+        json << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        for (const auto& buffer : mBuffers)
+        {
+            json << (first ? "" : ",\n") << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->mThreadId << ", \"args\": {\"name\": ";
+            writeString(json, buffer->mThreadName);
+            json << "}}";
+            first = false;
+
+            // threads without an event in this capture still hold the last one
+            if (buffer->mGeneration.load(std::memory_order_acquire) != generation)
+            {
+                continue;
+            }
+
+            const uint32_t count = buffer->mCount.load(std::memory_order_acquire);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const ProfileEvent& event = buffer->mEvents[i];
+                json << ",\n  {\"name\": ";
+                writeString(json, event.mName);
+                json << ", \"pid\": 1, \"tid\": " << buffer->mThreadId << ", \"ts\": ";
+                writeTime(json, event.mStart);
+                if (event.mType == ProfileEventType::Zone)
+                {
+                    json << ", \"ph\": \"X\", \"dur\": ";
+                    writeTime(json, event.mEnd - event.mStart);
+                    json << "}";
+                }
+                else
+                {
+                    json << ", \"ph\": \"C\", \"args\": {\"value\": " << event.mValue << "}}";
+                }
+            }
+        }
+        json << "\n]}\n";
+        return json.str();
+    }
+
+    bool Profiler::writeChromeTrace(const std::string& filename) const
+    {
+        std::ofstream file(filename, std::ios::out | std::ios::trunc);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        file << toChromeTrace();
+        return file.good();
+    }
+}
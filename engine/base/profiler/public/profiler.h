@@ -0,0 +1,147 @@
+//
+// Created by 最上川 on 2022/8/26/026.
+//
+
+#ifndef HOMURA_PROFILER_H
+#define HOMURA_PROFILER_H
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Zones and counters are switched with the HOMURA_PROFILING cmake option, without it the macros
+// below are empty and nothing is recorded. Turn it off for shipping builds
+#ifndef HOMURA_PROFILING
+#define HOMURA_PROFILING 0
+#endif
+
+namespace Base
+{
+    enum class ProfileEventType : uint32_t
+    {
+        Zone = 0,
+        Counter
+    };
+
+    struct ProfileEvent
+    {
+        // a string literal, only the pointer is kept
+        const char*         mName;
+        // nanoseconds since the profiler started
+        uint64_t            mStart;
+        uint64_t            mEnd;
+        int64_t             mValue;
+        ProfileEventType    mType;
+    };
+
+    // Events of one thread. Only the owner thread writes, an event is published by the release
+    // store of mCount, so readers never see it half written. Never shrinks, full buffers drop events
+    struct ProfileThreadBuffer
+    {
+        std::vector<ProfileEvent>   mEvents;
+        std::atomic<uint32_t>       mCount{0};
+        std::atomic<uint32_t>       mDropped{0};
+        // capture the buffer was last reset for
+        std::atomic<uint32_t>       mGeneration{0};
+        uint32_t                    mThreadId = 0;
+        std::string                 mThreadName;
+    };
+
+    // Records zones and counters into thread local buffers between beginCapture() and endCapture(),
+    // writing an event takes no lock. Exports Chrome trace JSON, which Perfetto and chrome://tracing open
+    class Profiler
+    {
+    public:
+        static Profiler& get();
+
+        // events each thread keeps per capture, set it before the first capture
+        void setBufferCapacity(uint32_t events);
+
+        // drops the events of the last capture. Not while an export is running
+        void beginCapture();
+        void endCapture();
+
+        static bool isCapturing()
+        {
+            return sCapturing.load(std::memory_order_relaxed);
+        }
+
+        static uint64_t now()
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sEpoch).count());
+        }
+
+        void recordZone(const char* name, uint64_t start, uint64_t end);
+        void recordCounter(const char* name, int64_t value);
+        // shows up as the name of the calling thread in the trace
+        void setThreadName(const std::string& name);
+
+        // events lost to full buffers in the last capture
+        uint64_t getDroppedCount() const;
+
+        std::string toChromeTrace() const;
+        bool writeChromeTrace(const std::string& filename) const;
+    private:
+        Profiler();
+
+        ProfileThreadBuffer* getThreadBuffer();
+        void record(const ProfileEvent& event);
+    private:
+        static std::atomic<bool>                            sCapturing;
+        static const std::chrono::steady_clock::time_point  sEpoch;
+
+        std::atomic<uint32_t>                               mGeneration;
+        std::atomic<uint32_t>                               mCapacity;
+        // registration only, once per thread
+        mutable std::mutex                                  mMutex;
+        std::vector<std::unique_ptr<ProfileThreadBuffer>>   mBuffers;
+    };
+
+    // times its scope as a zone of the calling thread
+    class ProfileZone
+    {
+    public:
+        explicit ProfileZone(const char* name)
+            : mName{name}
+            , mActive{Profiler::isCapturing()}
+            , mStart{mActive ? Profiler::now() : 0}
+        {
+
+        }
+
+        ~ProfileZone()
+        {
+            if (mActive)
+            {
+                Profiler::get().recordZone(mName, mStart, Profiler::now());
+            }
+        }
+
+        ProfileZone(const ProfileZone&) = delete;
+        ProfileZone& operator=(const ProfileZone&) = delete;
+    private:
+        const char* mName;
+        bool        mActive;
+        uint64_t    mStart;
+    };
+}
+
+#if HOMURA_PROFILING
+#define HOMURA_PROFILE_CONCAT_IMPL(a, b) a##b
+#define HOMURA_PROFILE_CONCAT(a, b) HOMURA_PROFILE_CONCAT_IMPL(a, b)
+// name has to be a string literal
+#define PROFILE_ZONE(name) Base::ProfileZone HOMURA_PROFILE_CONCAT(profileZone, __LINE__){name}
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+#define PROFILE_COUNTER(name, value) do { if (Base::Profiler::isCapturing()) { Base::Profiler::get().recordCounter(name, static_cast<int64_t>(value)); } } while (0)
+#define PROFILE_THREAD(name) Base::Profiler::get().setThreadName(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_FUNCTION() ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#endif
+
+#endif //HOMURA_PROFILER_H
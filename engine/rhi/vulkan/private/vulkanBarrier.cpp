@@ -0,0 +1,165 @@
+//
+// Created by 最上川 on 2022/8/29/029.
+//
+
+#include <vulkanBarrier.h>
+#include <vulkanPipelineCache.h>
+#include <algorithm>
+#include <cassert>
+
+namespace Homura
+{
+    static constexpr VkAccessFlags WRITE_ACCESS = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+                                                  VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+    VulkanImageAccess getImageAccess(VkImageLayout layout)
+    {
+        switch (layout)
+        {
+            case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+                return {layout, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT};
+            case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+                return {layout, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT};
+            case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+                return {layout, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT};
+            case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+                return {layout, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT};
+            case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+                return {layout, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT};
+            case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+                return {layout, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT};
+            case VK_IMAGE_LAYOUT_GENERAL:
+                return {layout, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+            case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+                return {layout, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0};
+            default:
+                return {layout, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT};
+        }
+    }
+
+    static uint64_t getSubresourceKey(VkImage image, uint32_t mip, uint32_t layer)
+    {
+        const uint64_t fields[3] = {reinterpret_cast<uint64_t>(image), mip, layer};
+        return hashMemory(fields, sizeof(fields));
+    }
+
+    VulkanBarrierBatch::VulkanBarrierBatch()
+        : mBarriers{}
+        , mSrcStages{0}
+        , mDstStages{0}
+        , mPending{}
+        , mBarrierCount{0}
+        , mFlushCount{0}
+    {
+
+    }
+
+    bool VulkanBarrierBatch::transition(VkImage image, VulkanImageLayoutState& state, const VkImageSubresourceRange& range, const VulkanImageAccess& next)
+    {
+        const uint32_t mipEnd = range.levelCount == VK_REMAINING_MIP_LEVELS ? state.getMipLevels() : range.baseMipLevel + range.levelCount;
+        const uint32_t layerEnd = range.layerCount == VK_REMAINING_ARRAY_LAYERS ? state.getLayerCount() : range.baseArrayLayer + range.layerCount;
+        assert(mipEnd <= state.getMipLevels() && layerEnd <= state.getLayerCount());
+        const bool nextWrites = (next.mAccess & WRITE_ACCESS) != 0;
+
+        // checked up front, so a refused range leaves the state and the batch as they were
+        if (!mPending.empty())
+        {
+            for (uint32_t layer = range.baseArrayLayer; layer < layerEnd; layer++)
+            {
+                for (uint32_t mip = range.baseMipLevel; mip < mipEnd; mip++)
+                {
+                    if (mPending.count(getSubresourceKey(image, mip, layer)))
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        for (uint32_t layer = range.baseArrayLayer; layer < layerEnd; layer++)
+        {
+            uint32_t mip = range.baseMipLevel;
+            while (mip < mipEnd)
+            {
+                VulkanImageAccess& current = state.get(mip, layer);
+                if (current.mLayout == next.mLayout && !nextWrites && (current.mAccess & WRITE_ACCESS) == 0 && current.mStages != 0)
+                {
+                    // reads after reads, a later write waits for all of them
+                    current.mStages |= next.mStages;
+                    current.mAccess |= next.mAccess;
+                    mip++;
+                    continue;
+                }
+
+                // the run of mips that comes from the same state
+                const VulkanImageAccess previous = current;
+                const uint32_t first = mip;
+                while (mip < mipEnd)
+                {
+                    VulkanImageAccess& entry = state.get(mip, layer);
+                    if (entry.mLayout != previous.mLayout || entry.mStages != previous.mStages || entry.mAccess != previous.mAccess)
+                    {
+                        break;
+                    }
+                    mPending.insert(getSubresourceKey(image, mip, layer));
+                    entry = next;
+                    mip++;
+                }
+
+                // only writes have to be made available, reads need the execution dependency alone
+                const VkAccessFlags srcAccess = previous.mAccess & WRITE_ACCESS;
+                if (!mBarriers.empty())
+                {
+                    // the same mips one layer up extend the last barrier
+                    VkImageMemoryBarrier& last = mBarriers.back();
+                    if (last.image == image && last.oldLayout == previous.mLayout && last.newLayout == next.mLayout && last.srcAccessMask == srcAccess &&
+                        last.dstAccessMask == next.mAccess && last.subresourceRange.baseMipLevel == first && last.subresourceRange.levelCount == mip - first &&
+                        last.subresourceRange.baseArrayLayer + last.subresourceRange.layerCount == layer)
+                    {
+                        last.subresourceRange.layerCount++;
+                        mSrcStages |= previous.mStages != 0 ? previous.mStages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+                        mDstStages |= next.mStages;
+                        continue;
+                    }
+                }
+
+                VkImageMemoryBarrier barrier{};
+                barrier.sType                               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                barrier.srcAccessMask                       = srcAccess;
+                barrier.dstAccessMask                       = next.mAccess;
+                barrier.oldLayout                           = previous.mLayout;
+                barrier.newLayout                           = next.mLayout;
+                barrier.srcQueueFamilyIndex                 = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex                 = VK_QUEUE_FAMILY_IGNORED;
+                barrier.image                               = image;
+                barrier.subresourceRange.aspectMask         = range.aspectMask;
+                barrier.subresourceRange.baseMipLevel       = first;
+                barrier.subresourceRange.levelCount         = mip - first;
+                barrier.subresourceRange.baseArrayLayer     = layer;
+                barrier.subresourceRange.layerCount         = 1;
+                mBarriers.push_back(barrier);
+                mSrcStages |= previous.mStages != 0 ? previous.mStages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+                mDstStages |= next.mStages;
+            }
+        }
+        return true;
+    }
+
+    void VulkanBarrierBatch::flush(VkCommandBuffer commandBuffer)
+    {
+        if (mBarriers.empty())
+        {
+            return;
+        }
+        vkCmdPipelineBarrier(commandBuffer, mSrcStages, mDstStages, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(mBarriers.size()), mBarriers.data());
+        mBarrierCount += mBarriers.size();
+        mFlushCount++;
+
+        mBarriers.clear();
+        mPending.clear();
+        mSrcStages = 0;
+        mDstStages = 0;
+    }
+}
@@ -0,0 +1,182 @@
+//
+// Created by 最上川 on 2022/8/24/024.
+//
+
+#include <vulkanBindless.h>
+#include <vulkanDevice.h>
+#include <vulkanTexture.h>
+#include <vulkanSampler.h>
+#include <debugUtils.h>
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+namespace Homura
+{
+    // more slots than a frame ever touches, the array costs descriptor memory up front
+    static constexpr uint32_t DEFAULT_BINDLESS_CAPACITY = 16 * 1024;
+
+    VulkanBindlessTable::VulkanBindlessTable(VulkanDevicePtr device, uint32_t capacity)
+        : mDevice{device}
+        , mCapacity{capacity}
+        , mPool{VK_NULL_HANDLE}
+        , mLayout{VK_NULL_HANDLE}
+        , mSet{VK_NULL_HANDLE}
+        , mMutex{}
+        , mHighWater{0}
+        , mCount{0}
+        , mFreeSlots{}
+        , mRetired{}
+        , mFrame{0}
+    {
+        create();
+    }
+
+    VulkanBindlessTable::~VulkanBindlessTable()
+    {
+        destroy();
+    }
+
+    void VulkanBindlessTable::create()
+    {
+        assert(mDevice->isBindlessSupported());
+        const uint32_t limit = mDevice->getBindlessLimit();
+        mCapacity = std::min(mCapacity > 0 ? mCapacity : DEFAULT_BINDLESS_CAPACITY, limit);
+
+        VkDescriptorSetLayoutBinding binding{};
+        binding.binding             = 0;
+        binding.descriptorType      = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        binding.descriptorCount     = mCapacity;
+        binding.stageFlags          = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        // slots nobody reads may be empty or rewritten while command buffers using the set are pending
+        const VkDescriptorBindingFlags bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                                                      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+                                                      VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+        VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+        flagsInfo.sType             = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        flagsInfo.bindingCount      = 1;
+        flagsInfo.pBindingFlags     = &bindingFlags;
+
+        // not through the layout cache, its key has no binding flags
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType            = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.pNext            = &flagsInfo;
+        layoutInfo.flags            = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        layoutInfo.bindingCount     = 1;
+        layoutInfo.pBindings        = &binding;
+        VERIFYVULKANRESULT(vkCreateDescriptorSetLayout(mDevice->getHandle(), &layoutInfo, nullptr, &mLayout));
+
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type               = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSize.descriptorCount    = mCapacity;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.flags              = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+        poolInfo.maxSets            = 1;
+        poolInfo.poolSizeCount      = 1;
+        poolInfo.pPoolSizes         = &poolSize;
+        VERIFYVULKANRESULT(vkCreateDescriptorPool(mDevice->getHandle(), &poolInfo, nullptr, &mPool));
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType                 = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool        = mPool;
+        allocInfo.descriptorSetCount    = 1;
+        allocInfo.pSetLayouts           = &mLayout;
+        VERIFYVULKANRESULT(vkAllocateDescriptorSets(mDevice->getHandle(), &allocInfo, &mSet));
+    }
+
+    void VulkanBindlessTable::destroy()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mPool != VK_NULL_HANDLE)
+        {
+            // the set goes with its pool
+            vkDestroyDescriptorPool(mDevice->getHandle(), mPool, nullptr);
+            mPool = VK_NULL_HANDLE;
+            mSet = VK_NULL_HANDLE;
+        }
+        if (mLayout != VK_NULL_HANDLE)
+        {
+            vkDestroyDescriptorSetLayout(mDevice->getHandle(), mLayout, nullptr);
+            mLayout = VK_NULL_HANDLE;
+        }
+        mFreeSlots.clear();
+        mRetired.clear();
+        mHighWater = 0;
+        mCount = 0;
+    }
+
+    uint32_t VulkanBindlessTable::add(VkImageView imageView, VkSampler sampler, VkImageLayout layout)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        uint32_t index = INVALID_INDEX;
+        if (!mFreeSlots.empty())
+        {
+            index = mFreeSlots.back();
+            mFreeSlots.pop_back();
+        }
+        else if (mHighWater < mCapacity)
+        {
+            index = mHighWater++;
+        }
+        else
+        {
+            std::cerr << "bindless texture table is full!" << std::endl;
+            return INVALID_INDEX;
+        }
+
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.sampler               = sampler;
+        imageInfo.imageView             = imageView;
+        imageInfo.imageLayout           = layout;
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet          = mSet;
+        descriptorWrite.dstBinding      = 0;
+        descriptorWrite.dstArrayElement = index;
+        descriptorWrite.descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pImageInfo      = &imageInfo;
+        vkUpdateDescriptorSets(mDevice->getHandle(), 1, &descriptorWrite, 0, nullptr);
+
+        mCount++;
+        return index;
+    }
+
+    uint32_t VulkanBindlessTable::add(VulkanTexture2DPtr texture)
+    {
+        return add(texture->getImageView(), texture->getSampler()->getHandle());
+    }
+
+    void VulkanBindlessTable::remove(uint32_t index)
+    {
+        if (index == INVALID_INDEX)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        assert(index < mHighWater);
+        // the descriptor stays until the slot is written again, nothing may index it from now on
+        if (mFrame >= mRetired.size())
+        {
+            mRetired.resize(mFrame + 1);
+        }
+        mRetired[mFrame].push_back(index);
+        mCount--;
+    }
+
+    void VulkanBindlessTable::beginFrame(uint32_t frame)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (frame < mRetired.size())
+        {
+            mFreeSlots.insert(mFreeSlots.end(), mRetired[frame].begin(), mRetired[frame].end());
+            mRetired[frame].clear();
+        }
+        mFrame = frame;
+    }
+}
@@ -6,18 +6,18 @@
 #include <debugUtils.h>
 #include <vulkanDevice.h>
 #include <vulkanCommandBuffer.h>
+#include <algorithm>
 
 namespace Homura
 {
     VulkanBuffer::VulkanBuffer(VulkanDevicePtr device, VulkanCommandBufferPtr commandBuffer, VkDeviceSize size, VkBufferUsageFlags  usage, VkMemoryPropertyFlags props)
         : mBuffer{VK_NULL_HANDLE}
-        , mBufferMemory{VK_NULL_HANDLE}
+        , mAllocation{}
         , mDevice{device}
         , mCommandBuffer{commandBuffer}
         , mSize{size}
         , mUsage{usage}
         , mProperties{props}
-        , mStagingBuffer{nullptr}
     {
         create();
     }
@@ -28,20 +28,16 @@ namespace Homura
         bufferInfo.sType            = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
         bufferInfo.size             = mSize;
         bufferInfo.usage            = mUsage;
-        bufferInfo.sharingMode      = VK_SHARING_MODE_EXCLUSIVE;
+        // shared with the transfer queue so uploads need no ownership transfer
+        const std::vector<uint32_t>& queueFamilies = mDevice->getSharedQueueFamilies();
+        bufferInfo.sharingMode              = queueFamilies.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount    = static_cast<uint32_t>(queueFamilies.size());
+        bufferInfo.pQueueFamilyIndices      = queueFamilies.data();
 
         VERIFYVULKANRESULT(vkCreateBuffer(mDevice->getHandle(), &bufferInfo, nullptr, &mBuffer));
 
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(mDevice->getHandle(), mBuffer, &memRequirements);
-
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType             = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize    = memRequirements.size;
-        allocInfo.memoryTypeIndex   = findMemoryType(memRequirements.memoryTypeBits, mProperties);
-
-        VERIFYVULKANRESULT(vkAllocateMemory(mDevice->getHandle(), &allocInfo, nullptr, &mBufferMemory));
-        VERIFYVULKANRESULT(vkBindBufferMemory(mDevice->getHandle(), mBuffer, mBufferMemory, 0));
+        mAllocation = mDevice->getMemoryAllocator().allocateBuffer(mBuffer, mProperties);
+        VERIFYVULKANRESULT(vkBindBufferMemory(mDevice->getHandle(), mBuffer, mAllocation.mMemory, mAllocation.mOffset));
     }
 
     void VulkanBuffer::destroy()
@@ -52,49 +48,73 @@ namespace Homura
             mBuffer = VK_NULL_HANDLE;
         }
 
-        if (mBufferMemory != VK_NULL_HANDLE)
-        {
-            vkFreeMemory(mDevice->getHandle(), mBufferMemory, nullptr);
-            mBufferMemory = VK_NULL_HANDLE;
-        }
+        mDevice->getMemoryAllocator().free(mAllocation);
+    }
 
-        if (mStagingBuffer)
-        {
-            mStagingBuffer->destroy();
-            delete mStagingBuffer;
-            mStagingBuffer = nullptr;
-        }
+    void VulkanBuffer::fillBuffer(void *inData, uint64_t size)
+    {
+        // host visible memory stays mapped for the lifetime of the block
+        assert(mAllocation.mMapped && size <= mSize);
+        memcpy(mAllocation.mMapped, inData, (size_t)size);
+        mDevice->getMemoryAllocator().flush(mAllocation, 0, size);
     }
 
-    uint32_t VulkanBuffer::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+    void VulkanBuffer::updateBufferByStaging(void *pData, uint32_t size)
     {
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(mDevice->getPhysicalHandle(), &memProperties);
+        // goes out with the next frame, the buffer is ready for every submission after it
+        mDevice->getUploadManager().uploadBuffer(mBuffer, pData, size);
+    }
 
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
-        {
-            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-            {
-                return i;
-            }
-        }
-        return -1;
+    static VkDeviceSize getUniformOffsetAlignment(VulkanDevicePtr device)
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device->getPhysicalHandle(), &properties);
+        return properties.limits.minUniformBufferOffsetAlignment;
     }
 
+    static VkDeviceSize alignUp(VkDeviceSize size, VkDeviceSize alignment)
+    {
+        return (size + alignment - 1) & ~(alignment - 1);
+    }
 
-    void VulkanBuffer::fillBuffer(void *inData, uint64_t size)
+    VulkanUniformRing::VulkanUniformRing(VulkanDevicePtr device, uint32_t frameCount, VkDeviceSize frameSize)
+        : VulkanBuffer(device, nullptr, frameCount * alignUp(frameSize, getUniformOffsetAlignment(device)), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        , mFrameCount{frameCount}
+        , mFrameStride{0}
+        , mAlignment{getUniformOffsetAlignment(device)}
+        , mFrameIndex{0}
+        , mHead{0}
     {
-        void* data;
-        vkMapMemory(mDevice->getHandle(), mBufferMemory, 0, mSize, 0, &data);
-        memcpy(data, inData, (size_t)size);
-        vkUnmapMemory(mDevice->getHandle(), mBufferMemory);
+        mFrameStride = mSize / frameCount;
+        assert(mAllocation.mMapped && "uniform ring needs host visible memory");
     }
 
-    void VulkanBuffer::updateBufferByStaging(void *pData, uint32_t size)
+    void VulkanUniformRing::beginFrame(uint32_t frameIndex)
     {
-        mStagingBuffer = new VulkanBuffer(mDevice, mCommandBuffer, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-        mStagingBuffer->fillBuffer(pData, size);
-        copyBuffer(*mStagingBuffer, *this, static_cast<VkDeviceSize>(size));
+        assert(frameIndex < mFrameCount);
+        mFrameIndex = frameIndex;
+        mHead = frameIndex * mFrameStride;
+    }
+
+    VulkanUniformRing::Allocation VulkanUniformRing::allocate(uint32_t size)
+    {
+        const VkDeviceSize frameEnd = (mFrameIndex + 1) * mFrameStride;
+        assert(mHead + size <= frameEnd && "uniform ring frame region exhausted");
+
+        Allocation allocation;
+        allocation.mData    = static_cast<char*>(mAllocation.mMapped) + mHead;
+        allocation.mOffset  = static_cast<uint32_t>(mHead);
+        mHead = std::min(mHead + alignSize(size), frameEnd);
+        return allocation;
+    }
+
+    void VulkanUniformRing::endFrame()
+    {
+        const VkDeviceSize frameBegin = mFrameIndex * mFrameStride;
+        if (mHead > frameBegin)
+        {
+            mDevice->getMemoryAllocator().flush(mAllocation, frameBegin, mHead - frameBegin);
+        }
     }
 
     void VulkanBuffer::copyBuffer(VulkanBuffer& srcBuffer, VulkanBuffer& dstBuffer, VkDeviceSize size)
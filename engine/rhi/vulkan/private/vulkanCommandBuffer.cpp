@@ -14,13 +14,23 @@
 #include <vulkanFramebuffer.h>
 #include <vulkanSwapChain.h>
 #include <vulkanSynchronization.h>
+#include <vulkanBindless.h>
+#include <vulkanGpuProfiler.h>
+#include <vulkanReadback.h>
+#include <vulkanFrameGraph.h>
+#include <vulkanTextureStreamer.h>
 #include <debugUtils.h>
+#include <profiler.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
 
 namespace Homura
 {
-    VulkanCommandPool::VulkanCommandPool(VulkanDevicePtr device)
+    VulkanCommandPool::VulkanCommandPool(VulkanDevicePtr device, VkCommandPoolCreateFlags flags)
         : mDevice{device}
         , mCommandPool{VK_NULL_HANDLE}
+        , mFlags{flags}
     {
         create();
     }
@@ -34,13 +44,14 @@ namespace Homura
     {
         VkCommandPoolCreateInfo createInfo{};
         createInfo.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        createInfo.flags            = mFlags;
         createInfo.queueFamilyIndex = mDevice->getGraphicsQueue()->getFamilyIndex();
         VERIFYVULKANRESULT(vkCreateCommandPool(mDevice->getHandle(), &createInfo, nullptr, &mCommandPool));
     }
 
-    void VulkanCommandPool::reset()
+    void VulkanCommandPool::reset(VkCommandPoolResetFlags flags)
     {
-        VERIFYVULKANRESULT(vkResetCommandPool(mDevice->getHandle(), mCommandPool, VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT));
+        VERIFYVULKANRESULT(vkResetCommandPool(mDevice->getHandle(), mCommandPool, flags));
     }
 
     void VulkanCommandPool::destroy()
@@ -52,19 +63,39 @@ namespace Homura
         }
     }
 
-    VulkanCommandBuffer::VulkanCommandBuffer(VulkanDevicePtr device, VulkanSwapChainPtr swapChain, VulkanCommandPoolPtr commandPool, VulkanFramebufferPtr framebuffer, VulkanPipelinePtr pipeline)
+    VulkanCommandBuffer::VulkanCommandBuffer(VulkanDevicePtr device, VulkanSwapChainPtr swapChain, VulkanCommandPoolPtr commandPool, VulkanFramebufferPtr framebuffer, VulkanPipelinePtr pipeline,
+                                             uint32_t framesInFlight)
         : mDevice{device}
         , mSwapChain{swapChain}
         , mCommandPool{commandPool}
         , mFramebuffer{framebuffer}
         , mPipeline{pipeline}
         , mCurrentFrame{0}
-        , imageInFlight{}
-        , inFlightFences{}
-        , mImageAvailableSemaphores{}
-        , mRenderFinishedSemaphores{}
-        , mMaxFrameCount{3}
+        , mFrameSync{nullptr}
+        , mMaxFrameCount{std::max(framesInFlight, 1u)}
         , mCommandBuffers{}
+        , mRecorder{nullptr}
+        , mActivePipeline{nullptr}
+        , mPerFrame{false}
+        , mFramePools{}
+        , mFrameCommandBuffers{}
+        , mDrawList{}
+        , mFrameDescriptorSet{VK_NULL_HANDLE}
+        , mRecordTimeMs{0.0}
+        , mGpuProfiler{nullptr}
+        , mPassRegions{}
+        , mReadback{nullptr}
+        , mFrameGraph{nullptr}
+        , mBackbuffer{0}
+        , mImageIndex{0}
+        , mTextureStreamer{nullptr}
+        , mRenderPass{VK_NULL_HANDLE}
+        , mVertexBuffer{VK_NULL_HANDLE}
+        , mIndexBuffer{VK_NULL_HANDLE}
+        , mDynamicOffsets{}
+        , mDynamicOffsetCount{0}
+        , mTextureIndex{0}
+        , mStreamedTexture{UINT32_MAX}
         , mHasIndexBuffer{false}
         , mBufferDataCount{0}
     {
@@ -77,6 +108,12 @@ namespace Homura
 
     }
 
+    void VulkanCommandBuffer::setParallelRecorder(VulkanParallelRecorderPtr recorder)
+    {
+        assert(!recorder || recorder->getFrameCount() == mCommandBuffers.size());
+        mRecorder = recorder;
+    }
+
     void VulkanCommandBuffer::create()
     {
         mCommandBuffers.resize(mSwapChain->getImageCount());
@@ -97,43 +134,61 @@ namespace Homura
         }
         mCommandBuffers.clear();
 
-        // imageInFlight and inFlightFences points to the same fences, so release it once!
-        if (inFlightFences != nullptr)
+        if (mRecorder != nullptr)
         {
-            inFlightFences->destroy();
-            inFlightFences.reset();
+            mRecorder->destroy();
+            mRecorder.reset();
         }
 
-        imageInFlight.reset();
+        // frame command buffers go with their pools
+        for (auto& pool : mFramePools)
+        {
+            pool->destroy();
+        }
+        mFramePools.clear();
+        mFrameCommandBuffers.clear();
 
-        if (mImageAvailableSemaphores != nullptr)
+        // delivers the frames still in flight before anything they use goes away
+        if (mReadback != nullptr)
         {
-            mImageAvailableSemaphores->destroy();
-            mImageAvailableSemaphores.reset();
+            mReadback->destroy();
+            mReadback.reset();
         }
-        if (mRenderFinishedSemaphores != nullptr)
+
+        if (mFrameSync != nullptr)
         {
-            mRenderFinishedSemaphores->destroy();
-            mRenderFinishedSemaphores.reset();
+            mFrameSync->destroy();
+            mFrameSync.reset();
         }
     }
 
-    void VulkanCommandBuffer::createSyncObj()
+    void VulkanCommandBuffer::setPerFrameRecording(bool enable)
     {
-        imageInFlight = std::make_shared<VulkanFences>(mDevice, mSwapChain->getImageCount());
-        inFlightFences = std::make_shared<VulkanFences>(mDevice, mMaxFrameCount);
-        inFlightFences->create();
-        mImageAvailableSemaphores = std::make_shared<VulkanSemaphores>(mDevice);
-        mImageAvailableSemaphores->create(mMaxFrameCount);
-        mRenderFinishedSemaphores = std::make_shared<VulkanSemaphores>(mDevice);
-        mRenderFinishedSemaphores->create(mMaxFrameCount);
+        mPerFrame = enable;
+        if (!enable || !mFramePools.empty())
+        {
+            return;
+        }
 
-        VkFenceCreateInfo fenceInfo{};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        // reset as a whole every frame, the command buffers are never reset one by one
+        mFramePools.resize(mMaxFrameCount);
+        mFrameCommandBuffers.resize(mMaxFrameCount);
+        for (uint32_t i = 0; i < mMaxFrameCount; i++)
+        {
+            mFramePools[i] = std::make_shared<VulkanCommandPool>(mDevice, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandBufferCount    = 1;
+            allocInfo.commandPool           = mFramePools[i]->getHandle();
+            allocInfo.level                 = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            VERIFYVULKANRESULT(vkAllocateCommandBuffers(mDevice->getHandle(), &allocInfo, &mFrameCommandBuffers[i]));
+        }
+    }
 
-        VkSemaphoreCreateInfo semaphoreInfo{};
-        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    void VulkanCommandBuffer::createSyncObj()
+    {
+        mFrameSync = std::make_shared<VulkanFrameSync>(mDevice, mMaxFrameCount, mSwapChain->getImageCount());
     }
 
     VkCommandBuffer VulkanCommandBuffer::beginSingleTimeCommands()
@@ -159,55 +214,111 @@ namespace Homura
     {
         vkEndCommandBuffer(commandBuffer);
 
-        submitSync(mDevice->getGraphicsQueue(), commandBuffer, false);
+        // freed right after, so it has to be done
+        submitSync(mDevice->getGraphicsQueue(), commandBuffer, true);
         vkFreeCommandBuffers(mDevice->getHandle(), mCommandPool->getHandle(), 1, &commandBuffer);
     }
 
     void VulkanCommandBuffer::begin()
     {
+        if (mPerFrame)
+        {
+            mDrawList.clear();
+            return;
+        }
+
         VkCommandBufferBeginInfo beginInfo{};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-        for (const auto& commandBuffer : mCommandBuffers)
-        {            
-            VERIFYVULKANRESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+        for (uint32_t i = 0; i < mCommandBuffers.size(); i++)
+        {
+            if (mRecorder)
+            {
+                mRecorder->reset(i);
+            }
+            VERIFYVULKANRESULT(vkBeginCommandBuffer(mCommandBuffers[i], &beginInfo));
+            if (mGpuProfiler)
+            {
+                mGpuProfiler->beginRecording(i, mCommandBuffers[i]);
+            }
         }
     }
 
     void VulkanCommandBuffer::beginRenderPass(VulkanRenderPassPtr renderPass)
     {
-        for (int i = 0; i < mCommandBuffers.size(); i++)
+        mRenderPass = renderPass->getHandle();
+        if (mPerFrame)
         {
-            VkRenderPassBeginInfo Info{};
-            Info.sType                      = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            Info.renderPass                 = renderPass->getHandle();
-            Info.framebuffer                = mFramebuffer->getHandle(i);
-            Info.renderArea.offset          = {0, 0};
-            Info.renderArea.extent          = mFramebuffer->getExtent();
-
-            std::vector<VkClearValue> clearValues{ 2 };
-            clearValues[0].color            = { {0.0f, 0.0f, 0.0f, 1.0f} };
-            clearValues[1].depthStencil     = { 1.0f, 0 };
+            return;
+        }
 
-            Info.clearValueCount            = static_cast<uint32_t>(clearValues.size());
-            Info.pClearValues               = clearValues.data();
-            vkCmdBeginRenderPass(mCommandBuffers[i], &Info, VK_SUBPASS_CONTENTS_INLINE);
+        const VkSubpassContents contents = mRecorder ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+        mPassRegions.assign(mCommandBuffers.size(), VulkanGpuProfiler::INVALID_REGION);
+        for (uint32_t i = 0; i < mCommandBuffers.size(); i++)
+        {
+            if (mGpuProfiler)
+            {
+                mPassRegions[i] = mGpuProfiler->beginRegion(i, mCommandBuffers[i], "render pass");
+            }
+            beginRenderPass(mCommandBuffers[i], i, contents);
         }
     }
 
+    void VulkanCommandBuffer::beginRenderPass(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkSubpassContents contents)
+    {
+        VkRenderPassBeginInfo Info{};
+        Info.sType                      = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        Info.renderPass                 = mRenderPass;
+        Info.framebuffer                = mFramebuffer->getHandle(imageIndex);
+        Info.renderArea.offset          = {0, 0};
+        Info.renderArea.extent          = mFramebuffer->getExtent();
+
+        VkClearValue clearValues[2]{};
+        clearValues[0].color            = { {0.0f, 0.0f, 0.0f, 1.0f} };
+        clearValues[1].depthStencil     = { 1.0f, 0 };
+
+        Info.clearValueCount            = 2;
+        Info.pClearValues               = clearValues;
+        vkCmdBeginRenderPass(commandBuffer, &Info, contents);
+    }
+
     void VulkanCommandBuffer::bindGraphicPipeline()
     {
+        if (mRecorder || mPerFrame)
+        {
+            return;
+        }
+        // recorded once, so there is nothing to fall back from
+        mPipeline->wait();
+        mActivePipeline = mPipeline.get();
         for (const auto& commandBuffer : mCommandBuffers)
         {
-            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mPipeline->getHandle());
+            bindPipeline(commandBuffer);
         }
     }
 
+    void VulkanCommandBuffer::bindPipeline(VkCommandBuffer commandBuffer)
+    {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mActivePipeline->getHandle());
+
+        // dynamic state of the pipeline, it always covers the whole framebuffer
+        const VkExtent2D extent = mFramebuffer->getExtent();
+        const VkViewport viewport{0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f};
+        const VkRect2D scissor{{0, 0}, extent};
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    }
+
     void VulkanCommandBuffer::bindVertexBuffer(VulkanVertexBufferPtr buffer, uint32_t count)
     {
         VkBuffer vertexBuffers[] = {buffer->getHandle()};
         VkDeviceSize offsets[] = {0};
         mBufferDataCount = count;
+        mVertexBuffer = buffer->getHandle();
+        if (mRecorder || mPerFrame)
+        {
+            return;
+        }
         for (const auto& commandBuffer : mCommandBuffers)
         {
             vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
@@ -217,28 +328,104 @@ namespace Homura
     void VulkanCommandBuffer::bindIndexBuffer(VulkanIndexBufferPtr buffer, uint32_t count)
     {
         mBufferDataCount = count;
+        mIndexBuffer = buffer->getHandle();
+        mHasIndexBuffer = true;
+        if (mRecorder || mPerFrame)
+        {
+            return;
+        }
         for (const auto& commandBuffer : mCommandBuffers)
         {
             vkCmdBindIndexBuffer(commandBuffer, buffer->getHandle(), 0, VK_INDEX_TYPE_UINT32);
         }
-        mHasIndexBuffer = true;
     }
 
-    void VulkanCommandBuffer::bindDescriptorSet()
+    void VulkanCommandBuffer::bindDescriptorSet(const std::vector<uint32_t>& dynamicOffsets, uint32_t offsetCount)
     {
         const VulkanPipelineLayoutPtr layout = mPipeline->getPipelineLayout();
         const VulkanDescriptorSetPtr descriptorSet = mPipeline->getDescriptorSet();
         assert(mCommandBuffers.size() == descriptorSet->getCount());
+        assert(dynamicOffsets.size() == mCommandBuffers.size() * offsetCount);
+        mDynamicOffsets = dynamicOffsets;
+        mDynamicOffsetCount = offsetCount;
+        if (mRecorder || mPerFrame)
+        {
+            return;
+        }
 
         std::vector<VkDescriptorSet>& desSet = descriptorSet->getData();
         for (int i = 0; i < mCommandBuffers.size(); i++)
         {
-            vkCmdBindDescriptorSets(mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, layout->getHandle(), 0, 1, &desSet[i], 0, nullptr);
+            const uint32_t* offsets = offsetCount > 0 ? &dynamicOffsets[i * offsetCount] : nullptr;
+            vkCmdBindDescriptorSets(mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, layout->getHandle(), 0, 1, &desSet[i], offsetCount, offsets);
+            bindBindless(mCommandBuffers[i]);
         }
     }
 
+    void VulkanCommandBuffer::bindTextureIndex(uint32_t textureIndex)
+    {
+        mTextureIndex = textureIndex;
+        mStreamedTexture = UINT32_MAX;
+        if (mRecorder || mPerFrame)
+        {
+            return;
+        }
+
+        assert(mActivePipeline && mActivePipeline->getBindlessTable());
+        const VulkanBindlessConstants constants{mTextureIndex};
+        const VkPushConstantRange range = VulkanBindlessTable::getPushConstantRange();
+        for (const auto& commandBuffer : mCommandBuffers)
+        {
+            vkCmdPushConstants(commandBuffer, mActivePipeline->getPipelineLayout()->getHandle(), range.stageFlags, range.offset, range.size, &constants);
+        }
+    }
+
+    void VulkanCommandBuffer::bindStreamedTexture(uint32_t texture)
+    {
+        // recorded once, a command buffer would keep sampling the version it was recorded with
+        assert(mPerFrame && mTextureStreamer);
+        mStreamedTexture = texture;
+        mTextureIndex = mTextureStreamer->getBindlessIndex(texture);
+    }
+
+    void VulkanCommandBuffer::bindBindless(VkCommandBuffer commandBuffer)
+    {
+        const VulkanBindlessTablePtr table = mActivePipeline->getBindlessTable();
+        if (!table)
+        {
+            return;
+        }
+
+        // one bind for the whole command buffer, draws only change the push constants
+        const VkPipelineLayout layout = mActivePipeline->getPipelineLayout()->getHandle();
+        const VkDescriptorSet set = table->getSet();
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, VulkanBindlessTable::BINDLESS_SET, 1, &set, 0, nullptr);
+
+        const VulkanBindlessConstants constants{mTextureIndex};
+        const VkPushConstantRange range = VulkanBindlessTable::getPushConstantRange();
+        vkCmdPushConstants(commandBuffer, layout, range.stageFlags, range.offset, range.size, &constants);
+    }
+
     void VulkanCommandBuffer::draw(uint32_t vertexCount)
     {
+        if (mPerFrame)
+        {
+            VulkanDrawCommand command;
+            command.mVertexBuffer    = mVertexBuffer;
+            command.mCount           = vertexCount;
+            command.mTextureIndex    = mTextureIndex;
+            command.mStreamedTexture = mStreamedTexture;
+            mDrawList.push_back(command);
+            return;
+        }
+        if (mRecorder)
+        {
+            // a triangle list splits into consecutive ranges, secondaries execute in order
+            drawParallel(vertexCount / 3, getTrianglesPerChunk(vertexCount / 3), [](VkCommandBuffer commandBuffer, uint32_t, uint32_t first, uint32_t count) {
+                vkCmdDraw(commandBuffer, count * 3, 1, first * 3, 0);
+            });
+            return;
+        }
         for (const auto& commandBuffer : mCommandBuffers)
         {
             vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
@@ -247,6 +434,24 @@ namespace Homura
 
     void VulkanCommandBuffer::drawIndex(uint32_t indexCount)
     {
+        if (mPerFrame)
+        {
+            VulkanDrawCommand command;
+            command.mVertexBuffer    = mVertexBuffer;
+            command.mIndexBuffer     = mIndexBuffer;
+            command.mCount           = indexCount;
+            command.mTextureIndex    = mTextureIndex;
+            command.mStreamedTexture = mStreamedTexture;
+            mDrawList.push_back(command);
+            return;
+        }
+        if (mRecorder)
+        {
+            drawParallel(indexCount / 3, getTrianglesPerChunk(indexCount / 3), [](VkCommandBuffer commandBuffer, uint32_t, uint32_t first, uint32_t count) {
+                vkCmdDrawIndexed(commandBuffer, count * 3, 1, first * 3, 0, 0);
+            });
+            return;
+        }
         for (const auto& commandBuffer : mCommandBuffers)
         {
             vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
@@ -255,6 +460,24 @@ namespace Homura
 
     void VulkanCommandBuffer::drawIndirect(VulkanVertexBufferPtr buffer)
     {
+        if (mPerFrame)
+        {
+            VulkanDrawCommand command;
+            command.mVertexBuffer    = mVertexBuffer;
+            command.mIndirectBuffer  = buffer->getHandle();
+            command.mTextureIndex    = mTextureIndex;
+            command.mStreamedTexture = mStreamedTexture;
+            mDrawList.push_back(command);
+            return;
+        }
+        if (mRecorder)
+        {
+            const VkBuffer handle = buffer->getHandle();
+            drawParallel(1, 1, [handle](VkCommandBuffer commandBuffer, uint32_t, uint32_t, uint32_t) {
+                vkCmdDrawIndirect(commandBuffer, handle, 0, 1, sizeof(VkDrawIndirectCommand));
+            });
+            return;
+        }
         for (const auto& commandBuffer : mCommandBuffers)
         {
             vkCmdDrawIndirect(commandBuffer, buffer->getHandle(), 0, 1, sizeof(VkDrawIndirectCommand));
@@ -275,22 +498,276 @@ namespace Homura
 
     void VulkanCommandBuffer::drawIndexIndirect(VulkanStagingBufferPtr buffer)
     {
+        if (mPerFrame)
+        {
+            VulkanDrawCommand command;
+            command.mVertexBuffer    = mVertexBuffer;
+            command.mIndexBuffer     = mIndexBuffer;
+            command.mIndirectBuffer  = buffer->getHandle();
+            command.mTextureIndex    = mTextureIndex;
+            command.mStreamedTexture = mStreamedTexture;
+            mDrawList.push_back(command);
+            return;
+        }
+        if (mRecorder)
+        {
+            const VkBuffer handle = buffer->getHandle();
+            drawParallel(1, 1, [handle](VkCommandBuffer commandBuffer, uint32_t, uint32_t, uint32_t) {
+                vkCmdDrawIndexedIndirect(commandBuffer, handle, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+            });
+            return;
+        }
         for (const auto& commandBuffer : mCommandBuffers)
         {
             vkCmdDrawIndexedIndirect(commandBuffer, buffer->getHandle(), 0, 1, sizeof(VkDrawIndexedIndirectCommand));
         }
     }
 
-    void VulkanCommandBuffer::endRenderPass()
+    uint32_t VulkanCommandBuffer::getTrianglesPerChunk(uint32_t triangleCount) const
     {
-        for (const auto& commandBuffer : mCommandBuffers)
+        // below that a secondary command buffer costs more than the draw it saves
+        static constexpr uint32_t MIN_TRIANGLES_PER_CHUNK = 16 * 1024;
+        const uint32_t chunkTarget = mRecorder->getWorkerCount() * 4;
+        return std::max(MIN_TRIANGLES_PER_CHUNK, (triangleCount + chunkTarget - 1) / chunkTarget);
+    }
+
+    void VulkanCommandBuffer::bindState(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+    {
+        bindPipeline(commandBuffer);
+
+        const VulkanDescriptorSetPtr descriptorSet = mPipeline->getDescriptorSet();
+        if (descriptorSet && imageIndex < descriptorSet->getData().size())
+        {
+            const uint32_t* offsets = mDynamicOffsetCount > 0 ? &mDynamicOffsets[imageIndex * mDynamicOffsetCount] : nullptr;
+            const VkDescriptorSet set = mFrameDescriptorSet != VK_NULL_HANDLE ? mFrameDescriptorSet : descriptorSet->getData()[imageIndex];
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mActivePipeline->getPipelineLayout()->getHandle(), 0, 1,
+                                    &set, mDynamicOffsetCount, offsets);
+        }
+        bindBindless(commandBuffer);
+        if (mVertexBuffer != VK_NULL_HANDLE)
+        {
+            const VkDeviceSize offset = 0;
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &mVertexBuffer, &offset);
+        }
+        if (mIndexBuffer != VK_NULL_HANDLE)
+        {
+            vkCmdBindIndexBuffer(commandBuffer, mIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        }
+    }
+
+    void VulkanCommandBuffer::drawParallel(uint32_t drawCount, uint32_t drawsPerChunk, const VulkanParallelRecorder::RecordCallback& callback)
+    {
+        if (!mRecorder)
+        {
+            // the primaries have the state bound already
+            for (uint32_t i = 0; i < mCommandBuffers.size(); i++)
+            {
+                callback(mCommandBuffers[i], i, 0, drawCount);
+            }
+            return;
+        }
+
+        assert(!mPerFrame && mRenderPass != VK_NULL_HANDLE);
+        mPipeline->wait();
+        mActivePipeline = mPipeline.get();
+        const VulkanParallelRecorder::RecordCallback record = [this, &callback](VkCommandBuffer commandBuffer, uint32_t frame, uint32_t first, uint32_t count) {
+            bindState(commandBuffer, frame);
+            callback(commandBuffer, frame, first, count);
+        };
+
+        for (uint32_t i = 0; i < mCommandBuffers.size(); i++)
+        {
+            const std::vector<VkCommandBuffer>& secondaries = mRecorder->record(i, mRenderPass, 0, mFramebuffer->getHandle(i), drawCount, drawsPerChunk, record);
+            if (!secondaries.empty())
+            {
+                vkCmdExecuteCommands(mCommandBuffers[i], static_cast<uint32_t>(secondaries.size()), secondaries.data());
+            }
+        }
+    }
+
+    void VulkanCommandBuffer::recordDraws(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count, bool profile)
+    {
+        // consecutive draws of the same mesh bind it once
+        VkBuffer vertexBuffer = VK_NULL_HANDLE;
+        VkBuffer indexBuffer = VK_NULL_HANDLE;
+        // bindState() pushed mTextureIndex already
+        const bool isBindless = mActivePipeline->getBindlessTable() != nullptr;
+        const VkPushConstantRange range = VulkanBindlessTable::getPushConstantRange();
+        uint32_t textureIndex = mTextureIndex;
+        uint32_t groupCount = 0;
+        uint32_t groupRegion = VulkanGpuProfiler::INVALID_REGION;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            const VulkanDrawCommand& command = mDrawList[i];
+            if (profile && (i == first || (command.mVertexBuffer != vertexBuffer && command.mVertexBuffer != VK_NULL_HANDLE)))
+            {
+                mGpuProfiler->endRegion(mCurrentFrame, commandBuffer, groupRegion);
+                groupRegion = mGpuProfiler->beginRegion(mCurrentFrame, commandBuffer, "draw group " + std::to_string(groupCount++));
+            }
+            if (isBindless && command.mTextureIndex != textureIndex)
+            {
+                const VulkanBindlessConstants constants{command.mTextureIndex};
+                vkCmdPushConstants(commandBuffer, mActivePipeline->getPipelineLayout()->getHandle(), range.stageFlags, range.offset, range.size, &constants);
+                textureIndex = command.mTextureIndex;
+            }
+            if (command.mVertexBuffer != vertexBuffer && command.mVertexBuffer != VK_NULL_HANDLE)
+            {
+                const VkDeviceSize offset = 0;
+                vkCmdBindVertexBuffers(commandBuffer, 0, 1, &command.mVertexBuffer, &offset);
+                vertexBuffer = command.mVertexBuffer;
+            }
+            if (command.mIndexBuffer != indexBuffer && command.mIndexBuffer != VK_NULL_HANDLE)
+            {
+                vkCmdBindIndexBuffer(commandBuffer, command.mIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+                indexBuffer = command.mIndexBuffer;
+            }
+
+            const bool indexed = command.mIndexBuffer != VK_NULL_HANDLE;
+            if (command.mIndirectBuffer != VK_NULL_HANDLE)
+            {
+                if (indexed)
+                {
+                    vkCmdDrawIndexedIndirect(commandBuffer, command.mIndirectBuffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+                }
+                else
+                {
+                    vkCmdDrawIndirect(commandBuffer, command.mIndirectBuffer, 0, 1, sizeof(VkDrawIndirectCommand));
+                }
+            }
+            else if (indexed)
+            {
+                vkCmdDrawIndexed(commandBuffer, command.mCount, command.mInstanceCount, command.mFirst, 0, 0);
+            }
+            else
+            {
+                vkCmdDraw(commandBuffer, command.mCount, command.mInstanceCount, command.mFirst, 0);
+            }
+        }
+        if (profile)
+        {
+            mGpuProfiler->endRegion(mCurrentFrame, commandBuffer, groupRegion);
+        }
+    }
+
+    void VulkanCommandBuffer::recordDrawList(VkCommandBuffer commandBuffer)
+    {
+        // mActivePipeline is what recordFrame() resolved for this frame
+        if (!mActivePipeline || mDrawList.empty())
+        {
+            return;
+        }
+        bindState(commandBuffer, mImageIndex);
+        recordDraws(commandBuffer, 0, static_cast<uint32_t>(mDrawList.size()), mGpuProfiler != nullptr);
+    }
+
+    VkCommandBuffer VulkanCommandBuffer::recordFrame(uint32_t imageIndex)
+    {
+        PROFILE_FUNCTION();
+        PROFILE_COUNTER("draws", mDrawList.size());
+        const auto start = std::chrono::steady_clock::now();
+        mImageIndex = imageIndex;
+
+        // the fence of this frame has signaled, nothing recorded from the pool is in use any more
+        mFramePools[mCurrentFrame]->reset(0);
+        VkCommandBuffer commandBuffer = mFrameCommandBuffers[mCurrentFrame];
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VERIFYVULKANRESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+        uint32_t passRegion = VulkanGpuProfiler::INVALID_REGION;
+        if (mGpuProfiler)
+        {
+            mGpuProfiler->beginRecording(mCurrentFrame, commandBuffer);
+            passRegion = mGpuProfiler->beginRegion(mCurrentFrame, commandBuffer, "render pass");
+        }
+
+        if (mTextureStreamer)
+        {
+            // draws of streamed textures sample the current version, update() may have replaced the last one
+            for (auto& command : mDrawList)
+            {
+                if (command.mStreamedTexture != UINT32_MAX)
+                {
+                    command.mTextureIndex = mTextureStreamer->use(command.mStreamedTexture);
+                }
+            }
+        }
+
+        // draws of a pipeline that is still compiling are skipped unless it has a fallback
+        mActivePipeline = mPipeline->resolve();
+        const uint32_t drawCount = mActivePipeline ? static_cast<uint32_t>(mDrawList.size()) : 0;
+        // written every frame, so changed textures don't pile up in the immutable sets. Allocated here,
+        // the workers can't touch the descriptor allocator
+        const VulkanDescriptorSetPtr descriptorSet = mPipeline->getDescriptorSet();
+        mFrameDescriptorSet = descriptorSet && drawCount > 0 ? descriptorSet->allocateFrameSet() : VK_NULL_HANDLE;
+        if (mFrameGraph)
+        {
+            // the passes record themselves, each one a region of its own
+            mFrameGraph->setImportedTexture(mBackbuffer, mSwapChain->getImage(imageIndex), mSwapChain->getImageView(imageIndex));
+            mFrameGraph->execute(commandBuffer, mGpuProfiler.get(), mCurrentFrame);
+        }
+        else if (mRecorder)
+        {
+            // secondaries of the image are free as well, waitImage() has been waited on
+            beginRenderPass(commandBuffer, imageIndex, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            mRecorder->reset(imageIndex);
+            const std::vector<VkCommandBuffer>& secondaries = mRecorder->record(imageIndex, mRenderPass, 0, mFramebuffer->getHandle(imageIndex), drawCount, 0,
+                [this](VkCommandBuffer secondary, uint32_t frame, uint32_t first, uint32_t count) {
+                    bindState(secondary, frame);
+                    recordDraws(secondary, first, count);
+                });
+            if (!secondaries.empty())
+            {
+                vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+            }
+        }
+        else
+        {
+            beginRenderPass(commandBuffer, imageIndex, VK_SUBPASS_CONTENTS_INLINE);
+            if (drawCount > 0)
+            {
+                bindState(commandBuffer, imageIndex);
+                recordDraws(commandBuffer, 0, drawCount, mGpuProfiler != nullptr);
+            }
+        }
+        if (!mFrameGraph)
         {
             vkCmdEndRenderPass(commandBuffer);
         }
+        if (mGpuProfiler)
+        {
+            mGpuProfiler->endRegion(mCurrentFrame, commandBuffer, passRegion);
+        }
+        VERIFYVULKANRESULT(vkEndCommandBuffer(commandBuffer));
+        mFrameDescriptorSet = VK_NULL_HANDLE;
+
+        mRecordTimeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return commandBuffer;
+    }
+
+    void VulkanCommandBuffer::endRenderPass()
+    {
+        if (mPerFrame)
+        {
+            return;
+        }
+        for (uint32_t i = 0; i < mCommandBuffers.size(); i++)
+        {
+            vkCmdEndRenderPass(mCommandBuffers[i]);
+            if (mGpuProfiler && i < mPassRegions.size())
+            {
+                mGpuProfiler->endRegion(i, mCommandBuffers[i], mPassRegions[i]);
+            }
+        }
     }
 
     void VulkanCommandBuffer::end()
     {
+        if (mPerFrame)
+        {
+            return;
+        }
         for (const auto& commandBuffer : mCommandBuffers)
         {
             VERIFYVULKANRESULT(vkEndCommandBuffer(commandBuffer));
@@ -304,8 +781,13 @@ namespace Homura
         submitInfo.commandBufferCount   = 1;
         submitInfo.pCommandBuffers      = &commandBuffer;
 
-        VERIFYVULKANRESULT(vkQueueSubmit(queue->getHandle(), 1, &submitInfo, isSync ? inFlightFences->getFence(mCurrentFrame) : VK_NULL_HANDLE));
-        VERIFYVULKANRESULT(vkQueueWaitIdle(queue->getHandle()));
+        // waits for this submit only, not for everything else on the queue
+        VulkanTimeline& timeline = queue->getTimeline();
+        const uint64_t value = timeline.submit(queue->getHandle(), submitInfo);
+        if (isSync)
+        {
+            timeline.wait(value);
+        }
     }
 
     void VulkanCommandBuffer::transferImageLayout(VkCommandBuffer commandBuffer, const VkImageMemoryBarrier& imageMemoryBarrier, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask)
@@ -360,46 +842,103 @@ namespace Homura
 
     void VulkanCommandBuffer::drawFrame(VulkanRHIPtr rhi)
     {
-        inFlightFences->wait(mCurrentFrame);
+        PROFILE_FUNCTION();
+        {
+            // waits for the frame mMaxFrameCount frames back only, the frames after it keep running
+            PROFILE_ZONE("wait frame");
+            mCurrentFrame = mFrameSync->beginFrame();
+        }
+        // the frame's slot is free, so are its transient descriptor sets
+        mDevice->getDescriptorAllocator().beginFrame(mCurrentFrame);
+        if (mGpuProfiler && mPerFrame)
+        {
+            // the slot's last submit is done, so are its queries
+            mGpuProfiler->resolve(mCurrentFrame);
+        }
+        VulkanUploadManager& uploadManager = mDevice->getUploadManager();
+        uploadManager.collect();
+        if (mPipeline->getBindlessTable())
+        {
+            mPipeline->getBindlessTable()->beginFrame(mCurrentFrame);
+        }
+        if (mTextureStreamer)
+        {
+            // after the table, slots retired with old versions are free again
+            PROFILE_ZONE("texture streaming");
+            mTextureStreamer->update(mCurrentFrame);
+        }
 
-        uint32_t imageIndex;
-        VkResult result = vkAcquireNextImageKHR(mDevice->getHandle(), mSwapChain->getHandle(), UINT64_MAX, mImageAvailableSemaphores->getSemaphore(mCurrentFrame), VK_NULL_HANDLE, &imageIndex);
+        VkSemaphore waitSemaphores[]        = { mFrameSync->getImageAvailableSemaphore() };
+        VkSemaphore signalSemaphores[]      = { mFrameSync->getRenderFinishedSemaphore() };
+        const bool headless = mSwapChain->isHeadless();
 
-        if (result == VK_ERROR_OUT_OF_DATE_KHR) 
+        uint32_t imageIndex;
+        VkResult result;
+        if (headless)
         {
-            rhi->recreateSwapChain();
+            // nothing to wait for, the image is free once the frames that used it are done
+            imageIndex = mSwapChain->acquireOffscreen();
         }
-        else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) 
+        else
         {
-            std::cerr << "failed to acquire swap chain image!" << std::endl;
+            {
+                PROFILE_ZONE("acquire");
+                result = vkAcquireNextImageKHR(mDevice->getHandle(), mSwapChain->getHandle(), UINT64_MAX, waitSemaphores[0], VK_NULL_HANDLE, &imageIndex);
+            }
+
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) 
+            {
+                rhi->recreateSwapChain();
+            }
+            else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) 
+            {
+                std::cerr << "failed to acquire swap chain image!" << std::endl;
+            }
         }
 
-        if (imageInFlight->getFence(imageIndex) != VK_NULL_HANDLE)
         {
-            vkWaitForFences(mDevice->getHandle(), 1, &imageInFlight->getFence(imageIndex), VK_TRUE, UINT64_MAX);
+            // the image may come back before the frame that rendered to it has finished
+            PROFILE_ZONE("wait image");
+            mFrameSync->waitImage(imageIndex);
+        }
+        if (mGpuProfiler && !mPerFrame)
+        {
+            mGpuProfiler->resolve(imageIndex);
         }
         rhi->updateUniformBuffer(imageIndex);
-        imageInFlight->setValue(inFlightFences->getEntity(mCurrentFrame), imageIndex);
+
+        // per frame recording rebuilds the commands now, otherwise those recorded for the image are reused
+        VkCommandBuffer commandBuffer = mPerFrame ? recordFrame(imageIndex) : mCommandBuffers[imageIndex];
 
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkSemaphore waitSemaphores[]        = { mImageAvailableSemaphores->getSemaphore(mCurrentFrame) };
-        VkSemaphore signalSemaphores[]      = { mRenderFinishedSemaphores->getSemaphore(mCurrentFrame) };
         VkPipelineStageFlags waitStages[]   = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        submitInfo.waitSemaphoreCount       = 1;
-        submitInfo.pWaitSemaphores          = waitSemaphores;
-        submitInfo.pWaitDstStageMask        = waitStages;
+        submitInfo.waitSemaphoreCount       = headless ? 0 : 1;
+        submitInfo.pWaitSemaphores          = headless ? nullptr : waitSemaphores;
+        submitInfo.pWaitDstStageMask        = headless ? nullptr : waitStages;
         submitInfo.commandBufferCount       = 1;
-        submitInfo.pCommandBuffers          = &mCommandBuffers[imageIndex];
-        submitInfo.signalSemaphoreCount     = 1;
-        submitInfo.pSignalSemaphores        = signalSemaphores;
+        submitInfo.pCommandBuffers          = &commandBuffer;
+        submitInfo.signalSemaphoreCount     = headless ? 0 : 1;
+        submitInfo.pSignalSemaphores        = headless ? nullptr : signalSemaphores;
 
-        vkResetFences(mDevice->getHandle(), 1, &inFlightFences->getFence(mCurrentFrame));
+        const uint64_t frame = mFrameSync->getFrameNumber();
+        {
+            // uploads of this frame go first on the graphics queue, the frame sees their results
+            PROFILE_ZONE("submit");
+            uploadManager.submit();
+            mFrameSync->submit(submitInfo, imageIndex);
+        }
 
-        if (vkQueueSubmit(mDevice->getGraphicsQueue()->getHandle(), 1, &submitInfo, inFlightFences->getFence(mCurrentFrame)) != VK_SUCCESS) 
+        if (mReadback != nullptr)
         {
-            std::cerr << "failed to submit draw command buffer!" << std::endl;
+            PROFILE_ZONE("readback");
+            mReadback->submit(imageIndex, frame);
+            mReadback->collect();
+        }
+        if (headless)
+        {
+            return;
         }
 
         VkSwapchainKHR swapChains[]         = { mSwapChain->getHandle() };
@@ -411,7 +950,10 @@ namespace Homura
         presentInfo.pSwapchains             = swapChains;
         presentInfo.pImageIndices           = &imageIndex;
 
-        result = vkQueuePresentKHR(mDevice->getPresentQueue()->getHandle(), &presentInfo);
+        {
+            PROFILE_ZONE("present");
+            result = vkQueuePresentKHR(mDevice->getPresentQueue()->getHandle(), &presentInfo);
+        }
 
         if (result == VK_ERROR_OUT_OF_DATE_KHR ||
             result == VK_SUBOPTIMAL_KHR) 
@@ -422,7 +964,5 @@ namespace Homura
         {
             std::cerr << "failed to present swap chain image!" << std::endl;
         }
-
-        mCurrentFrame = (mCurrentFrame + 1) % mMaxFrameCount;
     }
 }
\ No newline at end of file
@@ -10,13 +10,44 @@
 #include <vulkanBuffer.h>
 #include <vulkanTexture.h>
 #include <debugUtils.h>
+#include <algorithm>
+#include <iostream>
 
 namespace Homura
 {
-    VulkanDescriptorPool::VulkanDescriptorPool(VulkanDevicePtr device, uint32_t frameCount)
+    namespace
+    {
+        // descriptors per set a new pool reserves for each type, a guess at what materials use
+        struct PoolRatio
+        {
+            VkDescriptorType    mType;
+            float               mRatio;
+        };
+
+        const PoolRatio POOL_RATIOS[] = {
+            { VK_DESCRIPTOR_TYPE_SAMPLER,                   0.5f },
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,    4.0f },
+            { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,             4.0f },
+            { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,             1.0f },
+            { VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER,      1.0f },
+            { VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,      1.0f },
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,            2.0f },
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,            2.0f },
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,    2.0f },
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,    1.0f },
+            { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,          0.5f },
+        };
+
+        const uint32_t MAX_SETS_PER_POOL = 4096;
+    }
+
+    VulkanDescriptorPool::VulkanDescriptorPool(VulkanDevicePtr device, uint32_t frameCount, uint32_t setsPerPool)
         : mDevice{device}
-        , mDescriptorPool{VK_NULL_HANDLE}
         , mFrameCount{frameCount}
+        , mSetsPerPool{setsPerPool}
+        , mCurrent{VK_NULL_HANDLE}
+        , mUsedPools{}
+        , mFreePools{}
     {
         create();
     }
@@ -28,42 +59,226 @@ namespace Homura
 
     void VulkanDescriptorPool::create()
     {
-        std::vector<VkDescriptorPoolSize> poolSize{};
+        mCurrent = acquirePool();
+    }
 
-        VkDescriptorPoolSize uniformBufferSize{};
-        uniformBufferSize.type              = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        uniformBufferSize.descriptorCount   = mFrameCount;
-        poolSize.push_back(uniformBufferSize);
+    VkDescriptorPool VulkanDescriptorPool::acquirePool()
+    {
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        if (!mFreePools.empty())
+        {
+            pool = mFreePools.back();
+            mFreePools.pop_back();
+            mUsedPools.push_back(pool);
+            return pool;
+        }
 
-        VkDescriptorPoolSize textureSize{};
-        textureSize.type                    = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        textureSize.descriptorCount         = mFrameCount;
-        poolSize.push_back(textureSize);
+        VkDescriptorPoolSize poolSize[sizeof(POOL_RATIOS) / sizeof(POOL_RATIOS[0])];
+        uint32_t poolSizeCount = 0;
+        for (const auto& ratio : POOL_RATIOS)
+        {
+            poolSize[poolSizeCount].type            = ratio.mType;
+            poolSize[poolSizeCount].descriptorCount = std::max(1u, static_cast<uint32_t>(ratio.mRatio * mSetsPerPool));
+            poolSizeCount++;
+        }
 
+        // no FREE_DESCRIPTOR_SET_BIT, sets only go back with the whole pool
         VkDescriptorPoolCreateInfo createInfo{};
         createInfo.sType            = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        createInfo.poolSizeCount    = static_cast<uint32_t>(poolSize.size());
-        createInfo.pPoolSizes       = poolSize.data();
-        createInfo.maxSets          = mFrameCount;
-        createInfo.flags            = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+        createInfo.poolSizeCount    = poolSizeCount;
+        createInfo.pPoolSizes       = poolSize;
+        createInfo.maxSets          = mSetsPerPool;
+        createInfo.flags            = 0;
+
+        VERIFYVULKANRESULT(vkCreateDescriptorPool(mDevice->getHandle(), &createInfo, nullptr, &pool));
+        mUsedPools.push_back(pool);
+        mSetsPerPool = std::min(mSetsPerPool * 2, MAX_SETS_PER_POOL);
+        return pool;
+    }
+
+    bool VulkanDescriptorPool::allocate(VkDescriptorSetLayout layout, uint32_t count, VkDescriptorSet* sets)
+    {
+        if (mCurrent == VK_NULL_HANDLE)
+        {
+            mCurrent = acquirePool();
+        }
+
+        Base::ArenaVector<VkDescriptorSetLayout> layouts(count, layout, Base::ArenaAllocator<VkDescriptorSetLayout>(&mDevice->getFrameArena()));
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType                 = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool        = mCurrent;
+        allocInfo.descriptorSetCount    = count;
+        allocInfo.pSetLayouts           = layouts.data();
+
+        VkResult result = vkAllocateDescriptorSets(mDevice->getHandle(), &allocInfo, sets);
+        if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+        {
+            // the full pool stays in the chain, its sets are still in use
+            mCurrent = acquirePool();
+            allocInfo.descriptorPool = mCurrent;
+            result = vkAllocateDescriptorSets(mDevice->getHandle(), &allocInfo, sets);
+        }
+
+        if (result != VK_SUCCESS)
+        {
+            std::cerr << "failed to allocate descriptor sets!" << std::endl;
+            return false;
+        }
+        return true;
+    }
 
-        VERIFYVULKANRESULT(vkCreateDescriptorPool(mDevice->getHandle(), &createInfo, nullptr, &mDescriptorPool));
+    void VulkanDescriptorPool::reset()
+    {
+        for (auto pool : mUsedPools)
+        {
+            vkResetDescriptorPool(mDevice->getHandle(), pool, 0);
+            mFreePools.push_back(pool);
+        }
+        mUsedPools.clear();
+        mCurrent = VK_NULL_HANDLE;
     }
 
     void VulkanDescriptorPool::destroy()
     {
-        if (mDescriptorPool != VK_NULL_HANDLE)
+        for (auto pool : mUsedPools)
+        {
+            vkDestroyDescriptorPool(mDevice->getHandle(), pool, nullptr);
+        }
+        for (auto pool : mFreePools)
         {
-            vkDestroyDescriptorPool(mDevice->getHandle(), mDescriptorPool, nullptr);
-            mDescriptorPool = VK_NULL_HANDLE;
+            vkDestroyDescriptorPool(mDevice->getHandle(), pool, nullptr);
         }
+        mUsedPools.clear();
+        mFreePools.clear();
+        mCurrent = VK_NULL_HANDLE;
     }
 
-    VulkanDescriptorSet::VulkanDescriptorSet(VulkanDevicePtr device, VulkanDescriptorPoolPtr pool, VulkanDescriptorSetLayoutPtr layout)
+    VulkanDescriptorAllocator::VulkanDescriptorAllocator(VulkanDevicePtr device)
+        : mDevice{device}
+        , mFramePools{}
+        , mFrame{0}
+        , mImmutablePool{std::make_shared<VulkanDescriptorPool>(device, 1)}
+        , mImmutableSets{}
+    {
+
+    }
+
+    VulkanDescriptorAllocator::~VulkanDescriptorAllocator()
+    {
+        destroy();
+    }
+
+    void VulkanDescriptorAllocator::destroy()
+    {
+        for (auto& pool : mFramePools)
+        {
+            pool->destroy();
+        }
+        mFramePools.clear();
+        if (mImmutablePool)
+        {
+            mImmutablePool->destroy();
+            mImmutablePool.reset();
+        }
+        mImmutableSets.clear();
+    }
+
+    void VulkanDescriptorAllocator::beginFrame(uint32_t frame)
+    {
+        if (frame >= mFramePools.size())
+        {
+            mFramePools.resize(frame + 1);
+        }
+        if (!mFramePools[frame])
+        {
+            mFramePools[frame] = std::make_shared<VulkanDescriptorPool>(mDevice, 1);
+        }
+        else
+        {
+            mFramePools[frame]->reset();
+        }
+        mFrame = frame;
+    }
+
+    VkDescriptorSet VulkanDescriptorAllocator::allocateTransient(VkDescriptorSetLayout layout)
+    {
+        if (mFramePools.empty())
+        {
+            beginFrame(0);
+        }
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        mFramePools[mFrame]->allocate(layout, 1, &set);
+        return set;
+    }
+
+    VkDescriptorSet VulkanDescriptorAllocator::getImmutableSet(VkDescriptorSetLayout layout, const std::vector<VkWriteDescriptorSet>& writes)
+    {
+        // what the set holds, not where the writes came from
+        VulkanPipelineKey key;
+        key.add(layout);
+        for (const auto& write : writes)
+        {
+            key.add(write.dstBinding);
+            key.add(write.dstArrayElement);
+            key.add(write.descriptorType);
+            key.add(write.descriptorCount);
+            for (uint32_t i = 0; i < write.descriptorCount; i++)
+            {
+                if (write.pBufferInfo)
+                {
+                    key.add(write.pBufferInfo[i]);
+                }
+                if (write.pImageInfo)
+                {
+                    // field by field, the struct has tail padding
+                    key.add(write.pImageInfo[i].sampler);
+                    key.add(write.pImageInfo[i].imageView);
+                    key.add(write.pImageInfo[i].imageLayout);
+                }
+                if (write.pTexelBufferView)
+                {
+                    key.add(write.pTexelBufferView[i]);
+                }
+            }
+        }
+
+        auto it = mImmutableSets.find(key);
+        if (it != mImmutableSets.end())
+        {
+            return it->second;
+        }
+
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        if (!mImmutablePool->allocate(layout, 1, &set))
+        {
+            return VK_NULL_HANDLE;
+        }
+
+        Base::ArenaVector<VkWriteDescriptorSet> descriptorWrites(writes.begin(), writes.end(), Base::ArenaAllocator<VkWriteDescriptorSet>(&mDevice->getFrameArena()));
+        for (auto& write : descriptorWrites)
+        {
+            write.dstSet = set;
+        }
+        vkUpdateDescriptorSets(mDevice->getHandle(), static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+        mImmutableSets.emplace(std::move(key), set);
+        return set;
+    }
+
+    void VulkanDescriptorAllocator::invalidate()
+    {
+        mImmutablePool->reset();
+        mImmutableSets.clear();
+    }
+
+    VulkanDescriptorSet::VulkanDescriptorSet(VulkanDevicePtr device, VulkanDescriptorSetLayoutPtr layout, uint32_t frameCount)
         : mDevice{device}
-        , mPool{pool}
         , mLayout{layout}
+        , mFrameCount{frameCount}
         , mDescriptorSets{0}
+        , mUniformBuffers{}
+        , mSampleTextures{}
     {
         create();
     }
@@ -75,42 +290,58 @@ namespace Homura
 
     void VulkanDescriptorSet::create()
     {
-        std::vector<VkDescriptorSetLayout> layouts(mPool->getFrameCount(), mLayout->getHandle());
-        VkDescriptorSetAllocateInfo allocInfo{};
-        allocInfo.sType                 = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool        = mPool->getHandle();
-        allocInfo.descriptorSetCount    = mPool->getFrameCount();
-        allocInfo.pSetLayouts           = layouts.data();
-
-        mDescriptorSets.resize(mPool->getFrameCount());
-        VERIFYVULKANRESULT(vkAllocateDescriptorSets(mDevice->getHandle(), &allocInfo, mDescriptorSets.data()));
+        // the sets come with the first updateDescriptorSet()
+        mDescriptorSets.assign(mFrameCount, VK_NULL_HANDLE);
     }
 
     void VulkanDescriptorSet::destroy()
     {
+        // the layout and the set are shared through the device caches and go with the device
         mLayout->destroy();
-        if (!mDescriptorSets.empty())
+        mDescriptorSets.clear();
+        mUniformBuffers.clear();
+        mSampleTextures.clear();
+    }
+
+    void VulkanDescriptorSet::createWrites(VkDescriptorSet set, std::vector<VkWriteDescriptorSet>& writes)
+    {
+        writes.clear();
+        writes.reserve(mUniformBuffers.size() + mSampleTextures.size());
+        for (auto unifromBuffer : mUniformBuffers)
+        {
+            writes.push_back(unifromBuffer->createWriteDescriptorSet(set));
+        }
+
+        for (auto texture : mSampleTextures)
         {
-            vkFreeDescriptorSets(mDevice->getHandle(), mPool->getHandle(), static_cast<uint32_t >(mDescriptorSets.size()), mDescriptorSets.data());
-            mDescriptorSets.clear();
+            writes.push_back(texture->createWriteDescriptorSet(set));
         }
     }
 
     void VulkanDescriptorSet::updateDescriptorSet(std::vector<VulkanUniformBufferPtr>& uniformBuffers, std::vector<VulkanTexture2DPtr>& sampleTextures)
     {
-        for (size_t i = 0; i < mPool->getFrameCount(); i++)
-        {
-            std::vector<VkWriteDescriptorSet> descriptorWrites;
-            for (auto unifromBuffer : uniformBuffers)
-            {
-                descriptorWrites.push_back(unifromBuffer->createWriteDescriptorSet(mDescriptorSets[i]));
-            }
+        mUniformBuffers = uniformBuffers;
+        mSampleTextures = sampleTextures;
 
-            for (auto texture : sampleTextures)
-            {
-                descriptorWrites.push_back(texture->createWriteDescriptorSet(mDescriptorSets[i]));
-            }
-            vkUpdateDescriptorSets(mDevice->getHandle(), descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+        std::vector<VkWriteDescriptorSet> descriptorWrites;
+        createWrites(VK_NULL_HANDLE, descriptorWrites);
+
+        // the same resources give back the same set, so a swapchain recreation writes nothing
+        const VkDescriptorSet set = mDevice->getDescriptorAllocator().getImmutableSet(mLayout->getHandle(), descriptorWrites);
+        mDescriptorSets.assign(mFrameCount, set);
+    }
+
+    VkDescriptorSet VulkanDescriptorSet::allocateFrameSet()
+    {
+        const VkDescriptorSet set = mDevice->getDescriptorAllocator().allocateTransient(mLayout->getHandle());
+        if (set == VK_NULL_HANDLE)
+        {
+            return VK_NULL_HANDLE;
         }
+
+        std::vector<VkWriteDescriptorSet> descriptorWrites;
+        createWrites(set, descriptorWrites);
+        vkUpdateDescriptorSets(mDevice->getHandle(), static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        return set;
     }
-}
\ No newline at end of file
+}
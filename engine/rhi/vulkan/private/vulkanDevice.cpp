@@ -6,19 +6,28 @@
 #include <vulkanQueue.h>
 #include <vulkanInstance.h>
 #include <vulkanSurface.h>
+#include <algorithm>
 #include <string>
 #include <debugUtils.h>
 
 namespace Homura
 {
+    // the pipeline cache blob, written to the working directory
+    static const char* PIPELINE_CACHE_PATH = "pipelineCache.bin";
+
     VulkanDevice::VulkanDevice(VulkanInstancePtr instance, VulkanSurfacePtr surface)
         : mDevice{VK_NULL_HANDLE}
         , mPhysicalDevice{VK_NULL_HANDLE}
         , mGfxQueue{nullptr}
         , mPresent{nullptr}
+        , mTransfer{nullptr}
         , mInstance{instance}
         , mSurface{surface}
         , mMsaaSamples{VK_SAMPLE_COUNT_1_BIT}
+        , mFeatures{}
+        , mFeatures12{}
+        , mBindlessLimit{0}
+        , mFrameArena{64 * 1024, Base::MemoryTag::RHI}
     {
         create();
     }
@@ -27,12 +36,45 @@ namespace Homura
     {
         pickPhysicalDevice();
         createLogicalDevice();
+        mMemoryAllocator = std::make_unique<VulkanMemoryAllocator>(mPhysicalDevice, mDevice);
+        mPipelineCache = std::make_unique<VulkanPipelineCache>(mPhysicalDevice, mDevice, PIPELINE_CACHE_PATH);
+        mDescriptorLayoutCache = std::make_unique<VulkanDescriptorLayoutCache>(mDevice);
     }
 
     void VulkanDevice::destroy()
     {
         if (mDevice != VK_NULL_HANDLE)
         {
+            if (mUploadManager)
+            {
+                mUploadManager->destroy();
+                mUploadManager.reset();
+            }
+            if (mPipelineCache)
+            {
+                mPipelineCache->destroy();
+                mPipelineCache.reset();
+            }
+            // sets before the layouts they were allocated with
+            if (mDescriptorAllocator)
+            {
+                mDescriptorAllocator->destroy();
+                mDescriptorAllocator.reset();
+            }
+            if (mDescriptorLayoutCache)
+            {
+                mDescriptorLayoutCache->destroy();
+                mDescriptorLayoutCache.reset();
+            }
+            // the queues themselves go with the device
+            for (auto& queue : {mGfxQueue, mPresent, mTransfer})
+            {
+                if (queue)
+                {
+                    queue->getTimeline().destroy();
+                }
+            }
+            mMemoryAllocator.reset();
             vkDestroyDevice(mDevice, nullptr);
             mDevice = VK_NULL_HANDLE;
         }
@@ -43,6 +85,18 @@ namespace Homura
         vkDeviceWaitIdle(mDevice);
     }
 
+    bool VulkanDevice::isSampledFormatSupported(VkFormat format)
+    {
+        if (format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK && !isTextureCompressionBCSupported())
+        {
+            return false;
+        }
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(mPhysicalDevice, format, &properties);
+        const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        return (properties.optimalTilingFeatures & required) == required;
+    }
+
     void VulkanDevice::pickPhysicalDevice()
     {
         uint32_t deviceCount = 0;
@@ -78,6 +132,13 @@ namespace Homura
 
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         std::vector<uint32_t> queueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+        if (indices.transferFamily.has_value())
+        {
+            queueFamilies.push_back(indices.transferFamily.value());
+        }
+        // a family may be asked for once only, headless devices present on the graphics family
+        std::sort(queueFamilies.begin(), queueFamilies.end());
+        queueFamilies.erase(std::unique(queueFamilies.begin(), queueFamilies.end()), queueFamilies.end());
 
         float queuePriority = 1.0f;
         for (uint32_t queueFamily : queueFamilies)
@@ -97,13 +158,72 @@ namespace Homura
         deviceFeatures.independentBlend         = VK_TRUE;
         deviceFeatures.geometryShader           = VK_TRUE;
 
+        // optional, the GPU profiler only counts primitives and invocations when it is there
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(mPhysicalDevice, &supportedFeatures);
+        deviceFeatures.pipelineStatisticsQuery  = supportedFeatures.pipelineStatisticsQuery;
+        // optional as well, textures baked to BC formats fall back to their source image without it
+        deviceFeatures.textureCompressionBC     = supportedFeatures.textureCompressionBC;
+        mFeatures                               = deviceFeatures;
+
+        // 1.2 features are only chained when both instance and device speak 1.2
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(mPhysicalDevice, &properties);
+        const bool isVulkan12 = mInstance->getApiVersion() >= VK_API_VERSION_1_2 && properties.apiVersion >= VK_API_VERSION_1_2;
+
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType                     = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.features                  = deviceFeatures;
+        mFeatures12                         = {};
+        mFeatures12.sType                   = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        if (isVulkan12)
+        {
+            VkPhysicalDeviceVulkan12Features supported{};
+            supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+            VkPhysicalDeviceFeatures2 query{};
+            query.sType     = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            query.pNext     = &supported;
+            vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &query);
+
+            // bindless textures, all or nothing
+            if (supported.runtimeDescriptorArray && supported.descriptorBindingPartiallyBound &&
+                supported.descriptorBindingSampledImageUpdateAfterBind && supported.descriptorBindingUpdateUnusedWhilePending &&
+                supported.shaderSampledImageArrayNonUniformIndexing)
+            {
+                mFeatures12.descriptorIndexing                          = supported.descriptorIndexing;
+                mFeatures12.runtimeDescriptorArray                      = VK_TRUE;
+                mFeatures12.descriptorBindingPartiallyBound             = VK_TRUE;
+                mFeatures12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+                mFeatures12.descriptorBindingUpdateUnusedWhilePending   = VK_TRUE;
+                mFeatures12.shaderSampledImageArrayNonUniformIndexing   = VK_TRUE;
+
+                VkPhysicalDeviceVulkan12Properties properties12{};
+                properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+                VkPhysicalDeviceProperties2 properties2{};
+                properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+                properties2.pNext = &properties12;
+                vkGetPhysicalDeviceProperties2(mPhysicalDevice, &properties2);
+                // a combined image sampler counts against both the image and the sampler limits
+                mBindlessLimit = std::min({properties12.maxDescriptorSetUpdateAfterBindSampledImages,
+                                           properties12.maxDescriptorSetUpdateAfterBindSamplers,
+                                           properties12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                           properties12.maxPerStageDescriptorUpdateAfterBindSamplers});
+            }
+            // frame pacing counts on one semaphore per queue instead of fences
+            mFeatures12.timelineSemaphore = supported.timelineSemaphore;
+            features2.pNext = &mFeatures12;
+        }
+
         VkDeviceCreateInfo createInfo{};
         createInfo.sType                    = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
         createInfo.queueCreateInfoCount     = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pQueueCreateInfos        = queueCreateInfos.data();
-        createInfo.pEnabledFeatures         = &deviceFeatures;
-        createInfo.enabledExtensionCount    = static_cast<uint32_t>(deviceRequiredExtensions.size());
-        createInfo.ppEnabledExtensionNames  = deviceRequiredExtensions.data();
+        // VkPhysicalDeviceFeatures2 replaces pEnabledFeatures, a 1.0 device does not know it
+        createInfo.pNext                    = isVulkan12 ? &features2 : nullptr;
+        createInfo.pEnabledFeatures         = isVulkan12 ? nullptr : &deviceFeatures;
+        // nothing is presented without a surface, so there is no swapchain either
+        createInfo.enabledExtensionCount    = isHeadless() ? 0 : static_cast<uint32_t>(deviceRequiredExtensions.size());
+        createInfo.ppEnabledExtensionNames  = isHeadless() ? nullptr : deviceRequiredExtensions.data();
 
         if (enableValidationLayers)
         {
@@ -151,6 +271,30 @@ namespace Homura
         std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
         vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
+        for (uint32_t family = 0; family < queueFamilyCount; family++)
+        {
+            const VkQueueFlags flags = queueFamilies[family].queueFlags;
+            if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && !(flags & VK_QUEUE_COMPUTE_BIT))
+            {
+                indices.transferFamily = family;
+                break;
+            }
+        }
+
+        if (isHeadless())
+        {
+            for (uint32_t family = 0; family < queueFamilyCount; family++)
+            {
+                if (queueFamilies[family].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+                {
+                    indices.graphicsFamily = family;
+                    indices.presentFamily = family;
+                    break;
+                }
+            }
+            return indices;
+        }
+
         int i = 0;
         for (const auto &queueFamily : queueFamilies)
         {
@@ -181,6 +325,18 @@ namespace Homura
     {
         QueueFamilyIndices indices = findQueueFamilies(mPhysicalDevice);
         mGfxQueue   = std::make_shared<VulkanQueue>(shared_from_this(), indices.graphicsFamily.value());
-        mPresent    = std::make_shared<VulkanQueue>(shared_from_this(), indices.presentFamily.value());
+        // one queue of a family, so submits to it share a timeline
+        mPresent    = indices.presentFamily == indices.graphicsFamily ? mGfxQueue : std::make_shared<VulkanQueue>(shared_from_this(), indices.presentFamily.value());
+        if (indices.transferFamily.has_value())
+        {
+            mTransfer = std::make_shared<VulkanQueue>(shared_from_this(), indices.transferFamily.value());
+            mSharedQueueFamilies = {indices.graphicsFamily.value(), indices.transferFamily.value()};
+        }
+        else
+        {
+            mTransfer = mGfxQueue;
+        }
+        mUploadManager = std::make_unique<VulkanUploadManager>(shared_from_this());
+        mDescriptorAllocator = std::make_unique<VulkanDescriptorAllocator>(shared_from_this());
     }
 }
\ No newline at end of file
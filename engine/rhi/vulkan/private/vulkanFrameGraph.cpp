@@ -0,0 +1,859 @@
+//
+// Created by 最上川 on 2022/8/28/028.
+//
+
+#include <vulkanFrameGraph.h>
+#include <vulkanDevice.h>
+#include <vulkanRenderPass.h>
+#include <vulkanGpuProfiler.h>
+#include <vulkanPipelineCache.h>
+#include <debugUtils.h>
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+namespace Homura
+{
+    static constexpr VkAccessFlags WRITE_ACCESS = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+                                                  VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+    struct AccessInfo
+    {
+        VkImageLayout           mLayout;
+        VkPipelineStageFlags    mStages;
+        VkAccessFlags           mAccess;
+        VkImageUsageFlags       mUsage;
+    };
+
+    // indexed by FrameGraphAccess
+    static const AccessInfo ACCESS_INFOS[static_cast<uint32_t>(FrameGraphAccess::ACCESS_SIZE)] =
+    {
+        // ColorAttachment
+        {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+         VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT},
+        // DepthAttachment
+        {VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT},
+        // DepthRead
+        {VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT},
+        // Sampled
+        {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+         VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_USAGE_SAMPLED_BIT},
+        // StorageRead
+        {VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+         VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_USAGE_STORAGE_BIT},
+        // StorageWrite
+        {VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+         VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_USAGE_STORAGE_BIT},
+        // TransferSrc
+        {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_USAGE_TRANSFER_SRC_BIT},
+        // TransferDst
+        {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_USAGE_TRANSFER_DST_BIT},
+    };
+
+    static const AccessInfo& getAccessInfo(FrameGraphAccess access)
+    {
+        assert(access < FrameGraphAccess::ACCESS_SIZE);
+        return ACCESS_INFOS[static_cast<uint32_t>(access)];
+    }
+
+    static bool isDepthAccess(FrameGraphAccess access)
+    {
+        return access == FrameGraphAccess::DepthAttachment || access == FrameGraphAccess::DepthRead;
+    }
+
+    static bool hasStencil(VkFormat format)
+    {
+        return format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_S8_UINT;
+    }
+
+    static VkImageAspectFlags getAspectMask(VkFormat format)
+    {
+        switch (format)
+        {
+            case VK_FORMAT_D16_UNORM:
+            case VK_FORMAT_X8_D24_UNORM_PACK32:
+            case VK_FORMAT_D32_SFLOAT:
+                return VK_IMAGE_ASPECT_DEPTH_BIT;
+            case VK_FORMAT_S8_UINT:
+                return VK_IMAGE_ASPECT_STENCIL_BIT;
+            case VK_FORMAT_D16_UNORM_S8_UINT:
+            case VK_FORMAT_D24_UNORM_S8_UINT:
+            case VK_FORMAT_D32_SFLOAT_S8_UINT:
+                return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+            default:
+                return VK_IMAGE_ASPECT_COLOR_BIT;
+        }
+    }
+
+    // where imported textures go at the end of the frame
+    static AccessInfo getFinalInfo(VkImageLayout layout)
+    {
+        switch (layout)
+        {
+            case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+                return {layout, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0};
+            case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+                return getAccessInfo(FrameGraphAccess::TransferSrc);
+            case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+                return getAccessInfo(FrameGraphAccess::Sampled);
+            default:
+                return {layout, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT, 0};
+        }
+    }
+
+    VkImage FrameGraphContext::getImage(FrameGraphResource resource) const
+    {
+        return mGraph.getImage(resource);
+    }
+
+    VkImageView FrameGraphContext::getImageView(FrameGraphResource resource) const
+    {
+        return mGraph.getImageView(resource);
+    }
+
+    FrameGraphResource FrameGraphBuilder::create(const std::string& name, const FrameGraphTextureDesc& desc)
+    {
+        VulkanFrameGraph::Resource resource{};
+        resource.mName = name;
+        resource.mDesc = desc;
+        mGraph.mResources.push_back(resource);
+        return static_cast<FrameGraphResource>(mGraph.mResources.size() - 1);
+    }
+
+    void FrameGraphBuilder::read(FrameGraphResource resource, FrameGraphAccess access)
+    {
+        assert(access != FrameGraphAccess::ColorAttachment && access != FrameGraphAccess::DepthAttachment &&
+               access != FrameGraphAccess::StorageWrite && access != FrameGraphAccess::TransferDst);
+        mGraph.addUse(mPass, resource, access, false, VkClearValue{});
+    }
+
+    void FrameGraphBuilder::write(FrameGraphResource resource, FrameGraphAccess access, VkClearValue clearValue)
+    {
+        assert(access == FrameGraphAccess::ColorAttachment || access == FrameGraphAccess::DepthAttachment ||
+               access == FrameGraphAccess::StorageWrite || access == FrameGraphAccess::TransferDst);
+        mGraph.addUse(mPass, resource, access, true, clearValue);
+    }
+
+    void FrameGraphBuilder::resolve(FrameGraphResource src, FrameGraphResource dst)
+    {
+        mGraph.addUse(mPass, dst, FrameGraphAccess::ColorAttachment, true, VkClearValue{});
+        mGraph.mPasses[mPass].mResolves.emplace_back(src, dst);
+    }
+
+    void FrameGraphBuilder::setSideEffect()
+    {
+        mGraph.mPasses[mPass].mSideEffect = true;
+    }
+
+    VulkanFrameGraph::VulkanFrameGraph(VulkanDevicePtr device)
+        : mDevice{device}
+        , mResources{}
+        , mPasses{}
+        , mSlots{}
+        , mFinalBarriers{}
+        , mFinalSrcStages{0}
+        , mFinalDstStages{0}
+        , mCompiled{false}
+        , mStats{}
+    {
+
+    }
+
+    VulkanFrameGraph::~VulkanFrameGraph()
+    {
+        destroy();
+    }
+
+    void VulkanFrameGraph::destroy()
+    {
+        releaseCompiled();
+        mPasses.clear();
+        mResources.clear();
+    }
+
+    FrameGraphResource VulkanFrameGraph::importTexture(const std::string& name, const FrameGraphTextureDesc& desc, VkImage image, VkImageView imageView,
+                                                       VkImageLayout initialLayout, VkImageLayout finalLayout)
+    {
+        Resource resource{};
+        resource.mName          = name;
+        resource.mDesc          = desc;
+        resource.mImported      = true;
+        resource.mInitialLayout = initialLayout;
+        resource.mFinalLayout   = finalLayout;
+        resource.mImage         = image;
+        resource.mImageView     = imageView;
+        mResources.push_back(resource);
+        return static_cast<FrameGraphResource>(mResources.size() - 1);
+    }
+
+    void VulkanFrameGraph::setImportedTexture(FrameGraphResource resource, VkImage image, VkImageView imageView)
+    {
+        assert(resource < mResources.size() && mResources[resource].mImported);
+        mResources[resource].mImage     = image;
+        mResources[resource].mImageView = imageView;
+    }
+
+    void VulkanFrameGraph::addPass(const std::string& name, const SetupCallback& setup, const ExecuteCallback& execute)
+    {
+        Pass pass{};
+        pass.mName      = name;
+        pass.mExecute   = execute;
+        mPasses.push_back(std::move(pass));
+        mCompiled = false;
+
+        FrameGraphBuilder builder(*this, static_cast<uint32_t>(mPasses.size() - 1));
+        if (setup)
+        {
+            setup(builder);
+        }
+    }
+
+    VulkanFrameGraph::Use& VulkanFrameGraph::addUse(uint32_t pass, FrameGraphResource resource, FrameGraphAccess access, bool write, VkClearValue clearValue)
+    {
+        assert(resource < mResources.size());
+        Pass& entry = mPasses[pass];
+        for (const auto& use : entry.mUses)
+        {
+            if (use.mResource == resource)
+            {
+                std::cerr << "frame graph pass " << entry.mName << " uses " << mResources[resource].mName << " twice" << std::endl;
+            }
+        }
+        mResources[resource].mUsage |= getAccessInfo(access).mUsage;
+        entry.mUses.push_back(Use{resource, access, write, clearValue});
+        return entry.mUses.back();
+    }
+
+    void VulkanFrameGraph::compile()
+    {
+        releaseCompiled();
+        mStats = VulkanFrameGraphStats{};
+        mStats.mPassCount = static_cast<uint32_t>(mPasses.size());
+
+        cull();
+        computeLifetimes();
+        allocateTransients();
+        buildRenderPasses();
+        buildBarriers();
+        mCompiled = true;
+    }
+
+    void VulkanFrameGraph::cull()
+    {
+        for (auto& resource : mResources)
+        {
+            // the outside world reads imported textures
+            resource.mReaders = resource.mImported ? 1 : 0;
+            resource.mWriters.clear();
+        }
+        for (uint32_t i = 0; i < mPasses.size(); i++)
+        {
+            Pass& pass = mPasses[i];
+            pass.mRefCount  = 0;
+            pass.mCulled    = false;
+            for (const auto& use : pass.mUses)
+            {
+                if (use.mWrite)
+                {
+                    mResources[use.mResource].mWriters.push_back(i);
+                    pass.mRefCount++;
+                }
+                else
+                {
+                    mResources[use.mResource].mReaders++;
+                }
+            }
+        }
+
+        // textures nobody reads, their writers lose a reference each
+        std::vector<FrameGraphResource> unread;
+        for (uint32_t i = 0; i < mResources.size(); i++)
+        {
+            if (mResources[i].mReaders == 0)
+            {
+                unread.push_back(i);
+            }
+        }
+
+        auto cullPass = [this, &unread](Pass& pass) {
+            pass.mCulled = true;
+            mStats.mCulledPassCount++;
+            for (const auto& use : pass.mUses)
+            {
+                if (!use.mWrite && --mResources[use.mResource].mReaders == 0)
+                {
+                    unread.push_back(use.mResource);
+                }
+            }
+        };
+
+        for (auto& pass : mPasses)
+        {
+            if (pass.mRefCount == 0 && !pass.mSideEffect)
+            {
+                cullPass(pass);
+            }
+        }
+        while (!unread.empty())
+        {
+            const FrameGraphResource resource = unread.back();
+            unread.pop_back();
+            for (uint32_t writer : mResources[resource].mWriters)
+            {
+                Pass& pass = mPasses[writer];
+                if (!pass.mCulled && --pass.mRefCount == 0 && !pass.mSideEffect)
+                {
+                    cullPass(pass);
+                }
+            }
+        }
+    }
+
+    void VulkanFrameGraph::computeLifetimes()
+    {
+        for (auto& resource : mResources)
+        {
+            resource.mFirstPass = UINT32_MAX;
+            resource.mLastPass  = 0;
+        }
+        for (uint32_t i = 0; i < mPasses.size(); i++)
+        {
+            if (mPasses[i].mCulled)
+            {
+                continue;
+            }
+            for (const auto& use : mPasses[i].mUses)
+            {
+                Resource& resource = mResources[use.mResource];
+                resource.mFirstPass = std::min(resource.mFirstPass, i);
+                resource.mLastPass  = std::max(resource.mLastPass, i);
+            }
+        }
+    }
+
+    void VulkanFrameGraph::allocateTransients()
+    {
+        std::vector<FrameGraphResource> transients;
+        std::vector<VkMemoryRequirements> requirements(mResources.size());
+        for (uint32_t i = 0; i < mResources.size(); i++)
+        {
+            Resource& resource = mResources[i];
+            if (resource.mImported || resource.mFirstPass == UINT32_MAX)
+            {
+                continue;
+            }
+
+            VkImageCreateInfo createInfo{};
+            createInfo.sType            = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            createInfo.imageType        = VK_IMAGE_TYPE_2D;
+            createInfo.extent           = {resource.mDesc.mWidth, resource.mDesc.mHeight, 1};
+            createInfo.mipLevels        = 1;
+            createInfo.arrayLayers      = 1;
+            createInfo.format           = resource.mDesc.mFormat;
+            createInfo.tiling           = VK_IMAGE_TILING_OPTIMAL;
+            createInfo.initialLayout    = VK_IMAGE_LAYOUT_UNDEFINED;
+            createInfo.usage            = resource.mUsage;
+            createInfo.samples          = resource.mDesc.mSamples;
+            const std::vector<uint32_t>& queueFamilies = mDevice->getSharedQueueFamilies();
+            createInfo.sharingMode              = queueFamilies.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT;
+            createInfo.queueFamilyIndexCount    = static_cast<uint32_t>(queueFamilies.size());
+            createInfo.pQueueFamilyIndices      = queueFamilies.data();
+            VERIFYVULKANRESULT(vkCreateImage(mDevice->getHandle(), &createInfo, nullptr, &resource.mImage));
+
+            vkGetImageMemoryRequirements(mDevice->getHandle(), resource.mImage, &requirements[i]);
+            mStats.mTransientBytes += requirements[i].size;
+            mStats.mTransientCount++;
+            transients.push_back(i);
+        }
+
+        // largest first, smaller textures then fit into the slots of larger ones they do not overlap
+        std::sort(transients.begin(), transients.end(), [&requirements](FrameGraphResource a, FrameGraphResource b) {
+            return requirements[a].size > requirements[b].size;
+        });
+
+        for (FrameGraphResource index : transients)
+        {
+            Resource& resource = mResources[index];
+            const VkMemoryRequirements& required = requirements[index];
+            uint32_t found = UINT32_MAX;
+            for (uint32_t s = 0; s < mSlots.size() && found == UINT32_MAX; s++)
+            {
+                MemorySlot& slot = mSlots[s];
+                if ((slot.mRequirements.memoryTypeBits & required.memoryTypeBits) == 0)
+                {
+                    continue;
+                }
+                bool overlaps = false;
+                for (FrameGraphResource other : slot.mResources)
+                {
+                    if (mResources[other].mFirstPass <= resource.mLastPass && resource.mFirstPass <= mResources[other].mLastPass)
+                    {
+                        overlaps = true;
+                        break;
+                    }
+                }
+                if (!overlaps)
+                {
+                    found = s;
+                }
+            }
+
+            if (found == UINT32_MAX)
+            {
+                found = static_cast<uint32_t>(mSlots.size());
+                mSlots.push_back(MemorySlot{required, {}, {}});
+            }
+            MemorySlot& slot = mSlots[found];
+            slot.mRequirements.size             = std::max(slot.mRequirements.size, required.size);
+            slot.mRequirements.alignment        = std::max(slot.mRequirements.alignment, required.alignment);
+            slot.mRequirements.memoryTypeBits  &= required.memoryTypeBits;
+            slot.mResources.push_back(index);
+            resource.mSlot = found;
+        }
+
+        for (auto& slot : mSlots)
+        {
+            slot.mAllocation = mDevice->getMemoryAllocator().allocate(slot.mRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+            mStats.mAllocatedBytes += slot.mRequirements.size;
+
+            // the texture before each one in the slot, its last use has to finish before the next one starts
+            std::sort(slot.mResources.begin(), slot.mResources.end(), [this](FrameGraphResource a, FrameGraphResource b) {
+                return mResources[a].mFirstPass < mResources[b].mFirstPass;
+            });
+            FrameGraphResource previous = INVALID_RESOURCE;
+            for (FrameGraphResource index : slot.mResources)
+            {
+                Resource& resource = mResources[index];
+                resource.mPrevious = previous;
+                previous = index;
+                VERIFYVULKANRESULT(vkBindImageMemory(mDevice->getHandle(), resource.mImage, slot.mAllocation.mMemory, slot.mAllocation.mOffset));
+
+                VkImageViewCreateInfo viewInfo{};
+                viewInfo.sType                              = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+                viewInfo.image                              = resource.mImage;
+                viewInfo.viewType                           = VK_IMAGE_VIEW_TYPE_2D;
+                viewInfo.format                             = resource.mDesc.mFormat;
+                viewInfo.subresourceRange.aspectMask        = getAspectMask(resource.mDesc.mFormat) & ~VK_IMAGE_ASPECT_STENCIL_BIT;
+                viewInfo.subresourceRange.baseMipLevel      = 0;
+                viewInfo.subresourceRange.levelCount        = 1;
+                viewInfo.subresourceRange.baseArrayLayer    = 0;
+                viewInfo.subresourceRange.layerCount        = 1;
+                if (viewInfo.subresourceRange.aspectMask == 0)
+                {
+                    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_STENCIL_BIT;
+                }
+                VERIFYVULKANRESULT(vkCreateImageView(mDevice->getHandle(), &viewInfo, nullptr, &resource.mImageView));
+            }
+        }
+    }
+
+    void VulkanFrameGraph::buildRenderPasses()
+    {
+        for (uint32_t i = 0; i < mPasses.size(); i++)
+        {
+            Pass& pass = mPasses[i];
+            if (pass.mCulled)
+            {
+                continue;
+            }
+
+            std::vector<const Use*> colors;
+            const Use* depth = nullptr;
+            for (const auto& use : pass.mUses)
+            {
+                const bool isResolve = std::any_of(pass.mResolves.begin(), pass.mResolves.end(), [&use](const std::pair<FrameGraphResource, FrameGraphResource>& resolve) {
+                    return resolve.second == use.mResource;
+                });
+                if (use.mAccess == FrameGraphAccess::ColorAttachment && !isResolve)
+                {
+                    colors.push_back(&use);
+                }
+                else if (isDepthAccess(use.mAccess))
+                {
+                    depth = &use;
+                }
+            }
+            if (colors.empty() && !depth)
+            {
+                continue;
+            }
+
+            std::vector<VkAttachmentDescription> attachments;
+            auto addAttachment = [&](const Use& use, bool resolveTarget) -> uint32_t {
+                const Resource& resource = mResources[use.mResource];
+                const AccessInfo& info = getAccessInfo(use.mAccess);
+                // the first use of a texture without contents starts it over
+                const bool discard = i == resource.mFirstPass && (!resource.mImported || resource.mInitialLayout == VK_IMAGE_LAYOUT_UNDEFINED);
+                const bool keep = i != resource.mLastPass || resource.mImported;
+
+                VkAttachmentDescription attachment{};
+                attachment.format           = resource.mDesc.mFormat;
+                attachment.samples          = resource.mDesc.mSamples;
+                attachment.loadOp           = resolveTarget ? VK_ATTACHMENT_LOAD_OP_DONT_CARE : ((discard && use.mWrite) ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD);
+                attachment.storeOp          = keep ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                attachment.stencilLoadOp    = hasStencil(resource.mDesc.mFormat) ? attachment.loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+                attachment.stencilStoreOp   = hasStencil(resource.mDesc.mFormat) ? attachment.storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                // the transitions are barriers of their own, the pass leaves layouts alone
+                attachment.initialLayout    = info.mLayout;
+                attachment.finalLayout      = info.mLayout;
+                attachments.push_back(attachment);
+                pass.mAttachments.push_back(use.mResource);
+                pass.mClearValues.push_back(use.mClearValue);
+
+                if (pass.mAttachments.size() == 1)
+                {
+                    pass.mExtent = {resource.mDesc.mWidth, resource.mDesc.mHeight};
+                }
+                else if (pass.mExtent.width != resource.mDesc.mWidth || pass.mExtent.height != resource.mDesc.mHeight)
+                {
+                    std::cerr << "frame graph pass " << pass.mName << " has attachments of different sizes" << std::endl;
+                }
+                return static_cast<uint32_t>(attachments.size() - 1);
+            };
+
+            std::vector<VkAttachmentReference> colorReferences;
+            for (const Use* use : colors)
+            {
+                colorReferences.push_back({addAttachment(*use, false), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL});
+            }
+            VkAttachmentReference depthReference{VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED};
+            if (depth)
+            {
+                depthReference = {addAttachment(*depth, false), getAccessInfo(depth->mAccess).mLayout};
+            }
+
+            // one entry per color attachment, unused for those that are not resolved
+            std::vector<VkAttachmentReference> resolveReferences;
+            if (!pass.mResolves.empty())
+            {
+                resolveReferences.assign(colors.size(), {VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED});
+                for (const auto& resolve : pass.mResolves)
+                {
+                    auto color = std::find_if(colors.begin(), colors.end(), [&resolve](const Use* use) { return use->mResource == resolve.first; });
+                    auto target = std::find_if(pass.mUses.begin(), pass.mUses.end(), [&resolve](const Use& use) { return use.mResource == resolve.second; });
+                    if (color == colors.end() || target == pass.mUses.end())
+                    {
+                        std::cerr << "frame graph pass " << pass.mName << " resolves a texture it does not render to" << std::endl;
+                        continue;
+                    }
+                    resolveReferences[color - colors.begin()] = {addAttachment(*target, true), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+                }
+            }
+
+            VkSubpassDescription subPass{};
+            subPass.pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
+            subPass.colorAttachmentCount    = static_cast<uint32_t>(colorReferences.size());
+            subPass.pColorAttachments       = colorReferences.data();
+            subPass.pResolveAttachments     = resolveReferences.empty() ? nullptr : resolveReferences.data();
+            subPass.pDepthStencilAttachment = depth ? &depthReference : nullptr;
+
+            pass.mRenderPass = std::make_shared<VulkanRenderPass>(mDevice);
+            pass.mRenderPass->build(attachments, {subPass}, {});
+        }
+    }
+
+    void VulkanFrameGraph::transition(Pass& pass, FrameGraphResource resource, const ResourceState& next, bool write)
+    {
+        ResourceState& current = mResources[resource].mState;
+        const bool written = (current.mAccess & WRITE_ACCESS) != 0;
+        if (current.mLayout == next.mLayout && !write && !written && current.mStages != 0)
+        {
+            // reads after reads, a later write waits for all of them
+            current.mStages |= next.mStages;
+            current.mAccess |= next.mAccess;
+            return;
+        }
+
+        // only writes have to be made available, reads need the execution dependency alone
+        pass.mBarriers.push_back(Barrier{resource, current.mLayout, next.mLayout, current.mAccess & WRITE_ACCESS, next.mAccess});
+        pass.mSrcStages |= current.mStages != 0 ? current.mStages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+        pass.mDstStages |= next.mStages;
+        current = next;
+        mStats.mBarrierCount++;
+    }
+
+    void VulkanFrameGraph::buildTransitions(const std::vector<ResourceState>& slotEnds)
+    {
+        for (auto& resource : mResources)
+        {
+            resource.mState = ResourceState{};
+            if (resource.mImported)
+            {
+                // whatever touched it before the frame
+                resource.mState.mLayout = resource.mInitialLayout;
+                resource.mState.mStages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+                resource.mState.mAccess = resource.mInitialLayout == VK_IMAGE_LAYOUT_UNDEFINED ? 0 : VK_ACCESS_MEMORY_WRITE_BIT;
+            }
+        }
+
+        for (uint32_t i = 0; i < mPasses.size(); i++)
+        {
+            Pass& pass = mPasses[i];
+            if (pass.mCulled)
+            {
+                continue;
+            }
+            for (const auto& use : pass.mUses)
+            {
+                Resource& resource = mResources[use.mResource];
+                if (!resource.mImported && i == resource.mFirstPass)
+                {
+                    // the memory still belongs to the texture before it, in this frame or the one before,
+                    // wait for its last use. Its contents are gone
+                    const ResourceState& previous = resource.mPrevious != INVALID_RESOURCE ? mResources[resource.mPrevious].mState : slotEnds[resource.mSlot];
+                    resource.mState.mStages = previous.mStages;
+                    resource.mState.mAccess = previous.mAccess & WRITE_ACCESS;
+                }
+                const AccessInfo& info = getAccessInfo(use.mAccess);
+                transition(pass, use.mResource, ResourceState{info.mLayout, info.mStages, info.mAccess}, use.mWrite);
+            }
+        }
+    }
+
+    void VulkanFrameGraph::buildBarriers()
+    {
+        // Frames in flight share the transient textures, the first texture of a slot takes over from the
+        // last one of the frame before, which may still run. A frame is walked once to learn how slots end
+        const uint32_t barrierCount = mStats.mBarrierCount;
+        std::vector<ResourceState> slotEnds(mSlots.size());
+        buildTransitions(slotEnds);
+        for (uint32_t i = 0; i < mSlots.size(); i++)
+        {
+            const ResourceState& last = mResources[mSlots[i].mResources.back()].mState;
+            slotEnds[i].mStages = last.mStages;
+            slotEnds[i].mAccess = last.mAccess & WRITE_ACCESS;
+        }
+        for (auto& pass : mPasses)
+        {
+            pass.mBarriers.clear();
+            pass.mSrcStages = 0;
+            pass.mDstStages = 0;
+        }
+        mStats.mBarrierCount = barrierCount;
+        buildTransitions(slotEnds);
+
+        mFinalBarriers.clear();
+        mFinalSrcStages = 0;
+        mFinalDstStages = 0;
+        for (uint32_t i = 0; i < mResources.size(); i++)
+        {
+            Resource& resource = mResources[i];
+            if (!resource.mImported || resource.mFinalLayout == VK_IMAGE_LAYOUT_UNDEFINED || resource.mFirstPass == UINT32_MAX)
+            {
+                continue;
+            }
+            const AccessInfo info = getFinalInfo(resource.mFinalLayout);
+            const ResourceState& current = resource.mState;
+            if (current.mLayout == info.mLayout && (current.mAccess & WRITE_ACCESS) == 0)
+            {
+                continue;
+            }
+            mFinalBarriers.push_back(Barrier{i, current.mLayout, info.mLayout, current.mAccess & WRITE_ACCESS, info.mAccess});
+            mFinalSrcStages |= current.mStages;
+            mFinalDstStages |= info.mStages;
+            mStats.mBarrierCount++;
+        }
+    }
+
+    VkFramebuffer VulkanFrameGraph::getFramebuffer(Pass& pass)
+    {
+        std::vector<VkImageView> views;
+        for (FrameGraphResource resource : pass.mAttachments)
+        {
+            views.push_back(mResources[resource].mImageView);
+        }
+        const uint64_t key = hashMemory(views.data(), views.size() * sizeof(VkImageView));
+        auto it = pass.mFramebuffers.find(key);
+        if (it != pass.mFramebuffers.end())
+        {
+            return it->second;
+        }
+
+        VkFramebufferCreateInfo createInfo{};
+        createInfo.sType            = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        createInfo.renderPass       = pass.mRenderPass->getHandle();
+        createInfo.attachmentCount  = static_cast<uint32_t>(views.size());
+        createInfo.pAttachments     = views.data();
+        createInfo.width            = pass.mExtent.width;
+        createInfo.height           = pass.mExtent.height;
+        createInfo.layers           = 1;
+
+        VkFramebuffer framebuffer = VK_NULL_HANDLE;
+        VERIFYVULKANRESULT(vkCreateFramebuffer(mDevice->getHandle(), &createInfo, nullptr, &framebuffer));
+        pass.mFramebuffers[key] = framebuffer;
+        return framebuffer;
+    }
+
+    void VulkanFrameGraph::execute(VkCommandBuffer commandBuffer, VulkanGpuProfiler* profiler, uint32_t slot)
+    {
+        if (!mCompiled)
+        {
+            compile();
+        }
+
+        std::vector<VkImageMemoryBarrier> barriers;
+        auto recordBarriers = [this, commandBuffer, &barriers](const std::vector<Barrier>& list, VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages) {
+            if (list.empty())
+            {
+                return;
+            }
+            barriers.clear();
+            for (const auto& barrier : list)
+            {
+                const Resource& resource = mResources[barrier.mResource];
+                VkImageMemoryBarrier imageBarrier{};
+                imageBarrier.sType                              = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                imageBarrier.srcAccessMask                      = barrier.mSrcAccess;
+                imageBarrier.dstAccessMask                      = barrier.mDstAccess;
+                imageBarrier.oldLayout                          = barrier.mOldLayout;
+                imageBarrier.newLayout                          = barrier.mNewLayout;
+                imageBarrier.srcQueueFamilyIndex                = VK_QUEUE_FAMILY_IGNORED;
+                imageBarrier.dstQueueFamilyIndex                = VK_QUEUE_FAMILY_IGNORED;
+                imageBarrier.image                              = resource.mImage;
+                imageBarrier.subresourceRange.aspectMask        = getAspectMask(resource.mDesc.mFormat);
+                imageBarrier.subresourceRange.baseMipLevel      = 0;
+                imageBarrier.subresourceRange.levelCount        = VK_REMAINING_MIP_LEVELS;
+                imageBarrier.subresourceRange.baseArrayLayer    = 0;
+                imageBarrier.subresourceRange.layerCount        = VK_REMAINING_ARRAY_LAYERS;
+                barriers.push_back(imageBarrier);
+            }
+            vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+        };
+
+        for (auto& pass : mPasses)
+        {
+            if (pass.mCulled)
+            {
+                continue;
+            }
+
+            const uint32_t region = profiler ? profiler->beginRegion(slot, commandBuffer, pass.mName) : VulkanGpuProfiler::INVALID_REGION;
+            recordBarriers(pass.mBarriers, pass.mSrcStages, pass.mDstStages);
+            if (pass.mRenderPass)
+            {
+                VkRenderPassBeginInfo beginInfo{};
+                beginInfo.sType             = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                beginInfo.renderPass        = pass.mRenderPass->getHandle();
+                beginInfo.framebuffer       = getFramebuffer(pass);
+                beginInfo.renderArea.offset = {0, 0};
+                beginInfo.renderArea.extent = pass.mExtent;
+                beginInfo.clearValueCount   = static_cast<uint32_t>(pass.mClearValues.size());
+                beginInfo.pClearValues      = pass.mClearValues.data();
+                vkCmdBeginRenderPass(commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            }
+            if (pass.mExecute)
+            {
+                pass.mExecute(commandBuffer, FrameGraphContext(*this, pass.mRenderPass, pass.mExtent));
+            }
+            if (pass.mRenderPass)
+            {
+                vkCmdEndRenderPass(commandBuffer);
+            }
+            if (profiler)
+            {
+                profiler->endRegion(slot, commandBuffer, region);
+            }
+        }
+        recordBarriers(mFinalBarriers, mFinalSrcStages, mFinalDstStages);
+    }
+
+    VulkanRenderPassPtr VulkanFrameGraph::getRenderPass(const std::string& passName) const
+    {
+        for (const auto& pass : mPasses)
+        {
+            if (pass.mName == passName)
+            {
+                return pass.mRenderPass;
+            }
+        }
+        return nullptr;
+    }
+
+    bool VulkanFrameGraph::isCulled(const std::string& passName) const
+    {
+        for (const auto& pass : mPasses)
+        {
+            if (pass.mName == passName)
+            {
+                return pass.mCulled;
+            }
+        }
+        return true;
+    }
+
+    VkImage VulkanFrameGraph::getImage(FrameGraphResource resource) const
+    {
+        assert(resource < mResources.size());
+        return mResources[resource].mImage;
+    }
+
+    VkImageView VulkanFrameGraph::getImageView(FrameGraphResource resource) const
+    {
+        assert(resource < mResources.size());
+        return mResources[resource].mImageView;
+    }
+
+    const FrameGraphTextureDesc& VulkanFrameGraph::getDesc(FrameGraphResource resource) const
+    {
+        assert(resource < mResources.size());
+        return mResources[resource].mDesc;
+    }
+
+    void VulkanFrameGraph::releaseCompiled()
+    {
+        const bool built = !mSlots.empty() || std::any_of(mPasses.begin(), mPasses.end(), [](const Pass& pass) { return pass.mRenderPass != nullptr; });
+        if (built)
+        {
+            // command buffers of the frames in flight may still use them, a compile() between frames waits for those
+            mDevice->idle();
+        }
+        for (auto& pass : mPasses)
+        {
+            for (auto& framebuffer : pass.mFramebuffers)
+            {
+                vkDestroyFramebuffer(mDevice->getHandle(), framebuffer.second, nullptr);
+            }
+            pass.mFramebuffers.clear();
+            if (pass.mRenderPass)
+            {
+                pass.mRenderPass->destroy();
+                pass.mRenderPass.reset();
+            }
+            pass.mBarriers.clear();
+            pass.mSrcStages = 0;
+            pass.mDstStages = 0;
+            pass.mAttachments.clear();
+            pass.mClearValues.clear();
+        }
+
+        for (auto& resource : mResources)
+        {
+            if (resource.mImported)
+            {
+                continue;
+            }
+            if (resource.mImageView != VK_NULL_HANDLE)
+            {
+                vkDestroyImageView(mDevice->getHandle(), resource.mImageView, nullptr);
+                resource.mImageView = VK_NULL_HANDLE;
+            }
+            if (resource.mImage != VK_NULL_HANDLE)
+            {
+                vkDestroyImage(mDevice->getHandle(), resource.mImage, nullptr);
+                resource.mImage = VK_NULL_HANDLE;
+            }
+            resource.mSlot      = UINT32_MAX;
+            resource.mPrevious  = INVALID_RESOURCE;
+        }
+
+        for (auto& slot : mSlots)
+        {
+            mDevice->getMemoryAllocator().free(slot.mAllocation);
+        }
+        mSlots.clear();
+        mFinalBarriers.clear();
+        mCompiled = false;
+    }
+}
@@ -9,6 +9,7 @@
 #include <debugUtils.h>
 #include <vulkanDescriptorSet.h>
 #include <vulkanLayout.h>
+#include <vulkanBindless.h>
 
 namespace Homura
 {
@@ -24,8 +25,12 @@ namespace Homura
         , mColorBlendState{}
         , mDynamicState{}
         , mPipeline{VK_NULL_HANDLE}
+        , mFuture{}
+        , mFallback{nullptr}
         , mPipelineLayout{std::make_shared<VulkanPipelineLayout>(device)}
+        , mBindlessTable{nullptr}
         , mBlendAttachmentStates{}
+        , mDynamicStates{}
         , mShaders{}
         , mViewports{}
         , mScissors{}
@@ -68,9 +73,9 @@ namespace Homura
         mDepthStencilState.depthBoundsTestEnable            = VK_FALSE;
         mDepthStencilState.stencilTestEnable                = VK_FALSE;
 
-        std::vector<VkDynamicState> dynamicState{VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
-        mDynamicState.dynamicStateCount                     = static_cast<uint32_t >(dynamicState.size());
-        mDynamicState.pDynamicStates                        = dynamicState.data();
+        mDynamicStates                                      = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        mDynamicState.dynamicStateCount                     = static_cast<uint32_t >(mDynamicStates.size());
+        mDynamicState.pDynamicStates                        = mDynamicStates.data();
 
         VkPipelineColorBlendAttachmentState colorBlendState{};
         colorBlendState.colorWriteMask                      = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
@@ -86,13 +91,13 @@ namespace Homura
 
     void VulkanPipeline::destroy()
     {
+        // an async compile still reads the render pass and the layout
+        wait();
+        mFuture = VulkanPipelineFuture();
+        mFallback.reset();
+        // both owned by the pipeline cache, they are reused when the same state is built again
         mPipelineLayout->destroy();
-
-        if (mPipeline != VK_NULL_HANDLE)
-        {
-            vkDestroyPipeline(mDevice->getHandle(), mPipeline, nullptr);
-            mPipeline = VK_NULL_HANDLE;
-        }
+        mPipeline = VK_NULL_HANDLE;
     }
 
     void VulkanPipeline::setShaders(VulkanShaderPtr shaders)
@@ -111,9 +116,59 @@ namespace Homura
     }
 
     void VulkanPipeline::build(VulkanDescriptorSetPtr descriptorSet)
+    {
+        build(descriptorSet, nullptr);
+    }
+
+    void VulkanPipeline::buildAsync(VulkanDescriptorSetPtr descriptorSet, Base::JobSystem& jobSystem)
+    {
+        build(descriptorSet, &jobSystem);
+    }
+
+    bool VulkanPipeline::isReady()
+    {
+        if (mPipeline == VK_NULL_HANDLE && mFuture.isReady())
+        {
+            mPipeline = mFuture.get();
+        }
+        return mPipeline != VK_NULL_HANDLE;
+    }
+
+    void VulkanPipeline::wait()
+    {
+        if (mPipeline == VK_NULL_HANDLE && mFuture.isValid())
+        {
+            mPipeline = mFuture.wait();
+        }
+    }
+
+    VulkanPipeline* VulkanPipeline::resolve()
+    {
+        if (isReady())
+        {
+            return this;
+        }
+        return mFallback && mFallback->isReady() ? mFallback.get() : nullptr;
+    }
+
+    void VulkanPipeline::build(VulkanDescriptorSetPtr descriptorSet, Base::JobSystem* jobSystem)
     {
         mDescriptSet = descriptorSet;
-        mPipelineLayout->create(mDescriptSet->getLayout());
+        if (mBindlessTable)
+        {
+            static_assert(VulkanBindlessTable::BINDLESS_SET == 1, "the material set comes first");
+            // bindless layouts only differ in their capacity
+            VulkanPipelineKey layoutKey;
+            layoutKey.add(mDescriptSet->getLayout()->getHash());
+            layoutKey.add(mBindlessTable->getCapacity());
+            layoutKey.add(VulkanBindlessTable::getPushConstantRange());
+            mPipelineLayout->create(layoutKey, {mDescriptSet->getLayout()->getHandle(), mBindlessTable->getLayout()},
+                                    {VulkanBindlessTable::getPushConstantRange()});
+        }
+        else
+        {
+            mPipelineLayout->create(mDescriptSet->getLayout());
+        }
 
         std::vector<VkPipelineShaderStageCreateInfo> shaderCreateInfos{};
         std::vector<VulkanShaderEntityPtr>& shaders = mShaders->getShaders();
@@ -158,7 +213,7 @@ namespace Homura
         gfxPipelineInfo.pMultisampleState   = &mMultisampleState;
         gfxPipelineInfo.pDepthStencilState  = &mDepthStencilState;
         gfxPipelineInfo.pColorBlendState    = &mColorBlendState;
-        gfxPipelineInfo.pDynamicState       = nullptr;
+        gfxPipelineInfo.pDynamicState       = &mDynamicState;
         gfxPipelineInfo.layout              = mPipelineLayout->getHandle();
         gfxPipelineInfo.renderPass          = mRenderPass->getHandle();
         gfxPipelineInfo.subpass             = 0;
@@ -166,11 +221,85 @@ namespace Homura
         gfxPipelineInfo.basePipelineHandle  = VK_NULL_HANDLE;
         gfxPipelineInfo.basePipelineIndex   = -1;
 
-        if (mPipeline != VK_NULL_HANDLE)
+        VulkanPipelineCache& cache = mDevice->getPipelineCache();
+        const VulkanPipelineKey key = computeKey(shaderCreateInfos);
+        if (jobSystem)
+        {
+            // ready right away when the state is known
+            mFuture = cache.compileAsync(key, gfxPipelineInfo, *jobSystem);
+            mPipeline = mFuture.get();
+        }
+        else
+        {
+            mFuture = VulkanPipelineFuture();
+            mPipeline = cache.getOrCreate(key, gfxPipelineInfo);
+        }
+    }
+
+    VulkanPipelineKey VulkanPipeline::computeKey(const std::vector<VkPipelineShaderStageCreateInfo>& stages) const
+    {
+        VulkanPipelineKey key;
+        for (size_t i = 0; i < stages.size(); i++)
+        {
+            const VulkanShaderEntityPtr& shader = mShaders->getShaders()[i];
+            key.add(stages[i].stage);
+            key.add(shader->getCodeHash());
+            key.addData(shader->getName().data(), shader->getName().size() + 1);
+        }
+
+        for (uint32_t i = 0; i < mVertexInputState.vertexBindingDescriptionCount; i++)
+        {
+            key.add(mVertexInputState.pVertexBindingDescriptions[i]);
+        }
+        for (uint32_t i = 0; i < mVertexInputState.vertexAttributeDescriptionCount; i++)
+        {
+            key.add(mVertexInputState.pVertexAttributeDescriptions[i]);
+        }
+        key.add(mInputAssemblyState.topology);
+        key.add(mInputAssemblyState.primitiveRestartEnable);
+
+        key.add(mRasterizationState.depthClampEnable);
+        key.add(mRasterizationState.rasterizerDiscardEnable);
+        key.add(mRasterizationState.polygonMode);
+        key.add(mRasterizationState.cullMode);
+        key.add(mRasterizationState.frontFace);
+        key.add(mRasterizationState.depthBiasEnable);
+        key.add(mRasterizationState.depthBiasConstantFactor);
+        key.add(mRasterizationState.depthBiasClamp);
+        key.add(mRasterizationState.depthBiasSlopeFactor);
+        key.add(mRasterizationState.lineWidth);
+
+        key.add(mMultisampleState.rasterizationSamples);
+        key.add(mMultisampleState.sampleShadingEnable);
+        key.add(mMultisampleState.minSampleShading);
+
+        key.add(mDepthStencilState.depthTestEnable);
+        key.add(mDepthStencilState.depthWriteEnable);
+        key.add(mDepthStencilState.depthCompareOp);
+        key.add(mDepthStencilState.depthBoundsTestEnable);
+        key.add(mDepthStencilState.stencilTestEnable);
+        key.add(mDepthStencilState.front);
+        key.add(mDepthStencilState.back);
+
+        key.add(mColorBlendState.logicOpEnable);
+        key.add(mColorBlendState.logicOp);
+        for (const auto& attachment : mBlendAttachmentStates)
+        {
+            key.add(attachment);
+        }
+        key.add(mColorBlendState.blendConstants);
+        for (const auto& state : mDynamicStates)
         {
-            vkDestroyPipeline(mDevice->getHandle(), mPipeline, nullptr);
+            key.add(state);
         }
 
-        VERIFYVULKANRESULT(vkCreateGraphicsPipelines(mDevice->getHandle(), VK_NULL_HANDLE, 1, &gfxPipelineInfo, nullptr, &mPipeline));
+        // the viewport counts are fixed, their values are dynamic
+        key.add(mViewportState.viewportCount);
+        key.add(mViewportState.scissorCount);
+        key.add(mDescriptSet->getLayout()->getHash());
+        // bindless layouts only differ in their capacity
+        key.add(mBindlessTable ? mBindlessTable->getCapacity() : 0u);
+        key.add(mRenderPass->getCompatibilityHash());
+        return key;
     }
 }
\ No newline at end of file
@@ -0,0 +1,284 @@
+//
+// Created by 最上川 on 2022/8/25/025.
+//
+
+#include <vulkanGpuProfiler.h>
+#include <vulkanDevice.h>
+#include <vulkanQueue.h>
+#include <debugUtils.h>
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <iostream>
+
+namespace Homura
+{
+    // samples the rolling stats are taken over
+    static constexpr size_t HISTORY_SIZE = 120;
+
+    // in the order vkGetQueryPoolResults writes them, which is bit order
+    static constexpr VkQueryPipelineStatisticFlags STATISTIC_FLAGS = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+                                                                     VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+                                                                     VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+                                                                     VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+                                                                     VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+                                                                     VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+    static constexpr uint32_t STATISTIC_COUNT = 6;
+
+    VulkanGpuProfiler::VulkanGpuProfiler(VulkanDevicePtr device, uint32_t slotCount, uint32_t maxRegions, bool pipelineStatistics)
+        : mDevice{device}
+        , mSlotCount{slotCount}
+        , mMaxRegions{maxRegions}
+        , mWantStatistics{pipelineStatistics}
+        , mEnabled{false}
+        , mTimestampPeriod{1.0}
+        , mTimestampMask{~0ull}
+        , mTimestampPool{}
+        , mStatisticsPool{}
+        , mSlots{}
+        , mStats{}
+        , mHistory{}
+        , mDumpInterval{0}
+        , mResolveCount{0}
+    {
+        create();
+    }
+
+    VulkanGpuProfiler::~VulkanGpuProfiler()
+    {
+        destroy();
+    }
+
+    void VulkanGpuProfiler::create()
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(mDevice->getPhysicalHandle(), &properties);
+
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(mDevice->getPhysicalHandle(), &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(mDevice->getPhysicalHandle(), &familyCount, families.data());
+
+        const uint32_t validBits = families[mDevice->getGraphicsQueue()->getFamilyIndex()].timestampValidBits;
+        if (validBits == 0 || properties.limits.timestampPeriod <= 0.0f)
+        {
+            std::cerr << "graphics queue has no timestamps, GPU profiling is off" << std::endl;
+            return;
+        }
+        mEnabled            = true;
+        mTimestampPeriod    = properties.limits.timestampPeriod;
+        mTimestampMask      = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+        VkQueryPoolCreateInfo timestampInfo{};
+        timestampInfo.sType         = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        timestampInfo.queryType     = VK_QUERY_TYPE_TIMESTAMP;
+        timestampInfo.queryCount    = mMaxRegions * 2;
+
+        mTimestampPool.resize(mSlotCount);
+        for (auto& pool : mTimestampPool)
+        {
+            VERIFYVULKANRESULT(vkCreateQueryPool(mDevice->getHandle(), &timestampInfo, nullptr, &pool));
+        }
+
+        if (mWantStatistics && mDevice->getEnabledFeatures().pipelineStatisticsQuery)
+        {
+            VkQueryPoolCreateInfo statisticsInfo{};
+            statisticsInfo.sType                = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            statisticsInfo.queryType            = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+            statisticsInfo.queryCount           = mMaxRegions;
+            statisticsInfo.pipelineStatistics   = STATISTIC_FLAGS;
+
+            mStatisticsPool.resize(mSlotCount);
+            for (auto& pool : mStatisticsPool)
+            {
+                VERIFYVULKANRESULT(vkCreateQueryPool(mDevice->getHandle(), &statisticsInfo, nullptr, &pool));
+            }
+        }
+        mSlots.resize(mSlotCount);
+    }
+
+    void VulkanGpuProfiler::destroy()
+    {
+        for (auto pool : mTimestampPool)
+        {
+            vkDestroyQueryPool(mDevice->getHandle(), pool, nullptr);
+        }
+        for (auto pool : mStatisticsPool)
+        {
+            vkDestroyQueryPool(mDevice->getHandle(), pool, nullptr);
+        }
+        mTimestampPool.clear();
+        mStatisticsPool.clear();
+        mSlots.clear();
+        mEnabled = false;
+    }
+
+    void VulkanGpuProfiler::beginRecording(uint32_t slot, VkCommandBuffer commandBuffer)
+    {
+        if (!mEnabled || slot >= mSlotCount)
+        {
+            return;
+        }
+        mSlots[slot].mRegions.clear();
+        mSlots[slot].mOpen = 0;
+        mSlots[slot].mRecorded = true;
+
+        // queries have to be reset before every use, the command buffer does it each time it runs
+        vkCmdResetQueryPool(commandBuffer, mTimestampPool[slot], 0, mMaxRegions * 2);
+        if (hasPipelineStatistics())
+        {
+            vkCmdResetQueryPool(commandBuffer, mStatisticsPool[slot], 0, mMaxRegions);
+        }
+    }
+
+    uint32_t VulkanGpuProfiler::beginRegion(uint32_t slot, VkCommandBuffer commandBuffer, const std::string& name)
+    {
+        if (!mEnabled || slot >= mSlotCount)
+        {
+            return INVALID_REGION;
+        }
+
+        Slot& entry = mSlots[slot];
+        if (entry.mRegions.size() >= mMaxRegions)
+        {
+            return INVALID_REGION;
+        }
+
+        const uint32_t index = static_cast<uint32_t>(entry.mRegions.size());
+        // one pipeline statistics query of a pool may be active at a time
+        const bool hasStatistics = hasPipelineStatistics() && entry.mOpen == 0;
+        entry.mRegions.push_back(Region{name, index, hasStatistics, false});
+        entry.mOpen++;
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, mTimestampPool[slot], index * 2);
+        if (hasStatistics)
+        {
+            vkCmdBeginQuery(commandBuffer, mStatisticsPool[slot], index, 0);
+        }
+        return index;
+    }
+
+    void VulkanGpuProfiler::endRegion(uint32_t slot, VkCommandBuffer commandBuffer, uint32_t region)
+    {
+        if (!mEnabled || slot >= mSlotCount || region == INVALID_REGION)
+        {
+            return;
+        }
+
+        Slot& entry = mSlots[slot];
+        Region& current = entry.mRegions[region];
+        assert(!current.mEnded);
+        if (current.mHasStatistics)
+        {
+            vkCmdEndQuery(commandBuffer, mStatisticsPool[slot], current.mIndex);
+        }
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, mTimestampPool[slot], current.mIndex * 2 + 1);
+        current.mEnded = true;
+        entry.mOpen--;
+    }
+
+    void VulkanGpuProfiler::resolve(uint32_t slot)
+    {
+        if (!mEnabled || slot >= mSlotCount || !mSlots[slot].mRecorded || mSlots[slot].mRegions.empty())
+        {
+            return;
+        }
+
+        const std::vector<Region>& regions = mSlots[slot].mRegions;
+        const uint32_t regionCount = static_cast<uint32_t>(regions.size());
+
+        // value and availability per query, a region whose queries are not there yet is skipped
+        std::vector<uint64_t> timestamps(regionCount * 2 * 2);
+        const VkResult result = vkGetQueryPoolResults(mDevice->getHandle(), mTimestampPool[slot], 0, regionCount * 2, timestamps.size() * sizeof(uint64_t), timestamps.data(),
+                                                      sizeof(uint64_t) * 2, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if (result != VK_SUCCESS && result != VK_NOT_READY)
+        {
+            return;
+        }
+
+        std::vector<uint64_t> statistics;
+        if (hasPipelineStatistics())
+        {
+            statistics.resize(regionCount * (STATISTIC_COUNT + 1));
+            const VkResult statisticsResult = vkGetQueryPoolResults(mDevice->getHandle(), mStatisticsPool[slot], 0, regionCount, statistics.size() * sizeof(uint64_t), statistics.data(),
+                                                                    sizeof(uint64_t) * (STATISTIC_COUNT + 1), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+            if (statisticsResult != VK_SUCCESS && statisticsResult != VK_NOT_READY)
+            {
+                statistics.clear();
+            }
+        }
+
+        for (const auto& region : regions)
+        {
+            const uint64_t* begin = &timestamps[region.mIndex * 4];
+            const uint64_t* end = begin + 2;
+            if (!region.mEnded || begin[1] == 0 || end[1] == 0)
+            {
+                continue;
+            }
+
+            const uint64_t ticks = ((end[0] & mTimestampMask) - (begin[0] & mTimestampMask)) & mTimestampMask;
+            const double ms = static_cast<double>(ticks) * mTimestampPeriod / 1000000.0;
+
+            std::vector<double>& history = mHistory[region.mName];
+            if (history.size() == HISTORY_SIZE)
+            {
+                history.erase(history.begin());
+            }
+            history.push_back(ms);
+
+            VulkanGpuRegionStats& stats = mStats[region.mName];
+            stats.mLastMs       = ms;
+            stats.mMinMs        = *std::min_element(history.begin(), history.end());
+            stats.mMaxMs        = *std::max_element(history.begin(), history.end());
+            double sum = 0.0;
+            for (double sample : history)
+            {
+                sum += sample;
+            }
+            stats.mAverageMs    = sum / static_cast<double>(history.size());
+            stats.mSamples++;
+
+            const uint64_t* values = statistics.empty() ? nullptr : &statistics[region.mIndex * (STATISTIC_COUNT + 1)];
+            if (region.mHasStatistics && values && values[STATISTIC_COUNT] != 0)
+            {
+                stats.mInputAssemblyVertices        = values[0];
+                stats.mInputAssemblyPrimitives      = values[1];
+                stats.mVertexShaderInvocations      = values[2];
+                stats.mClippingInvocations          = values[3];
+                stats.mClippingPrimitives           = values[4];
+                stats.mFragmentShaderInvocations    = values[5];
+            }
+        }
+
+        mResolveCount++;
+        if (mDumpInterval > 0 && mResolveCount % mDumpInterval == 0)
+        {
+            dump(std::cout);
+        }
+    }
+
+    double VulkanGpuProfiler::getRegionMs(const std::string& name) const
+    {
+        auto it = mStats.find(name);
+        return it != mStats.end() ? it->second.mAverageMs : 0.0;
+    }
+
+    void VulkanGpuProfiler::dump(std::ostream& out) const
+    {
+        out << "gpu regions, last " << HISTORY_SIZE << " samples (ms)" << std::endl;
+        out << std::fixed << std::setprecision(3);
+        for (const auto& entry : mStats)
+        {
+            const VulkanGpuRegionStats& stats = entry.second;
+            out << "  " << std::left << std::setw(24) << entry.first << std::right
+                << " avg " << stats.mAverageMs << " min " << stats.mMinMs << " max " << stats.mMaxMs << " last " << stats.mLastMs;
+            if (hasPipelineStatistics())
+            {
+                out << " | vs " << stats.mVertexShaderInvocations << " prims " << stats.mClippingPrimitives << " fs " << stats.mFragmentShaderInvocations;
+            }
+            out << std::endl;
+        }
+        out << std::defaultfloat;
+    }
+}
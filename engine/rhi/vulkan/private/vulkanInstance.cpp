@@ -6,8 +6,10 @@
 
 namespace Homura
 {
-    VulkanInstance::VulkanInstance()
+    VulkanInstance::VulkanInstance(bool headless)
         : mInstance{VK_NULL_HANDLE}
+        , mApiVersion{VK_API_VERSION_1_0}
+        , mHeadless{headless}
     {
         create();
     }
@@ -23,13 +25,22 @@ namespace Homura
         {
             throw std::runtime_error("validation layers requested, but not available!");
         }
+        // 1.2 when the loader has it, descriptor indexing and timeline semaphores are core there.
+        // A 1.0 loader has no vkEnumerateInstanceVersion and rejects anything above 1.0
+        auto enumerateInstanceVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion"));
+        uint32_t loaderVersion = VK_API_VERSION_1_0;
+        if (enumerateInstanceVersion && enumerateInstanceVersion(&loaderVersion) == VK_SUCCESS)
+        {
+            mApiVersion = loaderVersion >= VK_API_VERSION_1_2 ? VK_API_VERSION_1_2 : VK_API_VERSION_1_0;
+        }
+
         VkApplicationInfo appInfo{};
         appInfo.sType               = VK_STRUCTURE_TYPE_APPLICATION_INFO;
         appInfo.pApplicationName    = "Homura";
         appInfo.applicationVersion  = VK_MAKE_VERSION(1, 0, 0);
         appInfo.pEngineName         = "Homura";
         appInfo.engineVersion       = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion          = VK_API_VERSION_1_0;
+        appInfo.apiVersion          = mApiVersion;
 
         VkInstanceCreateInfo createInfo = {};
         createInfo.sType            = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -68,10 +79,13 @@ namespace Homura
 
     std::vector<const char*> VulkanInstance::getRequiredExtensions()
     {
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-        std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        std::vector<const char*> extensions;
+        if (!mHeadless)
+        {
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+            extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
 
         if (mEnableValidationLayer)
         {
@@ -4,35 +4,101 @@
 
 #include <vulkanLayout.h>
 #include <vulkanDevice.h>
+#include <vulkanPipelineCache.h>
 #include <debugUtils.h>
+#include <algorithm>
 
 namespace Homura
 {
-    VulkanDescriptorSetLayout::VulkanDescriptorSetLayout(VulkanDevicePtr device)
+    VulkanDescriptorLayoutCache::VulkanDescriptorLayoutCache(VkDevice device)
         : mDevice{device}
-        , mSetLayout{VK_NULL_HANDLE}
+        , mMutex{}
+        , mLayouts{}
     {
 
     }
 
-    void VulkanDescriptorSetLayout::create(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+    VulkanDescriptorLayoutCache::~VulkanDescriptorLayoutCache()
+    {
+        destroy();
+    }
+
+    void VulkanDescriptorLayoutCache::destroy()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto& layout : mLayouts)
+        {
+            vkDestroyDescriptorSetLayout(mDevice, layout.second, nullptr);
+        }
+        mLayouts.clear();
+    }
+
+    VulkanPipelineKey VulkanDescriptorLayoutCache::createKey(std::vector<VkDescriptorSetLayoutBinding>& bindings)
     {
+        std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b)
+        {
+            return a.binding < b.binding;
+        });
+
+        VulkanPipelineKey key;
+        for (const auto& binding : bindings)
+        {
+            key.add(binding.binding);
+            key.add(binding.descriptorType);
+            key.add(binding.descriptorCount);
+            key.add(binding.stageFlags);
+            if (binding.pImmutableSamplers)
+            {
+                key.addData(binding.pImmutableSamplers, sizeof(VkSampler) * binding.descriptorCount);
+            }
+        }
+        return key;
+    }
+
+    VkDescriptorSetLayout VulkanDescriptorLayoutCache::getOrCreate(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+    {
+        std::vector<VkDescriptorSetLayoutBinding> sorted = bindings;
+        VulkanPipelineKey key = createKey(sorted);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mLayouts.find(key);
+        if (it != mLayouts.end())
+        {
+            return it->second;
+        }
+
         VkDescriptorSetLayoutCreateInfo createInfo{};
         createInfo.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        createInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-        createInfo.pBindings    = bindings.data();
+        createInfo.bindingCount = static_cast<uint32_t>(sorted.size());
+        createInfo.pBindings    = sorted.data();
         createInfo.pNext        = nullptr;
 
-        VERIFYVULKANRESULT(vkCreateDescriptorSetLayout(mDevice->getHandle(), &createInfo, nullptr, &mSetLayout));
+        VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+        VERIFYVULKANRESULT(vkCreateDescriptorSetLayout(mDevice, &createInfo, nullptr, &layout));
+        mLayouts.emplace(std::move(key), layout);
+        return layout;
+    }
+
+    VulkanDescriptorSetLayout::VulkanDescriptorSetLayout(VulkanDevicePtr device)
+        : mDevice{device}
+        , mSetLayout{VK_NULL_HANDLE}
+        , mHash{0}
+    {
+
+    }
+
+    void VulkanDescriptorSetLayout::create(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+    {
+        // the same key the cache finds the handle with
+        std::vector<VkDescriptorSetLayoutBinding> sorted = bindings;
+        mHash = VulkanDescriptorLayoutCache::createKey(sorted).getHash();
+
+        mSetLayout = mDevice->getDescriptorLayoutCache().getOrCreate(bindings);
     }
 
     void VulkanDescriptorSetLayout::destroy()
     {
-        if (mSetLayout != VK_NULL_HANDLE)
-        {
-            vkDestroyDescriptorSetLayout(mDevice->getHandle(), mSetLayout, nullptr);
-            mSetLayout = VK_NULL_HANDLE;
-        }
+        mSetLayout = VK_NULL_HANDLE;
     }
 
     VulkanPipelineLayout::VulkanPipelineLayout(VulkanDevicePtr device)
@@ -43,21 +109,26 @@ namespace Homura
     }
 
     void VulkanPipelineLayout::create(VulkanDescriptorSetLayoutPtr descriptorSetLayout)
+    {
+        VulkanPipelineKey key;
+        key.add(descriptorSetLayout->getHash());
+        create(key, {descriptorSetLayout->getHandle()}, {});
+    }
+
+    void VulkanPipelineLayout::create(const VulkanPipelineKey& key, const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstantRanges)
     {
         VkPipelineLayoutCreateInfo createInfo{};
-        createInfo.sType            = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        createInfo.setLayoutCount   = 1;
-        createInfo.pSetLayouts      = &descriptorSetLayout->getHandle();
+        createInfo.sType                    = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        createInfo.setLayoutCount           = static_cast<uint32_t>(setLayouts.size());
+        createInfo.pSetLayouts              = setLayouts.data();
+        createInfo.pushConstantRangeCount   = static_cast<uint32_t>(pushConstantRanges.size());
+        createInfo.pPushConstantRanges      = pushConstantRanges.data();
 
-        VERIFYVULKANRESULT(vkCreatePipelineLayout(mDevice->getHandle(), &createInfo, nullptr, &mPipelineLayout));
+        mPipelineLayout = mDevice->getPipelineCache().getOrCreateLayout(key, createInfo);
     }
 
     void VulkanPipelineLayout::destroy()
     {
-        if (mPipelineLayout != VK_NULL_HANDLE)
-        {
-            vkDestroyPipelineLayout(mDevice->getHandle(), mPipelineLayout, nullptr);
-            mPipelineLayout = VK_NULL_HANDLE;
-        }
+        mPipelineLayout = VK_NULL_HANDLE;
     }
 }
\ No newline at end of file
@@ -0,0 +1,430 @@
+//
+// Created by 最上川 on 2022/8/20/020.
+//
+
+#include <vulkanMemory.h>
+#include <debugUtils.h>
+#include <algorithm>
+#include <unordered_map>
+
+namespace Homura
+{
+    struct VulkanMemoryBlock
+    {
+        struct Record
+        {
+            void*           mUserData;
+            VkDeviceSize    mAlign;
+        };
+
+        VulkanMemoryBlock(VkDeviceSize size)
+            : mMemory{VK_NULL_HANDLE}
+            , mMemoryType{0}
+            , mLinear{false}
+            , mMapped{nullptr}
+            , mAllocator{size}
+        {
+
+        }
+
+        VkDeviceMemory                          mMemory;
+        uint32_t                                mMemoryType;
+        bool                                    mLinear;
+        char*                                   mMapped;
+        Base::TlsfAllocator                     mAllocator;
+        // allocations that can be moved, keyed by the tlsf handle
+        std::unordered_map<void*, Record>       mRecords;
+    };
+
+    VulkanMemoryAllocator::VulkanMemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize)
+        : mDevice{device}
+        , mMemoryProperties{}
+        , mBufferImageGranularity{1}
+        , mNonCoherentAtomSize{1}
+        , mMaxAllocationCount{UINT32_MAX}
+        , mBlockSizes{}
+        , mSeparateLinear{false}
+        , mDeviceAllocationCount{0}
+        , mDedicatedCount{0}
+        , mDedicatedBytes{0}
+    {
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &mMemoryProperties);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        mBufferImageGranularity = properties.limits.bufferImageGranularity;
+        mNonCoherentAtomSize    = properties.limits.nonCoherentAtomSize;
+        mMaxAllocationCount     = properties.limits.maxMemoryAllocationCount;
+        mSeparateLinear         = mBufferImageGranularity > 1;
+
+        for (uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; i++)
+        {
+            // small heaps, e.g. the 256MB host visible device local one, get smaller blocks
+            const VkDeviceSize heapSize = mMemoryProperties.memoryHeaps[mMemoryProperties.memoryTypes[i].heapIndex].size;
+            mBlockSizes[i] = std::min(blockSize, heapSize / 8);
+        }
+    }
+
+    VulkanMemoryAllocator::~VulkanMemoryAllocator()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        uint32_t liveCount = mDedicatedCount;
+        for (auto& type : mPools)
+        {
+            for (auto& pool : type)
+            {
+                for (VulkanMemoryBlock* block : pool.mBlocks)
+                {
+                    liveCount += block->mAllocator.getAllocationCount();
+                    destroyBlock(block);
+                }
+                pool.mBlocks.clear();
+            }
+        }
+
+        if (liveCount > 0)
+        {
+            std::cerr << "VulkanMemoryAllocator destroyed with " << liveCount << " live allocations" << std::endl;
+        }
+    }
+
+    uint32_t VulkanMemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+    {
+        for (uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; ++i)
+        {
+            if ((typeFilter & (1 << i)) && (mMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    bool VulkanMemoryAllocator::isHostVisible(uint32_t memoryType) const
+    {
+        return mMemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    }
+
+    VkDeviceSize VulkanMemoryAllocator::getAlignment(uint32_t memoryType, VkDeviceSize alignment) const
+    {
+        // flushes are rounded to nonCoherentAtomSize, neighbours must not share an atom
+        const VkMemoryPropertyFlags flags = mMemoryProperties.memoryTypes[memoryType].propertyFlags;
+        if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        {
+            return std::max(alignment, mNonCoherentAtomSize);
+        }
+        return std::max<VkDeviceSize>(alignment, 1);
+    }
+
+    VulkanMemoryAllocator::Pool& VulkanMemoryAllocator::getPool(uint32_t memoryType, bool linear)
+    {
+        return mPools[memoryType][mSeparateLinear && linear ? 1 : 0];
+    }
+
+    VulkanMemoryBlock* VulkanMemoryAllocator::createBlock(uint32_t memoryType, bool linear, VkDeviceSize size)
+    {
+        if (mDeviceAllocationCount >= mMaxAllocationCount)
+        {
+            return nullptr;
+        }
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType             = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize    = size;
+        allocInfo.memoryTypeIndex   = memoryType;
+
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        if (vkAllocateMemory(mDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        {
+            return nullptr;
+        }
+        mDeviceAllocationCount++;
+
+        VulkanMemoryBlock* block = new VulkanMemoryBlock(size);
+        block->mMemory      = memory;
+        block->mMemoryType  = memoryType;
+        block->mLinear      = linear;
+        if (isHostVisible(memoryType))
+        {
+            void* mapped = nullptr;
+            VERIFYVULKANRESULT(vkMapMemory(mDevice, memory, 0, VK_WHOLE_SIZE, 0, &mapped));
+            block->mMapped = static_cast<char*>(mapped);
+        }
+        return block;
+    }
+
+    void VulkanMemoryAllocator::destroyBlock(VulkanMemoryBlock* block)
+    {
+        if (block->mMapped)
+        {
+            vkUnmapMemory(mDevice, block->mMemory);
+        }
+        vkFreeMemory(mDevice, block->mMemory, nullptr);
+        mDeviceAllocationCount--;
+        delete block;
+    }
+
+    bool VulkanMemoryAllocator::allocateFromBlock(VulkanMemoryBlock* block, VkDeviceSize size, VkDeviceSize align, void* userData, VulkanAllocation& allocation)
+    {
+        const Base::TlsfAllocator::Allocation range = block->mAllocator.allocate(size, align);
+        if (!range.isValid())
+        {
+            return false;
+        }
+        if (userData)
+        {
+            block->mRecords[range.mHandle] = {userData, align};
+        }
+
+        allocation.mMemory      = block->mMemory;
+        allocation.mOffset      = range.mOffset;
+        allocation.mSize        = range.mSize;
+        allocation.mMapped      = block->mMapped ? block->mMapped + range.mOffset : nullptr;
+        allocation.mMemoryType  = block->mMemoryType;
+        allocation.mBlock       = block;
+        allocation.mRange       = range;
+        return true;
+    }
+
+    VulkanAllocation VulkanMemoryAllocator::allocateDedicated(uint32_t memoryType, VkDeviceSize size)
+    {
+        VulkanAllocation allocation;
+        if (mDeviceAllocationCount >= mMaxAllocationCount)
+        {
+            std::cerr << "maxMemoryAllocationCount reached!" << std::endl;
+            return allocation;
+        }
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType             = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize    = size;
+        allocInfo.memoryTypeIndex   = memoryType;
+
+        VERIFYVULKANRESULT(vkAllocateMemory(mDevice, &allocInfo, nullptr, &allocation.mMemory));
+        if (allocation.mMemory == VK_NULL_HANDLE)
+        {
+            return allocation;
+        }
+        if (isHostVisible(memoryType))
+        {
+            VERIFYVULKANRESULT(vkMapMemory(mDevice, allocation.mMemory, 0, VK_WHOLE_SIZE, 0, &allocation.mMapped));
+        }
+
+        allocation.mSize        = size;
+        allocation.mMemoryType  = memoryType;
+        mDeviceAllocationCount++;
+        mDedicatedCount++;
+        mDedicatedBytes += size;
+        return allocation;
+    }
+
+    VulkanAllocation VulkanMemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, void* userData)
+    {
+        const uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+        if (memoryType == UINT32_MAX)
+        {
+            std::cerr << "failed to find suitable memory type!" << std::endl;
+            return {};
+        }
+        const VkDeviceSize align = getAlignment(memoryType, requirements.alignment);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        // large resources would waste most of a block, they get their own memory
+        const VkDeviceSize blockSize = mBlockSizes[memoryType];
+        if (requirements.size > blockSize / 2)
+        {
+            return allocateDedicated(memoryType, requirements.size);
+        }
+
+        VulkanAllocation allocation;
+        Pool& pool = getPool(memoryType, linear);
+        for (VulkanMemoryBlock* block : pool.mBlocks)
+        {
+            if (allocateFromBlock(block, requirements.size, align, userData, allocation))
+            {
+                return allocation;
+            }
+        }
+
+        VulkanMemoryBlock* block = createBlock(memoryType, linear, blockSize);
+        if (!block)
+        {
+            return allocateDedicated(memoryType, requirements.size);
+        }
+        pool.mBlocks.push_back(block);
+        allocateFromBlock(block, requirements.size, align, userData, allocation);
+        return allocation;
+    }
+
+    VulkanAllocation VulkanMemoryAllocator::allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties, void* userData)
+    {
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(mDevice, buffer, &memRequirements);
+        return allocate(memRequirements, properties, true, userData);
+    }
+
+    VulkanAllocation VulkanMemoryAllocator::allocateImage(VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags properties, void* userData)
+    {
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(mDevice, image, &memRequirements);
+        return allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR, userData);
+    }
+
+    void VulkanMemoryAllocator::free(VulkanAllocation& allocation)
+    {
+        if (!allocation.isValid())
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        freeLocked(allocation);
+    }
+
+    void VulkanMemoryAllocator::freeLocked(VulkanAllocation& allocation)
+    {
+        VulkanMemoryBlock* block = allocation.mBlock;
+        if (!block)
+        {
+            if (allocation.mMapped)
+            {
+                vkUnmapMemory(mDevice, allocation.mMemory);
+            }
+            vkFreeMemory(mDevice, allocation.mMemory, nullptr);
+            mDeviceAllocationCount--;
+            mDedicatedCount--;
+            mDedicatedBytes -= allocation.mSize;
+            allocation = {};
+            return;
+        }
+
+        block->mRecords.erase(allocation.mRange.mHandle);
+        block->mAllocator.free(allocation.mRange);
+        allocation = {};
+
+        // keep one empty block around so a pool does not allocate and free memory every frame
+        Pool& pool = getPool(block->mMemoryType, block->mLinear);
+        if (block->mAllocator.isEmpty() && pool.mBlocks.size() > 1)
+        {
+            pool.mBlocks.erase(std::find(pool.mBlocks.begin(), pool.mBlocks.end(), block));
+            destroyBlock(block);
+        }
+    }
+
+    void VulkanMemoryAllocator::flush(const VulkanAllocation& allocation, VkDeviceSize offset, VkDeviceSize size)
+    {
+        if (!allocation.isValid() || !allocation.mMapped ||
+            (mMemoryProperties.memoryTypes[allocation.mMemoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+        {
+            return;
+        }
+
+        const VkDeviceSize memorySize = allocation.mBlock ? allocation.mBlock->mAllocator.getSize() : allocation.mSize;
+        const VkDeviceSize begin = allocation.mOffset + offset;
+        const VkDeviceSize end = size == VK_WHOLE_SIZE ? allocation.mOffset + allocation.mSize : begin + size;
+
+        VkMappedMemoryRange range{};
+        range.sType     = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory    = allocation.mMemory;
+        range.offset    = begin / mNonCoherentAtomSize * mNonCoherentAtomSize;
+        const VkDeviceSize alignedEnd = (end + mNonCoherentAtomSize - 1) / mNonCoherentAtomSize * mNonCoherentAtomSize;
+        range.size      = alignedEnd >= memorySize ? VK_WHOLE_SIZE : alignedEnd - range.offset;
+        VERIFYVULKANRESULT(vkFlushMappedMemoryRanges(mDevice, 1, &range));
+    }
+
+    uint32_t VulkanMemoryAllocator::defragment(const MoveCallback& move, uint32_t maxMoves)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        uint32_t moveCount = 0;
+        for (auto& type : mPools)
+        {
+            for (auto& pool : type)
+            {
+                if (pool.mBlocks.size() < 2 || moveCount >= maxMoves)
+                {
+                    continue;
+                }
+
+                // empty the least used block into the fullest ones
+                std::sort(pool.mBlocks.begin(), pool.mBlocks.end(), [](VulkanMemoryBlock* a, VulkanMemoryBlock* b)
+                {
+                    return a->mAllocator.getUsedSize() > b->mAllocator.getUsedSize();
+                });
+                VulkanMemoryBlock* source = pool.mBlocks.back();
+
+                std::vector<Base::TlsfAllocator::Allocation> candidates;
+                source->mAllocator.forEachAllocation([&](const Base::TlsfAllocator::Allocation& range)
+                {
+                    if (source->mRecords.count(range.mHandle))
+                    {
+                        candidates.push_back(range);
+                    }
+                });
+
+                for (const auto& range : candidates)
+                {
+                    if (moveCount >= maxMoves)
+                    {
+                        break;
+                    }
+                    const VulkanMemoryBlock::Record record = source->mRecords[range.mHandle];
+
+                    VulkanAllocation dst;
+                    for (size_t i = 0; i + 1 < pool.mBlocks.size(); i++)
+                    {
+                        if (allocateFromBlock(pool.mBlocks[i], range.mSize, record.mAlign, record.mUserData, dst))
+                        {
+                            break;
+                        }
+                    }
+                    if (!dst.isValid())
+                    {
+                        break;
+                    }
+
+                    VulkanAllocation src;
+                    src.mMemory     = source->mMemory;
+                    src.mOffset     = range.mOffset;
+                    src.mSize       = range.mSize;
+                    src.mMapped     = source->mMapped ? source->mMapped + range.mOffset : nullptr;
+                    src.mMemoryType = source->mMemoryType;
+                    src.mBlock      = source;
+                    src.mRange      = range;
+
+                    if (move(src, dst, record.mUserData))
+                    {
+                        freeLocked(src);
+                        moveCount++;
+                    }
+                    else
+                    {
+                        freeLocked(dst);
+                    }
+                }
+            }
+        }
+        return moveCount;
+    }
+
+    VulkanMemoryStats VulkanMemoryAllocator::getStats() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        VulkanMemoryStats stats;
+        for (auto& type : mPools)
+        {
+            for (auto& pool : type)
+            {
+                for (VulkanMemoryBlock* block : pool.mBlocks)
+                {
+                    stats.mBlockCount++;
+                    stats.mAllocationCount += block->mAllocator.getAllocationCount();
+                    stats.mBlockBytes += block->mAllocator.getSize();
+                    stats.mUsedBytes += block->mAllocator.getUsedSize();
+                }
+            }
+        }
+        stats.mDedicatedCount = mDedicatedCount;
+        stats.mDedicatedBytes = mDedicatedBytes;
+        stats.mAllocationCount += mDedicatedCount;
+        return stats;
+    }
+}
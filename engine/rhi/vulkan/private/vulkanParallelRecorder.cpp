@@ -0,0 +1,144 @@
+//
+// Created by 最上川 on 2022/8/22/022.
+//
+
+#include <vulkanParallelRecorder.h>
+#include <vulkanCommandBuffer.h>
+#include <vulkanDevice.h>
+#include <splitter.h>
+#include <debugUtils.h>
+#include <algorithm>
+#include <cassert>
+
+namespace Homura
+{
+    VulkanParallelRecorder::VulkanParallelRecorder(VulkanDevicePtr device, Base::JobSystem& jobSystem, uint32_t frameCount)
+        : mDevice{device}
+        , mJobSystem{jobSystem}
+        , mFrameCount{frameCount}
+        , mWorkerCount{jobSystem.getWorkerCount()}
+        , mPools{}
+        , mFrame{0}
+        , mInheritance{}
+        , mCallback{nullptr}
+        , mChunks{}
+        , mResults(frameCount)
+    {
+        // command buffers are reset together with their pool, never one by one
+        mPools.resize(mFrameCount * mWorkerCount);
+        for (auto& pool : mPools)
+        {
+            pool.mPool = std::make_shared<VulkanCommandPool>(mDevice, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+            pool.mUsed = 0;
+        }
+    }
+
+    VulkanParallelRecorder::~VulkanParallelRecorder()
+    {
+        destroy();
+    }
+
+    void VulkanParallelRecorder::destroy()
+    {
+        // secondary command buffers are freed with their pools
+        for (auto& pool : mPools)
+        {
+            pool.mPool->destroy();
+        }
+        mPools.clear();
+        mResults.clear();
+    }
+
+    VkCommandBuffer VulkanParallelRecorder::acquire(uint32_t worker)
+    {
+        ThreadPool& pool = mPools[mFrame * mWorkerCount + worker];
+        if (pool.mUsed == pool.mCommandBuffers.size())
+        {
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool           = pool.mPool->getHandle();
+            allocInfo.level                 = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount    = 1;
+
+            VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+            VERIFYVULKANRESULT(vkAllocateCommandBuffers(mDevice->getHandle(), &allocInfo, &commandBuffer));
+            pool.mCommandBuffers.push_back(commandBuffer);
+        }
+        return pool.mCommandBuffers[pool.mUsed++];
+    }
+
+    void VulkanParallelRecorder::recordChunks(Chunk* chunks, unsigned int count)
+    {
+        for (unsigned int i = 0; i < count; i++)
+        {
+            const Chunk& chunk = chunks[i];
+            VulkanParallelRecorder* recorder = chunk.mRecorder;
+            VkCommandBuffer commandBuffer = recorder->acquire(recorder->mJobSystem.getCurrentWorkerIndex());
+
+            // not one time submit, the primary is submitted again every time its image comes round
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType             = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags             = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            beginInfo.pInheritanceInfo  = &recorder->mInheritance;
+
+            VERIFYVULKANRESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+            (*recorder->mCallback)(commandBuffer, recorder->mFrame, chunk.mFirst, chunk.mCount);
+            VERIFYVULKANRESULT(vkEndCommandBuffer(commandBuffer));
+
+            recorder->mResults[recorder->mFrame][chunk.mIndex] = commandBuffer;
+        }
+    }
+
+    void VulkanParallelRecorder::reset(uint32_t frame)
+    {
+        assert(frame < mFrameCount);
+        for (uint32_t worker = 0; worker < mWorkerCount; worker++)
+        {
+            // keeps the memory, the next recording is about as large
+            ThreadPool& pool = mPools[frame * mWorkerCount + worker];
+            pool.mPool->reset(0);
+            pool.mUsed = 0;
+        }
+        mResults[frame].clear();
+    }
+
+    const std::vector<VkCommandBuffer>& VulkanParallelRecorder::record(uint32_t frame, VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer,
+                                                                       uint32_t drawCount, uint32_t drawsPerChunk, const RecordCallback& callback)
+    {
+        assert(frame < mFrameCount);
+        if (drawsPerChunk == 0)
+        {
+            // a few chunks per worker leave room for stealing when draws differ in cost
+            const uint32_t chunkTarget = mWorkerCount * 4;
+            drawsPerChunk = (drawCount + chunkTarget - 1) / chunkTarget;
+            drawsPerChunk = drawsPerChunk > 0 ? drawsPerChunk : 1;
+        }
+        const uint32_t chunkCount = (drawCount + drawsPerChunk - 1) / drawsPerChunk;
+
+        mChunks.resize(chunkCount);
+        for (uint32_t i = 0; i < chunkCount; i++)
+        {
+            const uint32_t first = i * drawsPerChunk;
+            mChunks[i] = Chunk{this, i, first, std::min(drawsPerChunk, drawCount - first)};
+        }
+        mResults[frame].assign(chunkCount, VK_NULL_HANDLE);
+        if (chunkCount == 0)
+        {
+            return mResults[frame];
+        }
+
+        mFrame                              = frame;
+        mCallback                           = &callback;
+        mInheritance                        = {};
+        mInheritance.sType                  = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        mInheritance.renderPass             = renderPass;
+        mInheritance.subpass                = subpass;
+        mInheritance.framebuffer            = framebuffer;
+
+        // one chunk per leaf, every chunk is worth a job of its own
+        Base::Job* root = mJobSystem.parallel_for(mChunks.data(), chunkCount, &VulkanParallelRecorder::recordChunks, Base::CountSplitter(1));
+        mJobSystem.wait(mJobSystem.run(root));
+        mCallback = nullptr;
+        return mResults[frame];
+    }
+}
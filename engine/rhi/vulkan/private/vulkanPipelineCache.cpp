@@ -0,0 +1,461 @@
+//
+// Created by 最上川 on 2022/8/23/023.
+//
+
+#include <vulkanPipelineCache.h>
+#include <debugUtils.h>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace Homura
+{
+    uint64_t hashMemory(const void* data, size_t size, uint64_t seed)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        uint64_t hash = seed;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void VulkanPipelineKey::addData(const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        mData.insert(mData.end(), bytes, bytes + size);
+        mHash = hashMemory(data, size, mHash);
+    }
+
+    VulkanPipelineCreateInfo::VulkanPipelineCreateInfo(const VkGraphicsPipelineCreateInfo& info)
+        : mInfo{info}
+        , mStages{}
+        , mEntryPoints{}
+        , mVertexInputState{}
+        , mBindings{}
+        , mAttributes{}
+        , mInputAssemblyState{}
+        , mTessellationState{}
+        , mViewportState{}
+        , mViewports{}
+        , mScissors{}
+        , mRasterizationState{}
+        , mMultisampleState{}
+        , mSampleMask{}
+        , mDepthStencilState{}
+        , mColorBlendState{}
+        , mBlendAttachmentStates{}
+        , mDynamicState{}
+        , mDynamicStates{}
+    {
+        assert(!info.pNext && "pNext chains are not copied");
+        mStages.assign(info.pStages, info.pStages + info.stageCount);
+        mEntryPoints.reserve(info.stageCount);
+        for (auto& stage : mStages)
+        {
+            assert(!stage.pNext && !stage.pSpecializationInfo && "specialization constants are not copied");
+            mEntryPoints.emplace_back(stage.pName);
+        }
+        for (uint32_t i = 0; i < info.stageCount; i++)
+        {
+            mStages[i].pName = mEntryPoints[i].c_str();
+        }
+        mInfo.pStages = mStages.data();
+
+        if (info.pVertexInputState)
+        {
+            mVertexInputState = *info.pVertexInputState;
+            mBindings.assign(mVertexInputState.pVertexBindingDescriptions, mVertexInputState.pVertexBindingDescriptions + mVertexInputState.vertexBindingDescriptionCount);
+            mAttributes.assign(mVertexInputState.pVertexAttributeDescriptions, mVertexInputState.pVertexAttributeDescriptions + mVertexInputState.vertexAttributeDescriptionCount);
+            mVertexInputState.pVertexBindingDescriptions    = mBindings.data();
+            mVertexInputState.pVertexAttributeDescriptions  = mAttributes.data();
+            mInfo.pVertexInputState = &mVertexInputState;
+        }
+        mInfo.pInputAssemblyState   = copyState(info.pInputAssemblyState, mInputAssemblyState);
+        mInfo.pTessellationState    = copyState(info.pTessellationState, mTessellationState);
+        mInfo.pRasterizationState   = copyState(info.pRasterizationState, mRasterizationState);
+        mInfo.pDepthStencilState    = copyState(info.pDepthStencilState, mDepthStencilState);
+
+        if (info.pViewportState)
+        {
+            mViewportState = *info.pViewportState;
+            // null when viewport and scissor are dynamic
+            if (mViewportState.pViewports)
+            {
+                mViewports.assign(mViewportState.pViewports, mViewportState.pViewports + mViewportState.viewportCount);
+                mViewportState.pViewports = mViewports.data();
+            }
+            if (mViewportState.pScissors)
+            {
+                mScissors.assign(mViewportState.pScissors, mViewportState.pScissors + mViewportState.scissorCount);
+                mViewportState.pScissors = mScissors.data();
+            }
+            mInfo.pViewportState = &mViewportState;
+        }
+
+        if (info.pMultisampleState)
+        {
+            mMultisampleState = *info.pMultisampleState;
+            if (mMultisampleState.pSampleMask)
+            {
+                const uint32_t maskCount = (static_cast<uint32_t>(mMultisampleState.rasterizationSamples) + 31) / 32;
+                mSampleMask.assign(mMultisampleState.pSampleMask, mMultisampleState.pSampleMask + maskCount);
+                mMultisampleState.pSampleMask = mSampleMask.data();
+            }
+            mInfo.pMultisampleState = &mMultisampleState;
+        }
+
+        if (info.pColorBlendState)
+        {
+            mColorBlendState = *info.pColorBlendState;
+            mBlendAttachmentStates.assign(mColorBlendState.pAttachments, mColorBlendState.pAttachments + mColorBlendState.attachmentCount);
+            mColorBlendState.pAttachments = mBlendAttachmentStates.data();
+            mInfo.pColorBlendState = &mColorBlendState;
+        }
+
+        if (info.pDynamicState)
+        {
+            mDynamicState = *info.pDynamicState;
+            mDynamicStates.assign(mDynamicState.pDynamicStates, mDynamicState.pDynamicStates + mDynamicState.dynamicStateCount);
+            mDynamicState.pDynamicStates = mDynamicStates.data();
+            mInfo.pDynamicState = &mDynamicState;
+        }
+    }
+
+    struct VulkanPipelineCompileState
+    {
+        VulkanPipelineCompileState(const VulkanPipelineKey& key, const VkGraphicsPipelineCreateInfo& info, Base::JobSystem& jobSystem)
+            : mKey{key}
+            , mInfo{info}
+            , mJobSystem{jobSystem}
+            , mJob{nullptr}
+            , mGeneration{0}
+            , mPipeline{VK_NULL_HANDLE}
+            , mReady{false}
+        {
+
+        }
+
+        VulkanPipelineKey           mKey;
+        VulkanPipelineCreateInfo    mInfo;
+        Base::JobSystem&            mJobSystem;
+        // the job handle, published by the thread that ran the job
+        std::atomic<Base::Job*>     mJob;
+        uint32_t                    mGeneration;
+        // written once before mReady is released
+        VkPipeline                  mPipeline;
+        std::atomic<bool>           mReady;
+    };
+
+    struct CompileJobData
+    {
+        VulkanPipelineCache*        mCache;
+        VulkanPipelineCompileState* mState;
+    };
+
+    VulkanPipelineFuture::VulkanPipelineFuture(VkPipeline pipeline)
+        : mPipeline{pipeline}
+        , mState{nullptr}
+    {
+
+    }
+
+    VulkanPipelineFuture::VulkanPipelineFuture(std::shared_ptr<VulkanPipelineCompileState> state)
+        : mPipeline{VK_NULL_HANDLE}
+        , mState{std::move(state)}
+    {
+
+    }
+
+    bool VulkanPipelineFuture::isReady() const
+    {
+        return mPipeline != VK_NULL_HANDLE || (mState && mState->mReady.load(std::memory_order_acquire));
+    }
+
+    VkPipeline VulkanPipelineFuture::get() const
+    {
+        if (mPipeline != VK_NULL_HANDLE)
+        {
+            return mPipeline;
+        }
+        return isReady() ? mState->mPipeline : VK_NULL_HANDLE;
+    }
+
+    VkPipeline VulkanPipelineFuture::wait() const
+    {
+        if (mState && !isReady())
+        {
+            Base::Job* job = mState->mJob.load(std::memory_order_acquire);
+            if (job)
+            {
+                mState->mJobSystem.wait(Base::JobHandle{job, mState->mGeneration});
+            }
+            // the compile was started on another thread that has not stored its handle yet
+            while (!isReady())
+            {
+                std::this_thread::yield();
+            }
+        }
+        return get();
+    }
+
+    VulkanPipelineCache::VulkanPipelineCache(VkPhysicalDevice physicalDevice, VkDevice device, std::string path)
+        : mDevice{device}
+        , mProperties{}
+        , mPath{std::move(path)}
+        , mCache{VK_NULL_HANDLE}
+        , mPipelines{}
+        , mStats{}
+    {
+        vkGetPhysicalDeviceProperties(physicalDevice, &mProperties);
+
+        std::vector<char> data = load();
+        if (!data.empty() && !isCompatible(data))
+        {
+            // another driver or GPU wrote it, the driver would reject it anyway
+            std::cerr << "pipeline cache " << mPath << " does not match the device, starting empty" << std::endl;
+            data.clear();
+        }
+        mStats.mLoadedBytes = data.size();
+
+        VkPipelineCacheCreateInfo createInfo{};
+        createInfo.sType            = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        createInfo.initialDataSize  = data.size();
+        createInfo.pInitialData     = data.empty() ? nullptr : data.data();
+        VERIFYVULKANRESULT(vkCreatePipelineCache(mDevice, &createInfo, nullptr, &mCache));
+    }
+
+    VulkanPipelineCache::~VulkanPipelineCache()
+    {
+        destroy();
+    }
+
+    void VulkanPipelineCache::destroy()
+    {
+        if (mCache == VK_NULL_HANDLE)
+        {
+            return;
+        }
+
+        // compiles in flight still use the cache
+        std::vector<std::shared_ptr<VulkanPipelineCompileState>> pending;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (auto& compile : mPending)
+            {
+                pending.push_back(compile.second);
+            }
+        }
+        for (auto& state : pending)
+        {
+            VulkanPipelineFuture(state).wait();
+        }
+        save();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto& pipeline : mPipelines)
+        {
+            vkDestroyPipeline(mDevice, pipeline.second, nullptr);
+        }
+        mPipelines.clear();
+        for (auto& layout : mLayouts)
+        {
+            vkDestroyPipelineLayout(mDevice, layout.second, nullptr);
+        }
+        mLayouts.clear();
+        vkDestroyPipelineCache(mDevice, mCache, nullptr);
+        mCache = VK_NULL_HANDLE;
+    }
+
+    std::vector<char> VulkanPipelineCache::load()
+    {
+        std::ifstream file(mPath, std::ios::ate | std::ios::binary);
+        if (!file.is_open())
+        {
+            return {};
+        }
+        const std::streamoff size = file.tellg();
+        if (size <= 0)
+        {
+            return {};
+        }
+        std::vector<char> data(static_cast<size_t>(size));
+        file.seekg(0);
+        file.read(data.data(), size);
+        if (!file)
+        {
+            return {};
+        }
+        return data;
+    }
+
+    bool VulkanPipelineCache::isCompatible(const std::vector<char>& data) const
+    {
+        // VkPipelineCacheHeaderVersionOne: length, version, vendorID, deviceID, pipelineCacheUUID
+        uint32_t header[4];
+        if (data.size() < sizeof(header) + VK_UUID_SIZE)
+        {
+            return false;
+        }
+        std::memcpy(header, data.data(), sizeof(header));
+        return header[0] >= sizeof(header) + VK_UUID_SIZE &&
+               header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+               header[2] == mProperties.vendorID &&
+               header[3] == mProperties.deviceID &&
+               std::memcmp(data.data() + sizeof(header), mProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+    bool VulkanPipelineCache::save()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        size_t size = 0;
+        if (vkGetPipelineCacheData(mDevice, mCache, &size, nullptr) != VK_SUCCESS || size == 0)
+        {
+            return false;
+        }
+        std::vector<char> data(size);
+        if (vkGetPipelineCacheData(mDevice, mCache, &size, data.data()) != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        // write next to it first, a crash must not leave a truncated cache behind
+        const std::string temporary = mPath + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+            {
+                std::cerr << "failed to write pipeline cache " << temporary << std::endl;
+                return false;
+            }
+            file.write(data.data(), static_cast<std::streamsize>(size));
+            if (!file)
+            {
+                return false;
+            }
+        }
+        std::remove(mPath.c_str());
+        return std::rename(temporary.c_str(), mPath.c_str()) == 0;
+    }
+
+    VkPipeline VulkanPipelineCache::find(const VulkanPipelineKey& key)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto iter = mPipelines.find(key);
+        return iter != mPipelines.end() ? iter->second : VK_NULL_HANDLE;
+    }
+
+    VkPipeline VulkanPipelineCache::getOrCreate(const VulkanPipelineKey& key, const VkGraphicsPipelineCreateInfo& info)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto iter = mPipelines.find(key);
+            if (iter != mPipelines.end())
+            {
+                mStats.mHits++;
+                return iter->second;
+            }
+        }
+
+        // compiled without the lock, VkPipelineCache is internally synchronized
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VERIFYVULKANRESULT(vkCreateGraphicsPipelines(mDevice, mCache, 1, &info, nullptr, &pipeline));
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto result = mPipelines.emplace(key, pipeline);
+        if (!result.second)
+        {
+            // another thread compiled the same state meanwhile, keep the first one
+            vkDestroyPipeline(mDevice, pipeline, nullptr);
+            mStats.mHits++;
+            return result.first->second;
+        }
+        mStats.mMisses++;
+        return pipeline;
+    }
+
+    VulkanPipelineFuture VulkanPipelineCache::compileAsync(const VulkanPipelineKey& key, const VkGraphicsPipelineCreateInfo& info, Base::JobSystem& jobSystem)
+    {
+        std::shared_ptr<VulkanPipelineCompileState> state;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto iter = mPipelines.find(key);
+            if (iter != mPipelines.end())
+            {
+                mStats.mHits++;
+                return VulkanPipelineFuture(iter->second);
+            }
+            auto pending = mPending.find(key);
+            if (pending != mPending.end())
+            {
+                return VulkanPipelineFuture(pending->second);
+            }
+            state = std::make_shared<VulkanPipelineCompileState>(key, info, jobSystem);
+            mPending.emplace(key, state);
+            mStats.mAsyncCompiles++;
+        }
+
+        // mPending keeps the state alive until the job has finished with it
+        Base::Job* job = jobSystem.createJob(nullptr, &VulkanPipelineCache::compileJob, CompileJobData{this, state.get()});
+        const Base::JobHandle handle = jobSystem.run(job);
+        state->mGeneration = handle.mGeneration;
+        state->mJob.store(handle.mJob, std::memory_order_release);
+        return VulkanPipelineFuture(state);
+    }
+
+    void VulkanPipelineCache::compileJob(Base::Job*, const void* data)
+    {
+        const CompileJobData& jobData = *static_cast<const CompileJobData*>(data);
+        VulkanPipelineCache* cache = jobData.mCache;
+        VulkanPipelineCompileState* state = jobData.mState;
+
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VERIFYVULKANRESULT(vkCreateGraphicsPipelines(cache->mDevice, cache->mCache, 1, &state->mInfo.get(), nullptr, &pipeline));
+
+        std::lock_guard<std::mutex> lock(cache->mMutex);
+        auto result = cache->mPipelines.emplace(state->mKey, pipeline);
+        if (!result.second)
+        {
+            // getOrCreate() compiled the same state meanwhile
+            vkDestroyPipeline(cache->mDevice, pipeline, nullptr);
+            pipeline = result.first->second;
+        }
+        else
+        {
+            cache->mStats.mMisses++;
+        }
+        state->mPipeline = pipeline;
+        state->mReady.store(true, std::memory_order_release);
+
+        // the last use of state, the map may hold the only reference
+        cache->mPending.erase(cache->mPending.find(state->mKey));
+    }
+
+    VkPipelineLayout VulkanPipelineCache::getOrCreateLayout(const VulkanPipelineKey& key, const VkPipelineLayoutCreateInfo& info)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto iter = mLayouts.find(key);
+        if (iter != mLayouts.end())
+        {
+            return iter->second;
+        }
+
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+        VERIFYVULKANRESULT(vkCreatePipelineLayout(mDevice, &info, nullptr, &layout));
+        mLayouts.emplace(key, layout);
+        return layout;
+    }
+
+    VulkanPipelineCacheStats VulkanPipelineCache::getStats() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        VulkanPipelineCacheStats stats = mStats;
+        stats.mPipelineCount = static_cast<uint32_t>(mPipelines.size());
+        return stats;
+    }
+}
@@ -7,7 +7,7 @@
 namespace Homura
 {
     VulkanQueue::VulkanQueue(VulkanDevicePtr device, uint32_t familyIndex)
-        : mQueue{VK_NULL_HANDLE}, mFamilyIndex{familyIndex}, mDevice{device}
+        : mQueue{VK_NULL_HANDLE}, mFamilyIndex{familyIndex}, mDevice{device}, mTimeline{std::make_unique<VulkanTimeline>(device)}
     {
         vkGetDeviceQueue(device->getHandle(), mFamilyIndex, 0, &mQueue);
     }
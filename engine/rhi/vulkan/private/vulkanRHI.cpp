@@ -20,6 +20,15 @@
 #include <vulkanLayout.h>
 #include <vulkanShader.h>
 #include <vulkanSampler.h>
+#include <vulkanBindless.h>
+#include <vulkanGpuProfiler.h>
+#include <vulkanReadback.h>
+#include <vulkanFrameGraph.h>
+#include <profiler.h>
+#include <mipGenerator.h>
+#include <ktx2.h>
+#include <algorithm>
+#include <iostream>
 
 namespace Homura
 {
@@ -31,9 +40,22 @@ namespace Homura
         , mFramebuffer{nullptr}
         , mCommandPool{nullptr}
         , mCommandBuffer{nullptr}
-        , mDescriptorPool{nullptr}
         , mRenderPass{nullptr}
         , mWindow{nullptr}
+        , mJobSystem{nullptr}
+        , mPerFrameRecording{false}
+        , mFramesInFlight{3}
+        , mBindlessTable{nullptr}
+        , mGpuProfiling{false}
+        , mPipelineStatistics{false}
+        , mGpuProfiler{nullptr}
+        , mHeadless{false}
+        , mFrameLimit{0}
+        , mReadbackCallback{}
+        , mFrameGraph{nullptr}
+        , mBackbuffer{0}
+        , mTextureStreamer{nullptr}
+        , mStreamedTextures{}
         , mMouseCallback{}
         , mFramebufferResizeCallback{}
         , mUpdateAfterRecreateSwapchain{}
@@ -50,7 +72,21 @@ namespace Homura
         createSwapChain();
         createFrameBuffer();
         createCommandPool();
-        createDescriptorPool();
+        createRenderPass();
+        createShader();
+        createPipeline();
+        createSampler();
+    }
+
+    void VulkanRHI::initHeadless(int width, int height, uint32_t imageCount)
+    {
+        mHeadless = true;
+        mInstance = std::make_shared<VulkanInstance>(true);
+        // no surface, the device picks its queues and extensions without one
+        createDevice();
+        mSwapChain = std::make_shared<VulkanSwapChain>(mDevice, VkExtent2D{static_cast<uint32_t>(width), static_cast<uint32_t>(height)}, imageCount);
+        createFrameBuffer();
+        createCommandPool();
         createRenderPass();
         createShader();
         createPipeline();
@@ -64,10 +100,26 @@ namespace Homura
 
     void VulkanRHI::update()
     {
-        while (!mWindow->shouldClose())
+        PROFILE_THREAD("render");
+        if (mHeadless && mFrameLimit == 0)
         {
-            mWindow->processInput();
+            std::cerr << "headless update without a frame limit renders forever" << std::endl;
+        }
+        uint32_t frames = 0;
+        while (mHeadless || !mWindow->shouldClose())
+        {
+            if (mFrameLimit > 0 && frames == mFrameLimit)
+            {
+                break;
+            }
+            PROFILE_ZONE("frame");
+            if (mWindow)
+            {
+                mWindow->processInput();
+            }
+            mDevice->getFrameArena().reset();
             mCommandBuffer->drawFrame(shared_from_this());
+            frames++;
         }
         idle();
         cleanup();
@@ -117,6 +169,11 @@ namespace Homura
 
     void VulkanRHI::recreateSwapChain()
     {
+        // offscreen images never go out of date
+        if (mHeadless)
+        {
+            return;
+        }
         // todo
         mWindow->resize();
         idle();
@@ -182,7 +239,30 @@ namespace Homura
 
     VulkanCommandBufferPtr VulkanRHI::createCommandBuffer()
     {
-        mCommandBuffer = std::make_shared<VulkanCommandBuffer>(mDevice, mSwapChain, mCommandPool, mFramebuffer, mPipeline);
+        mCommandBuffer = std::make_shared<VulkanCommandBuffer>(mDevice, mSwapChain, mCommandPool, mFramebuffer, mPipeline, mFramesInFlight);
+        if (mJobSystem)
+        {
+            mCommandBuffer->setParallelRecorder(std::make_shared<VulkanParallelRecorder>(mDevice, *mJobSystem, mSwapChain->getImageCount()));
+        }
+        mCommandBuffer->setPerFrameRecording(mPerFrameRecording);
+        if (mGpuProfiling)
+        {
+            // kept over swapchain recreation along with its rolling stats
+            if (!mGpuProfiler)
+            {
+                mGpuProfiler = std::make_shared<VulkanGpuProfiler>(mDevice, std::max(mFramesInFlight, mSwapChain->getImageCount()), 64, mPipelineStatistics);
+            }
+            mCommandBuffer->setGpuProfiler(mGpuProfiler);
+        }
+        if (mFrameGraph)
+        {
+            mCommandBuffer->setFrameGraph(mFrameGraph, mBackbuffer);
+        }
+        if (mHeadless && mReadbackCallback)
+        {
+            mCommandBuffer->setReadback(std::make_shared<VulkanReadback>(mDevice, mSwapChain, mReadbackCallback));
+        }
+        mCommandBuffer->setTextureStreamer(mTextureStreamer);
         return mCommandBuffer;
     }
 
@@ -192,26 +272,21 @@ namespace Homura
         return mRenderPass;
     }
 
-    VulkanDescriptorPoolPtr VulkanRHI::createDescriptorPool()
-    {
-        mDescriptorPool = std::make_shared<VulkanDescriptorPool>(mDevice, mSwapChain->getImageCount());
-        return mDescriptorPool;
-    }
-
     void VulkanRHI::createDescriptorSet()
     {
         VulkanDescriptorSetLayoutPtr layout = std::make_shared<VulkanDescriptorSetLayout>(mDevice);
         std::vector<VkDescriptorSetLayoutBinding> bindings;
         VkDescriptorSetLayoutBinding binding{};
-        if (!mUniformBuffers.empty())
+        for (auto& uniform : mUniformBuffers)
         {
-            binding.binding         = mUniformBuffers[0]->getBinding();
+            binding.binding         = uniform->getBinding();
             binding.descriptorCount = 1;
-            binding.descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            binding.descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             binding.stageFlags      = VK_SHADER_STAGE_VERTEX_BIT;
             bindings.push_back(binding);
         }
-        if (!mSampleTextures.empty())
+        // bindless textures live in a set of their own
+        if (!mSampleTextures.empty() && !mBindlessTable)
         {
             binding.binding         = mSampleTextures[0]->getBinding();
             binding.descriptorCount = 1;
@@ -220,12 +295,13 @@ namespace Homura
             bindings.push_back(binding);
         }
         layout->create(bindings);
-        mDescriptorSet = std::make_shared<VulkanDescriptorSet>(mDevice, mDescriptorPool, layout);
+        mDescriptorSet = std::make_shared<VulkanDescriptorSet>(mDevice, layout, mSwapChain->getImageCount());
     }
 
     void VulkanRHI::updateDescriptorSet()
     {
-        mDescriptorSet->updateDescriptorSet(mUniformBuffers, mSampleTextures);
+        std::vector<VulkanTexture2DPtr> noTextures;
+        mDescriptorSet->updateDescriptorSet(mUniformBuffers, mBindlessTable ? noTextures : mSampleTextures);
     }
 
     VulkanPipelinePtr VulkanRHI::createPipeline()
@@ -242,7 +318,10 @@ namespace Homura
 
     void VulkanRHI::destroyWindow()
     {
-        mWindow->destroy();
+        if (mWindow)
+        {
+            mWindow->destroy();
+        }
     }
 
     void VulkanRHI::destroyInstance()
@@ -252,12 +331,30 @@ namespace Homura
 
     void VulkanRHI::destroyDevice()
     {
+        if (mFrameGraph)
+        {
+            mFrameGraph->destroy();
+            mFrameGraph.reset();
+        }
+        if (mGpuProfiler)
+        {
+            mGpuProfiler->destroy();
+            mGpuProfiler.reset();
+        }
+        if (mBindlessTable)
+        {
+            mBindlessTable->destroy();
+            mBindlessTable.reset();
+        }
         mDevice->destroy();
     }
 
     void VulkanRHI::destroySurface()
     {
-        mSurface->destroy();
+        if (mSurface)
+        {
+            mSurface->destroy();
+        }
     }
 
     void VulkanRHI::destroySwapChain()
@@ -290,11 +387,6 @@ namespace Homura
         mDescriptorSet->destroy();
     }
 
-    void VulkanRHI::destroyDescriptorPool()
-    {
-        mDescriptorPool->destroy();
-    }
-
     void VulkanRHI::destroyShader()
     {
         mShader->destroy();
@@ -312,11 +404,13 @@ namespace Homura
             buffer->destroy();
         }
         mBuffers.clear();
-        for (auto& uniform : mUniformBuffers)
+        mUniformBuffers.clear();
+        mDynamicOffsets.clear();
+        if (mUniformRing)
         {
-            uniform->destroy();
+            mUniformRing->destroy();
+            mUniformRing.reset();
         }
-        mUniformBuffers.clear();
     }
 
     void VulkanRHI::destroySampler()
@@ -326,6 +420,11 @@ namespace Homura
 
     void VulkanRHI::cleanupSwapchain()
     {
+        // its textures and render passes are sized for the old swapchain
+        if (mFrameGraph)
+        {
+            mFrameGraph->destroy();
+        }
         destroyColorResources();
         destroyDepthResources();
         destroyCommandBuffer();
@@ -351,7 +450,6 @@ namespace Homura
         destroySurface();
         destroyPipeline();
         destroyRenderPass();
-        destroyDescriptorPool();
         destroyDevice();
         destroyInstance();
         destroyWindow();
@@ -364,6 +462,27 @@ namespace Homura
 
     void VulkanRHI::setupRenderPass(RHIRenderPassInfo info)
     {
+        if (mHeadless)
+        {
+            // nothing is presented, the images are copied to the host instead
+            for (auto& attachment : info.mAttachmentDescriptions)
+            {
+                if (attachment.finalLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR)
+                {
+                    attachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+                }
+            }
+            // the copy has to see the final layout transition and the last writes
+            VkSubpassDependency dependency{};
+            dependency.srcSubpass       = static_cast<uint32_t>(info.mSubPasses.size()) - 1;
+            dependency.dstSubpass       = VK_SUBPASS_EXTERNAL;
+            dependency.srcStageMask     = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            dependency.dstStageMask     = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            dependency.srcAccessMask    = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+            dependency.dstAccessMask    = VK_ACCESS_TRANSFER_READ_BIT;
+            dependency.dependencyFlags  = 0;
+            info.addDependency(dependency);
+        }
         mInfo = info;
         mRenderPass->set(info);
         mRenderPass->build();
@@ -379,13 +498,23 @@ namespace Homura
     void VulkanRHI::setupPipeline()
     {
         mPipeline->create(mRenderPass, getSampleCount());
-        VkViewport viewport{0.0, 0.0, (float)mWindow->getWidth(), (float)mWindow->getHeight(), 0.0, 1.0};
-        VkRect2D scissor{{0, 0}, {mWindow->getWidth(), mWindow->getHeight()}};
+        const VkExtent2D extent = mSwapChain->getExtent();
+        VkViewport viewport{0.0, 0.0, (float)extent.width, (float)extent.height, 0.0, 1.0};
+        VkRect2D scissor{{0, 0}, extent};
         mPipeline->setViewports({viewport});
         mPipeline->setScissors({scissor});
         mPipeline->setShaders(mShader);
+        mPipeline->setBindlessTable(mBindlessTable);
         updateDescriptorSet();
-        mPipeline->build(mDescriptorSet);
+        if (mJobSystem)
+        {
+            // static recording waits for it in beginCommandBuffer(), per frame recording skips draws until then
+            mPipeline->buildAsync(mDescriptorSet, *mJobSystem);
+        }
+        else
+        {
+            mPipeline->build(mDescriptorSet);
+        }
     }
 
     VulkanShaderEntityPtr VulkanRHI::setupShaders(std::string filename, ShaderType type)
@@ -398,11 +527,34 @@ namespace Homura
         mCommandBuffer->begin();
         mCommandBuffer->beginRenderPass(mRenderPass);
         mCommandBuffer->bindGraphicPipeline();
-        mCommandBuffer->bindDescriptorSet();
+        // every frame allocates its uniforms in the same order, so the offsets are known up front
+        mDynamicOffsets.clear();
+        if (mUniformRing)
+        {
+            for (uint32_t i = 0; i < mSwapChain->getImageCount(); i++)
+            {
+                uint32_t offset = mUniformRing->getFrameOffset(i);
+                for (auto& uniform : mUniformBuffers)
+                {
+                    mDynamicOffsets.push_back(offset);
+                    offset += static_cast<uint32_t>(mUniformRing->alignSize(uniform->getSize()));
+                }
+            }
+        }
+        mCommandBuffer->bindDescriptorSet(mDynamicOffsets, static_cast<uint32_t>(mUniformBuffers.size()));
+        if (mBindlessTable && !mSampleTextures.empty())
+        {
+            mCommandBuffer->bindTextureIndex(mSampleTextures[0]->getBindlessIndex());
+        }
+        else if (mTextureStreamer && !mStreamedTextures.empty())
+        {
+            mCommandBuffer->bindStreamedTexture(mStreamedTextures[0]);
+        }
     }
 
     void VulkanRHI::createVertexBuffer(void* bufferData, uint32_t bufferSize, uint32_t count)
     {
+        PROFILE_FUNCTION();
         VulkanVertexBufferPtr buffer = std::make_shared<VulkanVertexBuffer>(mDevice, mCommandBuffer, bufferSize, bufferData);
         mCommandBuffer->bindVertexBuffer(buffer, count);
         mBuffers.push_back(buffer);
@@ -410,6 +562,7 @@ namespace Homura
 
     void VulkanRHI::createIndexBuffer(void* bufferData, uint32_t bufferSize, uint32_t count)
     {
+        PROFILE_FUNCTION();
         VulkanIndexBufferPtr buffer = std::make_shared<VulkanIndexBuffer>(mDevice, mCommandBuffer, bufferSize, bufferData);
         mCommandBuffer->bindIndexBuffer(buffer, count);
         mBuffers.push_back(buffer);
@@ -417,11 +570,11 @@ namespace Homura
 
     void VulkanRHI::createUniformBuffer(int binding, uint32_t bufferSize)
     {
-        for (int i = 0; i < mSwapChain->getImageCount(); i++)
+        if (!mUniformRing)
         {
-            VulkanUniformBufferPtr buffer = std::make_shared<VulkanUniformBuffer>(mDevice, mCommandBuffer, bufferSize, binding);
-            mUniformBuffers.push_back(buffer);
+            mUniformRing = std::make_shared<VulkanUniformRing>(mDevice, mSwapChain->getImageCount());
         }
+        mUniformBuffers.push_back(std::make_shared<VulkanUniformBuffer>(mUniformRing, bufferSize, binding));
     }
 
     void VulkanRHI::setWriteDataCallback(UnifromUpdateCallback callback)
@@ -434,27 +587,61 @@ namespace Homura
 
     void VulkanRHI::updateUniformBuffer(uint32_t index)
     {
-        assert(index < mUniformBuffers.size());
-        mUniformBuffers[index]->update();
+        PROFILE_FUNCTION();
+        if (!mUniformRing)
+        {
+            return;
+        }
+        // the command buffer of this image has finished, its region of the ring is free
+        mUniformRing->beginFrame(index);
+        for (size_t i = 0; i < mUniformBuffers.size(); i++)
+        {
+            const uint32_t offset = mUniformBuffers[i]->update();
+            assert(offset == mDynamicOffsets[index * mUniformBuffers.size() + i]);
+            (void)offset;
+        }
+        mUniformRing->endFrame();
     }
 
     void VulkanRHI::createSampleTexture(int binding, void* imageData, uint32_t imageSize, uint32_t width, uint32_t height)
     {
-        VulkanStagingBufferPtr stagingBuffer = std::make_shared<VulkanStagingBuffer>(mDevice, mCommandBuffer, imageSize, imageData);
-        uint32_t mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
-        VulkanTexture2DPtr sampleTexture = std::make_shared<VulkanTexture2D>(mDevice, width, height, mipLevels, 
-                                                                            VK_SAMPLE_COUNT_1_BIT, 
-                                                                            VK_FORMAT_R8G8B8A8_SRGB, 
-                                                                            VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+        PROFILE_FUNCTION();
+        Base::Image image(width, height, Base::ImageFormat::RGBA8_SRGB);
+        assert(image.getLevel(0).mSize == imageSize);
+        std::memcpy(image.getData(0), imageData, std::min<size_t>(imageSize, image.getLevel(0).mSize));
+        createSampleTexture(binding, Base::generateMips(image, Base::MipGeneratorConfig{}, mJobSystem));
+    }
+
+    void VulkanRHI::createSampleTexture(int binding, const Base::Image& image)
+    {
+        PROFILE_FUNCTION();
+        assert(isImageFormatSupported(image.getFormat()));
+        // the KTX2 tag of a format is its VkFormat
+        const VkFormat format = static_cast<VkFormat>(Base::getKtx2VkFormat(image.getFormat()));
+        VulkanTexture2DPtr sampleTexture = std::make_shared<VulkanTexture2D>(mDevice, image.getWidth(), image.getHeight(), image.getLevelCount(),
+                                                                            VK_SAMPLE_COUNT_1_BIT,
+                                                                            format,
                                                                             VK_IMAGE_USAGE_TRANSFER_DST_BIT |
                                                                             VK_IMAGE_USAGE_SAMPLED_BIT,
                                                                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        sampleTexture->setImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mCommandBuffer);
-        sampleTexture->fromBuffer(mCommandBuffer, stagingBuffer);
-        sampleTexture->generateMipmaps(mCommandBuffer);
+        sampleTexture->setImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        for (uint32_t level = 0; level < image.getLevelCount(); level++)
+        {
+            sampleTexture->upload(image.getData(level), image.getLevel(level).mSize, level);
+        }
+        sampleTexture->setImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
         sampleTexture->setSampler(mSampler, binding);
+        if (mBindlessTable)
+        {
+            sampleTexture->setBindlessIndex(mBindlessTable->add(sampleTexture));
+        }
         mSampleTextures.push_back(sampleTexture);
-        stagingBuffer->destroy();
+    }
+
+    bool VulkanRHI::isImageFormatSupported(Base::ImageFormat format) const
+    {
+        const VkFormat vkFormat = static_cast<VkFormat>(Base::getKtx2VkFormat(format));
+        return vkFormat != VK_FORMAT_UNDEFINED && mDevice->isSampledFormatSupported(vkFormat);
     }
 
     void VulkanRHI::draw()
@@ -462,6 +649,163 @@ namespace Homura
         mCommandBuffer->draw();
     }
 
+    void VulkanRHI::drawParallel(uint32_t drawCount, uint32_t drawsPerChunk, const VulkanParallelRecorder::RecordCallback& callback)
+    {
+        mCommandBuffer->drawParallel(drawCount, drawsPerChunk, callback);
+    }
+
+    void VulkanRHI::setJobSystem(Base::JobSystem* jobSystem)
+    {
+        mJobSystem = jobSystem;
+    }
+
+    void VulkanRHI::setPerFrameRecording(bool enable)
+    {
+        mPerFrameRecording = enable;
+    }
+
+    void VulkanRHI::setFramesInFlight(uint32_t count)
+    {
+        mFramesInFlight = count;
+    }
+
+    std::vector<VulkanDrawCommand>& VulkanRHI::getDrawList()
+    {
+        return mCommandBuffer->getDrawList();
+    }
+
+    void VulkanRHI::setBindless(bool enable)
+    {
+        if (!enable)
+        {
+            mBindlessTable.reset();
+            return;
+        }
+        if (!mDevice->isBindlessSupported())
+        {
+            std::cerr << "bindless textures need descriptor indexing, binding textures one by one" << std::endl;
+            return;
+        }
+        if (!mBindlessTable)
+        {
+            mBindlessTable = std::make_shared<VulkanBindlessTable>(mDevice);
+        }
+    }
+
+    VulkanBindlessTablePtr VulkanRHI::getBindlessTable()
+    {
+        return mBindlessTable;
+    }
+
+    void VulkanRHI::setTextureStreaming(bool enable, const VulkanTextureStreamerConfig& config)
+    {
+        if (!enable)
+        {
+            if (mTextureStreamer)
+            {
+                // frames in flight may still sample its versions
+                mDevice->idle();
+                mTextureStreamer->destroy();
+                mTextureStreamer.reset();
+            }
+            mStreamedTextures.clear();
+            if (mCommandBuffer)
+            {
+                mCommandBuffer->setTextureStreamer(nullptr);
+            }
+            return;
+        }
+        if (!mBindlessTable)
+        {
+            std::cerr << "texture streaming swaps bindless slots, call setBindless() first" << std::endl;
+            return;
+        }
+        if (!mTextureStreamer)
+        {
+            mTextureStreamer = std::make_shared<VulkanTextureStreamer>(mDevice, mBindlessTable, mSampler, mJobSystem, config);
+        }
+        // a command buffer recorded once would sample the version it was recorded with forever
+        mPerFrameRecording = true;
+    }
+
+    VulkanTextureStreamerPtr VulkanRHI::getTextureStreamer()
+    {
+        return mTextureStreamer;
+    }
+
+    uint32_t VulkanRHI::streamSampleTexture(const std::string& filename)
+    {
+        PROFILE_FUNCTION();
+        if (!mTextureStreamer)
+        {
+            return VulkanTextureStreamer::INVALID_TEXTURE;
+        }
+        const uint32_t texture = mTextureStreamer->add(filename);
+        if (texture != VulkanTextureStreamer::INVALID_TEXTURE)
+        {
+            mStreamedTextures.push_back(texture);
+        }
+        return texture;
+    }
+
+    void VulkanRHI::setGpuProfiling(bool enable, bool pipelineStatistics)
+    {
+        mGpuProfiling = enable;
+        mPipelineStatistics = pipelineStatistics;
+        if (!enable)
+        {
+            mGpuProfiler.reset();
+        }
+    }
+
+    VulkanGpuProfilerPtr VulkanRHI::getGpuProfiler()
+    {
+        return mGpuProfiler;
+    }
+
+    VulkanFrameGraphPtr VulkanRHI::createFrameGraph()
+    {
+        return std::make_shared<VulkanFrameGraph>(mDevice);
+    }
+
+    FrameGraphResource VulkanRHI::importSwapChain(VulkanFrameGraphPtr graph)
+    {
+        FrameGraphTextureDesc desc{};
+        desc.mWidth     = mSwapChain->getExtent().width;
+        desc.mHeight    = mSwapChain->getExtent().height;
+        desc.mFormat    = mSwapChain->getFormat();
+        // the image of the frame is set right before the graph runs, acquired images hold nothing worth keeping
+        return graph->importTexture("backbuffer", desc, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED,
+                                    mHeadless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    }
+
+    void VulkanRHI::setFrameGraph(VulkanFrameGraphPtr graph, FrameGraphResource backbuffer)
+    {
+        mFrameGraph         = graph;
+        mBackbuffer         = backbuffer;
+        mPerFrameRecording  = mPerFrameRecording || graph != nullptr;
+        if (mCommandBuffer)
+        {
+            mCommandBuffer->setPerFrameRecording(mPerFrameRecording);
+            mCommandBuffer->setFrameGraph(mFrameGraph, mBackbuffer);
+        }
+    }
+
+    void VulkanRHI::recordDrawList(VkCommandBuffer commandBuffer)
+    {
+        mCommandBuffer->recordDrawList(commandBuffer);
+    }
+
+    void VulkanRHI::setFrameLimit(uint32_t count)
+    {
+        mFrameLimit = count;
+    }
+
+    void VulkanRHI::setReadbackCallback(ReadbackCallback callback)
+    {
+        mReadbackCallback = callback;
+    }
+
     void VulkanRHI::endCommandBuffer()
     {
         mCommandBuffer->endRenderPass();
@@ -470,8 +814,17 @@ namespace Homura
 
     void VulkanRHI::destroySampleTexture()
     {
+        if (mTextureStreamer)
+        {
+            mTextureStreamer->destroy();
+            mStreamedTextures.clear();
+        }
         for (auto& texture : mSampleTextures)
         {
+            if (mBindlessTable)
+            {
+                mBindlessTable->remove(texture->getBindlessIndex());
+            }
             texture->destroy();
         }
     }
@@ -0,0 +1,210 @@
+//
+// Created by 最上川 on 2022/8/27/027.
+//
+
+#include <vulkanReadback.h>
+#include <vulkanDevice.h>
+#include <vulkanQueue.h>
+#include <vulkanSwapChain.h>
+#include <vulkanBuffer.h>
+#include <vulkanCommandBuffer.h>
+#include <vulkanSynchronization.h>
+#include <debugUtils.h>
+#include <iostream>
+
+namespace Homura
+{
+    static uint32_t getTexelSize(VkFormat format)
+    {
+        switch (format)
+        {
+            case VK_FORMAT_R8G8B8A8_UNORM:
+            case VK_FORMAT_R8G8B8A8_SRGB:
+            case VK_FORMAT_B8G8R8A8_UNORM:
+            case VK_FORMAT_B8G8R8A8_SRGB:
+            case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+                return 4;
+            default:
+                return 0;
+        }
+    }
+
+    VulkanReadback::VulkanReadback(VulkanDevicePtr device, VulkanSwapChainPtr swapChain, ReadbackCallback callback)
+        : mDevice{device}
+        , mSwapChain{swapChain}
+        , mCallback{callback}
+        , mCommandPool{nullptr}
+        , mRowPitch{0}
+        , mSlots{}
+        , mPending{}
+    {
+        create();
+    }
+
+    VulkanReadback::~VulkanReadback()
+    {
+        destroy();
+    }
+
+    void VulkanReadback::create()
+    {
+        const uint32_t texelSize = getTexelSize(mSwapChain->getFormat());
+        if (texelSize == 0)
+        {
+            std::cerr << "readback supports 4 byte formats only, nothing is read back" << std::endl;
+            return;
+        }
+
+        const VkExtent2D extent = mSwapChain->getExtent();
+        mRowPitch = extent.width * texelSize;
+        mCommandPool = std::make_shared<VulkanCommandPool>(mDevice, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+
+        mSlots.resize(mSwapChain->getImageCount());
+        for (auto& slot : mSlots)
+        {
+            slot.mBuffer = std::make_shared<VulkanBuffer>(mDevice, nullptr, static_cast<VkDeviceSize>(mRowPitch) * extent.height, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandBufferCount    = 1;
+            allocInfo.commandPool           = mCommandPool->getHandle();
+            allocInfo.level                 = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            VERIFYVULKANRESULT(vkAllocateCommandBuffers(mDevice->getHandle(), &allocInfo, &slot.mCommandBuffer));
+        }
+    }
+
+    void VulkanReadback::destroy()
+    {
+        if (mSlots.empty())
+        {
+            return;
+        }
+        collect(true);
+        for (auto& slot : mSlots)
+        {
+            slot.mBuffer->destroy();
+        }
+        mSlots.clear();
+        // command buffers go with their pool
+        mCommandPool->destroy();
+        mCommandPool.reset();
+    }
+
+    void VulkanReadback::submit(uint32_t imageIndex, uint64_t frame)
+    {
+        if (imageIndex >= mSlots.size())
+        {
+            return;
+        }
+
+        // the buffer is about to be written again, whatever it holds goes out first
+        VulkanTimeline& timeline = mDevice->getGraphicsQueue()->getTimeline();
+        while (mSlots[imageIndex].mPending)
+        {
+            const uint32_t oldest = mPending.front();
+            timeline.wait(mSlots[oldest].mValue);
+            mPending.pop_front();
+            deliver(oldest);
+        }
+
+        Slot& slot = mSlots[imageIndex];
+        const VkExtent2D extent = mSwapChain->getExtent();
+        VkCommandBuffer commandBuffer = slot.mCommandBuffer;
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VERIFYVULKANRESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+        // the frame left the image in TRANSFER_SRC, through its render pass or a barrier of the frame graph.
+        // Only its writes have to be made visible
+        VkImageMemoryBarrier imageBarrier{};
+        imageBarrier.sType                              = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarrier.srcAccessMask                      = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        imageBarrier.dstAccessMask                      = VK_ACCESS_TRANSFER_READ_BIT;
+        imageBarrier.oldLayout                          = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        imageBarrier.newLayout                          = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        imageBarrier.srcQueueFamilyIndex                = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex                = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image                              = mSwapChain->getImage(imageIndex);
+        imageBarrier.subresourceRange.aspectMask        = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageBarrier.subresourceRange.baseMipLevel      = 0;
+        imageBarrier.subresourceRange.levelCount        = 1;
+        imageBarrier.subresourceRange.baseArrayLayer    = 0;
+        imageBarrier.subresourceRange.layerCount        = 1;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+        VkBufferImageCopy region{};
+        region.bufferOffset                     = 0;
+        region.bufferRowLength                  = 0;
+        region.bufferImageHeight                = 0;
+        region.imageSubresource.aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel        = 0;
+        region.imageSubresource.baseArrayLayer  = 0;
+        region.imageSubresource.layerCount      = 1;
+        region.imageOffset                      = {0, 0, 0};
+        region.imageExtent                      = {extent.width, extent.height, 1};
+        vkCmdCopyImageToBuffer(commandBuffer, imageBarrier.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.mBuffer->getHandle(), 1, &region);
+
+        // host reads after the copy, and later frames must not render into the image while it is copied
+        VkBufferMemoryBarrier bufferBarrier{};
+        bufferBarrier.sType                 = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarrier.srcAccessMask         = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.dstAccessMask         = VK_ACCESS_HOST_READ_BIT;
+        bufferBarrier.srcQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.dstQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.buffer                = slot.mBuffer->getHandle();
+        bufferBarrier.offset                = 0;
+        bufferBarrier.size                  = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+        VERIFYVULKANRESULT(vkEndCommandBuffer(commandBuffer));
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount   = 1;
+        submitInfo.pCommandBuffers      = &commandBuffer;
+        slot.mValue     = timeline.submit(mDevice->getGraphicsQueue()->getHandle(), submitInfo);
+        slot.mFrame     = frame;
+        slot.mPending   = true;
+        mPending.push_back(imageIndex);
+    }
+
+    void VulkanReadback::collect(bool wait)
+    {
+        VulkanTimeline& timeline = mDevice->getGraphicsQueue()->getTimeline();
+        while (!mPending.empty())
+        {
+            const uint32_t oldest = mPending.front();
+            if (wait)
+            {
+                timeline.wait(mSlots[oldest].mValue);
+            }
+            else if (!timeline.isComplete(mSlots[oldest].mValue))
+            {
+                break;
+            }
+            mPending.pop_front();
+            deliver(oldest);
+        }
+    }
+
+    void VulkanReadback::deliver(uint32_t imageIndex)
+    {
+        Slot& slot = mSlots[imageIndex];
+        slot.mPending = false;
+        if (!mCallback)
+        {
+            return;
+        }
+
+        VulkanReadbackImage image{};
+        image.mFrame        = slot.mFrame;
+        image.mImageIndex   = imageIndex;
+        image.mData         = slot.mBuffer->mAllocation.mMapped;
+        image.mExtent       = mSwapChain->getExtent();
+        image.mFormat       = mSwapChain->getFormat();
+        image.mRowPitch     = mRowPitch;
+        mCallback(image);
+    }
+}
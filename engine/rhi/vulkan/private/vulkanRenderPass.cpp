@@ -5,6 +5,7 @@
 #include <vulkanRenderPass.h>
 #include <vulkanDevice.h>
 #include <rhiResources.h>
+#include <vulkanPipelineCache.h>
 #include <debugUtils.h>
 
 namespace Homura
@@ -25,6 +26,7 @@ namespace Homura
     VulkanRenderPass::VulkanRenderPass(VulkanDevicePtr device)
         : mDevice{device}
         , mRenderPass{VK_NULL_HANDLE}
+        , mCompatibilityHash{0}
     {
 
     }
@@ -50,16 +52,50 @@ namespace Homura
             subPasses.push_back(mInfo.mSubPasses[i]->getHandle());
         }
 
+        build(mInfo.mAttachmentDescriptions, subPasses, mInfo.mDependencies);
+    }
+
+    void VulkanRenderPass::build(const std::vector<VkAttachmentDescription>& attachments, const std::vector<VkSubpassDescription>& subPasses,
+                                 const std::vector<VkSubpassDependency>& dependencies)
+    {
         VkRenderPassCreateInfo createInfo{};
         createInfo.sType            = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        createInfo.attachmentCount  = static_cast<uint32_t>(mInfo.mAttachmentDescriptions.size());
-        createInfo.pAttachments     = mInfo.mAttachmentDescriptions.data();
-        createInfo.dependencyCount  = static_cast<uint32_t>(mInfo.mDependencies.size());
-        createInfo.pDependencies    = mInfo.mDependencies.data();
+        createInfo.attachmentCount  = static_cast<uint32_t>(attachments.size());
+        createInfo.pAttachments     = attachments.data();
+        createInfo.dependencyCount  = static_cast<uint32_t>(dependencies.size());
+        createInfo.pDependencies    = dependencies.data();
         createInfo.subpassCount     = static_cast<uint32_t>(subPasses.size());
         createInfo.pSubpasses       = subPasses.data();
 
         VERIFYVULKANRESULT(vkCreateRenderPass(mDevice->getHandle(), &createInfo, nullptr, &mRenderPass));
+        mCompatibilityHash = computeCompatibilityHash(attachments, subPasses);
+    }
+
+    uint64_t VulkanRenderPass::computeCompatibilityHash(const std::vector<VkAttachmentDescription>& attachments, const std::vector<VkSubpassDescription>& subPasses) const
+    {
+        uint64_t hash = hashMemory(nullptr, 0);
+        for (const auto& attachment : attachments)
+        {
+            const uint32_t fields[2] = {static_cast<uint32_t>(attachment.format), static_cast<uint32_t>(attachment.samples)};
+            hash = hashMemory(fields, sizeof(fields), hash);
+        }
+
+        // only the attachment indices take part, layouts do not
+        auto hashReferences = [&hash](const VkAttachmentReference* references, uint32_t count) {
+            hash = hashMemory(&count, sizeof(count), hash);
+            for (uint32_t i = 0; i < count && references; i++)
+            {
+                hash = hashMemory(&references[i].attachment, sizeof(uint32_t), hash);
+            }
+        };
+        for (const auto& subPass : subPasses)
+        {
+            hashReferences(subPass.pColorAttachments, subPass.colorAttachmentCount);
+            hashReferences(subPass.pInputAttachments, subPass.inputAttachmentCount);
+            hashReferences(subPass.pResolveAttachments, subPass.pResolveAttachments ? subPass.colorAttachmentCount : 0);
+            hashReferences(subPass.pDepthStencilAttachment, subPass.pDepthStencilAttachment ? 1 : 0);
+        }
+        return hash;
     }
     void VulkanRenderPass::destroy()
     {
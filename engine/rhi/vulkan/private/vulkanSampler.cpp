@@ -40,7 +40,8 @@ namespace Homura
         createInfo.mipmapMode               = VK_SAMPLER_MIPMAP_MODE_LINEAR;
         createInfo.mipLodBias               = 0.0f;
         createInfo.minLod                   = 0.0f;
-        createInfo.maxLod                   = 0.0f;
+        // every mip the texture has
+        createInfo.maxLod                   = VK_LOD_CLAMP_NONE;
 
         VERIFYVULKANRESULT(vkCreateSampler(mDevice->getHandle(), &createInfo, nullptr, &mSampler));
     }
@@ -4,6 +4,7 @@
 
 #include <vulkanShader.h>
 #include <vulkanDevice.h>
+#include <vulkanPipelineCache.h>
 #include <debugUtils.h>
 #include <fstream>
 
@@ -14,6 +15,7 @@ namespace Homura
         , mStage{stage}
         , mEntryPoint{entryPoint}
         , mModule{VK_NULL_HANDLE}
+        , mCodeHash{0}
         , mVertexInputAttributeDes{}
         , mVertexInputBindingDes{}
     {
@@ -26,6 +28,7 @@ namespace Homura
         createInfo.sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
         createInfo.codeSize = shaderCode.size();
         createInfo.pCode    = reinterpret_cast<const uint32_t*>(shaderCode.data());
+        mCodeHash           = hashMemory(shaderCode.data(), shaderCode.size());
         VERIFYVULKANRESULT(vkCreateShaderModule(mDevice->getHandle(), &createInfo, nullptr, &mModule));
     }
 
@@ -19,12 +19,40 @@ namespace Homura
         : mDevice{device}
         , mSurface{surface}
         , mWindow{window}
+        , mSwapChain{VK_NULL_HANDLE}
+        , mSwapChainFormat{VK_FORMAT_UNDEFINED}
+        , mSwapChainExtent{}
+        , mImageCount{0}
+        , mHeadless{false}
+        , mOffscreenImages{}
+        , mNextImage{0}
+    {
+        create();
+    }
+
+    VulkanSwapChain::VulkanSwapChain(VulkanDevicePtr device, VkExtent2D extent, uint32_t imageCount, VkFormat format)
+        : mDevice{device}
+        , mSurface{nullptr}
+        , mWindow{nullptr}
+        , mSwapChain{VK_NULL_HANDLE}
+        , mSwapChainFormat{format}
+        , mSwapChainExtent{extent}
+        , mImageCount{std::max(imageCount, 1u)}
+        , mHeadless{true}
+        , mOffscreenImages{}
+        , mNextImage{0}
     {
         create();
     }
 
     void VulkanSwapChain::create()
     {
+        if (mHeadless)
+        {
+            createOffscreenImages();
+            return;
+        }
+
         auto swapChainSupportInfo = querySwapChainSupportInfo();
         VkSurfaceFormatKHR surfaceFormat = chooseSurfaceFormat(swapChainSupportInfo.mFormats);
         VkPresentModeKHR presentMode = chooseSurfacePresentMode(swapChainSupportInfo.mPresentModes);
@@ -84,6 +112,17 @@ namespace Homura
 
     void VulkanSwapChain::destroyImageView()
     {
+        if (mHeadless)
+        {
+            for (auto& image : mOffscreenImages)
+            {
+                image->destroy();
+            }
+            mOffscreenImages.clear();
+            mSwapChainImages.clear();
+            mSwapChainImageViews.clear();
+            return;
+        }
         for (auto &imageView : mSwapChainImageViews)
         {
             vkDestroyImageView(mDevice->getHandle(), imageView, nullptr);
@@ -109,6 +148,37 @@ namespace Homura
         }
     }
 
+    void VulkanSwapChain::createOffscreenImages()
+    {
+        // rendered to as the resolve target, then copied out or sampled
+        mOffscreenImages.resize(mImageCount);
+        mSwapChainImages.resize(mImageCount);
+        mSwapChainImageViews.resize(mImageCount);
+        for (uint32_t i = 0; i < mImageCount; i++)
+        {
+            mOffscreenImages[i] = std::make_shared<VulkanTexture2D>(mDevice, mSwapChainExtent.width, mSwapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT, mSwapChainFormat,
+                                                                    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            mSwapChainImages[i] = mOffscreenImages[i]->getImage();
+            mSwapChainImageViews[i] = mOffscreenImages[i]->getImageView();
+        }
+        mNextImage = 0;
+    }
+
+    uint32_t VulkanSwapChain::acquireOffscreen()
+    {
+        assert(mHeadless);
+        const uint32_t index = mNextImage;
+        mNextImage = (mNextImage + 1) % mImageCount;
+        return index;
+    }
+
+    VkImage VulkanSwapChain::getImage(uint32_t index)
+    {
+        assert(index < mImageCount);
+        return mSwapChainImages[index];
+    }
+
     VkImageView VulkanSwapChain::getImageView(uint32_t index)
     {
         assert(index < mImageCount);
@@ -4,7 +4,10 @@
 
 #include <vulkanSynchronization.h>
 #include <vulkanDevice.h>
+#include <vulkanQueue.h>
 #include <debugUtils.h>
+#include <algorithm>
+#include <cassert>
 
 namespace Homura
 {
@@ -51,13 +54,6 @@ namespace Homura
         return vkGetFenceStatus(mDevice->getHandle(), mFence);
     }
 
-    VulkanFenceEntity& VulkanFenceEntity::operator=(VulkanFenceEntity &r)
-    {
-        mDevice = r.mDevice;
-        mFence = r.mFence;
-        return *this;
-    }
-
     VulkanSemaphoreEntity::VulkanSemaphoreEntity(VulkanDevicePtr device)
         : mDevice{device}
         , mSemaphore{VK_NULL_HANDLE}
@@ -81,97 +77,303 @@ namespace Homura
         }
     }
 
-    VulkanFences::VulkanFences(VulkanDevicePtr device, uint32_t num)
+    VulkanSemaphores::VulkanSemaphores(VulkanDevicePtr device)
         : mDevice{device}
-        , mFences{}
+        , mSemaphores{}
     {
-        for (uint32_t i = 0; i < num; i++)
+
+    }
+
+    void VulkanSemaphores::create(uint32_t num)
+    {
+        for (int i = 0; i < num; i++)
         {
-            mFences.emplace_back(VulkanFenceEntity(mDevice));
+            VulkanSemaphoreEntity entiy(mDevice);
+            entiy.create();
+            mSemaphores.emplace_back(entiy);
         }
     }
 
-    void VulkanFences::create()
+    void VulkanSemaphores::destroy()
     {
-        for (auto& fence : mFences)
+        for (auto& entiy : mSemaphores)
         {
-            fence.create(true);
+            entiy.destroy();
         }
+        mSemaphores.clear();
     }
 
-    void VulkanFences::destroy()
+    VkSemaphore& VulkanSemaphores::getSemaphore(uint32_t index)
+    {
+        assert(index < mSemaphores.size());
+        return mSemaphores[index].getHandle();
+    }
+
+    VulkanTimeline::VulkanTimeline(VulkanDevicePtr device)
+        : mDevice{device}
+        , mSemaphore{VK_NULL_HANDLE}
+        , mMutex{}
+        , mLastValue{0}
+        , mCompletedValue{0}
+        , mPending{}
+        , mFreeFences{}
     {
-        for (auto& entity : mFences)
+        if (mDevice->isTimelineSupported())
+        {
+            VkSemaphoreTypeCreateInfo typeInfo{};
+            typeInfo.sType          = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+            typeInfo.semaphoreType  = VK_SEMAPHORE_TYPE_TIMELINE;
+            typeInfo.initialValue   = 0;
+
+            VkSemaphoreCreateInfo createInfo{};
+            createInfo.sType        = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            createInfo.pNext        = &typeInfo;
+            VERIFYVULKANRESULT(vkCreateSemaphore(mDevice->getHandle(), &createInfo, nullptr, &mSemaphore));
+        }
+    }
+
+    VulkanTimeline::~VulkanTimeline()
+    {
+        destroy();
+    }
+
+    void VulkanTimeline::destroy()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mSemaphore != VK_NULL_HANDLE)
+        {
+            vkDestroySemaphore(mDevice->getHandle(), mSemaphore, nullptr);
+            mSemaphore = VK_NULL_HANDLE;
+        }
+        for (auto& pending : mPending)
+        {
+            vkDestroyFence(mDevice->getHandle(), pending.second, nullptr);
+        }
+        mPending.clear();
+        for (auto fence : mFreeFences)
+        {
+            vkDestroyFence(mDevice->getHandle(), fence, nullptr);
+        }
+        mFreeFences.clear();
+    }
+
+    uint64_t VulkanTimeline::submit(VkQueue queue, const VkSubmitInfo& info, const std::vector<VulkanTimelineWait>& waits)
+    {
+        if (mSemaphore == VK_NULL_HANDLE)
+        {
+            // no GPU side waits between queues without timeline semaphores
+            for (const auto& wait : waits)
+            {
+                wait.mTimeline->wait(wait.mValue);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        const uint64_t value = mLastValue + 1;
+        VkSubmitInfo submitInfo = info;
+
+        if (mSemaphore != VK_NULL_HANDLE)
         {
-            entity.destroy();
+            // binary semaphores of info take a value too, it is ignored
+            std::vector<VkSemaphore> waitSemaphores(info.pWaitSemaphores, info.pWaitSemaphores + info.waitSemaphoreCount);
+            std::vector<VkPipelineStageFlags> waitStages(info.pWaitDstStageMask, info.pWaitDstStageMask + info.waitSemaphoreCount);
+            std::vector<uint64_t> waitValues(info.waitSemaphoreCount, 0);
+            for (const auto& wait : waits)
+            {
+                waitSemaphores.push_back(wait.mTimeline->getSemaphore());
+                waitStages.push_back(wait.mStageMask);
+                waitValues.push_back(wait.mValue);
+            }
+
+            std::vector<VkSemaphore> signalSemaphores(info.pSignalSemaphores, info.pSignalSemaphores + info.signalSemaphoreCount);
+            std::vector<uint64_t> signalValues(info.signalSemaphoreCount, 0);
+            signalSemaphores.push_back(mSemaphore);
+            signalValues.push_back(value);
+
+            VkTimelineSemaphoreSubmitInfo timelineInfo{};
+            timelineInfo.sType                      = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+            timelineInfo.pNext                      = info.pNext;
+            timelineInfo.waitSemaphoreValueCount    = static_cast<uint32_t>(waitValues.size());
+            timelineInfo.pWaitSemaphoreValues       = waitValues.data();
+            timelineInfo.signalSemaphoreValueCount  = static_cast<uint32_t>(signalValues.size());
+            timelineInfo.pSignalSemaphoreValues     = signalValues.data();
+
+            submitInfo.pNext                        = &timelineInfo;
+            submitInfo.waitSemaphoreCount           = static_cast<uint32_t>(waitSemaphores.size());
+            submitInfo.pWaitSemaphores              = waitSemaphores.data();
+            submitInfo.pWaitDstStageMask            = waitStages.data();
+            submitInfo.signalSemaphoreCount         = static_cast<uint32_t>(signalSemaphores.size());
+            submitInfo.pSignalSemaphores            = signalSemaphores.data();
+            VERIFYVULKANRESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
         }
-        mFences.clear();
+        else
+        {
+            VkFence fence = VK_NULL_HANDLE;
+            if (!mFreeFences.empty())
+            {
+                fence = mFreeFences.back();
+                mFreeFences.pop_back();
+            }
+            else
+            {
+                VkFenceCreateInfo fenceInfo{};
+                fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+                VERIFYVULKANRESULT(vkCreateFence(mDevice->getHandle(), &fenceInfo, nullptr, &fence));
+            }
+            VERIFYVULKANRESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+            mPending.emplace_back(value, fence);
+        }
+
+        mLastValue = value;
+        return value;
     }
 
-    void VulkanFences::wait(uint32_t index)
+    void VulkanTimeline::retire(uint64_t value, bool block)
     {
-        assert(index < mFences.size());
-        VulkanFenceEntity entity = mFences[index];
-        entity.wait();
+        while (!mPending.empty() && mPending.front().first <= value)
+        {
+            VkFence fence = mPending.front().second;
+            if (block)
+            {
+                VERIFYVULKANRESULT(vkWaitForFences(mDevice->getHandle(), 1, &fence, VK_TRUE, UINT64_MAX));
+            }
+            else if (vkGetFenceStatus(mDevice->getHandle(), fence) != VK_SUCCESS)
+            {
+                break;
+            }
+            // submits of a queue complete in order
+            mCompletedValue = mPending.front().first;
+            VERIFYVULKANRESULT(vkResetFences(mDevice->getHandle(), 1, &fence));
+            mFreeFences.push_back(fence);
+            mPending.pop_front();
+        }
     }
 
-    void VulkanFences::waitAll()
+    uint64_t VulkanTimeline::getCompletedValue()
     {
-        std::vector<VkFence> fences;
-        for (auto& entity : mFences)
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mSemaphore != VK_NULL_HANDLE)
         {
-            fences.push_back(entity.getHandle());
+            VERIFYVULKANRESULT(vkGetSemaphoreCounterValue(mDevice->getHandle(), mSemaphore, &mCompletedValue));
         }
-        VERIFYVULKANRESULT(vkWaitForFences(mDevice->getHandle(), fences.size(), fences.data(), VK_TRUE, UINT64_MAX));
+        else
+        {
+            retire(mLastValue, false);
+        }
+        return mCompletedValue;
     }
 
-    VkFence& VulkanFences::getFence(uint32_t index)
+    bool VulkanTimeline::isComplete(uint64_t value)
     {
-        assert(index < mFences.size());
-        return mFences[index].getHandle();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (value <= mCompletedValue)
+            {
+                return true;
+            }
+        }
+        return value <= getCompletedValue();
     }
 
-    void VulkanFences::setValue(VulkanFenceEntity &value, uint32_t index)
+    void VulkanTimeline::wait(uint64_t value)
     {
-        assert(index < mFences.size());
-        mFences[index] = value;
+        if (isComplete(value))
+        {
+            return;
+        }
+
+        if (mSemaphore != VK_NULL_HANDLE)
+        {
+            assert(value <= getLastValue());
+            VkSemaphoreWaitInfo waitInfo{};
+            waitInfo.sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+            waitInfo.semaphoreCount = 1;
+            waitInfo.pSemaphores    = &mSemaphore;
+            waitInfo.pValues        = &value;
+            VERIFYVULKANRESULT(vkWaitSemaphores(mDevice->getHandle(), &waitInfo, UINT64_MAX));
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        assert(value <= mLastValue);
+        retire(value, true);
     }
 
-    VulkanFenceEntity& VulkanFences::getEntity(uint32_t index)
+    void VulkanTimeline::waitIdle()
     {
-        assert(index < mFences.size());
-        return mFences[index];
+        wait(getLastValue());
     }
 
-    VulkanSemaphores::VulkanSemaphores(VulkanDevicePtr device)
+    VulkanFrameSync::VulkanFrameSync(VulkanDevicePtr device, uint32_t framesInFlight, uint32_t imageCount)
         : mDevice{device}
-        , mSemaphores{}
+        , mTimeline{device->getGraphicsQueue()->getTimeline()}
+        , mFramesInFlight{std::max(framesInFlight, 1u)}
+        , mFrameNumber{0}
+        , mSlotFrames(mFramesInFlight, 0)
+        , mSlotValues(mFramesInFlight, 0)
+        , mImageValues(imageCount, 0)
+        , mImageAvailable{device}
+        , mRenderFinished{device}
     {
+        mImageAvailable.create(mFramesInFlight);
+        mRenderFinished.create(mFramesInFlight);
+    }
 
+    VulkanFrameSync::~VulkanFrameSync()
+    {
+        destroy();
     }
 
-    void VulkanSemaphores::create(uint32_t num)
+    void VulkanFrameSync::destroy()
     {
-        for (int i = 0; i < num; i++)
-        {
-            VulkanSemaphoreEntity entiy(mDevice);
-            entiy.create();
-            mSemaphores.emplace_back(entiy);
-        }
+        mImageAvailable.destroy();
+        mRenderFinished.destroy();
     }
 
-    void VulkanSemaphores::destroy()
+    uint32_t VulkanFrameSync::beginFrame()
     {
-        for (auto& entiy : mSemaphores)
+        // frame N - mFramesInFlight, the last one to use this slot
+        const uint32_t slot = getFrameIndex();
+        mTimeline.wait(mSlotValues[slot]);
+        return slot;
+    }
+
+    void VulkanFrameSync::waitImage(uint32_t imageIndex)
+    {
+        assert(imageIndex < mImageValues.size());
+        mTimeline.wait(mImageValues[imageIndex]);
+    }
+
+    void VulkanFrameSync::submit(const VkSubmitInfo& info, uint32_t imageIndex, const std::vector<VulkanTimelineWait>& waits)
+    {
+        const uint32_t slot = getFrameIndex();
+        const uint64_t value = mTimeline.submit(mDevice->getGraphicsQueue()->getHandle(), info, waits);
+        mSlotFrames[slot] = mFrameNumber;
+        mSlotValues[slot] = value;
+        mImageValues[imageIndex] = value;
+        mFrameNumber++;
+    }
+
+    bool VulkanFrameSync::isFrameComplete(uint64_t frame)
+    {
+        assert(frame < mFrameNumber);
+        const uint32_t slot = static_cast<uint32_t>(frame % mFramesInFlight);
+        // a newer frame in the slot means beginFrame() has waited for this one already
+        return mSlotFrames[slot] != frame || mTimeline.isComplete(mSlotValues[slot]);
+    }
+
+    void VulkanFrameSync::waitFrame(uint64_t frame)
+    {
+        assert(frame < mFrameNumber);
+        const uint32_t slot = static_cast<uint32_t>(frame % mFramesInFlight);
+        if (mSlotFrames[slot] == frame)
         {
-            entiy.destroy();
+            mTimeline.wait(mSlotValues[slot]);
         }
-        mSemaphores.clear();
     }
 
-    VkSemaphore& VulkanSemaphores::getSemaphore(uint32_t index)
+    void VulkanFrameSync::waitIdle()
     {
-        assert(index < mSemaphores.size());
-        return mSemaphores[index].getHandle();
+        mTimeline.waitIdle();
     }
-}
\ No newline at end of file
+}
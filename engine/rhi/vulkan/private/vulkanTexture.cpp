@@ -7,6 +7,7 @@
 #include <vulkanBuffer.h>
 #include <vulkanCommandBuffer.h>
 #include <debugUtils.h>
+#include <algorithm>
 
 namespace Homura
 {
@@ -18,14 +19,16 @@ namespace Homura
         , mType{type}
         , mImage{VK_NULL_HANDLE}
         , mImageView{VK_NULL_HANDLE}
-        , mImageMemory{VK_NULL_HANDLE}
+        , mAllocation{}
         , mMipLevels{mipLevels}
         , mLayerCount{arraySize * ((mType == TEXTURE_CUBE || mType == TEXTURE_CUBE_ARRAY) ? 6 : 1)}
         , mFormat{format}
         , mNumSamples{numSamples}
         , mProperties{properties}
-        , mImageLayout{VK_IMAGE_LAYOUT_UNDEFINED}
+        , mAspect{aspectFlags}
+        , mLayoutState{}
     {
+        mLayoutState.reset(mMipLevels, mLayerCount, VK_IMAGE_LAYOUT_UNDEFINED);
         createImage(mWidth, mHeight, mMipLevels, mNumSamples, mFormat, tiling, usage, mProperties);
         createImageView(mFormat, aspectFlags, mMipLevels);
     }
@@ -42,11 +45,7 @@ namespace Homura
             vkDestroyImage(mDevice->getHandle(), mImage, nullptr);
             mImage = VK_NULL_HANDLE;
         }
-        if (mImageMemory != VK_NULL_HANDLE)
-        {
-            vkFreeMemory(mDevice->getHandle(), mImageMemory, nullptr);
-            mImageMemory = VK_NULL_HANDLE;
-        }
+        mDevice->getMemoryAllocator().free(mAllocation);
     }
 
     void VulkanTexture::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
@@ -83,25 +82,19 @@ namespace Homura
         createInfo.arrayLayers   = mLayerCount;
         createInfo.format        = format;
         createInfo.tiling        = tiling;
-        createInfo.initialLayout = mImageLayout;
+        createInfo.initialLayout = mLayoutState.getLayout();
         createInfo.usage         = usage;
         createInfo.samples       = numSamples;
-        createInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+        const std::vector<uint32_t>& queueFamilies = mDevice->getSharedQueueFamilies();
+        createInfo.sharingMode              = queueFamilies.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT;
+        createInfo.queueFamilyIndexCount    = static_cast<uint32_t>(queueFamilies.size());
+        createInfo.pQueueFamilyIndices      = queueFamilies.data();
 
 
         VERIFYVULKANRESULT(vkCreateImage(mDevice->getHandle(), &createInfo, nullptr, &mImage));
 
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(mDevice->getHandle(), mImage, &memRequirements);
-
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, mProperties);
-
-        VERIFYVULKANRESULT(vkAllocateMemory(mDevice->getHandle(), &allocInfo, nullptr, &mImageMemory));
-
-        vkBindImageMemory(mDevice->getHandle(), mImage, mImageMemory, 0);
+        mAllocation = mDevice->getMemoryAllocator().allocateImage(mImage, tiling, mProperties);
+        VERIFYVULKANRESULT(vkBindImageMemory(mDevice->getHandle(), mImage, mAllocation.mMemory, mAllocation.mOffset));
     }
 
     void VulkanTexture::createImageView(VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
@@ -145,85 +138,34 @@ namespace Homura
         VERIFYVULKANRESULT(vkCreateImageView(mDevice->getHandle(), &viewInfo, nullptr, &mImageView));
     }
 
-    uint32_t VulkanTexture::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
-    {
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(mDevice->getPhysicalHandle(), &memProperties);
-
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
-        {
-            if ((typeFilter & 1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-            {
-                return i;
-            }
-        }
-        return -1;
-    }
-
-    void VulkanTexture::fromBuffer(VulkanCommandBufferPtr command, VulkanBufferPtr buffer)
+    uint64_t VulkanTexture::upload(const void* data, VkDeviceSize size, uint32_t mipLevel)
     {
-        VkCommandBuffer commandBuffer = command->beginSingleTimeCommands();
         VkBufferImageCopy region{};
         region.bufferOffset                     = 0;
         region.bufferRowLength                  = 0;
         region.bufferImageHeight                = 0;
-        region.imageSubresource.aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel        = 0;
+        region.imageSubresource.aspectMask      = mAspect;
+        region.imageSubresource.mipLevel        = mipLevel;
         region.imageSubresource.baseArrayLayer  = 0;
         region.imageSubresource.layerCount      = 1;
         region.imageOffset                      = {0, 0, 0};
-        region.imageExtent                      = {mWidth, mHeight, 1};
+        region.imageExtent                      = {std::max(mWidth >> mipLevel, 1u), std::max(mHeight >> mipLevel, 1u), 1};
 
-        vkCmdCopyBufferToImage(commandBuffer, buffer->getHandle(), mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-        command->endSingleTimeCommands(commandBuffer);
+        return mDevice->getUploadManager().uploadImage(mImage, data, size, region);
     }
 
-    void VulkanTexture::setImageLayout(VkImageLayout newLayout, VulkanCommandBufferPtr command)
+    void VulkanTexture::setImageLayout(VkImageLayout newLayout, uint32_t baseMipLevel, uint32_t levelCount)
     {
-        VkImageMemoryBarrier imageMemoryBarrier{};
-        imageMemoryBarrier.sType                            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        imageMemoryBarrier.oldLayout                        = mImageLayout;
-        imageMemoryBarrier.newLayout                        = newLayout;
-        imageMemoryBarrier.srcQueueFamilyIndex              = VK_QUEUE_FAMILY_IGNORED;
-        imageMemoryBarrier.dstQueueFamilyIndex              = VK_QUEUE_FAMILY_IGNORED;
-        imageMemoryBarrier.image                            = mImage;
-        imageMemoryBarrier.subresourceRange.aspectMask      = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageMemoryBarrier.subresourceRange.baseMipLevel    = 0;
-        imageMemoryBarrier.subresourceRange.levelCount      = mMipLevels;
-        imageMemoryBarrier.subresourceRange.baseArrayLayer  = 0;
-        imageMemoryBarrier.subresourceRange.layerCount      = 1;
-
-        VkPipelineStageFlags srcStageMask;
-        VkPipelineStageFlags dstStageMask;
-
-        if (mImageLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-        {
-            imageMemoryBarrier.srcAccessMask = 0;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-            srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        }
-        else if (mImageLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-        {
-            imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-            srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
-            dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-        }
-        else
-        {
-            throw std::invalid_argument("unsupported layout transition!");
-        }
-
-        VkCommandBuffer commandBuffer = command->beginSingleTimeCommands();
-        command->transferImageLayout(commandBuffer, imageMemoryBarrier, srcStageMask, dstStageMask);
-        command->endSingleTimeCommands(commandBuffer);
-        mImageLayout = newLayout;
+        VkImageSubresourceRange range{};
+        range.aspectMask        = mAspect;
+        range.baseMipLevel      = baseMipLevel;
+        range.levelCount        = levelCount;
+        range.baseArrayLayer    = 0;
+        range.layerCount        = mLayerCount;
+        mDevice->getUploadManager().transitionImage(mImage, mLayoutState, range, newLayout);
     }
 
-    void VulkanTexture::generateMipmaps(VulkanCommandBufferPtr command)
+    void VulkanTexture::generateMipmaps()
     {
         VkFormatProperties formatProperties;
         vkGetPhysicalDeviceFormatProperties(mDevice->getPhysicalHandle(), mFormat, &formatProperties);
@@ -233,67 +175,51 @@ namespace Homura
             throw std::runtime_error("texture image format does not support linear blitting!");
         }
 
-        VkCommandBuffer commandBuffer = command->beginSingleTimeCommands();
-
-        VkImageMemoryBarrier barrier{};
-        barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.image                           = mImage;
-        barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
-        barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount     = 1;
-        barrier.subresourceRange.levelCount     = 1;
+        // blits need a graphics queue
+        VkCommandBuffer commandBuffer = mDevice->getUploadManager().getGraphicsCommands();
 
+        VkImageSubresourceRange range{};
+        range.aspectMask        = mAspect;
+        range.levelCount        = 1;
+        range.baseArrayLayer    = 0;
+        range.layerCount        = mLayerCount;
 
+        // one barrier per level, the source mip of every layer at once
+        VulkanBarrierBatch barriers;
         int32_t mipWidth = mWidth;
         int32_t mipHeight = mHeight;
 
         for (uint32_t i = 1; i < mMipLevels; i++)
         {
-            barrier.subresourceRange.baseMipLevel   = i - 1;
-            barrier.oldLayout                       = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            barrier.newLayout                       = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            barrier.srcAccessMask                   = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask                   = VK_ACCESS_TRANSFER_READ_BIT;
-
-            command->transferImageLayout(commandBuffer, barrier, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+            range.baseMipLevel = i - 1;
+            barriers.transition(mImage, mLayoutState, range, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+            barriers.flush(commandBuffer);
 
             VkImageBlit blit{};
             blit.srcOffsets[0]                      = {0, 0, 0};
             blit.srcOffsets[1]                      = {mipWidth, mipHeight, 1};
-            blit.srcSubresource.aspectMask          = VK_IMAGE_ASPECT_COLOR_BIT;
+            blit.srcSubresource.aspectMask          = mAspect;
             blit.srcSubresource.mipLevel            = i - 1;
             blit.srcSubresource.baseArrayLayer      = 0;
-            blit.srcSubresource.layerCount          = 1;
+            blit.srcSubresource.layerCount          = mLayerCount;
             blit.dstOffsets[0]                      = {0, 0, 0};
             blit.dstOffsets[1]                      = {mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1};
-            blit.dstSubresource.aspectMask          = VK_IMAGE_ASPECT_COLOR_BIT;
+            blit.dstSubresource.aspectMask          = mAspect;
             blit.dstSubresource.mipLevel            = i;
             blit.dstSubresource.baseArrayLayer      = 0;
-            blit.dstSubresource.layerCount          = 1;
+            blit.dstSubresource.layerCount          = mLayerCount;
 
-            command->blitImage(commandBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
-
-            barrier.oldLayout       = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            barrier.newLayout       = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            barrier.srcAccessMask   = VK_ACCESS_TRANSFER_READ_BIT;
-            barrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT;
-
-            command->transferImageLayout(commandBuffer, barrier, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+            vkCmdBlitImage(commandBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
 
             if (mipWidth > 1) mipWidth /= 2;
             if (mipHeight > 1) mipHeight /= 2;
         }
 
-        barrier.subresourceRange.baseMipLevel   = mMipLevels - 1;
-        barrier.oldLayout                       = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.newLayout                       = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        barrier.srcAccessMask                   = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask                   = VK_ACCESS_SHADER_READ_BIT;
-
-        command->transferImageLayout(commandBuffer, barrier, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-        command->endSingleTimeCommands(commandBuffer);
+        // every level to shader reads in one barrier, the blit sources and the last mip differ in their old layout only
+        range.baseMipLevel  = 0;
+        range.levelCount    = mMipLevels;
+        barriers.transition(mImage, mLayoutState, range, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        barriers.flush(commandBuffer);
     }
 
     VkWriteDescriptorSet VulkanTexture2D::createWriteDescriptorSet(VkDescriptorSet descriptorSet)
@@ -0,0 +1,372 @@
+//
+// Created by 最上川 on 2022/9/1/001.
+//
+
+#include <vulkanTextureStreamer.h>
+#include <vulkanDevice.h>
+#include <vulkanTexture.h>
+#include <vulkanBindless.h>
+#include <vulkanSampler.h>
+#include <profiler.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+
+namespace Homura
+{
+    struct VulkanTextureLoad
+    {
+        std::string         mFilename;
+        uint32_t            mFirstLevel = 0;
+        Base::Image         mImage;
+        bool                mSuccess = false;
+        // set last by the job, everything above is the render thread's after it
+        std::atomic<bool>   mReady{false};
+        Base::JobHandle     mHandle;
+    };
+
+    VulkanTextureStreamer::VulkanTextureStreamer(VulkanDevicePtr device, VulkanBindlessTablePtr table, VulkanSamplerPtr sampler, Base::JobSystem* jobSystem,
+                                                 const VulkanTextureStreamerConfig& config)
+        : mDevice{device}
+        , mTable{table}
+        , mSampler{sampler}
+        , mJobSystem{jobSystem}
+        , mConfig{config}
+        , mTextures{}
+        , mRetired{}
+        , mRetiredSizes{}
+        , mFrame{0}
+        , mFrameNumber{0}
+        , mResidentBytes{0}
+        , mRetiredBytes{0}
+        , mLoadsInFlight{0}
+        , mUpgrades{0}
+        , mEvictions{0}
+    {
+
+    }
+
+    VulkanTextureStreamer::~VulkanTextureStreamer()
+    {
+        destroy();
+    }
+
+    void VulkanTextureStreamer::destroy()
+    {
+        for (auto& texture : mTextures)
+        {
+            if (texture.mLoad && mJobSystem)
+            {
+                // the job writes into the load until it is done
+                mJobSystem->wait(texture.mLoad->mHandle);
+            }
+            texture.mLoad.reset();
+            if (texture.mTexture)
+            {
+                mTable->remove(texture.mSlot);
+                texture.mTexture->destroy();
+            }
+        }
+        mTextures.clear();
+        for (auto& retired : mRetired)
+        {
+            for (auto& version : retired)
+            {
+                version->destroy();
+            }
+        }
+        mRetired.clear();
+        mRetiredSizes.clear();
+        mResidentBytes = 0;
+        mRetiredBytes = 0;
+        mLoadsInFlight = 0;
+    }
+
+    uint32_t VulkanTextureStreamer::add(const std::string& filename)
+    {
+        PROFILE_FUNCTION();
+        StreamedTexture texture;
+        texture.mFilename = filename;
+        const Base::Ktx2Info& info = texture.mInfo;
+        if (!Base::readKtx2Info(filename, texture.mInfo) || !mDevice->isSampledFormatSupported(static_cast<VkFormat>(Base::getKtx2VkFormat(info.mFormat))))
+        {
+            return INVALID_TEXTURE;
+        }
+
+        // the first level within the tail size, the last one when no level is that small
+        uint32_t tail = 0;
+        while (tail + 1 < info.mLevelCount && std::max(info.mWidth >> tail, info.mHeight >> tail) > mConfig.mTailSize)
+        {
+            tail++;
+        }
+        texture.mTailLevel      = tail;
+        texture.mWantedLevel    = tail;
+        texture.mLastUsed       = mFrameNumber;
+        if (!Base::readKtx2(filename, texture.mTail, tail) || !createVersion(texture, texture.mTail, tail))
+        {
+            return INVALID_TEXTURE;
+        }
+        mTextures.push_back(std::move(texture));
+        return static_cast<uint32_t>(mTextures.size() - 1);
+    }
+
+    void VulkanTextureStreamer::reportUsage(uint32_t texture, float screenExtent)
+    {
+        StreamedTexture& streamed = mTextures[texture];
+        // a level per halving of the texels that land on a pixel, rounded towards the finer level
+        const float size = static_cast<float>(std::max(streamed.mInfo.mWidth, streamed.mInfo.mHeight));
+        const float level = std::log2(size / std::max(screenExtent, 1.0f)) + mConfig.mMipBias;
+        const uint32_t wanted = level <= 0.0f ? 0 : std::min(static_cast<uint32_t>(level), streamed.mTailLevel);
+
+        streamed.mWantedLevel = streamed.mWantedFrame == mFrameNumber ? std::min(streamed.mWantedLevel, wanted) : wanted;
+        streamed.mWantedFrame = mFrameNumber;
+        streamed.mLastUsed    = mFrameNumber;
+    }
+
+    uint32_t VulkanTextureStreamer::use(uint32_t texture)
+    {
+        StreamedTexture& streamed = mTextures[texture];
+        streamed.mLastUsed = mFrameNumber;
+        return streamed.mSlot;
+    }
+
+    void VulkanTextureStreamer::update(uint32_t frame)
+    {
+        PROFILE_FUNCTION();
+        mFrame = frame;
+        if (mFrame >= mRetired.size())
+        {
+            mRetired.resize(mFrame + 1);
+            mRetiredSizes.resize(mFrame + 1, 0);
+        }
+
+        // the fence of frame has signaled, nothing samples the versions replaced while it was recorded
+        for (auto& version : mRetired[mFrame])
+        {
+            version->destroy();
+        }
+        mRetired[mFrame].clear();
+        mRetiredBytes -= mRetiredSizes[mFrame];
+        mRetiredSizes[mFrame] = 0;
+
+        // finished reads become the new version if they still add levels and fit
+        for (auto& texture : mTextures)
+        {
+            if (!texture.mLoad || !texture.mLoad->mReady.load(std::memory_order_acquire))
+            {
+                continue;
+            }
+            const std::shared_ptr<VulkanTextureLoad> load = texture.mLoad;
+            if (load->mSuccess && load->mFirstLevel < texture.mResidentLevel)
+            {
+                // the version it replaces stays until the frames in flight are done, both have to fit
+                const VkDeviceSize bytes = load->mImage.getSize();
+                if (reserve(bytes, &texture))
+                {
+                    if (mResidentBytes + mRetiredBytes + bytes > mConfig.mBudget)
+                    {
+                        // versions retired or evicted for it are freed frames later, upload it then
+                        continue;
+                    }
+                    if (createVersion(texture, load->mImage, load->mFirstLevel))
+                    {
+                        mUpgrades++;
+                    }
+                }
+            }
+            texture.mLoad.reset();
+            mLoadsInFlight--;
+            if (!load->mSuccess)
+            {
+                std::cerr << "failed to stream " << texture.mFilename << ", keeping its resident levels" << std::endl;
+                texture.mFailed = true;
+            }
+        }
+
+        // the budget may have shrunk
+        reserve(0, nullptr);
+
+        // uses of the last frame are stamped with mFrameNumber, the textures it drew are kept and may stream in
+        std::vector<StreamedTexture*> candidates;
+        VkDeviceSize evictable = 0;
+        for (auto& texture : mTextures)
+        {
+            if (texture.mLastUsed < mFrameNumber)
+            {
+                evictable += texture.mResidentBytes - texture.mTail.getSize();
+            }
+            else if (!texture.mLoad && !texture.mFailed && texture.mWantedLevel < texture.mResidentLevel)
+            {
+                candidates.push_back(&texture);
+            }
+        }
+        // the textures missing the most levels first
+        std::sort(candidates.begin(), candidates.end(), [](const StreamedTexture* a, const StreamedTexture* b) -> bool {
+            return a->mResidentLevel - a->mWantedLevel > b->mResidentLevel - b->mWantedLevel;
+        });
+
+        // what fits next to the textures in use and the versions not freed yet, reads in flight have not
+        // claimed their share yet
+        const VkDeviceSize kept = mResidentBytes + mRetiredBytes - evictable;
+        VkDeviceSize available = mConfig.mBudget > kept ? mConfig.mBudget - kept : 0;
+        for (StreamedTexture* texture : candidates)
+        {
+            if (mLoadsInFlight >= mConfig.mMaxLoads)
+            {
+                break;
+            }
+            // the finest wanted level that fits next to the version it replaces, coarser ones when the budget is short
+            uint32_t first = texture->mWantedLevel;
+            while (first < texture->mResidentLevel && getLevelBytes(texture->mInfo, first) > available)
+            {
+                first++;
+            }
+            if (first < texture->mResidentLevel)
+            {
+                available -= getLevelBytes(texture->mInfo, first);
+                startLoad(*texture, first);
+            }
+        }
+        mFrameNumber++;
+    }
+
+    VulkanTextureStreamerStats VulkanTextureStreamer::getStats() const
+    {
+        VulkanTextureStreamerStats stats;
+        stats.mTextureCount     = static_cast<uint32_t>(mTextures.size());
+        stats.mResidentBytes    = mResidentBytes;
+        stats.mRetiredBytes     = mRetiredBytes;
+        stats.mLoadsInFlight    = mLoadsInFlight;
+        stats.mUpgrades         = mUpgrades;
+        stats.mEvictions        = mEvictions;
+        return stats;
+    }
+
+    void VulkanTextureStreamer::loadJob(Base::Job*, const void* data)
+    {
+        readLevels(**static_cast<VulkanTextureLoad* const*>(data));
+    }
+
+    void VulkanTextureStreamer::readLevels(VulkanTextureLoad& load)
+    {
+        PROFILE_FUNCTION();
+        load.mSuccess = Base::readKtx2(load.mFilename, load.mImage, load.mFirstLevel);
+        load.mReady.store(true, std::memory_order_release);
+    }
+
+    VkDeviceSize VulkanTextureStreamer::getLevelBytes(const Base::Ktx2Info& info, uint32_t first)
+    {
+        const uint32_t blockDimension = Base::Image::getBlockDimension(info.mFormat);
+        VkDeviceSize bytes = 0;
+        for (uint32_t i = first; i < info.mLevelCount; i++)
+        {
+            const uint32_t width = std::max(info.mWidth >> i, 1u);
+            const uint32_t height = std::max(info.mHeight >> i, 1u);
+            bytes += static_cast<VkDeviceSize>((width + blockDimension - 1) / blockDimension) * ((height + blockDimension - 1) / blockDimension) *
+                     Base::Image::getBlockSize(info.mFormat);
+        }
+        return bytes;
+    }
+
+    bool VulkanTextureStreamer::createVersion(StreamedTexture& texture, const Base::Image& levels, uint32_t first)
+    {
+        const VkFormat format = static_cast<VkFormat>(Base::getKtx2VkFormat(levels.getFormat()));
+        VulkanTexture2DPtr version = std::make_shared<VulkanTexture2D>(mDevice, levels.getWidth(), levels.getHeight(), levels.getLevelCount(),
+                                                                       VK_SAMPLE_COUNT_1_BIT,
+                                                                       format,
+                                                                       VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                                                                       VK_IMAGE_USAGE_SAMPLED_BIT,
+                                                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        // the current upload batch is submitted ahead of the frame, which may sample the version already
+        version->setImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        for (uint32_t level = 0; level < levels.getLevelCount(); level++)
+        {
+            version->upload(levels.getData(level), levels.getLevel(level).mSize, level);
+        }
+        version->setImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        version->setSampler(mSampler, 0);
+
+        const uint32_t slot = mTable->add(version);
+        if (slot == VulkanBindlessTable::INVALID_INDEX)
+        {
+            // the copies are recorded already, the image goes once they are done
+            retire(version, levels.getSize());
+            return false;
+        }
+        if (texture.mTexture)
+        {
+            // frames in flight still sample the old version through its slot
+            mTable->remove(texture.mSlot);
+            retire(texture.mTexture, texture.mResidentBytes);
+        }
+        mResidentBytes          = mResidentBytes - texture.mResidentBytes + levels.getSize();
+        texture.mTexture        = version;
+        texture.mSlot           = slot;
+        texture.mResidentLevel  = first;
+        texture.mResidentBytes  = levels.getSize();
+        return true;
+    }
+
+    bool VulkanTextureStreamer::reserve(VkDeviceSize bytes, const StreamedTexture* keep)
+    {
+        while (mResidentBytes + bytes > mConfig.mBudget)
+        {
+            StreamedTexture* oldest = nullptr;
+            for (auto& texture : mTextures)
+            {
+                if (&texture != keep && texture.mResidentLevel < texture.mTailLevel && texture.mLastUsed < mFrameNumber &&
+                    (!oldest || texture.mLastUsed < oldest->mLastUsed))
+                {
+                    oldest = &texture;
+                }
+            }
+            if (!oldest || !evict(*oldest))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void VulkanTextureStreamer::retire(VulkanTexture2DPtr version, VkDeviceSize bytes)
+    {
+        if (mFrame >= mRetired.size())
+        {
+            mRetired.resize(mFrame + 1);
+            mRetiredSizes.resize(mFrame + 1, 0);
+        }
+        mRetired[mFrame].push_back(version);
+        mRetiredSizes[mFrame] += bytes;
+        mRetiredBytes += bytes;
+    }
+
+    bool VulkanTextureStreamer::evict(StreamedTexture& texture)
+    {
+        // the tail is kept on the CPU, falling back to it reads nothing
+        if (!createVersion(texture, texture.mTail, texture.mTailLevel))
+        {
+            return false;
+        }
+        mEvictions++;
+        return true;
+    }
+
+    void VulkanTextureStreamer::startLoad(StreamedTexture& texture, uint32_t first)
+    {
+        std::shared_ptr<VulkanTextureLoad> load = std::make_shared<VulkanTextureLoad>();
+        load->mFilename     = texture.mFilename;
+        load->mFirstLevel   = first;
+        texture.mLoad       = load;
+        mLoadsInFlight++;
+        if (!mJobSystem)
+        {
+            // picked up by the next update like a read of a worker
+            readLevels(*load);
+            return;
+        }
+        // texture.mLoad keeps the load alive while the job fills it
+        Base::Job* job = mJobSystem->createJob(nullptr, &VulkanTextureStreamer::loadJob, load.get());
+        load->mHandle = mJobSystem->run(job);
+    }
+}
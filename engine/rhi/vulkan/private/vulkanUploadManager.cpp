@@ -0,0 +1,416 @@
+//
+// Created by 最上川 on 2022/8/21/021.
+//
+
+#include <vulkanUploadManager.h>
+#include <vulkanDevice.h>
+#include <vulkanQueue.h>
+#include <vulkanBuffer.h>
+#include <debugUtils.h>
+#include <allocator.h>
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace Homura
+{
+    static VkCommandPool createUploadCommandPool(VkDevice device, uint32_t familyIndex)
+    {
+        VkCommandPoolCreateInfo createInfo{};
+        createInfo.sType            = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        createInfo.flags            = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        createInfo.queueFamilyIndex = familyIndex;
+
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VERIFYVULKANRESULT(vkCreateCommandPool(device, &createInfo, nullptr, &commandPool));
+        return commandPool;
+    }
+
+    // staging buffers and batches count as RHI memory
+    template<typename T, typename... Args>
+    static T* createTracked(Args&&... args)
+    {
+        Base::allocator<T> alloc(Base::MemoryTag::RHI);
+        return new (alloc.allocate(1)) T(std::forward<Args>(args)...);
+    }
+
+    template<typename T>
+    static void destroyTracked(T* object)
+    {
+        object->~T();
+        Base::allocator<T>(Base::MemoryTag::RHI).deallocate(object);
+    }
+
+    VulkanUploadManager::VulkanUploadManager(VulkanDevicePtr device, VkDeviceSize ringSize)
+        : mDevice{device}
+        , mTransferQueue{device->getTransferQueue()}
+        , mGraphicsQueue{device->getGraphicsQueue()}
+        , mTransferPool{VK_NULL_HANDLE}
+        , mGraphicsPool{VK_NULL_HANDLE}
+        , mRing{nullptr}
+        , mRingSize{ringSize}
+        , mRingHead{0}
+        , mRingTail{0}
+        , mCurrent{nullptr}
+        , mTransferBarriers{}
+        , mGraphicsBarriers{}
+        , mNextBatchId{1}
+        , mCompletedBatchId{0}
+    {
+        mGraphicsPool = createUploadCommandPool(mDevice->getHandle(), mGraphicsQueue->getFamilyIndex());
+        mTransferPool = hasTransferQueue() ? createUploadCommandPool(mDevice->getHandle(), mTransferQueue->getFamilyIndex()) : mGraphicsPool;
+
+        mRing = createTracked<VulkanBuffer>(mDevice, nullptr, mRingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    }
+
+    VulkanUploadManager::~VulkanUploadManager()
+    {
+        destroy();
+    }
+
+    void VulkanUploadManager::destroy()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mRing)
+        {
+            return;
+        }
+
+        submitLocked();
+        while (!mInFlight.empty())
+        {
+            retireOldest(true);
+        }
+        for (Batch* batch : mFreeBatches)
+        {
+            batch->mSemaphore.destroy();
+            batch->mFence.destroy();
+            destroyTracked(batch);
+        }
+        mFreeBatches.clear();
+
+        // command buffers go with their pools
+        if (mTransferPool != mGraphicsPool)
+        {
+            vkDestroyCommandPool(mDevice->getHandle(), mTransferPool, nullptr);
+        }
+        vkDestroyCommandPool(mDevice->getHandle(), mGraphicsPool, nullptr);
+        mTransferPool = VK_NULL_HANDLE;
+        mGraphicsPool = VK_NULL_HANDLE;
+
+        mRing->destroy();
+        destroyTracked(mRing);
+        mRing = nullptr;
+    }
+
+    VulkanUploadManager::Batch* VulkanUploadManager::acquireBatch()
+    {
+        if (!mFreeBatches.empty())
+        {
+            Batch* batch = mFreeBatches.back();
+            mFreeBatches.pop_back();
+            return batch;
+        }
+
+        Batch* batch = createTracked<Batch>(mDevice);
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType                 = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level                 = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount    = 1;
+
+        allocInfo.commandPool           = mTransferPool;
+        VERIFYVULKANRESULT(vkAllocateCommandBuffers(mDevice->getHandle(), &allocInfo, &batch->mTransferCommands));
+        if (hasTransferQueue())
+        {
+            allocInfo.commandPool       = mGraphicsPool;
+            VERIFYVULKANRESULT(vkAllocateCommandBuffers(mDevice->getHandle(), &allocInfo, &batch->mGraphicsCommands));
+            batch->mSemaphore.create();
+        }
+        else
+        {
+            batch->mGraphicsCommands = batch->mTransferCommands;
+        }
+        batch->mFence.create(false);
+        return batch;
+    }
+
+    VulkanUploadManager::Batch* VulkanUploadManager::getCurrentBatch()
+    {
+        if (mCurrent)
+        {
+            return mCurrent;
+        }
+
+        mCurrent = acquireBatch();
+        mCurrent->mId = mNextBatchId;
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VERIFYVULKANRESULT(vkBeginCommandBuffer(mCurrent->mTransferCommands, &beginInfo));
+        if (hasTransferQueue())
+        {
+            VERIFYVULKANRESULT(vkBeginCommandBuffer(mCurrent->mGraphicsCommands, &beginInfo));
+        }
+        return mCurrent;
+    }
+
+    bool VulkanUploadManager::reserve(VkDeviceSize size, VkDeviceSize align, uint64_t& position)
+    {
+        if (size > mRingSize)
+        {
+            return false;
+        }
+
+        uint64_t begin = (mRingHead + align - 1) / align * align;
+        if (begin % mRingSize + size > mRingSize)
+        {
+            // never split a region across the end, skip to the start of the ring
+            begin = (begin / mRingSize + 1) * mRingSize;
+        }
+
+        while (begin + size - mRingTail > mRingSize)
+        {
+            // the space is held by batches still on the GPU, the recording one counts as well
+            if (!mInFlight.empty())
+            {
+                retireOldest(true);
+            }
+            else if (mCurrent)
+            {
+                submitLocked();
+            }
+            else
+            {
+                mRingTail = mRingHead;
+                break;
+            }
+        }
+
+        mRingHead = begin + size;
+        position = begin;
+        return true;
+    }
+
+    VulkanUploadManager::StagingRegion VulkanUploadManager::stageLocked(const void* data, VkDeviceSize size, VkDeviceSize align)
+    {
+        uint64_t position = 0;
+        if (!reserve(size, align, position))
+        {
+            // too large for the ring, it gets its own buffer that lives as long as the batch
+            VulkanBuffer* temporary = createTracked<VulkanBuffer>(mDevice, nullptr, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+            temporary->fillBuffer(const_cast<void*>(data), size);
+            getCurrentBatch()->mTemporaries.push_back(temporary);
+            return {temporary->getHandle(), 0};
+        }
+
+        const VkDeviceSize offset = position % mRingSize;
+        std::memcpy(static_cast<char*>(mRing->mAllocation.mMapped) + offset, data, static_cast<size_t>(size));
+        mDevice->getMemoryAllocator().flush(mRing->mAllocation, offset, size);
+        return {mRing->getHandle(), offset};
+    }
+
+    VulkanUploadManager::StagingRegion VulkanUploadManager::stage(const void* data, VkDeviceSize size, VkDeviceSize align)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return stageLocked(data, size, align);
+    }
+
+    uint64_t VulkanUploadManager::uploadBuffer(VkBuffer dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const StagingRegion region = stageLocked(data, size, 16);
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset    = region.mOffset;
+        copyRegion.dstOffset    = dstOffset;
+        copyRegion.size         = size;
+        Batch* batch = getCurrentBatch();
+        vkCmdCopyBuffer(batch->mTransferCommands, region.mBuffer, dst, 1, &copyRegion);
+        return batch->mId;
+    }
+
+    uint64_t VulkanUploadManager::uploadImage(VkImage dst, const void* data, VkDeviceSize size, const VkBufferImageCopy& region)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        // offsets into a buffer for image copies must be a multiple of the texel block size and of 4
+        const StagingRegion staging = stageLocked(data, size, 16);
+
+        VkBufferImageCopy copyRegion = region;
+        copyRegion.bufferOffset += staging.mOffset;
+        flushTransferBarriers();
+        Batch* batch = getCurrentBatch();
+        vkCmdCopyBufferToImage(batch->mTransferCommands, staging.mBuffer, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+        return batch->mId;
+    }
+
+    void VulkanUploadManager::transitionImage(VkImage image, VulkanImageLayoutState& state, const VkImageSubresourceRange& range, VkImageLayout layout)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const bool transfer = layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        VulkanBarrierBatch& barriers = transfer ? mTransferBarriers : mGraphicsBarriers;
+        if (!barriers.transition(image, state, range, layout))
+        {
+            // the range has a barrier pending already, it has to be recorded before the next one
+            if (transfer)
+            {
+                flushTransferBarriers();
+            }
+            else
+            {
+                flushGraphicsBarriers();
+            }
+            barriers.transition(image, state, range, layout);
+        }
+    }
+
+    void VulkanUploadManager::flushTransferBarriers()
+    {
+        if (!mTransferBarriers.empty())
+        {
+            mTransferBarriers.flush(getCurrentBatch()->mTransferCommands);
+        }
+    }
+
+    void VulkanUploadManager::flushGraphicsBarriers()
+    {
+        // graphics transitions may follow copies of the same batch, those go first
+        flushTransferBarriers();
+        if (!mGraphicsBarriers.empty())
+        {
+            mGraphicsBarriers.flush(getCurrentBatch()->mGraphicsCommands);
+        }
+    }
+
+    VkCommandBuffer VulkanUploadManager::getTransferCommands()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        flushTransferBarriers();
+        return getCurrentBatch()->mTransferCommands;
+    }
+
+    VkCommandBuffer VulkanUploadManager::getGraphicsCommands()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        flushGraphicsBarriers();
+        return getCurrentBatch()->mGraphicsCommands;
+    }
+
+    uint64_t VulkanUploadManager::submitLocked()
+    {
+        if (!mTransferBarriers.empty() || !mGraphicsBarriers.empty())
+        {
+            flushGraphicsBarriers();
+        }
+        if (!mCurrent)
+        {
+            return mNextBatchId - 1;
+        }
+        Batch* batch = mCurrent;
+        mCurrent = nullptr;
+
+        // copies and blits are visible to everything submitted after the batch
+        VkMemoryBarrier barrier{};
+        barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask   = VK_ACCESS_MEMORY_READ_BIT;
+        vkCmdPipelineBarrier(batch->mGraphicsCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount   = 1;
+        if (hasTransferQueue())
+        {
+            VERIFYVULKANRESULT(vkEndCommandBuffer(batch->mTransferCommands));
+            submitInfo.pCommandBuffers      = &batch->mTransferCommands;
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores    = &batch->mSemaphore.getHandle();
+            VERIFYVULKANRESULT(vkQueueSubmit(mTransferQueue->getHandle(), 1, &submitInfo, VK_NULL_HANDLE));
+
+            const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            submitInfo                      = {};
+            submitInfo.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.waitSemaphoreCount   = 1;
+            submitInfo.pWaitSemaphores      = &batch->mSemaphore.getHandle();
+            submitInfo.pWaitDstStageMask    = &waitStage;
+            submitInfo.commandBufferCount   = 1;
+        }
+        VERIFYVULKANRESULT(vkEndCommandBuffer(batch->mGraphicsCommands));
+        submitInfo.pCommandBuffers = &batch->mGraphicsCommands;
+        VERIFYVULKANRESULT(vkQueueSubmit(mGraphicsQueue->getHandle(), 1, &submitInfo, batch->mFence.getHandle()));
+
+        batch->mRingEnd = mRingHead;
+        mInFlight.push_back(batch);
+        mNextBatchId++;
+        return batch->mId;
+    }
+
+    uint64_t VulkanUploadManager::submit()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return submitLocked();
+    }
+
+    bool VulkanUploadManager::retireOldest(bool block)
+    {
+        Batch* batch = mInFlight.front();
+        if (block)
+        {
+            batch->mFence.wait();
+        }
+        else if (batch->mFence.getResult() != VK_SUCCESS)
+        {
+            return false;
+        }
+        mInFlight.pop_front();
+
+        // batches finish in submission order, everything staged before this one is free as well
+        mRingTail = batch->mRingEnd;
+        mCompletedBatchId = batch->mId;
+        for (VulkanBuffer* temporary : batch->mTemporaries)
+        {
+            temporary->destroy();
+            destroyTracked(temporary);
+        }
+        batch->mTemporaries.clear();
+
+        VERIFYVULKANRESULT(vkResetCommandBuffer(batch->mTransferCommands, 0));
+        if (hasTransferQueue())
+        {
+            VERIFYVULKANRESULT(vkResetCommandBuffer(batch->mGraphicsCommands, 0));
+        }
+        batch->mFence.reset();
+        mFreeBatches.push_back(batch);
+        return true;
+    }
+
+    void VulkanUploadManager::collect()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        while (!mInFlight.empty() && retireOldest(false))
+        {
+        }
+    }
+
+    bool VulkanUploadManager::isComplete(uint64_t batchId)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        while (!mInFlight.empty() && mCompletedBatchId < batchId && retireOldest(false))
+        {
+        }
+        return batchId <= mCompletedBatchId;
+    }
+
+    void VulkanUploadManager::wait(uint64_t batchId)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mCurrent && mCurrent->mId <= batchId)
+        {
+            submitLocked();
+        }
+        while (!mInFlight.empty() && mCompletedBatchId < batchId)
+        {
+            retireOldest(true);
+        }
+    }
+}
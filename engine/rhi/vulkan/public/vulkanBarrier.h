@@ -0,0 +1,126 @@
+//
+// Created by 最上川 on 2022/8/29/029.
+//
+
+#ifndef HOMURA_VULKANBARRIER_H
+#define HOMURA_VULKANBARRIER_H
+#include <vulkan/vulkan.h>
+#include <vulkanTypes.h>
+#include <unordered_set>
+#include <vector>
+
+namespace Homura
+{
+    // layout of a subresource and the stages and access that touched it last
+    struct ENGINE_API VulkanImageAccess
+    {
+        VkImageLayout           mLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkPipelineStageFlags    mStages = 0;
+        VkAccessFlags           mAccess = 0;
+    };
+
+    // the stages and access a layout is used with, for callers that only know the layout they want
+    ENGINE_API VulkanImageAccess getImageAccess(VkImageLayout layout);
+
+    // state of every mip and layer of one image
+    class ENGINE_API VulkanImageLayoutState
+    {
+    public:
+        VulkanImageLayoutState()
+            : mMipLevels{0}
+            , mLayerCount{0}
+            , mStates{}
+        {
+
+        }
+
+        VulkanImageLayoutState(uint32_t mipLevels, uint32_t layerCount, VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED)
+        {
+            reset(mipLevels, layerCount, initialLayout);
+        }
+
+        void reset(uint32_t mipLevels, uint32_t layerCount, VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED)
+        {
+            mMipLevels  = mipLevels;
+            mLayerCount = layerCount;
+            mStates.assign(static_cast<size_t>(mipLevels) * layerCount, VulkanImageAccess{initialLayout, 0, 0});
+        }
+
+        VulkanImageAccess& get(uint32_t mip, uint32_t layer)
+        {
+            return mStates[layer * mMipLevels + mip];
+        }
+
+        const VulkanImageAccess& get(uint32_t mip, uint32_t layer) const
+        {
+            return mStates[layer * mMipLevels + mip];
+        }
+
+        VkImageLayout getLayout(uint32_t mip = 0, uint32_t layer = 0) const
+        {
+            return get(mip, layer).mLayout;
+        }
+
+        uint32_t getMipLevels() const
+        {
+            return mMipLevels;
+        }
+
+        uint32_t getLayerCount() const
+        {
+            return mLayerCount;
+        }
+    private:
+        uint32_t                        mMipLevels;
+        uint32_t                        mLayerCount;
+        // layer major
+        std::vector<VulkanImageAccess>  mStates;
+    };
+
+    // Collects image transitions and records them as one vkCmdPipelineBarrier. Source stages are only
+    // those that touched the subresources last, subresources that are read in the layout they are in
+    // already get no barrier, and neighbouring mips and layers coming from the same state share one.
+    // A subresource may be transitioned once per flush, a second barrier would expect the layout the first
+    // one leaves it in before that one ran
+    class ENGINE_API VulkanBarrierBatch
+    {
+    public:
+        VulkanBarrierBatch();
+
+        // Range counts may be VK_REMAINING_MIP_LEVELS and VK_REMAINING_ARRAY_LAYERS. Returns false and changes
+        // nothing when a subresource of range has a barrier pending already, flush and transition again
+        bool transition(VkImage image, VulkanImageLayoutState& state, const VkImageSubresourceRange& range, const VulkanImageAccess& next);
+        bool transition(VkImage image, VulkanImageLayoutState& state, const VkImageSubresourceRange& range, VkImageLayout layout)
+        {
+            return transition(image, state, range, getImageAccess(layout));
+        }
+
+        // nothing is recorded without pending barriers
+        void flush(VkCommandBuffer commandBuffer);
+
+        bool empty() const
+        {
+            return mBarriers.empty();
+        }
+
+        // barriers recorded so far and the vkCmdPipelineBarrier calls they took
+        uint64_t getBarrierCount() const
+        {
+            return mBarrierCount;
+        }
+
+        uint64_t getFlushCount() const
+        {
+            return mFlushCount;
+        }
+    private:
+        std::vector<VkImageMemoryBarrier>   mBarriers;
+        VkPipelineStageFlags                mSrcStages;
+        VkPipelineStageFlags                mDstStages;
+        // image, mip and layer of every pending barrier
+        std::unordered_set<uint64_t>        mPending;
+        uint64_t                            mBarrierCount;
+        uint64_t                            mFlushCount;
+    };
+}
+#endif //HOMURA_VULKANBARRIER_H
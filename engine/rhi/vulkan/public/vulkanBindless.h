@@ -0,0 +1,92 @@
+//
+// Created by 最上川 on 2022/8/24/024.
+//
+
+#ifndef HOMURA_VULKANBINDLESS_H
+#define HOMURA_VULKANBINDLESS_H
+#include <vulkan/vulkan.h>
+#include <vulkanTypes.h>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace Homura
+{
+    // what a bindless pipeline gets pushed per draw, shaders declare the same block
+    struct ENGINE_API VulkanBindlessConstants
+    {
+        // slot of the draw's texture in the bindless array
+        uint32_t    mTextureIndex;
+    };
+
+    // Every texture in one partially bound, update after bind array of combined image samplers, bound once
+    // per command buffer as set BINDLESS_SET. Textures are addressed by slot, a draw passes its slot in
+    // VulkanBindlessConstants instead of binding a descriptor set of its own. Slots are written while the
+    // array is in use, a removed slot is only handed out again once the frames that could read it are done.
+    // Needs VulkanDevice::isBindlessSupported(). Thread safe
+    class ENGINE_API VulkanBindlessTable
+    {
+    public:
+        static constexpr uint32_t BINDLESS_SET      = 1;
+        static constexpr uint32_t INVALID_INDEX     = UINT32_MAX;
+
+        // capacity 0 takes what the device allows, up to 16K textures
+        VulkanBindlessTable(VulkanDevicePtr device, uint32_t capacity = 0);
+        ~VulkanBindlessTable();
+        VulkanBindlessTable(const VulkanBindlessTable&) = delete;
+        VulkanBindlessTable& operator=(const VulkanBindlessTable&) = delete;
+
+        void create();
+        void destroy();
+
+        // returns the slot, INVALID_INDEX when the array is full
+        uint32_t add(VkImageView imageView, VkSampler sampler, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        uint32_t add(VulkanTexture2DPtr texture);
+        void remove(uint32_t index);
+
+        // slots removed while frame was last recorded are free again, call once its fence has signaled
+        void beginFrame(uint32_t frame);
+
+        VkDescriptorSetLayout getLayout() const
+        {
+            return mLayout;
+        }
+
+        VkDescriptorSet getSet() const
+        {
+            return mSet;
+        }
+
+        uint32_t getCapacity() const
+        {
+            return mCapacity;
+        }
+
+        uint32_t getCount() const
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            return mCount;
+        }
+
+        static VkPushConstantRange getPushConstantRange()
+        {
+            return {VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(VulkanBindlessConstants)};
+        }
+    private:
+        VulkanDevicePtr                     mDevice;
+        uint32_t                            mCapacity;
+        VkDescriptorPool                    mPool;
+        VkDescriptorSetLayout               mLayout;
+        VkDescriptorSet                     mSet;
+
+        mutable std::mutex                  mMutex;
+        // slots below mHighWater have been handed out at least once
+        uint32_t                            mHighWater;
+        uint32_t                            mCount;
+        std::vector<uint32_t>               mFreeSlots;
+        // slots removed per frame in flight, grown on first use
+        std::vector<std::vector<uint32_t>>  mRetired;
+        uint32_t                            mFrame;
+    };
+}
+#endif //HOMURA_VULKANBINDLESS_H
@@ -6,6 +6,7 @@
 #define HOMURA_VULKANBUFFER_H
 #include <vulkan/vulkan.h>
 #include <vulkanTypes.h>
+#include <vulkanMemory.h>
 
 namespace Homura
 {
@@ -33,9 +34,7 @@ namespace Homura
             return mSize;
         }
 
-    private:
-        uint32_t  findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
-
+    protected:
         VulkanDevicePtr         mDevice;
         VulkanCommandBufferPtr  mCommandBuffer;
 
@@ -44,8 +43,7 @@ namespace Homura
     public:
         VkDeviceSize            mSize;
         VkBuffer                mBuffer;
-        VkDeviceMemory          mBufferMemory;
-        VulkanBuffer*           mStagingBuffer;
+        VulkanAllocation        mAllocation;
     };
 
     class ENGINE_API VulkanVertexBuffer : public VulkanBuffer
@@ -68,23 +66,66 @@ namespace Homura
         }
     };
 
-    class ENGINE_API VulkanUniformBuffer : public VulkanBuffer
+    // One persistently mapped buffer split into a region per frame. Uniform data of a frame is bump
+    // allocated from its region and bound with a dynamic offset, nothing is mapped or copied twice.
+    class ENGINE_API VulkanUniformRing : public VulkanBuffer
     {
     public:
-        VulkanUniformBuffer(VulkanDevicePtr device, VulkanCommandBufferPtr commandBuffer, VkDeviceSize size, uint32_t binding)
-            : VulkanBuffer(device, commandBuffer, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+        struct Allocation
+        {
+            void*       mData;
+            // dynamic offset for vkCmdBindDescriptorSets
+            uint32_t    mOffset;
+        };
+
+        VulkanUniformRing(VulkanDevicePtr device, uint32_t frameCount, VkDeviceSize frameSize = 256 * 1024);
+
+        // the region of frameIndex must no longer be read by the GPU
+        void beginFrame(uint32_t frameIndex);
+        Allocation allocate(uint32_t size);
+        // flushes the written part of the region for non-coherent memory
+        void endFrame();
+
+        VkDeviceSize alignSize(VkDeviceSize size) const
+        {
+            return (size + mAlignment - 1) & ~(mAlignment - 1);
+        }
+
+        uint32_t getFrameOffset(uint32_t frameIndex) const
+        {
+            return static_cast<uint32_t>(frameIndex * mFrameStride);
+        }
+
+        uint32_t getFrameCount() const
+        {
+            return mFrameCount;
+        }
+    private:
+        uint32_t                mFrameCount;
+        VkDeviceSize            mFrameStride;
+        VkDeviceSize            mAlignment;
+        uint32_t                mFrameIndex;
+        VkDeviceSize            mHead;
+    };
+
+    // A uniform block bound as UNIFORM_BUFFER_DYNAMIC. It owns no memory, every update() writes the
+    // user callback straight into the uniform ring.
+    class ENGINE_API VulkanUniformBuffer
+    {
+    public:
+        VulkanUniformBuffer(VulkanUniformRingPtr ring, uint32_t size, uint32_t binding)
+            : mRing{ring}
             , mCallback{}
-            , mDataBuffer{}
+            , mSize{size}
             , mBinding{binding}
             , mBufferInfo{}
         {
-            mDataBuffer.resize(size);
+
         }
-        
+
         VkWriteDescriptorSet createWriteDescriptorSet(VkDescriptorSet descriptorSet)
         {
-            
-            mBufferInfo.buffer                  = mBuffer;
+            mBufferInfo.buffer                  = mRing->getHandle();
             mBufferInfo.offset                  = 0;
             mBufferInfo.range                   = mSize;
             VkWriteDescriptorSet descriptorWrite{};
@@ -92,7 +133,7 @@ namespace Homura
             descriptorWrite.dstSet              = descriptorSet;
             descriptorWrite.dstBinding          = mBinding;
             descriptorWrite.dstArrayElement     = 0;
-            descriptorWrite.descriptorType      = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            descriptorWrite.descriptorType      = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             descriptorWrite.descriptorCount     = 1;
             descriptorWrite.pBufferInfo         = &mBufferInfo;
             return descriptorWrite;
@@ -103,21 +144,28 @@ namespace Homura
             return mBinding;
         }
 
+        uint32_t getSize()
+        {
+            return mSize;
+        }
+
         void setUpdateCallBack(UnifromUpdateCallback callback)
         {
             mCallback = callback;
         }
 
-        void update()
+        // call between beginFrame and endFrame of the ring, returns the dynamic offset
+        uint32_t update()
         {
-            char* userData = mDataBuffer.data();
-            uint32_t size = mCallback(userData, mDataBuffer.size());
-            assert(size == mDataBuffer.size());
-            fillBuffer(userData, size);
+            VulkanUniformRing::Allocation allocation = mRing->allocate(mSize);
+            uint32_t size = mCallback(allocation.mData, mSize);
+            assert(size == mSize);
+            return allocation.mOffset;
         }
     private:
+        VulkanUniformRingPtr    mRing;
         UnifromUpdateCallback   mCallback;
-        std::vector<char>       mDataBuffer;
+        uint32_t                mSize;
         uint32_t                mBinding;
         VkDescriptorBufferInfo  mBufferInfo;
     };
@@ -6,6 +6,7 @@
 #define HOMURA_VULKANCOMMANDBUFFER_H
 #include <vulkan/vulkan.h>
 #include <vulkanTypes.h>
+#include <vulkanParallelRecorder.h>
 #include <vector>
 
 namespace Homura
@@ -13,11 +14,12 @@ namespace Homura
     class ENGINE_API VulkanCommandPool
     {
     public:
-        explicit VulkanCommandPool(VulkanDevicePtr device);
+        explicit VulkanCommandPool(VulkanDevicePtr device, VkCommandPoolCreateFlags flags = 0);
         ~VulkanCommandPool();
 
         void create();
-        void reset();
+        // without RELEASE_RESOURCES the pool keeps its memory for the next recording
+        void reset(VkCommandPoolResetFlags flags = VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT);
         void destroy();
 
         VkCommandPool& getHandle()
@@ -27,12 +29,33 @@ namespace Homura
     private:
         VulkanDevicePtr             mDevice;
         VkCommandPool               mCommandPool;
+        VkCommandPoolCreateFlags    mFlags;
+    };
+
+    // one draw of the per frame draw list
+    struct ENGINE_API VulkanDrawCommand
+    {
+        VkBuffer    mVertexBuffer = VK_NULL_HANDLE;
+        // VK_NULL_HANDLE for a non indexed draw
+        VkBuffer    mIndexBuffer = VK_NULL_HANDLE;
+        // draws the VkDraw(Indexed)IndirectCommand at offset 0 instead when set
+        VkBuffer    mIndirectBuffer = VK_NULL_HANDLE;
+        // vertices or indices
+        uint32_t    mCount = 0;
+        uint32_t    mFirst = 0;
+        uint32_t    mInstanceCount = 1;
+        // slot of the texture in the bindless table, pushed as VulkanBindlessConstants
+        uint32_t    mTextureIndex = 0;
+        // a texture of the VulkanTextureStreamer, mTextureIndex follows its current version every frame
+        uint32_t    mStreamedTexture = UINT32_MAX;
     };
 
     class ENGINE_API VulkanCommandBuffer
     {
     public:
-        VulkanCommandBuffer(VulkanDevicePtr device, VulkanSwapChainPtr swapChain, VulkanCommandPoolPtr commandPool, VulkanFramebufferPtr framebuffer, VulkanPipelinePtr pipeline);
+        // framesInFlight frames are recorded and submitted ahead of the GPU at most
+        VulkanCommandBuffer(VulkanDevicePtr device, VulkanSwapChainPtr swapChain, VulkanCommandPoolPtr commandPool, VulkanFramebufferPtr framebuffer, VulkanPipelinePtr pipeline,
+                            uint32_t framesInFlight = 3);
         ~VulkanCommandBuffer();
 
         void create();
@@ -44,12 +67,73 @@ namespace Homura
             return mCommandBuffers[mCurrentFrame];
         }
 
+        // With a recorder the render pass takes secondary command buffers only. bind*() then just remember
+        // their state for bindState() and draws are recorded on the job system workers
+        void setParallelRecorder(VulkanParallelRecorderPtr recorder);
+
+        // Per frame recording: begin() to end() only fill the draw list, drawFrame() then rebuilds the
+        // command buffer of the frame in flight from it on a pool of its own. The draw list can be
+        // changed between frames, nothing has to be recorded again up front
+        void setPerFrameRecording(bool enable);
+        std::vector<VulkanDrawCommand>& getDrawList()
+        {
+            return mDrawList;
+        }
+        VulkanFrameSyncPtr getFrameSync()
+        {
+            return mFrameSync;
+        }
+
+        // Times the render pass of every frame, with per frame recording also each group of consecutive
+        // draws of one mesh. Its slots are frames in flight with per frame recording, swapchain images
+        // otherwise. Set it before begin()
+        void setGpuProfiler(VulkanGpuProfilerPtr profiler)
+        {
+            mGpuProfiler = profiler;
+        }
+
+        // Per frame recording runs the graph instead of the draw list, with the swapchain image of the
+        // frame as backbuffer. nullptr goes back to the draw list
+        void setFrameGraph(VulkanFrameGraphPtr graph, FrameGraphResource backbuffer)
+        {
+            mFrameGraph = graph;
+            mBackbuffer = backbuffer;
+        }
+
+        // records the draw list with its bound state into a render pass of the graph, from the execute
+        // callback of the pass. Nothing while the pipeline compiles without a fallback
+        void recordDrawList(VkCommandBuffer commandBuffer);
+
+        // copies every frame to the host after it is submitted, headless swapchains only
+        void setReadback(VulkanReadbackPtr readback)
+        {
+            mReadback = readback;
+        }
+
+        // Updated once per frame before recording, draws of streamed textures sample its current versions.
+        // Needs per frame recording
+        void setTextureStreamer(VulkanTextureStreamerPtr streamer)
+        {
+            mTextureStreamer = streamer;
+        }
+
+        // CPU time of the last per frame recording
+        double getRecordTimeMs() const
+        {
+            return mRecordTimeMs;
+        }
+
         void begin();
         void beginRenderPass(VulkanRenderPassPtr renderPass);
         void bindGraphicPipeline();
         void bindVertexBuffer(VulkanVertexBufferPtr buffer, uint32_t count);
         void bindIndexBuffer(VulkanIndexBufferPtr buffer, uint32_t count);
-        void bindDescriptorSet();
+        // dynamicOffsets holds offsetCount offsets for every command buffer, one after another
+        void bindDescriptorSet(const std::vector<uint32_t>& dynamicOffsets = {}, uint32_t offsetCount = 0);
+        // bindless texture slot of the draws that follow, needs a pipeline with a bindless table
+        void bindTextureIndex(uint32_t textureIndex);
+        // streamed texture of the draws that follow, per frame recording only
+        void bindStreamedTexture(uint32_t texture);
         void draw(uint32_t vertexCount);
         void drawIndex(uint32_t indexCount);
         void drawIndirect(VulkanVertexBufferPtr buffer);
@@ -57,6 +141,13 @@ namespace Homura
         void endRenderPass();
         void end();
 
+        // binds pipeline, descriptor set and geometry of the primary of imageIndex into a secondary command buffer
+        void bindState(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+        // records drawCount draws for every swapchain image through the recorder, the callback gets the bound
+        // state already and is called concurrently. Without a recorder it records inline in one call.
+        // Not available with per frame recording, use the draw list there
+        void drawParallel(uint32_t drawCount, uint32_t drawsPerChunk, const VulkanParallelRecorder::RecordCallback& callback);
+
         void draw();
         void drawFrame(VulkanRHIPtr rhi);
 
@@ -69,21 +160,59 @@ namespace Homura
         void endSingleTimeCommands(VkCommandBuffer commandBuffer);
         void copyBuffer(VulkanBuffer srcBuffer, VulkanBuffer dstBuffer, VkDeviceSize size);
         void copyBufferToTexture(VulkanBuffer Buffer, VulkanTexture2DPtr texture, uint32_t width, uint32_t height);
+        // submits on the timeline of queue, isSync blocks until exactly this submit has finished
         void submitSync(VulkanQueuePtr queue, VkCommandBuffer commandBuffer, bool isSync);
 
+    private:
+        uint32_t getTrianglesPerChunk(uint32_t triangleCount) const;
+        void bindPipeline(VkCommandBuffer commandBuffer);
+        // the bindless set and mTextureIndex, nothing when the active pipeline is not bindless
+        void bindBindless(VkCommandBuffer commandBuffer);
+        void beginRenderPass(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkSubpassContents contents);
+        // profile times every group of draws of one mesh into the slot of the frame in flight
+        void recordDraws(VkCommandBuffer commandBuffer, uint32_t first, uint32_t count, bool profile = false);
+        VkCommandBuffer recordFrame(uint32_t imageIndex);
     private:
         VulkanDevicePtr                 mDevice;
         VulkanSwapChainPtr              mSwapChain;
         VulkanFramebufferPtr            mFramebuffer;
         VulkanPipelinePtr               mPipeline;
         //  sync
-        VulkanFencesPtr                 imageInFlight;
-        VulkanFencesPtr                 inFlightFences;
-        VulkanSemaphoresPtr             mImageAvailableSemaphores;
-        VulkanSemaphoresPtr             mRenderFinishedSemaphores;
+        VulkanFrameSyncPtr              mFrameSync;
 
         VulkanCommandPoolPtr            mCommandPool;
         std::vector<VkCommandBuffer>    mCommandBuffers;
+        VulkanParallelRecorderPtr       mRecorder;
+        // the pipeline bindPipeline() uses, mPipeline or its fallback while it compiles
+        VulkanPipeline*                 mActivePipeline;
+
+        // per frame recording, one pool and primary per frame in flight
+        bool                            mPerFrame;
+        std::vector<VulkanCommandPoolPtr> mFramePools;
+        std::vector<VkCommandBuffer>    mFrameCommandBuffers;
+        std::vector<VulkanDrawCommand>  mDrawList;
+        // the material set of the frame being recorded, from the transient pools of the device
+        VkDescriptorSet                 mFrameDescriptorSet;
+        double                          mRecordTimeMs;
+
+        VulkanGpuProfilerPtr            mGpuProfiler;
+        // render pass region of every recorded swapchain image
+        std::vector<uint32_t>           mPassRegions;
+        VulkanReadbackPtr               mReadback;
+        VulkanFrameGraphPtr             mFrameGraph;
+        FrameGraphResource              mBackbuffer;
+        // swapchain image of the frame being recorded
+        uint32_t                        mImageIndex;
+        VulkanTextureStreamerPtr        mTextureStreamer;
+
+        // bound state, replayed into secondary command buffers
+        VkRenderPass                    mRenderPass;
+        VkBuffer                        mVertexBuffer;
+        VkBuffer                        mIndexBuffer;
+        std::vector<uint32_t>           mDynamicOffsets;
+        uint32_t                        mDynamicOffsetCount;
+        uint32_t                        mTextureIndex;
+        uint32_t                        mStreamedTexture;
 
         uint32_t                        mCurrentFrame;
         uint32_t                        mMaxFrameCount;
@@ -6,44 +6,101 @@
 #define HOMURA_VULKANDESCRIPTOR_H
 #include <vulkan/vulkan.h>
 #include <vulkanTypes.h>
+#include <vulkanPipelineCache.h>
+#include <unordered_map>
 #include <vector>
 
 namespace Homura
 {
+    // A chain of VkDescriptorPools that grows instead of running dry. When the current pool is out of
+    // memory the next one is started, each new pool holds twice the sets of the last up to a limit.
+    // Sets are never freed one by one, reset() recycles every pool of the chain at once
     class ENGINE_API VulkanDescriptorPool
     {
     public:
-        VulkanDescriptorPool(VulkanDevicePtr device, uint32_t frameCount);
+        // frameCount is the number of sets allocate() is expected to be asked for at once
+        VulkanDescriptorPool(VulkanDevicePtr device, uint32_t frameCount, uint32_t setsPerPool = 64);
         ~VulkanDescriptorPool();
 
-        VkDescriptorPool& getHandle()
-        {
-            return mDescriptorPool;
-        }
-
         void create();
         void destroy();
 
+        // returns false only when even a fresh pool cannot hold the sets
+        bool allocate(VkDescriptorSetLayout layout, uint32_t count, VkDescriptorSet* sets);
+        // every set of the chain becomes invalid, the GPU must be done with them
+        void reset();
+
         uint32_t getFrameCount()
         {
             return mFrameCount;
         }
+
+        uint32_t getPoolCount() const
+        {
+            return static_cast<uint32_t>(mUsedPools.size() + mFreePools.size());
+        }
+    private:
+        VkDescriptorPool acquirePool();
+    private:
+        VulkanDevicePtr                 mDevice;
+        uint32_t                        mFrameCount;
+        uint32_t                        mSetsPerPool;
+        VkDescriptorPool                mCurrent;
+        // pools handed out since the last reset, mCurrent is the last one
+        std::vector<VkDescriptorPool>   mUsedPools;
+        std::vector<VkDescriptorPool>   mFreePools;
+    };
+
+    // Descriptor sets owned by the device. Immutable sets are written once and shared by everything that
+    // binds the same resources with the same layout. Transient sets come from one pool chain per frame in
+    // flight and are reset when that frame comes around again. Render thread only
+    class ENGINE_API VulkanDescriptorAllocator
+    {
+    public:
+        explicit VulkanDescriptorAllocator(VulkanDevicePtr device);
+        ~VulkanDescriptorAllocator();
+        VulkanDescriptorAllocator(const VulkanDescriptorAllocator&) = delete;
+        VulkanDescriptorAllocator& operator=(const VulkanDescriptorAllocator&) = delete;
+
+        void destroy();
+
+        // resets the pools of frame, the fence of that frame must have been waited on
+        void beginFrame(uint32_t frame);
+        // a set valid until the current frame comes around again
+        VkDescriptorSet allocateTransient(VkDescriptorSetLayout layout);
+
+        // returns the set of layout written with writes, dstSet of the writes is ignored.
+        // The set is never written again, so the resources must outlive it or be dropped with invalidate()
+        VkDescriptorSet getImmutableSet(VkDescriptorSetLayout layout, const std::vector<VkWriteDescriptorSet>& writes);
+        // drops every immutable set, the GPU must be done with them
+        void invalidate();
+
+        uint32_t getImmutableSetCount() const
+        {
+            return static_cast<uint32_t>(mImmutableSets.size());
+        }
     private:
-        VulkanDevicePtr     mDevice;
-        VkDescriptorPool    mDescriptorPool;
-        uint32_t            mFrameCount;
+        VulkanDevicePtr                     mDevice;
+        std::vector<VulkanDescriptorPoolPtr> mFramePools;
+        uint32_t                            mFrame;
+        VulkanDescriptorPoolPtr             mImmutablePool;
+        std::unordered_map<VulkanPipelineKey, VkDescriptorSet, VulkanPipelineKeyHasher> mImmutableSets;
     };
 
+    // One set per swapchain image. Uniforms are dynamic, so every image binds the same immutable set
+    // from the device descriptor allocator. Per-frame recording writes a transient set instead
     class ENGINE_API VulkanDescriptorSet
     {
     public:
-        VulkanDescriptorSet(VulkanDevicePtr device, VulkanDescriptorPoolPtr pool, VulkanDescriptorSetLayoutPtr layout);
+        VulkanDescriptorSet(VulkanDevicePtr device, VulkanDescriptorSetLayoutPtr layout, uint32_t frameCount);
         ~VulkanDescriptorSet();
 
         void create();
         void destroy();
 
         void updateDescriptorSet(std::vector<VulkanUniformBufferPtr>& uniformBuffers, std::vector<VulkanTexture2DPtr>& sampleTextures);
+        // a transient set written with the resources of the last updateDescriptorSet()
+        VkDescriptorSet allocateFrameSet();
 
         const uint32_t getCount()
         {
@@ -59,11 +116,15 @@ namespace Homura
         {
             return mLayout;
         }
+    private:
+        void createWrites(VkDescriptorSet set, std::vector<VkWriteDescriptorSet>& writes);
     private:
         VulkanDevicePtr                 mDevice;
-        VulkanDescriptorPoolPtr         mPool;
         VulkanDescriptorSetLayoutPtr    mLayout;
+        uint32_t                        mFrameCount;
         std::vector<VkDescriptorSet>    mDescriptorSets;
+        std::vector<VulkanUniformBufferPtr> mUniformBuffers;
+        std::vector<VulkanTexture2DPtr> mSampleTextures;
     };
 }
 #endif //HOMURA_VULKANDESCRIPTOR_H
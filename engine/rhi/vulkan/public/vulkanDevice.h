@@ -8,6 +8,12 @@
 #include <vulkan/vulkan.h>
 #include <pixelFormat.h>
 #include <vulkanTypes.h>
+#include <linearArena.h>
+#include <vulkanMemory.h>
+#include <vulkanUploadManager.h>
+#include <vulkanPipelineCache.h>
+#include <vulkanDescriptorSet.h>
+#include <vulkanLayout.h>
 #include <optional>
 #include <vector>
 #include <string>
@@ -27,6 +33,8 @@ namespace Homura
     {
         std::optional<uint32_t> graphicsFamily;
         std::optional<uint32_t> presentFamily;
+        // a family with transfer but without graphics support, usually backed by a DMA engine
+        std::optional<uint32_t> transferFamily;
         bool isComplete()
         {
             return graphicsFamily.has_value() && presentFamily.has_value();
@@ -36,6 +44,7 @@ namespace Homura
     class ENGINE_API VulkanDevice : public std::enable_shared_from_this<VulkanDevice>
     {
     public:
+        // a null surface makes a headless device, without the swapchain extension and presenting on the graphics queue
         VulkanDevice(VulkanInstancePtr instance, VulkanSurfacePtr surface);
         ~VulkanDevice() = default;
 
@@ -53,6 +62,11 @@ namespace Homura
             return mPhysicalDevice;
         }
 
+        bool isHeadless() const
+        {
+            return mSurface == nullptr;
+        }
+
         VulkanQueuePtr getGraphicsQueue()
         {
             return mGfxQueue;
@@ -63,11 +77,98 @@ namespace Homura
             return mPresent;
         }
 
+        // the graphics queue when the device has no dedicated transfer family
+        VulkanQueuePtr getTransferQueue()
+        {
+            return mTransfer;
+        }
+
+        // families buffers and images are shared between, empty means exclusive to the graphics family
+        const std::vector<uint32_t>& getSharedQueueFamilies() const
+        {
+            return mSharedQueueFamilies;
+        }
+
         const VkSampleCountFlagBits& getSampleCount() const
         {
             return mMsaaSamples;
         }
 
+        // scratch memory for temporaries of the render thread, reset at the start of every frame
+        Base::LinearArena& getFrameArena()
+        {
+            return mFrameArena;
+        }
+
+        // every buffer and image gets its memory from here
+        VulkanMemoryAllocator& getMemoryAllocator()
+        {
+            return *mMemoryAllocator;
+        }
+
+        VulkanUploadManager& getUploadManager()
+        {
+            return *mUploadManager;
+        }
+
+        // graphics pipelines are created through here, it outlives every VulkanPipeline
+        VulkanPipelineCache& getPipelineCache()
+        {
+            return *mPipelineCache;
+        }
+
+        // descriptor set layouts are created through here and live as long as the device
+        VulkanDescriptorLayoutCache& getDescriptorLayoutCache()
+        {
+            return *mDescriptorLayoutCache;
+        }
+
+        // transient and immutable descriptor sets
+        VulkanDescriptorAllocator& getDescriptorAllocator()
+        {
+            return *mDescriptorAllocator;
+        }
+
+        // core features enabled on the device
+        const VkPhysicalDeviceFeatures& getEnabledFeatures() const
+        {
+            return mFeatures;
+        }
+
+        // 1.2 features enabled on the device, all false on a 1.0 device
+        const VkPhysicalDeviceVulkan12Features& getFeatures12() const
+        {
+            return mFeatures12;
+        }
+
+        // partially bound, update after bind arrays of sampled images
+        bool isBindlessSupported() const
+        {
+            return mBindlessLimit > 0;
+        }
+
+        // VulkanTimeline falls back to fences without it
+        bool isTimelineSupported() const
+        {
+            return mFeatures12.timelineSemaphore == VK_TRUE;
+        }
+
+        // BC1 to BC7 sampled images
+        bool isTextureCompressionBCSupported() const
+        {
+            return mFeatures.textureCompressionBC == VK_TRUE;
+        }
+
+        // optimal tiling images of format can be sampled with linear filtering, BC formats only with
+        // textureCompressionBC enabled
+        bool isSampledFormatSupported(VkFormat format);
+
+        // most combined image samplers one bindless array can hold
+        uint32_t getBindlessLimit() const
+        {
+            return mBindlessLimit;
+        }
+
         void initializeQueue();
     private:
         void pickPhysicalDevice();
@@ -85,8 +186,19 @@ namespace Homura
 
         VulkanQueuePtr                  mGfxQueue;
         VulkanQueuePtr                  mPresent;
+        VulkanQueuePtr                  mTransfer;
+        std::vector<uint32_t>           mSharedQueueFamilies;
 
         VkSampleCountFlagBits           mMsaaSamples;
+        VkPhysicalDeviceFeatures        mFeatures;
+        VkPhysicalDeviceVulkan12Features mFeatures12;
+        uint32_t                        mBindlessLimit;
+        Base::LinearArena               mFrameArena;
+        std::unique_ptr<VulkanMemoryAllocator> mMemoryAllocator;
+        std::unique_ptr<VulkanUploadManager>   mUploadManager;
+        std::unique_ptr<VulkanPipelineCache>   mPipelineCache;
+        std::unique_ptr<VulkanDescriptorLayoutCache> mDescriptorLayoutCache;
+        std::unique_ptr<VulkanDescriptorAllocator>   mDescriptorAllocator;
     };
 }
 #endif //HOMURA_VULKANDEVICE_H
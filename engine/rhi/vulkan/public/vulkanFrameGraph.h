@@ -0,0 +1,262 @@
+//
+// Created by 最上川 on 2022/8/28/028.
+//
+
+#ifndef HOMURA_VULKANFRAMEGRAPH_H
+#define HOMURA_VULKANFRAMEGRAPH_H
+#include <vulkan/vulkan.h>
+#include <vulkanTypes.h>
+#include <vulkanMemory.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Homura
+{
+    // how a pass uses a texture, decides its layout, stages and access
+    enum class FrameGraphAccess : uint32_t
+    {
+        ColorAttachment = 0,
+        DepthAttachment,
+        // depth test without depth writes
+        DepthRead,
+        Sampled,
+        StorageRead,
+        StorageWrite,
+        TransferSrc,
+        TransferDst,
+        ACCESS_SIZE
+    };
+
+    struct ENGINE_API FrameGraphTextureDesc
+    {
+        uint32_t                mWidth = 0;
+        uint32_t                mHeight = 0;
+        VkFormat                mFormat = VK_FORMAT_UNDEFINED;
+        VkSampleCountFlagBits   mSamples = VK_SAMPLE_COUNT_1_BIT;
+    };
+
+    struct ENGINE_API VulkanFrameGraphStats
+    {
+        uint32_t        mPassCount = 0;
+        uint32_t        mCulledPassCount = 0;
+        uint32_t        mTransientCount = 0;
+        uint32_t        mBarrierCount = 0;
+        // memory the transient textures would take one by one, and what they take aliased
+        VkDeviceSize    mTransientBytes = 0;
+        VkDeviceSize    mAllocatedBytes = 0;
+    };
+
+    class VulkanFrameGraph;
+
+    // what a pass sees while it records
+    class ENGINE_API FrameGraphContext
+    {
+    public:
+        FrameGraphContext(const VulkanFrameGraph& graph, VulkanRenderPassPtr renderPass, VkExtent2D extent)
+            : mGraph{graph}
+            , mRenderPass{renderPass}
+            , mExtent{extent}
+        {
+
+        }
+
+        VkImage getImage(FrameGraphResource resource) const;
+        VkImageView getImageView(FrameGraphResource resource) const;
+
+        // nullptr for passes without attachments, the graph has begun it already otherwise
+        VulkanRenderPassPtr getRenderPass() const
+        {
+            return mRenderPass;
+        }
+
+        VkExtent2D getExtent() const
+        {
+            return mExtent;
+        }
+    private:
+        const VulkanFrameGraph& mGraph;
+        VulkanRenderPassPtr     mRenderPass;
+        VkExtent2D              mExtent;
+    };
+
+    // declares what one pass reads and writes, handed to the setup callback of addPass()
+    class ENGINE_API FrameGraphBuilder
+    {
+    public:
+        FrameGraphBuilder(VulkanFrameGraph& graph, uint32_t pass)
+            : mGraph{graph}
+            , mPass{pass}
+        {
+
+        }
+
+        // a texture that lives within the frame, its memory may be shared with others that do not overlap it
+        FrameGraphResource create(const std::string& name, const FrameGraphTextureDesc& desc);
+        void read(FrameGraphResource resource, FrameGraphAccess access = FrameGraphAccess::Sampled);
+        // attachments are bound in the order they are written. The first writer of a texture clears it
+        // to clearValue, later ones load it
+        void write(FrameGraphResource resource, FrameGraphAccess access = FrameGraphAccess::ColorAttachment, VkClearValue clearValue = {});
+        // resolves the multisampled color attachment src into dst at the end of the pass
+        void resolve(FrameGraphResource src, FrameGraphResource dst);
+        // keeps the pass even if nothing reads what it writes
+        void setSideEffect();
+    private:
+        VulkanFrameGraph&   mGraph;
+        uint32_t            mPass;
+    };
+
+    // Passes declare the textures they read and write, compile() then drops passes nothing depends on,
+    // derives the layout transitions and barriers between the rest and places transient textures whose
+    // lifetimes do not overlap in the same memory. Passes run in the order they were added.
+    // A texture may be used once per pass
+    class ENGINE_API VulkanFrameGraph
+    {
+    public:
+        using SetupCallback = std::function<void(FrameGraphBuilder& builder)>;
+        using ExecuteCallback = std::function<void(VkCommandBuffer commandBuffer, const FrameGraphContext& context)>;
+
+        static constexpr FrameGraphResource INVALID_RESOURCE = UINT32_MAX;
+
+        explicit VulkanFrameGraph(VulkanDevicePtr device);
+        ~VulkanFrameGraph();
+        VulkanFrameGraph(const VulkanFrameGraph&) = delete;
+        VulkanFrameGraph& operator=(const VulkanFrameGraph&) = delete;
+
+        // drops passes, resources and everything compile() created, the graph can be set up again
+        void destroy();
+
+        // A texture owned elsewhere, like a swapchain image. It is in initialLayout when the frame starts
+        // and is moved to finalLayout at its end, UNDEFINED leaves it in its last layout.
+        // Its contents are kept unless initialLayout is UNDEFINED
+        FrameGraphResource importTexture(const std::string& name, const FrameGraphTextureDesc& desc, VkImage image, VkImageView imageView,
+                                         VkImageLayout initialLayout, VkImageLayout finalLayout);
+        // swaps the image of an imported texture, for the swapchain image of the frame
+        void setImportedTexture(FrameGraphResource resource, VkImage image, VkImageView imageView);
+
+        void addPass(const std::string& name, const SetupCallback& setup, const ExecuteCallback& execute);
+
+        // culls, allocates and builds render passes, again after every change to the passes. What an earlier
+        // compile() built may be in use by frames in flight, replacing it waits for the device to go idle
+        void compile();
+        // records every pass that survived culling. With a profiler every pass is a region of slot
+        void execute(VkCommandBuffer commandBuffer, VulkanGpuProfiler* profiler = nullptr, uint32_t slot = 0);
+
+        // after compile(), pipelines of a pass are created against it. nullptr for culled passes
+        VulkanRenderPassPtr getRenderPass(const std::string& passName) const;
+        bool isCulled(const std::string& passName) const;
+
+        VkImage getImage(FrameGraphResource resource) const;
+        VkImageView getImageView(FrameGraphResource resource) const;
+        const FrameGraphTextureDesc& getDesc(FrameGraphResource resource) const;
+
+        const VulkanFrameGraphStats& getStats() const
+        {
+            return mStats;
+        }
+    private:
+        friend class FrameGraphBuilder;
+
+        struct ResourceState
+        {
+            VkImageLayout           mLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkPipelineStageFlags    mStages = 0;
+            VkAccessFlags           mAccess = 0;
+        };
+
+        struct Resource
+        {
+            std::string             mName;
+            FrameGraphTextureDesc   mDesc;
+            bool                    mImported = false;
+            VkImageLayout           mInitialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkImageLayout           mFinalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkImageUsageFlags       mUsage = 0;
+            VkImage                 mImage = VK_NULL_HANDLE;
+            VkImageView             mImageView = VK_NULL_HANDLE;
+
+            // compiled
+            uint32_t                mReaders = 0;
+            std::vector<uint32_t>   mWriters;
+            uint32_t                mFirstPass = UINT32_MAX;
+            uint32_t                mLastPass = 0;
+            // memory slot of a transient texture, and the texture that used it last before this one
+            uint32_t                mSlot = UINT32_MAX;
+            FrameGraphResource      mPrevious = INVALID_RESOURCE;
+            ResourceState           mState;
+        };
+
+        struct Use
+        {
+            FrameGraphResource      mResource;
+            FrameGraphAccess        mAccess;
+            bool                    mWrite;
+            VkClearValue            mClearValue;
+        };
+
+        struct Barrier
+        {
+            FrameGraphResource      mResource;
+            VkImageLayout           mOldLayout;
+            VkImageLayout           mNewLayout;
+            VkAccessFlags           mSrcAccess;
+            VkAccessFlags           mDstAccess;
+        };
+
+        struct Pass
+        {
+            std::string                 mName;
+            ExecuteCallback             mExecute;
+            std::vector<Use>            mUses;
+            // src, dst
+            std::vector<std::pair<FrameGraphResource, FrameGraphResource>> mResolves;
+            bool                        mSideEffect = false;
+
+            // compiled
+            uint32_t                    mRefCount = 0;
+            bool                        mCulled = false;
+            std::vector<Barrier>        mBarriers;
+            VkPipelineStageFlags        mSrcStages = 0;
+            VkPipelineStageFlags        mDstStages = 0;
+            VulkanRenderPassPtr         mRenderPass;
+            VkExtent2D                  mExtent{};
+            // in attachment order
+            std::vector<FrameGraphResource> mAttachments;
+            std::vector<VkClearValue>   mClearValues;
+            // by the views they were made of, imported views change between frames
+            std::unordered_map<uint64_t, VkFramebuffer> mFramebuffers;
+        };
+
+        struct MemorySlot
+        {
+            VkMemoryRequirements    mRequirements{};
+            std::vector<FrameGraphResource> mResources;
+            VulkanAllocation        mAllocation;
+        };
+
+        Use& addUse(uint32_t pass, FrameGraphResource resource, FrameGraphAccess access, bool write, VkClearValue clearValue);
+        void cull();
+        void computeLifetimes();
+        void allocateTransients();
+        void buildRenderPasses();
+        void buildBarriers();
+        // the transitions of every pass, the first texture of each slot waits for slotEnds
+        void buildTransitions(const std::vector<ResourceState>& slotEnds);
+        VkFramebuffer getFramebuffer(Pass& pass);
+        void transition(Pass& pass, FrameGraphResource resource, const ResourceState& next, bool write);
+        void releaseCompiled();
+    private:
+        VulkanDevicePtr             mDevice;
+        std::vector<Resource>       mResources;
+        std::vector<Pass>           mPasses;
+        std::vector<MemorySlot>     mSlots;
+        // imported textures going to their final layout after the last pass
+        std::vector<Barrier>        mFinalBarriers;
+        VkPipelineStageFlags        mFinalSrcStages;
+        VkPipelineStageFlags        mFinalDstStages;
+        bool                        mCompiled;
+        VulkanFrameGraphStats       mStats;
+    };
+}
+#endif //HOMURA_VULKANFRAMEGRAPH_H
@@ -6,6 +6,7 @@
 #define HOMURA_VULKANGFXPIPELINE_H
 #include <vulkan/vulkan.h>
 #include <vulkanTypes.h>
+#include <vulkanPipelineCache.h>
 #include <vector>
 
 namespace Homura
@@ -23,7 +24,36 @@ namespace Homura
         void setViewports(const std::vector<VkViewport>& viewports);
         void setScissors(const std::vector<VkRect2D>& scissors);
 
+        // the pipeline comes from the device pipeline cache, building the same state again compiles nothing
         void build(VulkanDescriptorSetPtr descriptorSet);
+        // compiles on a job system worker instead, getHandle() stays VK_NULL_HANDLE until isReady().
+        // Call from a job system thread
+        void buildAsync(VulkanDescriptorSetPtr descriptorSet, Base::JobSystem& jobSystem);
+        bool isReady();
+        // blocks until an async build is done
+        void wait();
+
+        // drawn with instead while this one is still compiling, e.g. a cheaper permutation.
+        // It must use a compatible pipeline layout
+        void setFallback(VulkanPipelinePtr fallback)
+        {
+            mFallback = fallback;
+        }
+        // this pipeline, its fallback or nullptr when neither is ready yet
+        VulkanPipeline* resolve();
+
+        // adds the bindless array as set VulkanBindlessTable::BINDLESS_SET and VulkanBindlessConstants
+        // as push constants to the layout. Call before build()
+        void setBindlessTable(VulkanBindlessTablePtr table)
+        {
+            mBindlessTable = table;
+        }
+
+        VulkanBindlessTablePtr getBindlessTable()
+        {
+            return mBindlessTable;
+        }
+
         VkPipeline& getHandle()
         {
             return mPipeline;
@@ -38,6 +68,9 @@ namespace Homura
         {
             return mDescriptSet;
         }
+    private:
+        void build(VulkanDescriptorSetPtr descriptorSet, Base::JobSystem* jobSystem);
+        VulkanPipelineKey computeKey(const std::vector<VkPipelineShaderStageCreateInfo>& stages) const;
     private:
         VulkanDevicePtr                                     mDevice;
         VulkanRenderPassPtr                                 mRenderPass;
@@ -53,10 +86,15 @@ namespace Homura
         VkPipelineDynamicStateCreateInfo                    mDynamicState;
 
         VkPipeline                                          mPipeline;
+        VulkanPipelineFuture                                mFuture;
+        VulkanPipelinePtr                                   mFallback;
         VulkanDescriptorSetPtr                              mDescriptSet;
         VulkanPipelineLayoutPtr                             mPipelineLayout;
+        VulkanBindlessTablePtr                              mBindlessTable;
 
         std::vector<VkPipelineColorBlendAttachmentState>    mBlendAttachmentStates{};
+        // viewport and scissor are set in the command buffer, a resize keeps the pipeline
+        std::vector<VkDynamicState>                         mDynamicStates;
         VulkanShaderPtr                                     mShaders;
         std::vector<VkViewport>                             mViewports;
         std::vector<VkRect2D>                               mScissors;
@@ -0,0 +1,126 @@
+//
+// Created by 最上川 on 2022/8/25/025.
+//
+
+#ifndef HOMURA_VULKANGPUPROFILER_H
+#define HOMURA_VULKANGPUPROFILER_H
+#include <vulkan/vulkan.h>
+#include <vulkanTypes.h>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Homura
+{
+    // GPU time of one named region over the last samples
+    struct ENGINE_API VulkanGpuRegionStats
+    {
+        double      mLastMs = 0.0;
+        double      mAverageMs = 0.0;
+        double      mMinMs = 0.0;
+        double      mMaxMs = 0.0;
+        uint64_t    mSamples = 0;
+        // pipeline statistics of the last sample, all 0 when they are off
+        uint64_t    mInputAssemblyVertices = 0;
+        uint64_t    mInputAssemblyPrimitives = 0;
+        uint64_t    mVertexShaderInvocations = 0;
+        uint64_t    mClippingInvocations = 0;
+        uint64_t    mClippingPrimitives = 0;
+        uint64_t    mFragmentShaderInvocations = 0;
+    };
+
+    // Times regions of command buffers with vkCmdWriteTimestamp, optionally with a pipeline statistics
+    // query per region. Every slot has query pools of its own, the caller picks the slot a command buffer
+    // records into: the frame in flight for per frame recording, the swapchain image otherwise. A slot
+    // recorded into a command buffer that is submitted again and again is timed on every submit. Results
+    // of a slot are read with resolve() once the GPU is done with its last submit, which the frame pacing
+    // guarantees anyway, so reading never stalls. Needs timestamp support on the graphics queue, software
+    // drivers like lavapipe have it. Render thread only
+    class ENGINE_API VulkanGpuProfiler
+    {
+    public:
+        static constexpr uint32_t INVALID_REGION = UINT32_MAX;
+
+        VulkanGpuProfiler(VulkanDevicePtr device, uint32_t slotCount, uint32_t maxRegions = 64, bool pipelineStatistics = false);
+        ~VulkanGpuProfiler();
+        VulkanGpuProfiler(const VulkanGpuProfiler&) = delete;
+        VulkanGpuProfiler& operator=(const VulkanGpuProfiler&) = delete;
+
+        void create();
+        void destroy();
+
+        // false when the queue has no timestamps, every call is a no-op then
+        bool isEnabled() const
+        {
+            return mEnabled;
+        }
+
+        bool hasPipelineStatistics() const
+        {
+            return mStatisticsPool.size() > 0;
+        }
+
+        // resets the queries of slot in commandBuffer, call outside a render pass before any region
+        void beginRecording(uint32_t slot, VkCommandBuffer commandBuffer);
+        // Regions may nest, only the outermost one gets pipeline statistics and it has to begin and end
+        // on the same side of a render pass. INVALID_REGION once the slot is full
+        uint32_t beginRegion(uint32_t slot, VkCommandBuffer commandBuffer, const std::string& name);
+        void endRegion(uint32_t slot, VkCommandBuffer commandBuffer, uint32_t region);
+
+        // reads the results of the last recording of slot into the stats, its submit must have completed
+        void resolve(uint32_t slot);
+
+        const std::map<std::string, VulkanGpuRegionStats>& getStats() const
+        {
+            return mStats;
+        }
+        // average GPU milliseconds of a region, 0 when it was never resolved
+        double getRegionMs(const std::string& name) const;
+
+        void dump(std::ostream& out) const;
+        // dumps to std::cout every frames resolves, 0 turns it off
+        void setDumpInterval(uint32_t frames)
+        {
+            mDumpInterval = frames;
+        }
+    private:
+        struct Region
+        {
+            std::string     mName;
+            // timestamp queries mIndex * 2 and mIndex * 2 + 1
+            uint32_t        mIndex;
+            bool            mHasStatistics;
+            bool            mEnded;
+        };
+
+        struct Slot
+        {
+            std::vector<Region> mRegions;
+            // regions begun and not ended yet
+            uint32_t            mOpen = 0;
+            bool                mRecorded = false;
+        };
+    private:
+        VulkanDevicePtr                 mDevice;
+        uint32_t                        mSlotCount;
+        uint32_t                        mMaxRegions;
+        bool                            mWantStatistics;
+        bool                            mEnabled;
+        // nanoseconds per tick and the bits of a timestamp that count
+        double                          mTimestampPeriod;
+        uint64_t                        mTimestampMask;
+
+        std::vector<VkQueryPool>        mTimestampPool;
+        std::vector<VkQueryPool>        mStatisticsPool;
+        std::vector<Slot>               mSlots;
+
+        std::map<std::string, VulkanGpuRegionStats> mStats;
+        // last samples per region for the rolling stats
+        std::map<std::string, std::vector<double>>  mHistory;
+        uint32_t                        mDumpInterval;
+        uint64_t                        mResolveCount;
+    };
+}
+#endif //HOMURA_VULKANGPUPROFILER_H
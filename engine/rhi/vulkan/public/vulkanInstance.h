@@ -15,7 +15,8 @@ namespace Homura
     class ENGINE_API VulkanInstance
     {
     public:
-        VulkanInstance();
+        // headless instances enable no surface extensions, GLFW is never asked for them
+        explicit VulkanInstance(bool headless = false);
         ~VulkanInstance();
 
         void create();
@@ -28,8 +29,16 @@ namespace Homura
         {
             return mInstance;
         }
+
+        // VK_API_VERSION_1_2 when the loader supports it, otherwise VK_API_VERSION_1_0
+        uint32_t getApiVersion() const
+        {
+            return mApiVersion;
+        }
     private:
         VkInstance                      mInstance;
+        uint32_t                        mApiVersion;
+        bool                            mHeadless;
         bool                            mEnableValidationLayer = true;
         const std::vector<const char*>  mValidationLayers = {
                 "VK_LAYER_KHRONOS_validation"
@@ -7,26 +7,68 @@
 
 #include <vulkan/vulkan.h>
 #include <vulkanTypes.h>
+#include <vulkanPipelineCache.h>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 namespace Homura
 {
+    // Descriptor set layouts by binding signature, materials with the same bindings share one
+    // VkDescriptorSetLayout. Owned by the device and destroyed with it. Thread safe
+    class ENGINE_API VulkanDescriptorLayoutCache
+    {
+    public:
+        explicit VulkanDescriptorLayoutCache(VkDevice device);
+        ~VulkanDescriptorLayoutCache();
+        VulkanDescriptorLayoutCache(const VulkanDescriptorLayoutCache&) = delete;
+        VulkanDescriptorLayoutCache& operator=(const VulkanDescriptorLayoutCache&) = delete;
+
+        void destroy();
+
+        // the order of bindings does not matter, the cache owns the result
+        VkDescriptorSetLayout getOrCreate(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+
+        // sorts bindings by binding number and keys them with their immutable samplers, getOrCreate()
+        // looks layouts up with it and VulkanDescriptorSetLayout hashes it
+        static VulkanPipelineKey createKey(std::vector<VkDescriptorSetLayoutBinding>& bindings);
+
+        uint32_t getLayoutCount() const
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            return static_cast<uint32_t>(mLayouts.size());
+        }
+    private:
+        VkDevice                mDevice;
+        mutable std::mutex      mMutex;
+        std::unordered_map<VulkanPipelineKey, VkDescriptorSetLayout, VulkanPipelineKeyHasher> mLayouts;
+    };
+
     class ENGINE_API VulkanDescriptorSetLayout
     {
     public:
         explicit VulkanDescriptorSetLayout(VulkanDevicePtr device);
         ~VulkanDescriptorSetLayout() = default;
 
+        // the handle comes from the device layout cache
         void create(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+        // drops the handle, the cache destroys it with the device
         void destroy();
         VkDescriptorSetLayout& getHandle()
         {
             return mSetLayout;
         }
 
+        // equal for layouts created from the same bindings
+        uint64_t getHash() const
+        {
+            return mHash;
+        }
+
     private:
         VulkanDevicePtr         mDevice;
         VkDescriptorSetLayout   mSetLayout;
+        uint64_t                mHash;
     };
 
     class ENGINE_API VulkanPipelineLayout
@@ -36,6 +78,10 @@ namespace Homura
         ~VulkanPipelineLayout() = default;
 
         void create(VulkanDescriptorSetLayoutPtr descriptorSetLayout);
+        // Set i of the layout is setLayouts[i]. The handle comes from the device pipeline cache, key has to tell
+        // apart everything setLayouts and pushConstantRanges describe, layouts of equal keys are shared
+        void create(const VulkanPipelineKey& key, const std::vector<VkDescriptorSetLayout>& setLayouts, const std::vector<VkPushConstantRange>& pushConstantRanges);
+        // drops the handle, the pipeline cache destroys it with the pipelines built with it
         void destroy();
 
         VkPipelineLayout& getHandle()
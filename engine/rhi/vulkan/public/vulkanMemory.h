@@ -0,0 +1,110 @@
+//
+// Created by 最上川 on 2022/8/20/020.
+//
+
+#ifndef HOMURA_VULKANMEMORY_H
+#define HOMURA_VULKANMEMORY_H
+#include <vulkan/vulkan.h>
+#include <vulkanTypes.h>
+#include <tlsfAllocator.h>
+#include <mutex>
+#include <vector>
+
+namespace Homura
+{
+    struct VulkanMemoryBlock;
+
+    struct ENGINE_API VulkanAllocation
+    {
+        VkDeviceMemory                  mMemory = VK_NULL_HANDLE;
+        VkDeviceSize                    mOffset = 0;
+        VkDeviceSize                    mSize = 0;
+        // persistently mapped pointer at mOffset, nullptr for memory that is not host visible
+        void*                           mMapped = nullptr;
+        uint32_t                        mMemoryType = UINT32_MAX;
+        // nullptr for a dedicated allocation
+        VulkanMemoryBlock*              mBlock = nullptr;
+        Base::TlsfAllocator::Allocation mRange;
+
+        bool isValid() const
+        {
+            return mMemory != VK_NULL_HANDLE;
+        }
+    };
+
+    struct ENGINE_API VulkanMemoryStats
+    {
+        uint32_t        mBlockCount = 0;
+        uint32_t        mDedicatedCount = 0;
+        uint32_t        mAllocationCount = 0;
+        VkDeviceSize    mBlockBytes = 0;
+        VkDeviceSize    mUsedBytes = 0;
+        VkDeviceSize    mDedicatedBytes = 0;
+    };
+
+    // Sub allocates VkDeviceMemory blocks per memory type with a TLSF allocator, so resources no longer
+    // count against maxMemoryAllocationCount one by one. Linear and optimal tiling resources live in
+    // separate blocks when bufferImageGranularity requires it. Thread safe.
+    class ENGINE_API VulkanMemoryAllocator
+    {
+    public:
+        // called for every allocation a defragmentation pass wants to move. The owner copies the data,
+        // rebinds its resource to dst and returns true, the allocator then frees src. It runs under the
+        // allocator lock and must not call back into the allocator
+        using MoveCallback = std::function<bool(const VulkanAllocation& src, const VulkanAllocation& dst, void* userData)>;
+
+        VulkanMemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = 64ull * 1024 * 1024);
+        ~VulkanMemoryAllocator();
+        VulkanMemoryAllocator(const VulkanMemoryAllocator&) = delete;
+        VulkanMemoryAllocator& operator=(const VulkanMemoryAllocator&) = delete;
+
+        // memory properties are queried once, this is only a table lookup
+        uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+        // linear is true for buffers and linear tiling images. userData is handed to the move callback,
+        // only allocations with userData take part in defragmentation
+        VulkanAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, void* userData = nullptr);
+        VulkanAllocation allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties, void* userData = nullptr);
+        VulkanAllocation allocateImage(VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags properties, void* userData = nullptr);
+        void free(VulkanAllocation& allocation);
+
+        // makes host writes visible for memory without HOST_COHERENT, a no-op otherwise
+        void flush(const VulkanAllocation& allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+
+        // moves up to maxMoves allocations out of the least used block of every pool into the others
+        // and releases blocks that end up empty. Returns the number of moves
+        uint32_t defragment(const MoveCallback& move, uint32_t maxMoves);
+
+        VulkanMemoryStats getStats() const;
+    private:
+        struct Pool
+        {
+            std::vector<VulkanMemoryBlock*> mBlocks;
+        };
+
+        Pool& getPool(uint32_t memoryType, bool linear);
+        VulkanMemoryBlock* createBlock(uint32_t memoryType, bool linear, VkDeviceSize size);
+        void destroyBlock(VulkanMemoryBlock* block);
+        bool allocateFromBlock(VulkanMemoryBlock* block, VkDeviceSize size, VkDeviceSize align, void* userData, VulkanAllocation& allocation);
+        VulkanAllocation allocateDedicated(uint32_t memoryType, VkDeviceSize size);
+        void freeLocked(VulkanAllocation& allocation);
+        VkDeviceSize getAlignment(uint32_t memoryType, VkDeviceSize alignment) const;
+        bool isHostVisible(uint32_t memoryType) const;
+    private:
+        VkDevice                            mDevice;
+        VkPhysicalDeviceMemoryProperties    mMemoryProperties;
+        VkDeviceSize                        mBufferImageGranularity;
+        VkDeviceSize                        mNonCoherentAtomSize;
+        uint32_t                            mMaxAllocationCount;
+        VkDeviceSize                        mBlockSizes[VK_MAX_MEMORY_TYPES];
+        bool                                mSeparateLinear;
+
+        mutable std::mutex                  mMutex;
+        // [memory type][0 optimal, 1 linear], without granularity concerns everything is in slot 0
+        Pool                                mPools[VK_MAX_MEMORY_TYPES][2];
+        uint32_t                            mDeviceAllocationCount;
+        uint32_t                            mDedicatedCount;
+        VkDeviceSize                        mDedicatedBytes;
+    };
+}
+#endif //HOMURA_VULKANMEMORY_H
@@ -0,0 +1,85 @@
+//
+// Created by 最上川 on 2022/8/22/022.
+//
+
+#ifndef HOMURA_VULKANPARALLELRECORDER_H
+#define HOMURA_VULKANPARALLELRECORDER_H
+#include <vulkan/vulkan.h>
+#include <vulkanTypes.h>
+#include <jobSystem.h>
+#include <functional>
+#include <vector>
+
+namespace Homura
+{
+    // Records the draws of a subpass on JobSystem workers. Every worker owns one command pool per frame,
+    // so recording needs no locks, and each chunk of draws goes into its own secondary command buffer.
+    // The primary executes them in draw order.
+    class ENGINE_API VulkanParallelRecorder
+    {
+    public:
+        // records draws [first, first + count) into a secondary command buffer that is already begun.
+        // Runs on any worker, nothing bound in the primary is inherited
+        using RecordCallback = std::function<void(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t first, uint32_t count)>;
+
+        // jobSystem must have been created on the thread that calls record()
+        VulkanParallelRecorder(VulkanDevicePtr device, Base::JobSystem& jobSystem, uint32_t frameCount);
+        ~VulkanParallelRecorder();
+        VulkanParallelRecorder(const VulkanParallelRecorder&) = delete;
+        VulkanParallelRecorder& operator=(const VulkanParallelRecorder&) = delete;
+
+        void destroy();
+
+        // recycles every secondary command buffer of frame, the GPU must be done with them
+        void reset(uint32_t frame);
+
+        // records drawCount draws in chunks of drawsPerChunk, 0 picks a few chunks per worker. Returns the
+        // secondary command buffers in draw order, valid until the next record() or reset() of that frame
+        const std::vector<VkCommandBuffer>& record(uint32_t frame, VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer,
+                                                   uint32_t drawCount, uint32_t drawsPerChunk, const RecordCallback& callback);
+
+        uint32_t getFrameCount() const
+        {
+            return mFrameCount;
+        }
+
+        uint32_t getWorkerCount() const
+        {
+            return mWorkerCount;
+        }
+    private:
+        struct ThreadPool
+        {
+            VulkanCommandPoolPtr            mPool;
+            std::vector<VkCommandBuffer>    mCommandBuffers;
+            // command buffers handed out since the last reset
+            uint32_t                        mUsed;
+        };
+
+        struct Chunk
+        {
+            VulkanParallelRecorder*         mRecorder;
+            uint32_t                        mIndex;
+            uint32_t                        mFirst;
+            uint32_t                        mCount;
+        };
+
+        static void recordChunks(Chunk* chunks, unsigned int count);
+        VkCommandBuffer acquire(uint32_t worker);
+    private:
+        VulkanDevicePtr                     mDevice;
+        Base::JobSystem&                    mJobSystem;
+        uint32_t                            mFrameCount;
+        uint32_t                            mWorkerCount;
+        // [frame * mWorkerCount + worker], a pool is only touched by its worker
+        std::vector<ThreadPool>             mPools;
+
+        // state of the record() in progress
+        uint32_t                            mFrame;
+        VkCommandBufferInheritanceInfo      mInheritance;
+        const RecordCallback*               mCallback;
+        std::vector<Chunk>                  mChunks;
+        std::vector<std::vector<VkCommandBuffer>> mResults;
+    };
+}
+#endif //HOMURA_VULKANPARALLELRECORDER_H
@@ -0,0 +1,195 @@
+//
+// Created by 最上川 on 2022/8/23/023.
+//
+
+#ifndef HOMURA_VULKANPIPELINECACHE_H
+#define HOMURA_VULKANPIPELINECACHE_H
+#include <vulkan/vulkan.h>
+#include <vulkanTypes.h>
+#include <jobSystem.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace Homura
+{
+    // 64 bit FNV-1a, chain calls through seed
+    ENGINE_API uint64_t hashMemory(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+    // Everything a pipeline is compiled from, serialized field by field. Two keys are only equal when the
+    // bytes are, the hash just picks the bucket
+    class ENGINE_API VulkanPipelineKey
+    {
+    public:
+        template<typename T>
+        void add(const T& value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "pipeline state must be plain data");
+            addData(&value, sizeof(T));
+        }
+
+        void addData(const void* data, size_t size);
+
+        uint64_t getHash() const
+        {
+            return mHash;
+        }
+
+        bool operator==(const VulkanPipelineKey& other) const
+        {
+            return mHash == other.mHash && mData == other.mData;
+        }
+    private:
+        std::vector<uint8_t>    mData;
+        uint64_t                mHash = 14695981039346656037ull;
+    };
+
+    struct VulkanPipelineKeyHasher
+    {
+        size_t operator()(const VulkanPipelineKey& key) const
+        {
+            return static_cast<size_t>(key.getHash());
+        }
+    };
+
+    // Deep copy of a VkGraphicsPipelineCreateInfo, so it can be compiled after the caller's state is gone.
+    // pNext chains and specialization constants are not supported. Shader modules, layout and render pass
+    // are handles and have to stay alive until the pipeline is compiled
+    class ENGINE_API VulkanPipelineCreateInfo
+    {
+    public:
+        explicit VulkanPipelineCreateInfo(const VkGraphicsPipelineCreateInfo& info);
+        VulkanPipelineCreateInfo(const VulkanPipelineCreateInfo&) = delete;
+        VulkanPipelineCreateInfo& operator=(const VulkanPipelineCreateInfo&) = delete;
+
+        const VkGraphicsPipelineCreateInfo& get() const
+        {
+            return mInfo;
+        }
+    private:
+        template<typename T>
+        static const T* copyState(const T* src, T& dst)
+        {
+            if (!src)
+            {
+                return nullptr;
+            }
+            dst = *src;
+            return &dst;
+        }
+    private:
+        VkGraphicsPipelineCreateInfo                        mInfo;
+        std::vector<VkPipelineShaderStageCreateInfo>        mStages;
+        std::vector<std::string>                            mEntryPoints;
+        VkPipelineVertexInputStateCreateInfo                mVertexInputState;
+        std::vector<VkVertexInputBindingDescription>        mBindings;
+        std::vector<VkVertexInputAttributeDescription>      mAttributes;
+        VkPipelineInputAssemblyStateCreateInfo              mInputAssemblyState;
+        VkPipelineTessellationStateCreateInfo               mTessellationState;
+        VkPipelineViewportStateCreateInfo                   mViewportState;
+        std::vector<VkViewport>                             mViewports;
+        std::vector<VkRect2D>                               mScissors;
+        VkPipelineRasterizationStateCreateInfo              mRasterizationState;
+        VkPipelineMultisampleStateCreateInfo                mMultisampleState;
+        std::vector<VkSampleMask>                           mSampleMask;
+        VkPipelineDepthStencilStateCreateInfo               mDepthStencilState;
+        VkPipelineColorBlendStateCreateInfo                 mColorBlendState;
+        std::vector<VkPipelineColorBlendAttachmentState>    mBlendAttachmentStates;
+        VkPipelineDynamicStateCreateInfo                    mDynamicState;
+        std::vector<VkDynamicState>                         mDynamicStates;
+    };
+
+    struct VulkanPipelineCompileState;
+
+    // Result of VulkanPipelineCache::compileAsync(). Copies share the same compile
+    class ENGINE_API VulkanPipelineFuture
+    {
+    public:
+        VulkanPipelineFuture() = default;
+        explicit VulkanPipelineFuture(VkPipeline pipeline);
+        explicit VulkanPipelineFuture(std::shared_ptr<VulkanPipelineCompileState> state);
+
+        bool isValid() const
+        {
+            return mPipeline != VK_NULL_HANDLE || mState != nullptr;
+        }
+        bool isReady() const;
+        // VK_NULL_HANDLE while the pipeline is still compiling
+        VkPipeline get() const;
+        // helps the job system until the pipeline is done, call it from a job system thread
+        VkPipeline wait() const;
+    private:
+        VkPipeline                                  mPipeline = VK_NULL_HANDLE;
+        std::shared_ptr<VulkanPipelineCompileState> mState;
+    };
+
+    struct ENGINE_API VulkanPipelineCacheStats
+    {
+        uint32_t    mPipelineCount = 0;
+        // lookups answered from the table, pipelines compiled by the driver
+        uint64_t    mHits = 0;
+        uint64_t    mMisses = 0;
+        uint64_t    mAsyncCompiles = 0;
+        // size of the blob loaded at startup, 0 when there was none or it was rejected
+        size_t      mLoadedBytes = 0;
+    };
+
+    // Owns every graphics pipeline of the device. Pipelines are deduplicated by their state key, so
+    // rebuilding a VulkanPipeline with the same state, e.g. after a window resize, compiles nothing.
+    // Misses go through one VkPipelineCache that is loaded from and saved to disk. The blob is only
+    // used when its header matches the vendor, device and pipeline cache UUID. Thread safe.
+    class ENGINE_API VulkanPipelineCache
+    {
+    public:
+        VulkanPipelineCache(VkPhysicalDevice physicalDevice, VkDevice device, std::string path);
+        ~VulkanPipelineCache();
+        VulkanPipelineCache(const VulkanPipelineCache&) = delete;
+        VulkanPipelineCache& operator=(const VulkanPipelineCache&) = delete;
+
+        // saves the blob and destroys every pipeline
+        void destroy();
+
+        VkPipeline find(const VulkanPipelineKey& key);
+        // returns the pipeline of key, info is only compiled when the key is new.
+        // The cache owns the result, never destroy it
+        VkPipeline getOrCreate(const VulkanPipelineKey& key, const VkGraphicsPipelineCreateInfo& info);
+        // Compiles on a job system worker, info is copied. Known keys come back ready, a key that is
+        // already compiling returns the future of that compile. Call from a job system thread
+        VulkanPipelineFuture compileAsync(const VulkanPipelineKey& key, const VkGraphicsPipelineCreateInfo& info, Base::JobSystem& jobSystem);
+        // Pipeline layouts live as long as the pipelines, the same key always returns the same layout so a
+        // pipeline handed out again never refers to a destroyed one. The cache owns the result, never destroy it
+        VkPipelineLayout getOrCreateLayout(const VulkanPipelineKey& key, const VkPipelineLayoutCreateInfo& info);
+
+        // writes the VkPipelineCache blob to the path given at construction
+        bool save();
+
+        VkPipelineCache getHandle() const
+        {
+            return mCache;
+        }
+
+        VulkanPipelineCacheStats getStats() const;
+    private:
+        static void compileJob(Base::Job* job, const void* data);
+        std::vector<char> load();
+        bool isCompatible(const std::vector<char>& data) const;
+    private:
+        VkDevice                                mDevice;
+        VkPhysicalDeviceProperties              mProperties;
+        std::string                             mPath;
+        VkPipelineCache                         mCache;
+
+        mutable std::mutex                      mMutex;
+        std::unordered_map<VulkanPipelineKey, VkPipeline, VulkanPipelineKeyHasher> mPipelines;
+        std::unordered_map<VulkanPipelineKey, VkPipelineLayout, VulkanPipelineKeyHasher> mLayouts;
+        // compiles in flight, removed by their job once the pipeline is in mPipelines
+        std::unordered_map<VulkanPipelineKey, std::shared_ptr<VulkanPipelineCompileState>, VulkanPipelineKeyHasher> mPending;
+        VulkanPipelineCacheStats                mStats;
+    };
+}
+#endif //HOMURA_VULKANPIPELINECACHE_H
@@ -6,6 +6,7 @@
 #define HOMURA_VULKANQUEUE_H
 #include <vulkan/vulkan.h>
 #include <vulkanTypes.h>
+#include <vulkanSynchronization.h>
 #include <memory>
 
 namespace Homura
@@ -26,10 +27,17 @@ namespace Homura
             return mQueue;
         }
 
+        // every submit to the queue that wants to be waited on goes through here
+        VulkanTimeline& getTimeline()
+        {
+            return *mTimeline;
+        }
+
     private:
         VkQueue                     mQueue;
         uint32_t                    mFamilyIndex;
         VulkanDevicePtr             mDevice;
+        std::unique_ptr<VulkanTimeline> mTimeline;
     };
 }
 #endif //HOMURA_VULKANQUEUE_H
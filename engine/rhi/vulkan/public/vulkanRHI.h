@@ -8,6 +8,9 @@
 #include <vulkan/vulkan.h>
 #include <vulkanTypes.h>
 #include <rhiResources.h>
+#include <vulkanParallelRecorder.h>
+#include <image.h>
+#include <vulkanTextureStreamer.h>
 #include <GLFW/glfw3.h>
 
 #include <vector>
@@ -22,6 +25,13 @@ namespace Homura
         virtual ~VulkanRHI() = default;
 
         void init(int width, int height, std::string title);
+        // Renders into imageCount offscreen images instead of a window, no GLFW and no swapchain. Frames
+        // only leave the GPU through setReadbackCallback(). Call instead of init()
+        void initHeadless(int width, int height, uint32_t imageCount = 3);
+        bool isHeadless() const
+        {
+            return mHeadless;
+        }
         void exit();
         void update();
         VkSampleCountFlagBits getSampleCount();
@@ -39,11 +49,62 @@ namespace Homura
         void createIndexBuffer(void* bufferData, uint32_t bufferSize, uint32_t count);
         void createUniformBuffer(int binding, uint32_t bufferSize);
         void updateUniformBuffer(uint32_t index);
+        // RGBA8 sRGB pixels, the mips are filtered on the CPU, on the workers of the job system if there is one
         void createSampleTexture(int binding, void* imageData, uint32_t imageSize, uint32_t width, uint32_t height);
+        // a baked mip chain, every level is one copy and nothing is blitted. Block compressed levels go
+        // to the GPU as they are, check isImageFormatSupported() first
+        void createSampleTexture(int binding, const Base::Image& image);
+        // whether images of format can be sampled, block compressed formats need textureCompressionBC
+        bool isImageFormatSupported(Base::ImageFormat format) const;
 
         void draw();
+        // drawCount draws recorded concurrently into secondary command buffers after setJobSystem()
+        void drawParallel(uint32_t drawCount, uint32_t drawsPerChunk, const VulkanParallelRecorder::RecordCallback& callback);
         void endCommandBuffer();
 
+        // Records draws, compiles the pipeline in setupPipeline() and reads streamed levels on the workers of
+        // jobSystem. Every submit comes from the thread that calls init(), setupPipeline() and update(), it
+        // has to be the thread that created jobSystem. Call before setTextureStreaming() and createCommandBuffer(),
+        // nullptr goes back to doing it all on the calling thread
+        void setJobSystem(Base::JobSystem* jobSystem);
+        // Rebuilds the commands every frame from the draw list that beginCommandBuffer() to endCommandBuffer()
+        // fill, instead of recording every swapchain image once. Call before createCommandBuffer()
+        void setPerFrameRecording(bool enable);
+        std::vector<VulkanDrawCommand>& getDrawList();
+        // frames the CPU may run ahead of the GPU, more hides stalls at the cost of latency. Call before createCommandBuffer()
+        void setFramesInFlight(uint32_t count);
+        // Puts sample textures into one bindless array instead of a binding each, draws pick theirs through
+        // VulkanDrawCommand::mTextureIndex. Call after init() and before createSampleTexture(), does nothing
+        // when the device lacks descriptor indexing
+        void setBindless(bool enable);
+        VulkanBindlessTablePtr getBindlessTable();
+        // Streams textures from KTX2 files within config.mBudget instead of loading them whole, levels are
+        // read on the job system of setJobSystem(). Needs the bindless table, call after setBindless() and
+        // before createCommandBuffer(). Turns on per frame recording. Turning it off waits for the device and
+        // releases every streamed texture, draws that sampled them have to be recorded again
+        void setTextureStreaming(bool enable, const VulkanTextureStreamerConfig& config = VulkanTextureStreamerConfig{});
+        VulkanTextureStreamerPtr getTextureStreamer();
+        // The tail of the file is resident when this returns, feed the streamer usage to get finer levels.
+        // Returns VulkanTextureStreamer::INVALID_TEXTURE without streaming or for files it cannot stream
+        uint32_t streamSampleTexture(const std::string& filename);
+        // GPU time per render pass and draw group, read back frames later without waiting. Call before
+        // createCommandBuffer(), pipeline statistics are only collected when the device supports them
+        void setGpuProfiling(bool enable, bool pipelineStatistics = false);
+        VulkanGpuProfilerPtr getGpuProfiler();
+        // A frame graph records the frame instead of the draw list, backbuffer being the texture
+        // importSwapChain() gave it. Turns on per frame recording, call before createCommandBuffer().
+        // Swapchain recreation drops its passes, set them up again in the UpdateAfterRecreateSwapchain callback
+        VulkanFrameGraphPtr createFrameGraph();
+        FrameGraphResource importSwapChain(VulkanFrameGraphPtr graph);
+        void setFrameGraph(VulkanFrameGraphPtr graph, FrameGraphResource backbuffer);
+        // records the draw list into the render pass of a graph pass, call from its execute callback
+        void recordDrawList(VkCommandBuffer commandBuffer);
+        // update() returns after count frames, 0 runs until the window closes. Headless runs need one
+        void setFrameLimit(uint32_t count);
+        // Called with every rendered frame, frames later and in order, while update() runs. Headless only,
+        // call before createCommandBuffer()
+        void setReadbackCallback(ReadbackCallback callback);
+
         // callback
         void setMouseButtonCallBack(MouseCallback cb);
         void setFramebufferResizeCallback(FramebufferResizeCallback cb);
@@ -63,7 +124,6 @@ namespace Homura
         VulkanSurfacePtr createSurface();
         VulkanSwapChainPtr createSwapChain();
         VulkanRenderPassPtr createRenderPass();
-        VulkanDescriptorPoolPtr createDescriptorPool();
 
         VulkanCommandPoolPtr createCommandPool();
         VulkanFramebufferPtr createFrameBuffer();
@@ -81,7 +141,6 @@ namespace Homura
         void destroySwapChain();
         void destroyRenderPass();
         void destroyDescriptorSet();
-        void destroyDescriptorPool();
         void destroyFrameBuffer();
         void destroyCommandBuffer();
         void destroyCommandPool();
@@ -102,7 +161,6 @@ namespace Homura
         VulkanSurfacePtr                    mSurface;
         VulkanSwapChainPtr                  mSwapChain;
         VulkanRenderPassPtr                 mRenderPass;
-        VulkanDescriptorPoolPtr             mDescriptorPool;
         VulkanDescriptorSetPtr              mDescriptorSet;
         VulkanCommandPoolPtr                mCommandPool;
         VulkanCommandBufferPtr              mCommandBuffer;
@@ -115,13 +173,30 @@ namespace Homura
 
         VulkanTexture2DPtr                  mDepthStencil;
         std::vector<VulkanBufferPtr>        mBuffers;
+        VulkanUniformRingPtr                mUniformRing;
         std::vector<VulkanUniformBufferPtr> mUniformBuffers;
+        // dynamic offsets of mUniformBuffers for every swapchain image, as recorded in the command buffers
+        std::vector<uint32_t>               mDynamicOffsets;
         std::vector<VulkanTexture2DPtr>     mSampleTextures;
 
         //test
         RHIRenderPassInfo                   mInfo;
         // window
         ApplicationWindowPtr                mWindow;
+        Base::JobSystem*                    mJobSystem;
+        bool                                mPerFrameRecording;
+        uint32_t                            mFramesInFlight;
+        VulkanBindlessTablePtr              mBindlessTable;
+        bool                                mGpuProfiling;
+        bool                                mPipelineStatistics;
+        VulkanGpuProfilerPtr                mGpuProfiler;
+        bool                                mHeadless;
+        uint32_t                            mFrameLimit;
+        ReadbackCallback                    mReadbackCallback;
+        VulkanFrameGraphPtr                 mFrameGraph;
+        FrameGraphResource                  mBackbuffer;
+        VulkanTextureStreamerPtr            mTextureStreamer;
+        std::vector<uint32_t>               mStreamedTextures;
     public:
         MouseCallback                       mMouseCallback;
         FramebufferResizeCallback           mFramebufferResizeCallback;
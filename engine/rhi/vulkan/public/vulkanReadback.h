@@ -0,0 +1,69 @@
+//
+// Created by 最上川 on 2022/8/27/027.
+//
+
+#ifndef HOMURA_VULKANREADBACK_H
+#define HOMURA_VULKANREADBACK_H
+#include <vulkan/vulkan.h>
+#include <vulkanTypes.h>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace Homura
+{
+    // one rendered image as the readback callback sees it, mData is only valid during the call
+    struct ENGINE_API VulkanReadbackImage
+    {
+        uint64_t    mFrame;
+        uint32_t    mImageIndex;
+        const void* mData;
+        VkExtent2D  mExtent;
+        VkFormat    mFormat;
+        // bytes per row, rows are tightly packed
+        uint32_t    mRowPitch;
+    };
+
+    // Copies swapchain images into host visible buffers after their frame, on the graphics queue and
+    // without waiting for it. Finished copies reach the callback in submit order from collect(), an
+    // image is only waited for when its buffer is needed again. 4 byte formats only
+    class ENGINE_API VulkanReadback
+    {
+    public:
+        VulkanReadback(VulkanDevicePtr device, VulkanSwapChainPtr swapChain, ReadbackCallback callback);
+        ~VulkanReadback();
+        VulkanReadback(const VulkanReadback&) = delete;
+        VulkanReadback& operator=(const VulkanReadback&) = delete;
+
+        void create();
+        // waits for and delivers what is still in flight
+        void destroy();
+
+        // copies imageIndex after everything submitted so far, it has to be in TRANSFER_SRC layout by then
+        void submit(uint32_t imageIndex, uint64_t frame);
+        // hands finished copies to the callback, wait blocks until every copy has finished
+        void collect(bool wait = false);
+    private:
+        struct Slot
+        {
+            VulkanBufferPtr mBuffer;
+            VkCommandBuffer mCommandBuffer = VK_NULL_HANDLE;
+            uint64_t        mValue = 0;
+            uint64_t        mFrame = 0;
+            bool            mPending = false;
+        };
+
+        void deliver(uint32_t imageIndex);
+    private:
+        VulkanDevicePtr         mDevice;
+        VulkanSwapChainPtr      mSwapChain;
+        ReadbackCallback        mCallback;
+        VulkanCommandPoolPtr    mCommandPool;
+        uint32_t                mRowPitch;
+        // per swapchain image
+        std::vector<Slot>       mSlots;
+        // images with a copy in flight, in submit order
+        std::deque<uint32_t>    mPending;
+    };
+}
+#endif //HOMURA_VULKANREADBACK_H
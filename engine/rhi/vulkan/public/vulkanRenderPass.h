@@ -35,6 +35,9 @@ namespace Homura
 
         void set(RHIRenderPassInfo info);
         void build();
+        // without an RHIRenderPassInfo, for passes that have no color attachment or come from the frame graph
+        void build(const std::vector<VkAttachmentDescription>& attachments, const std::vector<VkSubpassDescription>& subPasses,
+                   const std::vector<VkSubpassDependency>& dependencies);
         void destroy();
 
         VkRenderPass& getHandle()
@@ -42,9 +45,19 @@ namespace Homura
             return mRenderPass;
         }
 
+        // equal for compatible render passes: attachment formats, sample counts and subpass references
+        // match, load/store ops and layouts may differ. A pipeline works with every compatible pass
+        uint64_t getCompatibilityHash() const
+        {
+            return mCompatibilityHash;
+        }
+
+    private:
+        uint64_t computeCompatibilityHash(const std::vector<VkAttachmentDescription>& attachments, const std::vector<VkSubpassDescription>& subPasses) const;
     private:
         VulkanDevicePtr                         mDevice;
         VkRenderPass                            mRenderPass;
+        uint64_t                                mCompatibilityHash;
 
         std::vector<VulkanSubPass>              mSubPasses;
         std::vector<VkSubpassDependency>        mDependencies;
@@ -36,6 +36,12 @@ namespace Homura
             return mEntryPoint;
         }
 
+        // hash of the SPIR-V code, part of the pipeline key
+        uint64_t getCodeHash() const
+        {
+            return mCodeHash;
+        }
+
         void setVertexAttributeDescription(std::vector<VkVertexInputAttributeDescription>& attributeDescriptions);
         void setVertexInputBindingDescription(VkVertexInputBindingDescription inputBindingDescription);
         uint32_t getVertexAttributeDesriptionCount() const;
@@ -47,6 +53,7 @@ namespace Homura
         VkShaderModule              mModule;
         VkShaderStageFlagBits       mStage;
         std::string                 mEntryPoint;
+        uint64_t                    mCodeHash;
         std::vector<VkVertexInputAttributeDescription>  mVertexInputAttributeDes;
         std::vector<VkVertexInputBindingDescription>    mVertexInputBindingDes;
     };
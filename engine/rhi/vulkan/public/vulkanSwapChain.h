@@ -26,6 +26,9 @@ namespace Homura
     {
     public:
         VulkanSwapChain(VulkanDevicePtr device, ApplicationWindowPtr window, VulkanSurfacePtr surface);
+        // Headless, imageCount offscreen VulkanTexture2D targets stand in for the swapchain images and
+        // acquireOffscreen() hands them out round robin. Nothing is presented
+        VulkanSwapChain(VulkanDevicePtr device, VkExtent2D extent, uint32_t imageCount, VkFormat format = VK_FORMAT_R8G8B8A8_UNORM);
         ~VulkanSwapChain() = default;
 
         void create();
@@ -53,12 +56,22 @@ namespace Homura
             return mSwapChainExtent;
         }
 
+        bool isHeadless() const
+        {
+            return mHeadless;
+        }
+
+        // index of the next offscreen image, the caller waits for the frame that last rendered to it
+        uint32_t acquireOffscreen();
+        VkImage getImage(uint32_t index);
+
         SwapChainSupportInfo querySwapChainSupportInfo();
         VkSurfaceFormatKHR chooseSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &availableFormats);
         VkPresentModeKHR chooseSurfacePresentMode(const std::vector<VkPresentModeKHR> &availablePresentModes);
         VkExtent2D chooseExtent(const VkSurfaceCapabilitiesKHR &capabilities);
 
         void createSwapChainImageViews();
+        void createOffscreenImages();
         VkImageView getImageView(uint32_t index);
     private:
         VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageViewType viewType, uint32_t layerCount, uint32_t mipLevels = 1);
@@ -74,6 +87,11 @@ namespace Homura
 
         std::vector<VkImage>            mSwapChainImages;
         std::vector<VkImageView>        mSwapChainImageViews;
+
+        bool                            mHeadless;
+        // own the images and views above when headless
+        std::vector<VulkanTexture2DPtr> mOffscreenImages;
+        uint32_t                        mNextImage;
     };
 }
 #endif //HOMURA_VULKANSWAPCHAIN_H
@@ -6,6 +6,9 @@
 #define HOMURA_VULKANSYNCHRONIZATION_H
 #include <vulkan/vulkan.h>
 #include <vulkanTypes.h>
+#include <deque>
+#include <mutex>
+#include <utility>
 #include <vector>
 
 namespace Homura
@@ -16,8 +19,6 @@ namespace Homura
         explicit VulkanFenceEntity(VulkanDevicePtr device);
         ~VulkanFenceEntity() = default;
 
-        VulkanFenceEntity& operator=(VulkanFenceEntity& r);
-
         void create(bool signaled);
         void destroy();
 
@@ -51,25 +52,6 @@ namespace Homura
         VkSemaphore     mSemaphore;
     };
 
-    class ENGINE_API VulkanFences
-    {
-    public:
-        explicit VulkanFences(VulkanDevicePtr device, uint32_t num);
-        ~VulkanFences() = default;
-
-        void create();
-        void destroy();
-
-        void wait(uint32_t index);
-        void waitAll();
-        void setValue(VulkanFenceEntity& value, uint32_t index);
-        VkFence& getFence(uint32_t index);
-        VulkanFenceEntity& getEntity(uint32_t index);
-    private:
-        VulkanDevicePtr                 mDevice;
-        std::vector<VulkanFenceEntity>  mFences;
-    };
-
     class ENGINE_API VulkanSemaphores
     {
     public:
@@ -83,5 +65,135 @@ namespace Homura
         VulkanDevicePtr                     mDevice;
         std::vector<VulkanSemaphoreEntity>  mSemaphores;
     };
+
+    class VulkanTimeline;
+
+    // a submit waits until timeline has reached value
+    struct ENGINE_API VulkanTimelineWait
+    {
+        VulkanTimeline*         mTimeline;
+        uint64_t                mValue;
+        VkPipelineStageFlags    mStageMask;
+    };
+
+    // One monotonically increasing value per queue, every submit through it signals the next one.
+    // CPU waits and dependencies between queues are expressed as values. Backed by a timeline semaphore,
+    // or on devices without one by a pool of fences, one per submit that is recycled once it signaled.
+    // The fallback cannot wait for another queue on the GPU, it waits on the CPU before submitting. Thread safe
+    class ENGINE_API VulkanTimeline
+    {
+    public:
+        explicit VulkanTimeline(VulkanDevicePtr device);
+        ~VulkanTimeline();
+        VulkanTimeline(const VulkanTimeline&) = delete;
+        VulkanTimeline& operator=(const VulkanTimeline&) = delete;
+
+        void destroy();
+
+        // submits info with the waits added and the next value signaled, returns that value.
+        // Binary semaphores of info are kept
+        uint64_t submit(VkQueue queue, const VkSubmitInfo& info, const std::vector<VulkanTimelineWait>& waits = {});
+
+        bool isComplete(uint64_t value);
+        // blocks until value has been reached, value must have been submitted
+        void wait(uint64_t value);
+        // every submit so far
+        void waitIdle();
+
+        uint64_t getCompletedValue();
+
+        uint64_t getLastValue()
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            return mLastValue;
+        }
+
+        bool isTimelineSemaphore() const
+        {
+            return mSemaphore != VK_NULL_HANDLE;
+        }
+
+        // VK_NULL_HANDLE in the fence fallback
+        VkSemaphore getSemaphore() const
+        {
+            return mSemaphore;
+        }
+    private:
+        // fence fallback, retires signaled fences up to value
+        void retire(uint64_t value, bool block);
+    private:
+        VulkanDevicePtr                             mDevice;
+        VkSemaphore                                 mSemaphore;
+        std::mutex                                  mMutex;
+        uint64_t                                    mLastValue;
+        uint64_t                                    mCompletedValue;
+        // fence fallback, in submit order
+        std::deque<std::pair<uint64_t, VkFence>>    mPending;
+        std::vector<VkFence>                        mFreeFences;
+    };
+
+    // Paces frames on the graphics timeline. A frame reuses the resources of the frame framesInFlight
+    // before it, beginFrame() waits for exactly that frame and nothing newer. Swapchain images remember
+    // the frame that last rendered to them instead of sharing its fence
+    class ENGINE_API VulkanFrameSync
+    {
+    public:
+        VulkanFrameSync(VulkanDevicePtr device, uint32_t framesInFlight, uint32_t imageCount);
+        ~VulkanFrameSync();
+        VulkanFrameSync(const VulkanFrameSync&) = delete;
+        VulkanFrameSync& operator=(const VulkanFrameSync&) = delete;
+
+        void destroy();
+
+        // waits for the frame that last used the slot and returns the slot, in [0, framesInFlight)
+        uint32_t beginFrame();
+        // waits for the last frame that rendered to imageIndex
+        void waitImage(uint32_t imageIndex);
+        // submits the current frame on the graphics queue and moves on to the next frame number
+        void submit(const VkSubmitInfo& info, uint32_t imageIndex, const std::vector<VulkanTimelineWait>& waits = {});
+
+        bool isFrameComplete(uint64_t frame);
+        // frame must have been submitted
+        void waitFrame(uint64_t frame);
+        void waitIdle();
+
+        // number of the frame being recorded, the first one is 0
+        uint64_t getFrameNumber() const
+        {
+            return mFrameNumber;
+        }
+
+        uint32_t getFrameIndex() const
+        {
+            return static_cast<uint32_t>(mFrameNumber % mFramesInFlight);
+        }
+
+        uint32_t getFramesInFlight() const
+        {
+            return mFramesInFlight;
+        }
+
+        VkSemaphore getImageAvailableSemaphore()
+        {
+            return mImageAvailable.getSemaphore(getFrameIndex());
+        }
+
+        VkSemaphore getRenderFinishedSemaphore()
+        {
+            return mRenderFinished.getSemaphore(getFrameIndex());
+        }
+    private:
+        VulkanDevicePtr         mDevice;
+        VulkanTimeline&         mTimeline;
+        uint32_t                mFramesInFlight;
+        uint64_t                mFrameNumber;
+        // per slot, the frame that last used it and its timeline value, 0 before the first submit
+        std::vector<uint64_t>   mSlotFrames;
+        std::vector<uint64_t>   mSlotValues;
+        std::vector<uint64_t>   mImageValues;
+        // binary, acquire and present do not take timeline semaphores
+        VulkanSemaphores        mImageAvailable;
+        VulkanSemaphores        mRenderFinished;
+    };
 }
 #endif //HOMURA_VULKANSYNCHRONIZATION_H
@@ -7,6 +7,8 @@
 #include <vulkan/vulkan.h>
 #include <vulkanTypes.h>
 #include <vulkanSampler.h>
+#include <vulkanMemory.h>
+#include <vulkanBarrier.h>
 
 namespace Homura
 {
@@ -41,7 +43,9 @@ namespace Homura
         ~VulkanTexture() = default;
 
         void destroy();
-        void fromBuffer(VulkanCommandBufferPtr commandBuffer, VulkanBufferPtr buffer);
+        // stages tightly packed data of one mip in the upload manager, the mip must be in TRANSFER_DST
+        // layout. Returns the upload batch id
+        uint64_t upload(const void* data, VkDeviceSize size, uint32_t mipLevel = 0);
 
         VkImage& getImage()
         {
@@ -63,19 +67,27 @@ namespace Homura
 
         void createImageView(VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
 
-        uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+        // Moves the mips of every layer to newLayout. Recorded into the current upload batch together with
+        // the transitions of other textures, nothing waits for the queue
+        void setImageLayout(VkImageLayout newLayout, uint32_t baseMipLevel = 0, uint32_t levelCount = VK_REMAINING_MIP_LEVELS);
 
-        void setImageLayout(VkImageLayout newLayout, VulkanCommandBufferPtr command);
+        VkImageLayout getImageLayout(uint32_t mipLevel = 0, uint32_t layer = 0) const
+        {
+            return mLayoutState.getLayout(mipLevel, layer);
+        }
 
-        void generateMipmaps(VulkanCommandBufferPtr command);
+        // fills the mips from mip 0, which must be in TRANSFER_DST layout, and leaves all of them shader readable
+        void generateMipmaps();
     private:
         VulkanDevicePtr                 mDevice;
 
         VkImage                         mImage;
-        VkDeviceMemory                  mImageMemory;
+        VulkanAllocation                mAllocation;
         VkFormat                        mFormat;
-        VkImageLayout                   mImageLayout;
         TextureType                     mType;
+        VkImageAspectFlags              mAspect;
+        // layout and last access of every mip and layer
+        VulkanImageLayoutState          mLayoutState;
 
         uint32_t                        mWidth, mHeight;
         uint32_t                        mMipLevels, mLayerCount;
@@ -105,6 +117,7 @@ namespace Homura
         , mSampler{}
         , mBinding{0}
         , mImageInfo{}
+        , mBindlessIndex{UINT32_MAX}
         {
 
         }
@@ -120,10 +133,27 @@ namespace Homura
         {
             return mBinding;
         }
+
+        VulkanSamplerPtr getSampler()
+        {
+            return mSampler;
+        }
+
+        // slot in the bindless table, UINT32_MAX when the texture is bound through its binding
+        void setBindlessIndex(uint32_t index)
+        {
+            mBindlessIndex = index;
+        }
+
+        uint32_t getBindlessIndex() const
+        {
+            return mBindlessIndex;
+        }
     public:
         VulkanSamplerPtr        mSampler;
         uint32_t                mBinding;
         VkDescriptorImageInfo   mImageInfo;
+        uint32_t                mBindlessIndex;
     };
 
     class ENGINE_API VulkanTexture2DArray : public VulkanTexture
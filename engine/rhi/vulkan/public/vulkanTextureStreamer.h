@@ -0,0 +1,154 @@
+//
+// Created by 最上川 on 2022/9/1/001.
+//
+
+#ifndef HOMURA_VULKANTEXTURESTREAMER_H
+#define HOMURA_VULKANTEXTURESTREAMER_H
+#include <vulkan/vulkan.h>
+#include <vulkanTypes.h>
+#include <ktx2.h>
+#include <jobSystem.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Homura
+{
+    struct ENGINE_API VulkanTextureStreamerConfig
+    {
+        // bytes of mip levels the streamed textures may hold together, tails and the versions frames in flight
+        // may still sample included
+        VkDeviceSize    mBudget = 256ull * 1024 * 1024;
+        // levels this size and smaller are the tail of a texture, add() loads them and they are never evicted
+        uint32_t        mTailSize = 64;
+        // disk reads in flight at once
+        uint32_t        mMaxLoads = 4;
+        // added to the level usage feedback asks for, positive values stream less
+        float           mMipBias = 0.0f;
+    };
+
+    struct ENGINE_API VulkanTextureStreamerStats
+    {
+        uint32_t        mTextureCount = 0;
+        VkDeviceSize    mResidentBytes = 0;
+        // replaced versions frames in flight may still sample, they count against the budget until freed
+        VkDeviceSize    mRetiredBytes = 0;
+        uint32_t        mLoadsInFlight = 0;
+        // versions created with finer levels, and with only the tail left
+        uint64_t        mUpgrades = 0;
+        uint64_t        mEvictions = 0;
+    };
+
+    struct VulkanTextureLoad;
+
+    // Streams the mips of KTX2 textures under a fixed budget. add() only loads the tail, the levels of
+    // mTailSize and smaller, so the first frame waits for little. Usage feedback asks for finer levels,
+    // which are read on the job system and uploaded as a new version of the texture: an image holding
+    // just the resident levels, finest first. When the budget is full, the textures used least recently
+    // fall back to their tail. A new version gets a bindless slot of its own and the old one is retired
+    // with its slot once the frames that could sample it are done, so no descriptor in use is written and
+    // nothing waits for the GPU. Draws pick the current slot with use() every frame, which needs per
+    // frame recording. Render thread only
+    class ENGINE_API VulkanTextureStreamer
+    {
+    public:
+        static constexpr uint32_t INVALID_TEXTURE = UINT32_MAX;
+
+        // without a job system levels are read on the render thread inside update()
+        VulkanTextureStreamer(VulkanDevicePtr device, VulkanBindlessTablePtr table, VulkanSamplerPtr sampler, Base::JobSystem* jobSystem = nullptr,
+                              const VulkanTextureStreamerConfig& config = VulkanTextureStreamerConfig{});
+        ~VulkanTextureStreamer();
+        VulkanTextureStreamer(const VulkanTextureStreamer&) = delete;
+        VulkanTextureStreamer& operator=(const VulkanTextureStreamer&) = delete;
+
+        // waits for the reads in flight and releases every version and its slot, the device must be idle
+        void destroy();
+
+        // Returns the texture, INVALID_TEXTURE when the file is no KTX2 file the device can sample
+        // or the bindless table is full. Only the tail is resident until usage feedback asks for more
+        uint32_t add(const std::string& filename);
+
+        // the texture covers screenExtent pixels along its longer side this frame. The finest level
+        // asked for in a frame counts, and stays wanted until a later frame reports again
+        void reportUsage(uint32_t texture, float screenExtent);
+        // slot of the current version for a draw of this frame, marks the texture used
+        uint32_t use(uint32_t texture);
+
+        // Once per frame after the bindless table's beginFrame(frame), frame being the slot in flight
+        // whose fence has signaled. Retires old versions, uploads finished reads, evicts and starts new reads
+        void update(uint32_t frame);
+
+        void setBudget(VkDeviceSize budget)
+        {
+            mConfig.mBudget = budget;
+        }
+
+        uint32_t getBindlessIndex(uint32_t texture) const
+        {
+            return mTextures[texture].mSlot;
+        }
+
+        // finest level on the GPU
+        uint32_t getResidentLevel(uint32_t texture) const
+        {
+            return mTextures[texture].mResidentLevel;
+        }
+
+        VulkanTextureStreamerStats getStats() const;
+    private:
+        struct StreamedTexture
+        {
+            std::string                         mFilename;
+            Base::Ktx2Info                      mInfo;
+            // first level of the tail and the tail itself, every version ends with it
+            uint32_t                            mTailLevel = 0;
+            Base::Image                         mTail;
+            // the version draws sample, levels mResidentLevel and up
+            VulkanTexture2DPtr                  mTexture;
+            uint32_t                            mResidentLevel = 0;
+            uint32_t                            mSlot = UINT32_MAX;
+            VkDeviceSize                        mResidentBytes = 0;
+            // finest level feedback asked for, and the frame it did
+            uint32_t                            mWantedLevel = 0;
+            uint64_t                            mWantedFrame = 0;
+            uint64_t                            mLastUsed = 0;
+            std::shared_ptr<VulkanTextureLoad>  mLoad;
+            // a read failed, the texture keeps what it has
+            bool                                mFailed = false;
+        };
+
+        static void loadJob(Base::Job* job, const void* data);
+        static void readLevels(VulkanTextureLoad& load);
+        // bytes of levels first and up
+        static VkDeviceSize getLevelBytes(const Base::Ktx2Info& info, uint32_t first);
+
+        // replaces the version of texture with levels, level 0 of levels being level first of the file
+        bool createVersion(StreamedTexture& texture, const Base::Image& levels, uint32_t first);
+        // Drops textures not used last frame to their tail, least recently used first, until bytes more fit
+        // once the retired versions are freed. Whether they fit right now is up to the caller
+        bool reserve(VkDeviceSize bytes, const StreamedTexture* keep);
+        bool evict(StreamedTexture& texture);
+        void retire(VulkanTexture2DPtr version, VkDeviceSize bytes);
+        void startLoad(StreamedTexture& texture, uint32_t first);
+    private:
+        VulkanDevicePtr                             mDevice;
+        VulkanBindlessTablePtr                      mTable;
+        VulkanSamplerPtr                            mSampler;
+        Base::JobSystem*                            mJobSystem;
+        VulkanTextureStreamerConfig                 mConfig;
+
+        std::vector<StreamedTexture>                mTextures;
+        // versions replaced while each frame in flight was recorded and their bytes, grown on first use
+        std::vector<std::vector<VulkanTexture2DPtr>> mRetired;
+        std::vector<VkDeviceSize>                   mRetiredSizes;
+        uint32_t                                    mFrame;
+        // frames since construction, what use() and reportUsage() stamp
+        uint64_t                                    mFrameNumber;
+        VkDeviceSize                                mResidentBytes;
+        VkDeviceSize                                mRetiredBytes;
+        uint32_t                                    mLoadsInFlight;
+        uint64_t                                    mUpgrades;
+        uint64_t                                    mEvictions;
+    };
+}
+#endif //HOMURA_VULKANTEXTURESTREAMER_H
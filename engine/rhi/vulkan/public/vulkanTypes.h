@@ -20,6 +20,7 @@ namespace Homura
     class VulkanVertexBuffer;
     class VulkanIndexBuffer;
     class VulkanUniformBuffer;
+    class VulkanUniformRing;
     class VulkanStagingBuffer;
     class VulkanQueue;
     class VulkanSwapChain;
@@ -28,6 +29,8 @@ namespace Homura
     class VulkanDescriptorSet;
     class VulkanCommandPool;
     class VulkanCommandBuffer;
+    class VulkanParallelRecorder;
+    struct VulkanDrawCommand;
     class VulkanTexture1D;
     class VulkanTexture2D;
     class VulkanTexture3D;
@@ -37,12 +40,18 @@ namespace Homura
     class VulkanShader;
     class VulkanShaderEntity;
     class VulkanSurface;
-    class VulkanFences;
     class VulkanSemaphores;
+    class VulkanFrameSync;
     class VulkanPipeline;
     class VulkanPipelineLayout;
     class VulkanSampler;
     class VulkanFramebuffer;
+    class VulkanBindlessTable;
+    class VulkanGpuProfiler;
+    class VulkanReadback;
+    class VulkanFrameGraph;
+    class VulkanTextureStreamer;
+    struct VulkanReadbackImage;
 
     using ApplicationWindowPtr          = std::shared_ptr<ApplicationWindow>;
     using VulkanRHIPtr                  = std::shared_ptr<VulkanRHI>;
@@ -54,6 +63,7 @@ namespace Homura
     using VulkanVertexBufferPtr         = std::shared_ptr<VulkanVertexBuffer>;
     using VulkanIndexBufferPtr          = std::shared_ptr<VulkanIndexBuffer>;
     using VulkanUniformBufferPtr        = std::shared_ptr<VulkanUniformBuffer>;
+    using VulkanUniformRingPtr          = std::shared_ptr<VulkanUniformRing>;
     using VulkanStagingBufferPtr        = std::shared_ptr<VulkanStagingBuffer>;
     using VulkanQueuePtr                = std::shared_ptr<VulkanQueue>;
     using VulkanSwapChainPtr            = std::shared_ptr<VulkanSwapChain>;
@@ -62,6 +72,7 @@ namespace Homura
     using VulkanDescriptorSetLayoutPtr  = std::shared_ptr<VulkanDescriptorSetLayout>;
     using VulkanCommandPoolPtr          = std::shared_ptr<VulkanCommandPool>;
     using VulkanCommandBufferPtr        = std::shared_ptr<VulkanCommandBuffer>;
+    using VulkanParallelRecorderPtr     = std::shared_ptr<VulkanParallelRecorder>;
     using VulkanShaderPtr               = std::shared_ptr<VulkanShader>;
     using VulkanShaderEntityPtr         = std::shared_ptr<VulkanShaderEntity>;
     using VulkanTexture1DPtr            = std::shared_ptr<VulkanTexture1D>;
@@ -70,17 +81,25 @@ namespace Homura
     using VulkanTexture2DArrayPtr       = std::shared_ptr<VulkanTexture2DArray>;
     using VulkanTextureDepthPtr         = std::shared_ptr<VulkanTextureDepth>;
     using VulkanSurfacePtr              = std::shared_ptr<VulkanSurface>;
-    using VulkanFencesPtr               = std::shared_ptr<VulkanFences>;
     using VulkanSemaphoresPtr           = std::shared_ptr<VulkanSemaphores>;
+    using VulkanFrameSyncPtr            = std::shared_ptr<VulkanFrameSync>;
     using VulkanPipelinePtr             = std::shared_ptr<VulkanPipeline>;
     using VulkanPipelineLayoutPtr       = std::shared_ptr<VulkanPipelineLayout>;
     using VulkanSamplerPtr              = std::shared_ptr<VulkanSampler>;
     using VulkanFramebufferPtr          = std::shared_ptr<VulkanFramebuffer>;
+    using VulkanBindlessTablePtr        = std::shared_ptr<VulkanBindlessTable>;
+    using VulkanGpuProfilerPtr          = std::shared_ptr<VulkanGpuProfiler>;
+    using VulkanReadbackPtr             = std::shared_ptr<VulkanReadback>;
+    using VulkanFrameGraphPtr           = std::shared_ptr<VulkanFrameGraph>;
+    using VulkanTextureStreamerPtr      = std::shared_ptr<VulkanTextureStreamer>;
 
     using MouseCallback                 = std::function<void(int, int, int)>;
     using FramebufferResizeCallback     = std::function<void(int, int)>;
     using UnifromUpdateCallback         = std::function<uint32_t(void*, uint32_t)>;
     using UpdateAfterRecreateSwapchain  = std::function<void()>;
+    using ReadbackCallback              = std::function<void(const VulkanReadbackImage&)>;
+    // index of a texture in a VulkanFrameGraph
+    using FrameGraphResource            = uint32_t;
 #define ENGINE_API
 }
 #endif //HOMURA_VULKANTYPES_H
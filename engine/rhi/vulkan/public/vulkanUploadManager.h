@@ -0,0 +1,134 @@
+//
+// Created by 最上川 on 2022/8/21/021.
+//
+
+#ifndef HOMURA_VULKANUPLOADMANAGER_H
+#define HOMURA_VULKANUPLOADMANAGER_H
+#include <vulkan/vulkan.h>
+#include <vulkanTypes.h>
+#include <vulkanSynchronization.h>
+#include <vulkanBarrier.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace Homura
+{
+    // Streams data to the GPU without stalling a queue. Data is copied into a persistently mapped
+    // staging ring and the copies of a frame are batched into one command buffer, submitted once per
+    // frame with a fence. Ring space of a batch is reused as soon as its fence has signaled.
+    // With a dedicated transfer queue family copies run there and the graphics part of a batch
+    // (mip generation, final layout transitions) waits on them with a semaphore.
+    // stage() and upload*() are thread safe, submit() and collect() belong to the render thread.
+    class ENGINE_API VulkanUploadManager
+    {
+    public:
+        struct StagingRegion
+        {
+            VkBuffer        mBuffer;
+            VkDeviceSize    mOffset;
+        };
+
+        VulkanUploadManager(VulkanDevicePtr device, VkDeviceSize ringSize = 64ull * 1024 * 1024);
+        ~VulkanUploadManager();
+        VulkanUploadManager(const VulkanUploadManager&) = delete;
+        VulkanUploadManager& operator=(const VulkanUploadManager&) = delete;
+
+        void destroy();
+
+        // copies data into the staging ring, the region stays valid until the current batch completes
+        StagingRegion stage(const void* data, VkDeviceSize size, VkDeviceSize align = 16);
+
+        // both return the id of the batch the copy belongs to
+        uint64_t uploadBuffer(VkBuffer dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+        uint64_t uploadImage(VkImage dst, const void* data, VkDeviceSize size, const VkBufferImageCopy& region);
+
+        // Moves part of an image to layout. Transitions into TRANSFER_DST go with the copies, the rest with
+        // the graphics commands. They are recorded right before the next copy, the next get*Commands() or
+        // the submit, so transitions of many textures share one barrier. A range that is transitioned again
+        // before that records its pending barrier first. Render thread only
+        void transitionImage(VkImage image, VulkanImageLayoutState& state, const VkImageSubresourceRange& range, VkImageLayout layout);
+
+        // recorders for the current batch, pending transitions are recorded into them first. Transfer
+        // commands run first, graphics commands after them, on a queue that supports blits. Both are the
+        // same command buffer without a transfer queue.
+        // Render thread only, a submit from another thread would end them under the caller
+        VkCommandBuffer getTransferCommands();
+        VkCommandBuffer getGraphicsCommands();
+
+        // submits the current batch, returns its id. A batch without commands is not submitted
+        uint64_t submit();
+        // releases ring space and command buffers of finished batches, never blocks
+        void collect();
+
+        bool isComplete(uint64_t batchId);
+        // blocks on the fence of that batch only, submits it first if it is still recording
+        void wait(uint64_t batchId);
+
+        uint64_t getCurrentBatchId() const
+        {
+            return mNextBatchId;
+        }
+
+        bool hasTransferQueue() const
+        {
+            return mTransferQueue != mGraphicsQueue;
+        }
+    private:
+        struct Batch
+        {
+            explicit Batch(VulkanDevicePtr device)
+                : mId{0}
+                , mTransferCommands{VK_NULL_HANDLE}
+                , mGraphicsCommands{VK_NULL_HANDLE}
+                , mSemaphore{device}
+                , mFence{device}
+                , mRingEnd{0}
+            {
+
+            }
+
+            uint64_t                    mId;
+            VkCommandBuffer             mTransferCommands;
+            VkCommandBuffer             mGraphicsCommands;
+            VulkanSemaphoreEntity       mSemaphore;
+            VulkanFenceEntity           mFence;
+            // ring position once the batch completes
+            uint64_t                    mRingEnd;
+            // staging buffers for uploads larger than the ring
+            std::vector<VulkanBuffer*>  mTemporaries;
+        };
+
+        Batch* acquireBatch();
+        Batch* getCurrentBatch();
+        uint64_t submitLocked();
+        void flushTransferBarriers();
+        void flushGraphicsBarriers();
+        bool retireOldest(bool block);
+        bool reserve(VkDeviceSize size, VkDeviceSize align, uint64_t& position);
+        StagingRegion stageLocked(const void* data, VkDeviceSize size, VkDeviceSize align);
+    private:
+        VulkanDevicePtr         mDevice;
+        VulkanQueuePtr          mTransferQueue;
+        VulkanQueuePtr          mGraphicsQueue;
+        VkCommandPool           mTransferPool;
+        VkCommandPool           mGraphicsPool;
+
+        VulkanBuffer*           mRing;
+        VkDeviceSize            mRingSize;
+        // monotonic positions, the ring offset is position % mRingSize
+        uint64_t                mRingHead;
+        uint64_t                mRingTail;
+
+        std::mutex              mMutex;
+        Batch*                  mCurrent;
+        std::deque<Batch*>      mInFlight;
+        std::vector<Batch*>     mFreeBatches;
+        // transitions waiting for the next command recorded into the current batch
+        VulkanBarrierBatch      mTransferBarriers;
+        VulkanBarrierBatch      mGraphicsBarriers;
+        uint64_t                mNextBatchId;
+        uint64_t                mCompletedBatchId;
+    };
+}
+#endif //HOMURA_VULKANUPLOADMANAGER_H
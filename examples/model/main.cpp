@@ -20,6 +20,10 @@
 #include <unordered_map>
 #include <memory>
 #include <chrono>
+#include <cctype>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
 
 #include <filesystem.h>
 #include <application.h>
@@ -28,6 +32,12 @@
 #include <vulkanRenderPass.h>
 #include <rhiResources.h>
 #include <vulkanShader.h>
+#include <vulkanReadback.h>
+#include <vulkanFrameGraph.h>
+#include <vulkanTextureStreamer.h>
+#include <profiler.h>
+#include <ktx2.h>
+#include <jobSystem.h>
 
 #include <new>
 #include <functional>
@@ -36,6 +46,15 @@
 static int width = 960;
 static int height = 520;
 static float aspect = width / (float)height;
+// --headless [frames] renders that many frames offscreen and writes the last one to model_headless.ppm
+static bool headless = false;
+static uint32_t headlessFrames = 60;
+// --bindless samples the texture from the bindless array through model_bindless.frag
+static bool bindless = false;
+// --stream streams the mips of the baked texture by how large the model shows up, implies --bindless
+static bool stream = false;
+// --jobs compiles the pipeline and reads streamed levels on a job system owned by the main thread
+static bool jobs = false;
 
 struct Vertex
 {
@@ -83,6 +102,11 @@ namespace Homura
     const std::string MODEL_PATH = FileSystem::getPath("resources/models/viking_room.obj");
     const std::string TEXTURE_PATH = FileSystem::getPath("resources/textures/viking_room.png");
 
+    // the texture of --stream and the bounding sphere radius of the model its usage is reported with
+    VulkanTextureStreamerPtr textureStreamer;
+    uint32_t streamedTexture = VulkanTextureStreamer::INVALID_TEXTURE;
+    float modelRadius = 0.0f;
+
     struct UniformBufferObject
     {
         alignas(16) glm::mat4 model;
@@ -103,6 +127,14 @@ namespace Homura
         ubo.proj = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 10.0f);
         ubo.proj[1][1] *= -1;
         memcpy(data, &ubo, size);
+
+        if (textureStreamer && streamedTexture != VulkanTextureStreamer::INVALID_TEXTURE)
+        {
+            // pixels the bounding sphere spans on screen, the texture wraps around about that much
+            const float distance = glm::length(glm::vec3(2.0f, 2.0f, 2.0f));
+            const float extent = modelRadius / (distance * std::tan(glm::radians(45.0f) * 0.5f)) * static_cast<float>(height);
+            textureStreamer->reportUsage(streamedTexture, extent);
+        }
         return sizeof(ubo);
     }
 
@@ -122,7 +154,38 @@ namespace Homura
 
         bool init()
         {
-            rhi->init(width, height, "model");
+            // startup and the first frames, the buffers drop what does not fit
+            Base::Profiler::get().beginCapture();
+            if (headless)
+            {
+                rhi->initHeadless(width, height);
+                rhi->setFrameLimit(headlessFrames);
+                rhi->setReadbackCallback([](const VulkanReadbackImage& image) -> void {
+                    if (image.mFrame + 1 == headlessFrames)
+                    {
+                        writeImage("model_headless.ppm", image);
+                    }
+                });
+            }
+            else
+            {
+                rhi->init(width, height, "model");
+            }
+            if (jobs)
+            {
+                // created on the thread that drives the rhi, every submit comes from there
+                jobSystem = std::make_unique<Base::JobSystem>();
+                rhi->setJobSystem(jobSystem.get());
+            }
+            if (bindless || stream)
+            {
+                rhi->setBindless(true);
+            }
+            if (stream)
+            {
+                rhi->setTextureStreaming(true);
+                textureStreamer = rhi->getTextureStreamer();
+            }
             rhi->setFramebufferResizeCallback([](int width, int height) -> void {
                 aspect = width / (float)height;
                 std::cout << "framebuffer size changed " << width << " " << height << std::endl;
@@ -132,6 +195,8 @@ namespace Homura
             });
 
             rhi->setUpdateAfterRecreateSwapchain([this]() -> void {
+                // the recreation dropped the passes along with the old swapchain
+                setupFrameGraph();
                 recordCommand();
             });
             VulkanTexture2DPtr colorImg = rhi->createColorResources();
@@ -167,7 +232,11 @@ namespace Homura
             auto vertexShader = rhi->setupShaders(FileSystem::getPath("resources/shader/model/model.vert.spv"), VERTEX);
             vertexShader->setVertexAttributeDescription(Vertex::getAttributeDescriptions());
             vertexShader->setVertexInputBindingDescription(Vertex::getBindingDescription());
-            rhi->setupShaders(FileSystem::getPath("resources/shader/model/model.frag.spv"), FRAGMENT);
+            // without descriptor indexing setBindless() leaves the table unset, the texture is bound on its own then
+            const char* fragmentShader = rhi->getBindlessTable() ? "resources/shader/model/model_bindless.frag.spv" : "resources/shader/model/model.frag.spv";
+            rhi->setupShaders(FileSystem::getPath(fragmentShader), FRAGMENT);
+            depthFormat = depthImg->getFormat();
+            setupFrameGraph();
             rhi->createCommandBuffer();
 
             rhi->createUniformBuffer(0, sizeof(UniformBufferObject));
@@ -184,6 +253,46 @@ namespace Homura
             return true;
         }
 
+        // The model goes into a transient multisampled color and depth that are resolved to the swapchain image,
+        // the frame graph allocates both. The debug pass writes a texture nothing reads, compile() culls it
+        void setupFrameGraph()
+        {
+            if (!frameGraph)
+            {
+                frameGraph = rhi->createFrameGraph();
+            }
+            const FrameGraphResource backbuffer = rhi->importSwapChain(frameGraph);
+            FrameGraphTextureDesc colorDesc = frameGraph->getDesc(backbuffer);
+            colorDesc.mSamples = rhi->getSampleCount();
+            FrameGraphTextureDesc depthDesc = colorDesc;
+            depthDesc.mFormat = depthFormat;
+
+            // color, depth and resolve, the order of the render pass the pipeline is built against
+            frameGraph->addPass("model", [&](FrameGraphBuilder& builder) {
+                VkClearValue clearColor{};
+                clearColor.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+                VkClearValue clearDepth{};
+                clearDepth.depthStencil = {1.0f, 0};
+                const FrameGraphResource color = builder.create("color", colorDesc);
+                builder.write(color, FrameGraphAccess::ColorAttachment, clearColor);
+                builder.write(builder.create("depth", depthDesc), FrameGraphAccess::DepthAttachment, clearDepth);
+                builder.resolve(color, backbuffer);
+            }, [this](VkCommandBuffer commandBuffer, const FrameGraphContext&) {
+                rhi->recordDrawList(commandBuffer);
+            });
+            // a copy, create() grows the resources getDesc() points into
+            const FrameGraphTextureDesc debugDesc = frameGraph->getDesc(backbuffer);
+            frameGraph->addPass("debug", [&](FrameGraphBuilder& builder) {
+                builder.write(builder.create("debug", debugDesc));
+            }, [](VkCommandBuffer, const FrameGraphContext&) {});
+            frameGraph->compile();
+            rhi->setFrameGraph(frameGraph, backbuffer);
+
+            const VulkanFrameGraphStats& stats = frameGraph->getStats();
+            std::cout << "frame graph " << stats.mPassCount << " passes, " << stats.mCulledPassCount << " culled, "
+                      << stats.mTransientCount << " transient textures" << std::endl;
+        }
+
         void recordCommand()
         {
             rhi->beginCommandBuffer();
@@ -195,17 +304,47 @@ namespace Homura
 
         void exit()
         {
+            textureStreamer.reset();
+            frameGraph.reset();
             rhi->exit();
         }
 
         void update()
         {
             rhi->update();
+            Base::Profiler::get().endCapture();
+            Base::Profiler::get().writeChromeTrace("model_trace.json");
         }
     private:
 
+        // binary ppm, drops alpha and swaps bgr formats around
+        static void writeImage(const std::string& filename, const VulkanReadbackImage& image)
+        {
+            std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+            {
+                std::cerr << "failed to write " << filename << std::endl;
+                return;
+            }
+            const bool bgr = image.mFormat == VK_FORMAT_B8G8R8A8_UNORM || image.mFormat == VK_FORMAT_B8G8R8A8_SRGB;
+            file << "P6\n" << image.mExtent.width << " " << image.mExtent.height << "\n255\n";
+            std::vector<char> row(image.mExtent.width * 3);
+            for (uint32_t y = 0; y < image.mExtent.height; y++)
+            {
+                const unsigned char* texel = static_cast<const unsigned char*>(image.mData) + y * image.mRowPitch;
+                for (uint32_t x = 0; x < image.mExtent.width; x++, texel += 4)
+                {
+                    row[x * 3 + 0] = static_cast<char>(texel[bgr ? 2 : 0]);
+                    row[x * 3 + 1] = static_cast<char>(texel[1]);
+                    row[x * 3 + 2] = static_cast<char>(texel[bgr ? 0 : 2]);
+                }
+                file.write(row.data(), row.size());
+            }
+        }
+
         void loadModel()
         {
+            PROFILE_FUNCTION();
             tinyobj::attrib_t attrib;
             std::vector<tinyobj::shape_t> shapes;
             std::vector<tinyobj::material_t> materials;
@@ -236,6 +375,7 @@ namespace Homura
                     };
 
                     vertex.color = { 1.0f, 1.0f, 1.0f };
+                    modelRadius = std::max(modelRadius, glm::length(vertex.pos));
 
                     if (uniqueVertices.count(vertex) == 0)
                     {
@@ -250,6 +390,25 @@ namespace Homura
 
         void loadSampleTexture(std::string filename, int binding)
         {
+            PROFILE_FUNCTION();
+            // a mip chain baked by textureBaker next to the source image skips decoding and filtering,
+            // block compressed bakes need a device that samples them
+            const std::string bakedFilename = filename.substr(0, filename.find_last_of('.')) + ".ktx2";
+            if (textureStreamer)
+            {
+                // only the tail is loaded now, UpdateUniform asks for the rest
+                streamedTexture = rhi->streamSampleTexture(bakedFilename);
+                if (streamedTexture != VulkanTextureStreamer::INVALID_TEXTURE)
+                {
+                    return;
+                }
+            }
+            Base::Image baked;
+            if (Base::readKtx2(bakedFilename, baked) && rhi->isImageFormatSupported(baked.getFormat()))
+            {
+                rhi->createSampleTexture(binding, baked);
+                return;
+            }
             int texWidth, texHeight, texChannels;
             stbi_uc* pixels = stbi_load(filename.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
             VkDeviceSize imageSize = texWidth * texHeight * 4;
@@ -259,12 +418,40 @@ namespace Homura
 
         std::vector<Vertex>                 vertices;
         std::vector<uint32_t>               indices;
+        VulkanFrameGraphPtr                 frameGraph;
+        VkFormat                            depthFormat = VK_FORMAT_UNDEFINED;
+        // declared before rhi, so it is destroyed after everything that submits to it
+        std::unique_ptr<Base::JobSystem>    jobSystem;
         VulkanRHIPtr                        rhi;
     };
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--headless")
+        {
+            headless = true;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+            {
+                headlessFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+        }
+        else if (std::string(argv[i]) == "--bindless")
+        {
+            bindless = true;
+        }
+        else if (std::string(argv[i]) == "--stream")
+        {
+            stream = true;
+        }
+        else if (std::string(argv[i]) == "--jobs")
+        {
+            jobs = true;
+        }
+    }
+
     Homura::ModelApplication app;
     try
     {
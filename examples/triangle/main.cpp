@@ -20,6 +20,7 @@
 #include <unordered_map>
 #include <memory>
 #include <chrono>
+#include <cctype>
 
 #include <filesystem.h>
 #include <application.h>
@@ -35,6 +36,9 @@
 static int width = 960;
 static int height = 520;
 static float aspect = width / (float)height;
+// --headless [frames] renders that many frames offscreen, without a window
+static bool headless = false;
+static uint32_t headlessFrames = 60;
 
 struct Vertex
 {
@@ -115,7 +119,15 @@ namespace Homura
 
         bool init()
         {
-            rhi->init(width, height, "triangle");
+            if (headless)
+            {
+                rhi->initHeadless(width, height);
+                rhi->setFrameLimit(headlessFrames);
+            }
+            else
+            {
+                rhi->init(width, height, "triangle");
+            }
             rhi->setFramebufferResizeCallback([](int width, int height) -> void {
                 aspect = width / (float)height;
                 std::cout << "framebuffer size changed " << width << " " << height << std::endl;
@@ -222,8 +234,20 @@ namespace Homura
     };
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--headless")
+        {
+            headless = true;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+            {
+                headlessFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+        }
+    }
+
     Homura::TriangleApplication app;
     try
     {
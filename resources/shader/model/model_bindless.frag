@@ -0,0 +1,16 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+layout(push_constant) uniform BindlessConstants {
+    uint textureIndex;
+} constants;
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+    outColor = texture(textures[nonuniformEXT(constants.textureIndex)], fragTexCoord);
+}
\ No newline at end of file
@@ -0,0 +1,164 @@
+//
+// Created by 最上川 on 2022/8/21/021.
+//
+// CPU only test of TlsfAllocator, it only keeps books on a range so no device is needed.
+
+#include <tlsfAllocator.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <random>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition)                                                        \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+// live allocations must lie inside the range, be aligned and not overlap
+static void randomAllocFree()
+{
+    const uint64_t size = 1u << 20;
+    Base::TlsfAllocator allocator(size);
+    std::mt19937 random(1234);
+    std::vector<Base::TlsfAllocator::Allocation> live;
+    // offset to end of every live allocation
+    std::map<uint64_t, uint64_t> ranges;
+    uint64_t used = 0;
+
+    for (int i = 0; i < 20000; i++)
+    {
+        if (live.empty() || random() % 3 != 0)
+        {
+            const uint64_t request = 1 + random() % 4096;
+            const uint64_t align = 1ull << (random() % 9);
+            const Base::TlsfAllocator::Allocation allocation = allocator.allocate(request, align);
+            if (!allocation.isValid())
+            {
+                continue;
+            }
+            CHECK(allocation.mOffset % align == 0);
+            CHECK(allocation.mSize >= request);
+            CHECK(allocation.mOffset + allocation.mSize <= size);
+
+            auto next = ranges.lower_bound(allocation.mOffset);
+            CHECK(next == ranges.end() || next->first >= allocation.mOffset + allocation.mSize);
+            if (next != ranges.begin())
+            {
+                CHECK(std::prev(next)->second <= allocation.mOffset);
+            }
+            ranges.emplace(allocation.mOffset, allocation.mOffset + allocation.mSize);
+            live.push_back(allocation);
+            used += allocation.mSize;
+        }
+        else
+        {
+            const size_t index = random() % live.size();
+            const Base::TlsfAllocator::Allocation allocation = live[index];
+            live[index] = live.back();
+            live.pop_back();
+            ranges.erase(allocation.mOffset);
+            used -= allocation.mSize;
+            allocator.free(allocation);
+        }
+        CHECK(allocator.getUsedSize() == used);
+        CHECK(allocator.getAllocationCount() == live.size());
+    }
+
+    // in any order the free neighbours merge back into the whole range
+    std::shuffle(live.begin(), live.end(), random);
+    for (const auto& allocation : live)
+    {
+        allocator.free(allocation);
+    }
+    CHECK(allocator.isEmpty());
+    CHECK(allocator.getUsedSize() == 0);
+    CHECK(allocator.getLargestFreeSize() == size);
+    CHECK(allocator.getFragmentation() == 0.0f);
+}
+
+// freeing every other block leaves holes, freeing the rest merges them into one
+static void coalesce()
+{
+    const uint64_t size = 64 * 1024;
+    Base::TlsfAllocator allocator(size);
+    std::vector<Base::TlsfAllocator::Allocation> blocks;
+    for (uint32_t i = 0; i < 64; i++)
+    {
+        blocks.push_back(allocator.allocate(1024));
+        CHECK(blocks.back().isValid());
+    }
+    CHECK(allocator.getUsedSize() == size);
+    CHECK(allocator.getLargestFreeSize() == 0);
+
+    for (uint32_t i = 0; i < blocks.size(); i += 2)
+    {
+        allocator.free(blocks[i]);
+    }
+    CHECK(allocator.getLargestFreeSize() == 1024);
+    CHECK(allocator.getFragmentation() > 0.0f);
+
+    for (uint32_t i = 1; i < blocks.size(); i += 2)
+    {
+        allocator.free(blocks[i]);
+    }
+    CHECK(allocator.isEmpty());
+    CHECK(allocator.getLargestFreeSize() == size);
+    CHECK(allocator.getFragmentation() == 0.0f);
+}
+
+// a full range hands out invalid allocations until something is freed
+static void outOfSpace()
+{
+    const uint64_t size = 4096;
+    Base::TlsfAllocator allocator(size);
+    CHECK(!allocator.allocate(size + 1).isValid());
+    CHECK(!allocator.allocate(0).isValid());
+
+    std::vector<Base::TlsfAllocator::Allocation> blocks;
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        blocks.push_back(allocator.allocate(1024));
+        CHECK(blocks.back().isValid());
+    }
+    const Base::TlsfAllocator::Allocation none = allocator.allocate(1);
+    CHECK(!none.isValid());
+    // an invalid allocation frees to nothing
+    allocator.free(none);
+    CHECK(allocator.getAllocationCount() == 4);
+
+    allocator.free(blocks[2]);
+    blocks[2] = allocator.allocate(1024);
+    CHECK(blocks[2].isValid());
+    CHECK(blocks[2].mOffset == 2048);
+    CHECK(!allocator.allocate(1).isValid());
+
+    for (const auto& block : blocks)
+    {
+        allocator.free(block);
+    }
+    CHECK(allocator.isEmpty());
+}
+
+int main()
+{
+    randomAllocFree();
+    coalesce();
+    outOfSpace();
+    if (failures > 0)
+    {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
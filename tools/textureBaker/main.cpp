@@ -0,0 +1,123 @@
+//
+// Created by 最上川 on 2022/8/30/030.
+//
+// Bakes an image and its full mip chain into a KTX 2.0 file, so the engine uploads every level with
+// one copy instead of decoding and filtering at load time.
+//
+//     textureBaker input.png output.ktx2 [--box] [--linear] [--format rgba|bc1|bc3|bc4|bc5|bc7]
+//
+// --box filters with a box instead of the Kaiser window, --linear stores color as UNORM instead of sRGB.
+// --format picks the block compression of every level, bc7 by default, rgba keeps them uncompressed.
+// bc4 and bc5 hold data rather than color and have no sRGB variant, they are always baked linear.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <jobSystem.h>
+#include <image.h>
+#include <mipGenerator.h>
+#include <blockCompressor.h>
+#include <ktx2.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::printf("usage: %s input output.ktx2 [--box] [--linear] [--format rgba|bc1|bc3|bc4|bc5|bc7]\n", argv[0]);
+        return 1;
+    }
+
+    Base::MipGeneratorConfig config;
+    Base::ImageFormat format = Base::ImageFormat::RGBA8_SRGB;
+    Base::ImageFormat compressedFormat = Base::ImageFormat::BC7_UNORM;
+    for (int i = 3; i < argc; i++)
+    {
+        const std::string option = argv[i];
+        if (option == "--box")
+        {
+            config.mFilter = Base::MipFilter::Box;
+        }
+        else if (option == "--linear")
+        {
+            format = Base::ImageFormat::RGBA8_UNORM;
+        }
+        else if (option == "--format" && i + 1 < argc)
+        {
+            const std::string name = argv[++i];
+            if (name == "rgba")
+            {
+                compressedFormat = Base::ImageFormat::RGBA8_UNORM;
+            }
+            else if (name == "bc1")
+            {
+                compressedFormat = Base::ImageFormat::BC1_UNORM;
+            }
+            else if (name == "bc3")
+            {
+                compressedFormat = Base::ImageFormat::BC3_UNORM;
+            }
+            else if (name == "bc4")
+            {
+                compressedFormat = Base::ImageFormat::BC4_UNORM;
+            }
+            else if (name == "bc5")
+            {
+                compressedFormat = Base::ImageFormat::BC5_UNORM;
+            }
+            else if (name == "bc7")
+            {
+                compressedFormat = Base::ImageFormat::BC7_UNORM;
+            }
+            else
+            {
+                std::printf("unknown format %s\n", name.c_str());
+                return 1;
+            }
+        }
+        else
+        {
+            std::printf("unknown option %s\n", option.c_str());
+            return 1;
+        }
+    }
+
+    // filtering them as sRGB would bend the data stored as UNORM
+    if (compressedFormat == Base::ImageFormat::BC4_UNORM || compressedFormat == Base::ImageFormat::BC5_UNORM)
+    {
+        format = Base::ImageFormat::RGBA8_UNORM;
+    }
+
+    int width, height, channels;
+    stbi_uc* pixels = stbi_load(argv[1], &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels)
+    {
+        std::printf("failed to load %s: %s\n", argv[1], stbi_failure_reason());
+        return 1;
+    }
+    Base::Image source(static_cast<uint32_t>(width), static_cast<uint32_t>(height), format);
+    std::memcpy(source.getData(0), pixels, source.getLevel(0).mSize);
+    stbi_image_free(pixels);
+
+    Base::JobSystem jobSystem;
+    const auto start = std::chrono::high_resolution_clock::now();
+    const Base::Image mips = Base::generateMips(source, config, &jobSystem);
+    const auto mipEnd = std::chrono::high_resolution_clock::now();
+    // sRGB sources become the sRGB variant of the format
+    const Base::Image image = Base::compressImage(mips, compressedFormat, &jobSystem);
+    const auto end = std::chrono::high_resolution_clock::now();
+
+    if (!Base::writeKtx2(argv[2], image))
+    {
+        std::printf("failed to write %s\n", argv[2]);
+        return 1;
+    }
+    std::printf("%s: %dx%d, %u levels, %zu bytes, mips in %.2f ms, compression in %.2f ms\n", argv[2], width, height, image.getLevelCount(),
+                image.getSize(), std::chrono::duration<double, std::milli>(mipEnd - start).count(),
+                std::chrono::duration<double, std::milli>(end - mipEnd).count());
+    return 0;
+}